@@ -4,4 +4,5 @@ from .python.serial import PandaSerial  # noqa: F401
 from .python.utils import logger # noqa: F401
 from .python import (Panda, PandaDFU, # noqa: F401
                      pack_can_buffer, unpack_can_buffer, calculate_checksum,
-                     DLC_TO_LEN, LEN_TO_DLC, CANPACKET_HEAD_SIZE)
+                     DLC_TO_LEN, LEN_TO_DLC, CANPACKET_HEAD_SIZE, TELEMETRY_BUS, CanRxDecompressor,
+                     ISOTP_BUS, pack_isotp_pdu, pack_playback)
@@ -0,0 +1,74 @@
+// Image hashing used by the bootstub. On H7 the hash runs on the HASH
+// peripheral when it passes a known-answer test, otherwise in software.
+//
+// The RSA check runs on every boot, there is no cached verification record.
+// A record is only safe if the app can't forge it, and nothing here keeps
+// it from the app: backup SRAM and the RTC backup registers are writable
+// from the app, the H7 OTP area is too and can't be rewritten on reflash,
+// and hiding a key needs the secure-hide option bytes, which lock the
+// bootstub and so can't be set by a firmware update. A record could also
+// only skip RSA, the image still has to be hashed to bind it, and RSA
+// with e = 3 or 65537 costs a few modular multiplications next to that.
+
+#define HASH_HW_TIMEOUT 1000000U
+
+#ifdef STM32H7
+static bool hash_hw_ok = false;
+
+static bool hash_hw_run(const uint8_t *data, uint32_t len, uint8_t *digest) {
+  bool ret = true;
+
+  // SHA-1 (ALGO = 0), byte swapped input
+  HASH->CR = HASH_CR_DATATYPE_1 | HASH_CR_INIT;
+  HASH->STR = ((len % 4U) * 8U) & HASH_STR_NBLW;
+  for (uint32_t i = 0U; i < len; i += 4U) {
+    uint32_t w = 0U;
+    (void)memcpy(&w, &data[i], MIN(4U, len - i));
+    HASH->DIN = w;
+  }
+  register_set_bits(&(HASH->STR), HASH_STR_DCAL);
+
+  uint32_t timeout = 0U;
+  while ((HASH->SR & HASH_SR_DCIS) == 0U) {
+    timeout++;
+    if (timeout > HASH_HW_TIMEOUT) {
+      ret = false;
+      break;
+    }
+  }
+
+  for (uint32_t i = 0U; i < 5U; i++) {
+    uint32_t h = HASH->HR[i];
+    digest[(i * 4U) + 0U] = (uint8_t)(h >> 24);
+    digest[(i * 4U) + 1U] = (uint8_t)(h >> 16);
+    digest[(i * 4U) + 2U] = (uint8_t)(h >> 8);
+    digest[(i * 4U) + 3U] = (uint8_t)h;
+  }
+  return ret;
+}
+
+void boot_verify_init(void) {
+  register_set_bits(&(RCC->AHB2ENR), RCC_AHB2ENR_HASHEN);
+  static const uint8_t kat_digest[SHA_DIGEST_SIZE] = {
+    0xa9U, 0x99U, 0x3eU, 0x36U, 0x47U, 0x06U, 0x81U, 0x6aU, 0xbaU, 0x3eU,
+    0x25U, 0x71U, 0x78U, 0x50U, 0xc2U, 0x6cU, 0x9cU, 0xd0U, 0xd8U, 0x9dU,
+  };
+  uint8_t out[SHA_DIGEST_SIZE];
+  hash_hw_ok = hash_hw_run((const uint8_t *)"abc", 3U, out) && (memcmp(out, kat_digest, SHA_DIGEST_SIZE) == 0);
+  if (!hash_hw_ok) {
+    register_clear_bits(&(RCC->AHB2ENR), RCC_AHB2ENR_HASHEN);
+  }
+}
+
+void boot_hash(const void *data, int len, uint8_t *digest) {
+  if (!hash_hw_ok || !hash_hw_run((const uint8_t *)data, (uint32_t)len, digest)) {
+    SHA_hash(data, len, digest);
+  }
+}
+#else
+// F4 has no hash peripheral
+void boot_verify_init(void) {}
+void boot_hash(const void *data, int len, uint8_t *digest) {
+  SHA_hash(data, len, digest);
+}
+#endif
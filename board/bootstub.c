@@ -18,6 +18,7 @@
 
 #include "obj/cert.h"
 #include "obj/gitversion.h"
+#include "boot_verify.h"
 #include "flasher.h"
 
 // cppcheck-suppress unusedFunction ; used in headers not included in cppcheck
@@ -42,7 +43,8 @@ int main(void) {
   disable_interrupts();
   clock_init();
   detect_board_type();
-  
+  boot_verify_init();
+
   if (enter_bootloader_mode == ENTER_SOFTLOADER_MAGIC) {
     enter_bootloader_mode = 0;
     soft_flasher_start();
@@ -54,7 +56,7 @@ int main(void) {
 
   // compute SHA hash
   uint8_t digest[SHA_DIGEST_SIZE];
-  SHA_hash(&_app_start[1], len-4, digest);
+  boot_hash(&_app_start[1], len-4, digest);
 
   // verify version, last bytes in the signed area
   uint32_t vers[2] = {0};
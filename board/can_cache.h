@@ -0,0 +1,184 @@
+/*
+  Last-value cache for subscribed CAN addresses. can_rx overwrites the
+  slot of a subscribed (bus, addr) with every frame, so the host can poll
+  the latest values without draining can_rx_q. Frames are still delivered
+  as usual, use can_filter.h to drop them from the stream.
+
+  Slots are written from the CAN RX interrupts and read under a seqlock:
+  the writer makes the sequence odd while it updates the slot, and a
+  reader retries a copy that raced a write.
+
+  The snapshot holds every slot in subscription order, each one as
+  [u32 key][u32 timestamp][u32 count][u8 data_len_code][data]. Slots that
+  did not receive a frame yet have a count of 0. USB hosts take a snapshot
+  with control 0xed and read it in 64 byte pieces. SPI hosts read it from
+  endpoint CAN_CACHE_SPI_ENDPOINT until a transfer comes back short: the
+  first transfer takes the snapshot and the following ones continue it.
+*/
+
+#define CAN_CACHE_MAX_SLOTS 64U
+#define CAN_CACHE_INDEX_SIZE 128U  // power of two
+#define CAN_CACHE_SLOT_HEAD_SIZE 13U
+#define CAN_CACHE_SNAPSHOT_SIZE (CAN_CACHE_MAX_SLOTS * (CAN_CACHE_SLOT_HEAD_SIZE + CANPACKET_DATA_SIZE_MAX))
+#define CAN_CACHE_READ_TRIES 4U
+
+typedef struct {
+  uint32_t seq;  // odd while the slot is written
+  uint32_t key;  // addr | bus << 29 | extended << 31
+  uint32_t ts;
+  uint32_t count;
+  uint8_t data_len_code;
+  uint8_t data[CANPACKET_DATA_SIZE_MAX];
+} can_cache_slot_t;
+
+static can_cache_slot_t can_cache_slots[CAN_CACHE_MAX_SLOTS];
+static uint8_t can_cache_index[CAN_CACHE_INDEX_SIZE];  // slot + 1, 0 is empty
+static volatile uint32_t can_cache_slot_cnt = 0U;
+static uint8_t can_cache_snapshot_buf[CAN_CACHE_SNAPSHOT_SIZE];
+static uint32_t can_cache_snapshot_len = 0U;
+static uint32_t can_cache_stream_pos = 0U;
+static bool can_cache_streaming = false;
+
+static uint32_t can_cache_hash(uint32_t key) {
+  return ((key * 2654435761U) >> 25) & (CAN_CACHE_INDEX_SIZE - 1U);
+}
+
+// slot of key, or CAN_CACHE_MAX_SLOTS
+static uint32_t can_cache_find(uint32_t key) {
+  uint32_t ret = CAN_CACHE_MAX_SLOTS;
+  uint32_t idx = can_cache_hash(key);
+  for (uint32_t i = 0U; i < CAN_CACHE_INDEX_SIZE; i++) {
+    uint8_t slot = can_cache_index[(idx + i) & (CAN_CACHE_INDEX_SIZE - 1U)];
+    if (slot == 0U) {
+      break;
+    }
+    if (can_cache_slots[slot - 1U].key == key) {
+      ret = slot - 1U;
+      break;
+    }
+  }
+  return ret;
+}
+
+void can_cache_clear(void) {
+  ENTER_CRITICAL();
+  can_cache_slot_cnt = 0U;
+  (void)memset(can_cache_index, 0, sizeof(can_cache_index));
+  can_cache_snapshot_len = 0U;
+  can_cache_streaming = false;
+  EXIT_CRITICAL();
+}
+
+bool can_cache_subscribe(uint8_t bus, uint32_t addr, bool extended) {
+  bool ret = false;
+  if ((bus < PANDA_BUS_CNT) && (addr <= 0x1FFFFFFFU)) {
+    uint32_t key = addr | ((uint32_t)bus << 29) | (extended ? (1UL << 31) : 0U);
+    ENTER_CRITICAL();
+    if (can_cache_find(key) != CAN_CACHE_MAX_SLOTS) {
+      ret = true;
+    } else if (can_cache_slot_cnt < CAN_CACHE_MAX_SLOTS) {
+      can_cache_slot_t *s = &can_cache_slots[can_cache_slot_cnt];
+      (void)memset(s, 0, sizeof(can_cache_slot_t));
+      s->key = key;
+
+      uint32_t idx = can_cache_hash(key);
+      while (can_cache_index[idx] != 0U) {
+        idx = (idx + 1U) & (CAN_CACHE_INDEX_SIZE - 1U);
+      }
+      can_cache_slot_cnt += 1U;
+      can_cache_index[idx] = (uint8_t)can_cache_slot_cnt;
+      ret = true;
+    } else {
+      // full
+    }
+    EXIT_CRITICAL();
+  }
+  return ret;
+}
+
+void can_cache_rx(const CANPacket_t *msg) {
+  if (can_cache_slot_cnt > 0U) {
+    uint32_t key = GET_ADDR(msg) | ((uint32_t)GET_BUS(msg) << 29) | ((msg->extended != 0U) ? (1UL << 31) : 0U);
+    uint32_t slot = can_cache_find(key);
+    if (slot != CAN_CACHE_MAX_SLOTS) {
+      can_cache_slot_t *s = &can_cache_slots[slot];
+      s->seq += 1U;
+      __DMB();
+      s->ts = microsecond_timer_get();
+      s->count += 1U;
+      s->data_len_code = msg->data_len_code;
+      (void)memcpy(s->data, msg->data, dlc_to_len[msg->data_len_code]);
+      __DMB();
+      s->seq += 1U;
+    }
+  }
+}
+
+static void can_cache_read_slot(const can_cache_slot_t *s, can_cache_slot_t *out) {
+  bool ok = false;
+  for (uint32_t i = 0U; (i < CAN_CACHE_READ_TRIES) && !ok; i++) {
+    uint32_t seq = s->seq;
+    __DMB();
+    (void)memcpy(out, s, sizeof(can_cache_slot_t));
+    __DMB();
+    ok = ((seq & 1U) == 0U) && (seq == s->seq);
+  }
+
+  // the bus keeps winning, block it for one copy
+  if (!ok) {
+    ENTER_CRITICAL();
+    (void)memcpy(out, s, sizeof(can_cache_slot_t));
+    EXIT_CRITICAL();
+  }
+}
+
+// whole slots that fit in max_len
+uint32_t can_cache_snapshot(uint8_t *data, uint32_t max_len) {
+  uint32_t pos = 0U;
+  for (uint32_t i = 0U; i < can_cache_slot_cnt; i++) {
+    can_cache_slot_t s;
+    can_cache_read_slot(&can_cache_slots[i], &s);
+    uint32_t len = dlc_to_len[s.data_len_code];
+    if ((pos + CAN_CACHE_SLOT_HEAD_SIZE + len) > max_len) {
+      break;
+    }
+    (void)memcpy(&data[pos], &s.key, 4U);
+    uint32_t ts = time_sync_correct(s.ts);
+    (void)memcpy(&data[pos + 4U], &ts, 4U);
+    (void)memcpy(&data[pos + 8U], &s.count, 4U);
+    data[pos + 12U] = s.data_len_code;
+    (void)memcpy(&data[pos + CAN_CACHE_SLOT_HEAD_SIZE], s.data, len);
+    pos += CAN_CACHE_SLOT_HEAD_SIZE + len;
+  }
+  return pos;
+}
+
+// USB: take a snapshot, returns its length
+uint32_t can_cache_snapshot_take(void) {
+  can_cache_streaming = false;
+  can_cache_snapshot_len = can_cache_snapshot(can_cache_snapshot_buf, CAN_CACHE_SNAPSHOT_SIZE);
+  return can_cache_snapshot_len;
+}
+
+// USB: piece of the last snapshot
+uint32_t can_cache_snapshot_read(uint32_t offset, uint8_t *data, uint32_t max_len) {
+  uint32_t len = 0U;
+  if (offset < can_cache_snapshot_len) {
+    len = MIN(max_len, can_cache_snapshot_len - offset);
+    (void)memcpy(data, &can_cache_snapshot_buf[offset], len);
+  }
+  return len;
+}
+
+// SPI: next piece of the snapshot, a short one ends it
+uint32_t can_cache_snapshot_stream(uint8_t *data, uint32_t max_len) {
+  if (!can_cache_streaming) {
+    (void)can_cache_snapshot_take();
+    can_cache_stream_pos = 0U;
+    can_cache_streaming = true;
+  }
+  uint32_t len = can_cache_snapshot_read(can_cache_stream_pos, data, max_len);
+  can_cache_stream_pos += len;
+  can_cache_streaming = (len == max_len);
+  return len;
+}
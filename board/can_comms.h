@@ -15,7 +15,7 @@
 typedef struct {
   uint32_t ptr;
   uint32_t tail_size;
-  uint8_t data[72];
+  uint8_t data[88];
 } asm_buffer;
 
 static asm_buffer can_read_buffer = {.ptr = 0U, .tail_size = 0U};
@@ -35,16 +35,24 @@ int comms_can_read(uint8_t *data, uint32_t max_len) {
   if (can_read_buffer.ptr == 0U) {
     // Fill rest of buffer with new data
     CANPacket_t can_packet;
+    uint8_t compressed[CAN_COMPRESS_MAX_RECORD_LEN];
+    COMPILE_TIME_ASSERT(sizeof(compressed) <= sizeof(can_read_buffer.data));
     while ((pos < max_len) && can_pop(&can_rx_q, &can_packet)) {
+      uint8_t *pckt = (uint8_t*)&can_packet;
       uint32_t pckt_len = CANPACKET_HEAD_SIZE + dlc_to_len[can_packet.data_len_code];
+      if (can_compress_enabled) {
+        pckt = compressed;
+        pckt_len = can_compress(&can_packet, compressed);
+      }
+
       if ((pos + pckt_len) <= max_len) {
-        (void)memcpy(&data[pos], (uint8_t*)&can_packet, pckt_len);
+        (void)memcpy(&data[pos], pckt, pckt_len);
         pos += pckt_len;
       } else {
-        (void)memcpy(&data[pos], (uint8_t*)&can_packet, max_len - pos);
+        (void)memcpy(&data[pos], pckt, max_len - pos);
         can_read_buffer.ptr += pckt_len - (max_len - pos);
         // cppcheck-suppress objectIndex
-        (void)memcpy(can_read_buffer.data, &((uint8_t*)&can_packet)[(max_len - pos)], can_read_buffer.ptr);
+        (void)memcpy(can_read_buffer.data, &pckt[(max_len - pos)], can_read_buffer.ptr);
         pos = max_len;
       }
     }
@@ -55,6 +63,30 @@ int comms_can_read(uint8_t *data, uint32_t max_len) {
 
 static asm_buffer can_write_buffer = {.ptr = 0U, .tail_size = 0U};
 
+static void comms_can_send(CANPacket_t *to_push) {
+  if (to_push->bus == ISOTP_BUS) {
+    isotp_host_write(to_push);
+  } else {
+    // the host marks high priority frames with the returned bit, unused on TX.
+    // The checksum is only redone if it was valid, so a corrupt frame stays invalid.
+    // The two queues drain independently, so the host keeps each ID in one class.
+    bool high = (to_push->returned != 0U);
+    if (high) {
+      bool valid = can_check_checksum(to_push);
+      to_push->returned = 0U;
+      if (valid) {
+        can_set_checksum(to_push);
+      }
+    }
+    can_template_apply(to_push->bus, to_push);
+    if (high) {
+      can_send_prio(to_push, to_push->bus, false, CAN_TX_PRIO_HIGH);
+    } else {
+      can_send(to_push, to_push->bus, false);
+    }
+  }
+}
+
 // send on CAN
 void comms_can_write(const uint8_t *data, uint32_t len) {
   uint32_t pos = 0U;
@@ -70,7 +102,7 @@ void comms_can_write(const uint8_t *data, uint32_t len) {
 
       // send out
       (void)memcpy((uint8_t*)&to_push, can_write_buffer.data, can_write_buffer.ptr);
-      can_send(&to_push, to_push.bus, false);
+      comms_can_send(&to_push);
 
       // reset overflow buffer
       can_write_buffer.ptr = 0U;
@@ -91,7 +123,7 @@ void comms_can_write(const uint8_t *data, uint32_t len) {
     if ((pos + pckt_len) <= len) {
       CANPacket_t to_push = {0};
       (void)memcpy((uint8_t*)&to_push, &data[pos], pckt_len);
-      can_send(&to_push, to_push.bus, false);
+      comms_can_send(&to_push);
       pos += pckt_len;
     } else {
       (void)memcpy(can_write_buffer.data, &data[pos], len - pos);
@@ -109,6 +141,18 @@ void comms_can_reset(void) {
   can_write_buffer.tail_size = 0U;
   can_read_buffer.ptr = 0U;
   can_read_buffer.tail_size = 0U;
+  can_compress_enabled = false;
+  can_compress_reset();
+  can_filter_clear();
+  isotp_reset();
+}
+
+// a partially sent packet in the read buffer is dropped, as its format changes
+void comms_can_set_compression(bool enabled) {
+  can_read_buffer.ptr = 0U;
+  can_read_buffer.tail_size = 0U;
+  can_compress_enabled = enabled;
+  can_compress_reset();
 }
 
 // TODO: make this more general!
@@ -0,0 +1,153 @@
+/*
+  Opt-in compressed format for the CAN RX stream to the host.
+
+  Both ends keep a dictionary of the last frame per (bus, addr, extended),
+  indexed by a one byte token that is assigned when the frame is first
+  seen. Each record starts with a tag:
+
+  * RAW:   tag, CANPacket_t                           (no token or dictionary full)
+  * DEF:   tag, token, CANPacket_t                    (new entry or header changed)
+  * DELTA: tag, token, checksum, mask, changed bytes  (payload XOR previous payload)
+  * SAME:  tag, token, checksum                       (payload unchanged)
+  * RESET: tag, generation, ~generation               (dictionary emptied)
+
+  The mask has one bit per payload byte. A set bit means the byte is sent
+  as XOR against the previous payload. The checksum is the CANPacket_t
+  checksum XOR the generation, so the host detects a dictionary mismatch,
+  including one left by a missed RESET.
+
+  A transfer lost after comms_can_read advanced the dictionary leaves the
+  host out of sync, often in the middle of a record. The dictionary is
+  therefore emptied every CAN_COMPRESS_REFRESH records, with a RESET record
+  ahead of the next one. The host drops what it can't decode and scans for
+  the next RESET, whose inverted generation byte marks it. It is also reset
+  whenever compression is toggled and on comms_can_reset, which also
+  turns compression off.
+*/
+
+#define CAN_COMPRESS_RAW 0U
+#define CAN_COMPRESS_DEF 1U
+#define CAN_COMPRESS_DELTA 2U
+#define CAN_COMPRESS_SAME 3U
+#define CAN_COMPRESS_RESET 4U
+
+#define CAN_COMPRESS_ENTRIES 256U
+#define CAN_COMPRESS_HASH_SIZE 512U  // power of two, > CAN_COMPRESS_ENTRIES
+#define CAN_COMPRESS_HEAD_SIZE 5U    // CANPacket_t header without checksum
+#define CAN_COMPRESS_REFRESH 4096U  // records between dictionary resets
+// a RESET record and the longest of the others
+#define CAN_COMPRESS_MAX_RECORD_LEN (3U + 3U + CANPACKET_HEAD_SIZE + CANPACKET_DATA_SIZE_MAX + (CANPACKET_DATA_SIZE_MAX / 8U))
+
+typedef struct {
+  uint8_t head[CAN_COMPRESS_HEAD_SIZE];
+  uint8_t data[CANPACKET_DATA_SIZE_MAX];
+} can_compress_entry_t;
+
+bool can_compress_enabled = false;
+SRAM12_DATA static can_compress_entry_t can_compress_dict[CAN_COMPRESS_ENTRIES];  // not zeroed, entries are written before use
+static uint16_t can_compress_hash[CAN_COMPRESS_HASH_SIZE];  // dict index + 1, 0 is empty
+static uint32_t can_compress_cnt = 0U;
+static uint32_t can_compress_records = 0U;  // since the last reset
+static uint8_t can_compress_gen = 0U;
+
+void can_compress_reset(void) {
+  can_compress_cnt = 0U;
+  can_compress_records = 0U;
+  can_compress_gen += 1U;
+  (void)memset(can_compress_hash, 0, sizeof(can_compress_hash));
+}
+
+// returns the hash slot holding (bus, id), or the empty slot to insert it at.
+// id is the address and the extended flag, bits 2-31 of the header word.
+static uint32_t can_compress_slot(uint32_t bus, uint32_t id) {
+  uint32_t slot = ((id ^ (bus << 29)) * 2654435761U) >> 23;  // top 9 bits
+  while (can_compress_hash[slot] != 0U) {
+    const can_compress_entry_t *e = &can_compress_dict[can_compress_hash[slot] - 1U];
+    uint32_t e_id = ((uint32_t)e->head[1] | ((uint32_t)e->head[2] << 8) | ((uint32_t)e->head[3] << 16) | ((uint32_t)e->head[4] << 24)) >> 2;
+    uint32_t e_bus = (e->head[0] >> 1) & 0x7U;
+    if ((e_bus == bus) && (e_id == id)) {
+      break;
+    }
+    slot = (slot + 1U) & (CAN_COMPRESS_HASH_SIZE - 1U);
+  }
+  return slot;
+}
+
+static uint32_t can_compress_def(const CANPacket_t *pkt, uint8_t token, uint8_t *out) {
+  uint32_t len = dlc_to_len[pkt->data_len_code];
+  can_compress_entry_t *e = &can_compress_dict[token];
+
+  (void)memcpy(e->head, (const uint8_t*)pkt, CAN_COMPRESS_HEAD_SIZE);
+  (void)memcpy(e->data, pkt->data, len);
+
+  out[0] = CAN_COMPRESS_DEF;
+  out[1] = token;
+  (void)memcpy(&out[2], (const uint8_t*)pkt, CANPACKET_HEAD_SIZE + len);
+  return 2U + CANPACKET_HEAD_SIZE + len;
+}
+
+static uint32_t can_compress_record(const CANPacket_t *pkt, uint8_t *out) {
+  uint32_t ret;
+  uint32_t len = dlc_to_len[pkt->data_len_code];
+  uint32_t slot = can_compress_slot(pkt->bus, ((uint32_t)pkt->addr << 1) | pkt->extended);
+
+  if ((pkt->returned != 0U) || (pkt->rejected != 0U)) {
+    // echoes of our own TX, not worth a dictionary slot
+    out[0] = CAN_COMPRESS_RAW;
+    (void)memcpy(&out[1], (const uint8_t*)pkt, CANPACKET_HEAD_SIZE + len);
+    ret = 1U + CANPACKET_HEAD_SIZE + len;
+  } else if (can_compress_hash[slot] == 0U) {
+    if (can_compress_cnt < CAN_COMPRESS_ENTRIES) {
+      can_compress_hash[slot] = (uint16_t)(can_compress_cnt + 1U);
+      ret = can_compress_def(pkt, (uint8_t)can_compress_cnt, out);
+      can_compress_cnt += 1U;
+    } else {
+      out[0] = CAN_COMPRESS_RAW;
+      (void)memcpy(&out[1], (const uint8_t*)pkt, CANPACKET_HEAD_SIZE + len);
+      ret = 1U + CANPACKET_HEAD_SIZE + len;
+    }
+  } else {
+    uint8_t token = (uint8_t)(can_compress_hash[slot] - 1U);
+    can_compress_entry_t *e = &can_compress_dict[token];
+
+    if (memcmp(e->head, (const uint8_t*)pkt, CAN_COMPRESS_HEAD_SIZE) != 0) {
+      // DLC or flags changed
+      ret = can_compress_def(pkt, token, out);
+    } else {
+      uint32_t mask_len = (len + 7U) / 8U;
+      uint32_t pos = 3U + mask_len;
+      (void)memset(&out[3], 0, mask_len);
+      for (uint32_t i = 0U; i < len; i++) {
+        uint8_t x = pkt->data[i] ^ e->data[i];
+        if (x != 0U) {
+          out[3U + (i / 8U)] |= (uint8_t)(1U << (i % 8U));
+          out[pos] = x;
+          pos += 1U;
+          e->data[i] = pkt->data[i];
+        }
+      }
+
+      out[0] = (pos == (3U + mask_len)) ? CAN_COMPRESS_SAME : CAN_COMPRESS_DELTA;
+      out[1] = token;
+      out[2] = pkt->checksum ^ can_compress_gen;
+      ret = (out[0] == CAN_COMPRESS_SAME) ? 3U : pos;
+    }
+  }
+  return ret;
+}
+
+// encodes one packet into out, which must hold CAN_COMPRESS_MAX_RECORD_LEN bytes
+uint32_t can_compress(const CANPacket_t *pkt, uint8_t *out) {
+  uint32_t ret = 0U;
+  if (can_compress_records >= CAN_COMPRESS_REFRESH) {
+    can_compress_reset();
+  }
+  if (can_compress_records == 0U) {
+    out[0] = CAN_COMPRESS_RESET;
+    out[1] = can_compress_gen;
+    out[2] = (uint8_t)(~can_compress_gen);
+    ret = 3U;
+  }
+  can_compress_records += 1U;
+  return ret + can_compress_record(pkt, &out[ret]);
+}
@@ -0,0 +1,149 @@
+/*
+  Host subscription filters for received CAN frames. Rules are evaluated
+  in order and the first match decides. A frame that matches no rule is
+  delivered. Safety and forwarding run before the filter and see every
+  frame; only delivery to can_rx_q is filtered.
+
+  Rules are uploaded with three control requests: 0xac and 0xad stage
+  the first and last address of the range, and 0xae commits the rule.
+*/
+
+#define CAN_FILTER_PASS 0U
+#define CAN_FILTER_DROP 1U
+#define CAN_FILTER_DECIMATE 2U   // deliver every n-th frame per address
+#define CAN_FILTER_ON_CHANGE 3U  // deliver on payload change, or after n unchanged frames if n > 0
+
+#define CAN_FILTER_ANY_BUS 0xFFU
+#define CAN_FILTER_MAX_RULES 32U
+#define CAN_FILTER_STATE_SIZE 512U  // power of two
+#define CAN_FILTER_STATE_MAX_FILL ((CAN_FILTER_STATE_SIZE * 3U) / 4U)
+
+typedef struct {
+  uint32_t addr_lo;
+  uint32_t addr_hi;
+  uint8_t bus;
+  uint8_t action;
+  uint16_t n;
+} can_filter_rule_t;
+
+// per address state for the stateful actions
+typedef struct {
+  uint32_t key;  // addr | bus << 29 | extended << 31
+  uint32_t last_hash;
+  uint16_t cnt;
+  bool used;
+} can_filter_state_t;
+
+uint32_t can_filter_dropped = 0U;
+
+static can_filter_rule_t can_filter_rules[CAN_FILTER_MAX_RULES];
+static volatile uint32_t can_filter_rule_cnt = 0U;
+static can_filter_state_t can_filter_state[CAN_FILTER_STATE_SIZE];
+static uint32_t can_filter_state_cnt = 0U;
+static uint32_t can_filter_staged_lo = 0U;
+static uint32_t can_filter_staged_hi = 0x1FFFFFFFU;
+
+void can_filter_clear(void) {
+  ENTER_CRITICAL();
+  can_filter_rule_cnt = 0U;
+  can_filter_state_cnt = 0U;
+  can_filter_dropped = 0U;
+  (void)memset(can_filter_state, 0, sizeof(can_filter_state));
+  EXIT_CRITICAL();
+}
+
+void can_filter_stage(bool last, uint32_t addr) {
+  if (last) {
+    can_filter_staged_hi = addr;
+  } else {
+    can_filter_staged_lo = addr;
+  }
+}
+
+// appends a rule for the staged address range
+bool can_filter_add(uint8_t bus, uint8_t action, uint16_t n) {
+  bool ret = false;
+  if ((can_filter_rule_cnt < CAN_FILTER_MAX_RULES) && (action <= CAN_FILTER_ON_CHANGE) && (can_filter_staged_lo <= can_filter_staged_hi)) {
+    can_filter_rule_t *r = &can_filter_rules[can_filter_rule_cnt];
+    r->addr_lo = can_filter_staged_lo;
+    r->addr_hi = can_filter_staged_hi;
+    r->bus = bus;
+    r->action = action;
+    r->n = ((action == CAN_FILTER_DECIMATE) && (n == 0U)) ? 1U : n;
+
+    // publish only once the rule is complete, the CAN RX ISR may be reading
+    can_filter_rule_cnt += 1U;
+    ret = true;
+  }
+  return ret;
+}
+
+static uint32_t can_filter_payload_hash(const CANPacket_t *pkt) {
+  // FNV-1a over DLC and payload
+  uint32_t h = 2166136261U ^ pkt->data_len_code;
+  for (uint8_t i = 0U; i < dlc_to_len[pkt->data_len_code]; i++) {
+    h = (h ^ pkt->data[i]) * 16777619U;
+  }
+  return h;
+}
+
+static bool can_filter_stateful(const can_filter_rule_t *r, const CANPacket_t *pkt) {
+  bool deliver = true;
+  uint32_t key = pkt->addr | ((uint32_t)pkt->bus << 29) | ((pkt->extended != 0U) ? (1UL << 31) : 0U);
+  uint32_t slot = (key * 2654435761U) >> 23;  // top 9 bits
+
+  while (can_filter_state[slot].used && (can_filter_state[slot].key != key)) {
+    slot = (slot + 1U) & (CAN_FILTER_STATE_SIZE - 1U);
+  }
+
+  can_filter_state_t *s = &can_filter_state[slot];
+  if (!s->used) {
+    // first frame of an address is always delivered, out of state it stays unfiltered
+    if (can_filter_state_cnt < CAN_FILTER_STATE_MAX_FILL) {
+      s->used = true;
+      s->key = key;
+      s->cnt = 0U;
+      s->last_hash = can_filter_payload_hash(pkt);
+      can_filter_state_cnt += 1U;
+    }
+  } else if (r->action == CAN_FILTER_DECIMATE) {
+    s->cnt += 1U;
+    if (s->cnt >= r->n) {
+      s->cnt = 0U;
+    }
+    deliver = (s->cnt == 0U);
+  } else {
+    uint32_t h = can_filter_payload_hash(pkt);
+    s->cnt += 1U;
+    deliver = (h != s->last_hash) || ((r->n != 0U) && (s->cnt >= r->n));
+    if (deliver) {
+      s->cnt = 0U;
+    }
+    s->last_hash = h;
+  }
+  return deliver;
+}
+
+// returns true if the frame should be delivered to the host
+bool can_filter_check(const CANPacket_t *pkt) {
+  bool deliver = true;
+  uint32_t rule_cnt = can_filter_rule_cnt;
+
+  for (uint32_t i = 0U; i < rule_cnt; i++) {
+    const can_filter_rule_t *r = &can_filter_rules[i];
+    if (((r->bus == CAN_FILTER_ANY_BUS) || (r->bus == pkt->bus)) && (pkt->addr >= r->addr_lo) && (pkt->addr <= r->addr_hi)) {
+      if (r->action == CAN_FILTER_DROP) {
+        deliver = false;
+      } else if (r->action != CAN_FILTER_PASS) {
+        deliver = can_filter_stateful(r, pkt);
+      } else {
+      }
+      break;
+    }
+  }
+
+  if (!deliver) {
+    can_filter_dropped += 1U;
+  }
+  return deliver;
+}
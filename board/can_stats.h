@@ -0,0 +1,125 @@
+/*
+  Per-address receive statistics, one fixed-size table per bus, updated
+  from can_rx. Addresses hash into the table with a short linear probe;
+  frames of addresses that find no slot are only counted in
+  can_stats_untracked.
+
+  The host reads the table incrementally (control 0xeb or SPI endpoint
+  CAN_STATS_SPI_ENDPOINT). Each read continues where the last one
+  stopped, and an empty read marks the end of a pass.
+*/
+
+#define CAN_STATS_BUS_CNT 3U
+#define CAN_STATS_SIZE 256U  // per bus, power of two
+#define CAN_STATS_MAX_PROBE 8U
+#define CAN_STATS_EWMA_SHIFT 3U  // inter-arrival EWMA weight 1/8
+
+typedef struct __attribute__((packed)) {
+  uint32_t addr;         // bit 31: extended
+  uint8_t bus;
+  uint8_t dlc;
+  uint16_t dlc_changes;
+  uint32_t count;
+  uint32_t last_ts;      // microsecond timer, corrected when read
+  uint32_t min_gap_us;
+  uint32_t max_gap_us;
+  uint32_t ewma_gap_us;
+  uint16_t invalid;      // failed safety rx checks
+  uint16_t lost;         // not delivered, can_rx_q full
+} can_stats_entry_t;
+
+uint32_t can_stats_untracked = 0U;
+
+static can_stats_entry_t can_stats[CAN_STATS_BUS_CNT][CAN_STATS_SIZE];
+static uint32_t can_stats_cursor = 0U;
+
+static uint32_t can_stats_hash(uint32_t key) {
+  return ((key * 2654435761U) >> 24) & (CAN_STATS_SIZE - 1U);
+}
+
+void can_stats_rx(const CANPacket_t *msg, bool valid, bool delivered) {
+  uint8_t bus = GET_BUS(msg);
+  if (bus < CAN_STATS_BUS_CNT) {
+    uint32_t key = GET_ADDR(msg) | ((msg->extended != 0U) ? (1UL << 31) : 0U);
+    uint32_t now = microsecond_timer_get();
+    uint32_t idx = can_stats_hash(key);
+    can_stats_entry_t *e = NULL;
+
+    for (uint32_t i = 0U; i < CAN_STATS_MAX_PROBE; i++) {
+      can_stats_entry_t *slot = &can_stats[bus][(idx + i) & (CAN_STATS_SIZE - 1U)];
+      if ((slot->count == 0U) || (slot->addr == key)) {
+        e = slot;
+        break;
+      }
+    }
+
+    if (e == NULL) {
+      can_stats_untracked += 1U;
+    } else if (e->count == 0U) {
+      e->addr = key;
+      e->bus = bus;
+      e->dlc = msg->data_len_code;
+      e->dlc_changes = 0U;
+      e->count = 1U;
+      e->last_ts = now;
+      e->min_gap_us = 0xFFFFFFFFU;
+      e->max_gap_us = 0U;
+      e->ewma_gap_us = 0U;
+      e->invalid = valid ? 0U : 1U;
+      e->lost = delivered ? 0U : 1U;
+    } else {
+      uint32_t gap = get_ts_elapsed(now, e->last_ts);
+      e->min_gap_us = MIN(e->min_gap_us, gap);
+      e->max_gap_us = MAX(e->max_gap_us, gap);
+      if (e->count == 1U) {
+        e->ewma_gap_us = gap;
+      } else {
+        e->ewma_gap_us = e->ewma_gap_us - (e->ewma_gap_us >> CAN_STATS_EWMA_SHIFT) + (gap >> CAN_STATS_EWMA_SHIFT);
+      }
+      if (e->dlc != msg->data_len_code) {
+        e->dlc = msg->data_len_code;
+        e->dlc_changes += (e->dlc_changes < 0xFFFFU) ? 1U : 0U;
+      }
+      e->invalid += (!valid && (e->invalid < 0xFFFFU)) ? 1U : 0U;
+      e->lost += (!delivered && (e->lost < 0xFFFFU)) ? 1U : 0U;
+      e->count += 1U;
+      e->last_ts = now;
+    }
+  }
+}
+
+// next used entries of the current pass, 0 at the end of a pass
+uint32_t can_stats_read(uint8_t *data, uint32_t max_len) {
+  uint32_t pos = 0U;
+  const uint32_t total = CAN_STATS_BUS_CNT * CAN_STATS_SIZE;
+
+  while ((can_stats_cursor < total) && ((pos + sizeof(can_stats_entry_t)) <= max_len)) {
+    ENTER_CRITICAL();
+    const can_stats_entry_t *e = &can_stats[can_stats_cursor / CAN_STATS_SIZE][can_stats_cursor % CAN_STATS_SIZE];
+    if (e->count != 0U) {
+      can_stats_entry_t out = *e;
+      out.last_ts = time_sync_correct(out.last_ts);
+      (void)memcpy(&data[pos], &out, sizeof(can_stats_entry_t));
+      pos += sizeof(can_stats_entry_t);
+    }
+    EXIT_CRITICAL();
+    can_stats_cursor += 1U;
+  }
+
+  if (pos == 0U) {
+    can_stats_cursor = 0U;
+  }
+  return pos;
+}
+
+void can_stats_restart(void) {
+  can_stats_cursor = 0U;
+}
+
+void can_stats_clear(void) {
+  ENTER_CRITICAL();
+  (void)memset(can_stats, 0, sizeof(can_stats));
+  can_stats_untracked = 0U;
+  can_stats_cursor = 0U;
+  EXIT_CRITICAL();
+}
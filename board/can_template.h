@@ -0,0 +1,169 @@
+/*
+  TX templates: the firmware fills in the rolling counter and checksum of
+  host frames for a (bus, addr) as they are sent, before the safety tx
+  hook checks them. The counter advances with every frame sent, whatever
+  the host put in it. Forwarded frames are never stamped, and changing
+  the safety mode clears all templates.
+
+  The counter is a bit field in one byte. The checksum is one whole byte
+  and covers all other data bytes.
+
+  Templates are added with two control requests: 0xef stages the counter
+  and checksum layout, and 0xee adds it for an address.
+*/
+
+#define CAN_TEMPLATE_MAX 32U
+#define CAN_TEMPLATE_INDEX_SIZE 64U  // power of two
+
+#define CAN_TEMPLATE_CHECKSUM_NONE 0U
+#define CAN_TEMPLATE_CHECKSUM_SUM8 1U         // sum of the data bytes
+#define CAN_TEMPLATE_CHECKSUM_SUM8_ADDR 2U    // sum of the address bytes, length and data bytes
+#define CAN_TEMPLATE_CHECKSUM_XOR8 3U
+#define CAN_TEMPLATE_CHECKSUM_CRC8_J1850 4U   // poly 0x1D, init and xorout 0xFF
+#define CAN_TEMPLATE_CHECKSUM_CRC8_AUTOSAR 5U // poly 0x2F, init and xorout 0xFF
+
+typedef struct {
+  uint32_t key;  // addr | bus << 29 | extended << 31
+  uint8_t counter_byte;
+  uint8_t counter_shift;
+  uint8_t counter_mask;  // 0 for no counter
+  uint8_t counter;
+  uint8_t checksum_type;
+  uint8_t checksum_byte;
+} can_template_t;
+
+uint32_t can_template_stamped = 0U;
+
+static can_template_t can_templates[CAN_TEMPLATE_MAX];
+static uint8_t can_template_index[CAN_TEMPLATE_INDEX_SIZE];  // template + 1, 0 is empty
+static volatile uint32_t can_template_cnt = 0U;
+static uint16_t can_template_staged_counter = 0U;
+static uint16_t can_template_staged_checksum = 0U;
+
+static uint32_t can_template_hash(uint32_t key) {
+  return ((key * 2654435761U) >> 26) & (CAN_TEMPLATE_INDEX_SIZE - 1U);
+}
+
+static can_template_t *can_template_find(uint32_t key) {
+  can_template_t *ret = NULL;
+  uint32_t idx = can_template_hash(key);
+  for (uint32_t i = 0U; i < CAN_TEMPLATE_INDEX_SIZE; i++) {
+    uint8_t t = can_template_index[(idx + i) & (CAN_TEMPLATE_INDEX_SIZE - 1U)];
+    if (t == 0U) {
+      break;
+    }
+    if (can_templates[t - 1U].key == key) {
+      ret = &can_templates[t - 1U];
+      break;
+    }
+  }
+  return ret;
+}
+
+void can_template_clear(void) {
+  ENTER_CRITICAL();
+  can_template_cnt = 0U;
+  can_template_stamped = 0U;
+  (void)memset(can_template_index, 0, sizeof(can_template_index));
+  EXIT_CRITICAL();
+}
+
+// counter: byte | lsb position << 6 | (bits - 1) << 9 | enable << 15
+// checksum: byte | type << 6
+void can_template_stage(uint16_t counter, uint16_t checksum) {
+  can_template_staged_counter = counter;
+  can_template_staged_checksum = checksum;
+}
+
+// adds or replaces the template of an address with the staged layout
+bool can_template_add(uint8_t bus, uint32_t addr, bool extended) {
+  bool ret = false;
+  uint8_t counter_byte = can_template_staged_counter & 0x3FU;
+  uint8_t counter_shift = (can_template_staged_counter >> 6) & 0x7U;
+  uint8_t counter_bits = ((can_template_staged_counter >> 9) & 0x7U) + 1U;
+  bool counter_en = (can_template_staged_counter >> 15) != 0U;
+  uint8_t checksum_byte = can_template_staged_checksum & 0x3FU;
+  uint8_t checksum_type = (can_template_staged_checksum >> 6) & 0xFU;
+
+  if ((bus < PANDA_BUS_CNT) && (addr <= 0x1FFFFFFFU) && (checksum_type <= CAN_TEMPLATE_CHECKSUM_CRC8_AUTOSAR) &&
+      ((counter_shift + counter_bits) <= 8U) && (counter_byte < CANPACKET_DATA_SIZE_MAX) && (checksum_byte < CANPACKET_DATA_SIZE_MAX) &&
+      (!counter_en || (checksum_type == CAN_TEMPLATE_CHECKSUM_NONE) || (counter_byte != checksum_byte))) {
+    uint32_t key = addr | ((uint32_t)bus << 29) | (extended ? (1UL << 31) : 0U);
+    ENTER_CRITICAL();
+    can_template_t *t = can_template_find(key);
+    if ((t == NULL) && (can_template_cnt < CAN_TEMPLATE_MAX)) {
+      t = &can_templates[can_template_cnt];
+      t->key = key;
+      uint32_t idx = can_template_hash(key);
+      while (can_template_index[idx] != 0U) {
+        idx = (idx + 1U) & (CAN_TEMPLATE_INDEX_SIZE - 1U);
+      }
+      can_template_cnt += 1U;
+      can_template_index[idx] = (uint8_t)can_template_cnt;
+    }
+    if (t != NULL) {
+      t->counter_byte = counter_byte;
+      t->counter_shift = counter_shift;
+      t->counter_mask = counter_en ? (uint8_t)((1U << counter_bits) - 1U) : 0U;
+      t->counter = t->counter_mask;  // first frame sends 0
+      t->checksum_type = checksum_type;
+      t->checksum_byte = checksum_byte;
+      ret = true;
+    }
+    EXIT_CRITICAL();
+  }
+  return ret;
+}
+
+static uint8_t can_template_crc8(const uint8_t *dat, uint32_t len, uint8_t skip, uint8_t poly) {
+  uint8_t crc = 0xFFU;
+  for (uint32_t i = 0U; i < len; i++) {
+    if (i != skip) {
+      crc ^= dat[i];
+      for (uint8_t b = 0U; b < 8U; b++) {
+        crc = ((crc & 0x80U) != 0U) ? (uint8_t)((crc << 1) ^ poly) : (uint8_t)(crc << 1);
+      }
+    }
+  }
+  return crc ^ 0xFFU;
+}
+
+static uint8_t can_template_checksum(const can_template_t *t, const CANPacket_t *msg, uint32_t len) {
+  uint8_t ret = 0U;
+  if ((t->checksum_type == CAN_TEMPLATE_CHECKSUM_CRC8_J1850) || (t->checksum_type == CAN_TEMPLATE_CHECKSUM_CRC8_AUTOSAR)) {
+    ret = can_template_crc8(msg->data, len, t->checksum_byte, (t->checksum_type == CAN_TEMPLATE_CHECKSUM_CRC8_J1850) ? 0x1DU : 0x2FU);
+  } else {
+    if (t->checksum_type == CAN_TEMPLATE_CHECKSUM_SUM8_ADDR) {
+      uint32_t addr = GET_ADDR(msg);
+      ret = (uint8_t)(addr + (addr >> 8) + (addr >> 16) + (addr >> 24) + len);
+    }
+    for (uint32_t i = 0U; i < len; i++) {
+      if (i != t->checksum_byte) {
+        ret = (t->checksum_type == CAN_TEMPLATE_CHECKSUM_XOR8) ? (ret ^ msg->data[i]) : (uint8_t)(ret + msg->data[i]);
+      }
+    }
+  }
+  return ret;
+}
+
+// host frames, before the safety tx hook. A frame with a bad checksum is
+// left alone so it stays invalid.
+void can_template_apply(uint8_t bus, CANPacket_t *msg) {
+  if (can_template_cnt > 0U) {
+    uint32_t key = GET_ADDR(msg) | ((uint32_t)bus << 29) | ((msg->extended != 0U) ? (1UL << 31) : 0U);
+    can_template_t *t = can_template_find(key);
+    uint32_t len = dlc_to_len[msg->data_len_code];
+    if ((t != NULL) && can_check_checksum(msg)) {
+      if ((t->counter_mask != 0U) && (t->counter_byte < len)) {
+        t->counter = (t->counter + 1U) & t->counter_mask;
+        uint8_t mask = (uint8_t)(t->counter_mask << t->counter_shift);
+        msg->data[t->counter_byte] = (msg->data[t->counter_byte] & (uint8_t)~mask) | (uint8_t)(t->counter << t->counter_shift);
+      }
+      if ((t->checksum_type != CAN_TEMPLATE_CHECKSUM_NONE) && (t->checksum_byte < len)) {
+        msg->data[t->checksum_byte] = can_template_checksum(t, msg, len);
+      }
+      can_set_checksum(msg);
+      can_template_stamped += 1U;
+    }
+  }
+}
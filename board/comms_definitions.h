@@ -7,6 +7,17 @@ typedef struct {
 
 int comms_control_handler(ControlPacket_t *req, uint8_t *resp);
 void comms_endpoint2_write(const uint8_t *data, uint32_t len);
+bool comms_endpoint2_ready(uint8_t port, uint32_t len);
+void comms_endpoint2_resume_usb(void);
 void comms_can_write(const uint8_t *data, uint32_t len);
 int comms_can_read(uint8_t *data, uint32_t max_len);
 void comms_can_reset(void);
+
+#define PLAYBACK_SPI_ENDPOINT 5U
+void comms_playback_write(const uint8_t *data, uint32_t len);
+
+#define CAN_STATS_SPI_ENDPOINT 6U
+uint32_t comms_can_stats_read(uint8_t *data, uint32_t max_len);
+
+#define CAN_CACHE_SPI_ENDPOINT 7U
+uint32_t comms_can_cache_read(uint8_t *data, uint32_t max_len);
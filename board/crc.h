@@ -19,3 +19,17 @@ uint8_t crc_checksum(const uint8_t *dat, int len, const uint8_t poly) {
   return crc;
 }
 #endif
+
+#ifdef BOOTSTUB
+// CRC-32 (IEEE, reflected), matches zlib.crc32
+uint32_t crc32(const uint8_t *dat, uint32_t len) {
+  uint32_t crc = 0xFFFFFFFFU;
+  for (uint32_t i = 0U; i < len; i++) {
+    crc ^= dat[i];
+    for (uint8_t j = 0U; j < 8U; j++) {
+      crc = ((crc & 1U) != 0U) ? ((crc >> 1) ^ 0xEDB88320U) : (crc >> 1);
+    }
+  }
+  return ~crc;
+}
+#endif
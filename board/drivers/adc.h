@@ -0,0 +1,118 @@
+#include "adc_declarations.h"
+
+// Supply channels are registered on first read, before the background scan
+// starts. From then on reads return the running average in O(1) and never
+// block on a conversion.
+static adc_channel_t adc_channels[ADC_SCAN_MAX_CHANNELS];
+static uint8_t adc_channels_len = 0U;
+static bool adc_scan_running = false;
+
+static uint8_t adc_scan_seq[ADC_SCAN_MAX_CHANNELS + 2U];
+static uint8_t adc_scan_seq_len = 0U;
+static volatile bool adc_scan_busy = false;
+#ifdef STM32H7
+// DMA1 can't reach DTCM
+__attribute__((section(".sram12"))) static volatile uint16_t adc_scan_res[ADC_SCAN_MAX_CHANNELS + 2U];
+#else
+static volatile uint16_t adc_scan_res[ADC_SCAN_MAX_CHANNELS + 2U];
+#endif
+
+static uint8_t adc_oneshot_ch[2];
+static adc_oneshot_cb adc_oneshot_pending = NULL;
+static adc_oneshot_cb adc_oneshot_active = NULL;
+
+static adc_channel_t *adc_find(uint8_t channel) {
+  adc_channel_t *ret = NULL;
+  for (uint8_t i = 0U; i < adc_channels_len; i++) {
+    if (adc_channels[i].channel == channel) {
+      ret = &adc_channels[i];
+      break;
+    }
+  }
+  return ret;
+}
+
+static void adc_push_sample(adc_channel_t *ch, uint16_t raw) {
+  ch->sum = (ch->sum - ch->samples[ch->idx]) + raw;
+  ch->samples[ch->idx] = raw;
+  ch->idx = (ch->idx + 1U) % ADC_AVG_DEPTH;
+}
+
+uint16_t adc_get_raw(uint8_t channel) {
+  uint16_t ret;
+  adc_channel_t *ch = adc_find(channel);
+  if (ch != NULL) {
+    ret = (uint16_t)(ch->sum / ADC_AVG_DEPTH);
+  } else {
+    // blocking read, only allowed while the scan is not running
+    ret = adc_scan_running ? 0U : adc_read_raw(channel);
+    if (!adc_scan_running && (adc_channels_len < ADC_SCAN_MAX_CHANNELS)) {
+      ch = &adc_channels[adc_channels_len];
+      ch->channel = channel;
+      ch->idx = 0U;
+      ch->sum = 0U;
+      for (uint8_t i = 0U; i < ADC_AVG_DEPTH; i++) {
+        adc_push_sample(ch, ret);
+      }
+      adc_channels_len += 1U;
+    }
+  }
+  return ret;
+}
+
+uint16_t adc_get_mV(uint8_t channel) {
+  return adc_raw_to_mV(adc_get_raw(channel));
+}
+
+// sample two extra channels with the next scan, cb runs right after conversion
+bool adc_sample_once(uint8_t ch1, uint8_t ch2, adc_oneshot_cb cb) {
+  bool ret = false;
+  ENTER_CRITICAL();
+  if (adc_scan_running && (adc_oneshot_pending == NULL) && (adc_oneshot_active == NULL)) {
+    adc_oneshot_ch[0] = ch1;
+    adc_oneshot_ch[1] = ch2;
+    adc_oneshot_pending = cb;
+    ret = true;
+  }
+  EXIT_CRITICAL();
+  return ret;
+}
+
+void adc_scan_done(void) {
+  for (uint8_t i = 0U; i < adc_channels_len; i++) {
+    adc_push_sample(&adc_channels[i], adc_scan_res[i]);
+  }
+  if (adc_oneshot_active != NULL) {
+    adc_oneshot_cb cb = adc_oneshot_active;
+    adc_oneshot_active = NULL;
+    cb(adc_raw_to_mV(adc_scan_res[adc_channels_len]), adc_raw_to_mV(adc_scan_res[adc_channels_len + 1U]));
+  }
+  adc_scan_busy = false;
+}
+
+// called at 8Hz, the conversion runs in the background
+void adc_tick(void) {
+  adc_scan_running = true;
+  if (!adc_scan_busy) {
+    adc_scan_seq_len = 0U;
+    for (uint8_t i = 0U; i < adc_channels_len; i++) {
+      adc_scan_seq[adc_scan_seq_len] = adc_channels[i].channel;
+      adc_scan_seq_len += 1U;
+    }
+
+    ENTER_CRITICAL();
+    adc_oneshot_active = adc_oneshot_pending;
+    adc_oneshot_pending = NULL;
+    EXIT_CRITICAL();
+    if (adc_oneshot_active != NULL) {
+      adc_scan_seq[adc_scan_seq_len] = adc_oneshot_ch[0];
+      adc_scan_seq[adc_scan_seq_len + 1U] = adc_oneshot_ch[1];
+      adc_scan_seq_len += 2U;
+    }
+
+    if (adc_scan_seq_len > 0U) {
+      adc_scan_busy = true;
+      adc_scan_dma_start(adc_scan_seq, adc_scan_seq_len, adc_scan_res);
+    }
+  }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// channels sampled in the background, averaged over ADC_AVG_DEPTH scans
+#define ADC_SCAN_MAX_CHANNELS 4U
+#define ADC_AVG_DEPTH 8U
+
+// called from the DMA interrupt once a one-shot sample is converted
+typedef void (*adc_oneshot_cb)(uint16_t ch1_mV, uint16_t ch2_mV);
+
+typedef struct {
+  uint8_t channel;
+  uint8_t idx;
+  uint16_t samples[ADC_AVG_DEPTH];
+  uint32_t sum;
+} adc_channel_t;
+
+// platform (lladc.h)
+void adc_init(void);
+void adc_scan_init(void);
+uint16_t adc_read_raw(uint8_t channel);
+uint16_t adc_raw_to_mV(uint16_t raw);
+void adc_scan_dma_start(const uint8_t *channels, uint8_t len, volatile uint16_t *res);
+
+// common (adc.h)
+uint16_t adc_get_raw(uint8_t channel);
+uint16_t adc_get_mV(uint8_t channel);
+bool adc_sample_once(uint8_t ch1, uint8_t ch2, adc_oneshot_cb cb);
+void adc_scan_done(void);
+void adc_tick(void);
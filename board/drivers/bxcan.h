@@ -108,7 +108,8 @@ void process_can(uint8_t can_number) {
         CANx->TSR |= CAN_TSR_RQCP0;
       }
 
-      if (can_pop(can_queues[bus_number], &to_send)) {
+      uint32_t bench_start = can_bench_start();
+      if (can_tx_pop(bus_number, &to_send)) {
         if (can_check_checksum(&to_send)) {
           can_health[can_number].total_tx_cnt += 1U;
           // only send if we have received a packet
@@ -118,6 +119,8 @@ void process_can(uint8_t can_number) {
           BYTE_ARRAY_TO_WORD(CANx->sTxMailBox[0].TDHR, &to_send.data[4]);
           // Send request TXRQ
           CANx->sTxMailBox[0].TIR |= 0x1U;
+          TRACE(TRACE_EV_CAN_TX, bus_number, to_send.addr);
+          can_bench_end(CAN_BENCH_TX, bench_start);
         } else {
           can_health[can_number].total_tx_checksum_error_cnt += 1U;
         }
@@ -137,6 +140,7 @@ void can_rx(uint8_t can_number) {
   uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
 
   while ((CANx->RF0R & CAN_RF0R_FMP0) != 0U) {
+    uint32_t bench_start = can_bench_start();
     can_health[can_number].total_rx_cnt += 1U;
 
     // can is live
@@ -173,16 +177,30 @@ void can_rx(uint8_t can_number) {
 
       can_send(&to_send, bus_fwd_num, true);
       can_health[can_number].total_fwd_cnt += 1U;
+      TRACE(TRACE_EV_CAN_FWD, bus_fwd_num, to_send.addr);
     }
 
-    safety_rx_invalid += safety_rx_hook(&to_push) ? 0U : 1U;
+    bool rx_valid = safety_rx_hook(&to_push);
+    safety_rx_invalid += rx_valid ? 0U : 1U;
     ignition_can_hook(&to_push);
+    isotp_rx_hook(&to_push);
+    can_cache_rx(&to_push);
 
     led_set(LED_BLUE, true);
-    rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    TRACE(TRACE_EV_CAN_RX, bus_number, to_push.addr);
+    bool rx_delivered = true;
+    if (can_filter_check(&to_push)) {
+      if (!can_push(&can_rx_q, &to_push)) {
+        rx_delivered = false;
+        rx_buffer_overflow += 1U;
+        TRACE(TRACE_EV_CAN_RX_OVERFLOW, bus_number, to_push.addr);
+      }
+    }
+    can_stats_rx(&to_push, rx_valid, rx_delivered);
 
     // next
     CANx->RF0R |= CAN_RF0R_RFOM0;
+    can_bench_end((bus_fwd_num != -1) ? CAN_BENCH_FWD : CAN_BENCH_RX, bench_start);
   }
 }
 
@@ -215,6 +233,7 @@ bool can_init(uint8_t can_number) {
     CAN_TypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
     ret &= can_set_speed(can_number);
     ret &= llcan_init(CANx);
+    TRACE(TRACE_EV_CAN_INIT, can_number, ret);
     // in case there are queued up messages
     process_can(can_number);
   }
@@ -0,0 +1,75 @@
+// CAN path cycle benchmark. While enabled, the DWT cycle counter times
+// every received frame (split by whether it was forwarded) and every
+// frame written to the controller. Starting it resets the results.
+// Compare builds with and without DISABLE_ITCM_CODE to see what the ITCM
+// placement buys.
+
+#define CAN_BENCH_RX 0U
+#define CAN_BENCH_FWD 1U
+#define CAN_BENCH_TX 2U
+#define CAN_BENCH_CNT 3U
+
+typedef struct __attribute__((packed)) {
+  uint32_t frames;
+  uint32_t cycles_mean;
+  uint32_t cycles_max;
+} can_bench_result_t;
+
+typedef struct {
+  uint32_t frames;
+  uint32_t cycles;
+  uint32_t cycles_max;
+} can_bench_acc_t;
+
+static bool can_bench_enabled = false;
+static can_bench_acc_t can_bench_acc[CAN_BENCH_CNT];
+
+CAN_FAST_CODE uint32_t can_bench_start(void) {
+  return can_bench_enabled ? DWT->CYCCNT : 0U;
+}
+
+CAN_FAST_CODE void can_bench_end(uint8_t kind, uint32_t start) {
+  if (can_bench_enabled) {
+    uint32_t cycles = DWT->CYCCNT - start;
+    can_bench_acc_t *acc = &can_bench_acc[kind];
+    // a window ends when the sum would overflow
+    if (cycles <= (0xFFFFFFFFU - acc->cycles)) {
+      acc->frames += 1U;
+      acc->cycles += cycles;
+      acc->cycles_max = MAX(acc->cycles_max, cycles);
+    }
+  }
+}
+
+void can_bench_set(bool enable) {
+  ENTER_CRITICAL();
+  if (enable) {
+    (void)memset(can_bench_acc, 0, sizeof(can_bench_acc));
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+#ifdef STM32H7
+    DWT->LAR = 0xC5ACCE55U;
+#endif
+    DWT->CYCCNT = 0U;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+  can_bench_enabled = enable;
+  EXIT_CRITICAL();
+}
+
+// results for rx, fwd and tx, then the core clock in MHz and whether the path runs from ITCM
+int can_bench_read(uint8_t *resp) {
+  uint32_t pos = 0U;
+  ENTER_CRITICAL();
+  for (uint8_t i = 0U; i < CAN_BENCH_CNT; i++) {
+    can_bench_result_t r;
+    r.frames = can_bench_acc[i].frames;
+    r.cycles_mean = (r.frames > 0U) ? (can_bench_acc[i].cycles / r.frames) : 0U;
+    r.cycles_max = can_bench_acc[i].cycles_max;
+    (void)memcpy(&resp[pos], &r, sizeof(r));
+    pos += sizeof(r);
+  }
+  EXIT_CRITICAL();
+  resp[pos] = (uint8_t)CORE_FREQ;
+  resp[pos + 1U] = (uint8_t)CAN_FAST_CODE_IN_ITCM;
+  return (int)(pos + 2U);
+}
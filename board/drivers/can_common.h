@@ -24,9 +24,12 @@ bool can_loopback = false;
 
 #define CAN_RX_BUFFER_SIZE 4096U
 #define CAN_TX_BUFFER_SIZE 416U
+#define CAN_TX_HP_BUFFER_SIZE 32U
 
 #ifdef STM32H7
-// ITCM RAM and DTCM RAM are the fastest for Cortex-M7 core access
+// ITCM RAM and DTCM RAM are the fastest for Cortex-M7 core access. The bus 0
+// and bus 1 TX rings fill all but 5632 bytes of ITCM, the CAN_FAST_CODE
+// functions get the rest, so the high priority rings stay in DTCM
 __attribute__((section(".axisram"))) can_buffer(rx_q, CAN_RX_BUFFER_SIZE)
 __attribute__((section(".itcmram"))) can_buffer(tx1_q, CAN_TX_BUFFER_SIZE)
 __attribute__((section(".itcmram"))) can_buffer(tx2_q, CAN_TX_BUFFER_SIZE)
@@ -36,13 +39,22 @@ can_buffer(tx1_q, CAN_TX_BUFFER_SIZE)
 can_buffer(tx2_q, CAN_TX_BUFFER_SIZE)
 #endif
 can_buffer(tx3_q, CAN_TX_BUFFER_SIZE)
+can_buffer(tx1_hp_q, CAN_TX_HP_BUFFER_SIZE)
+can_buffer(tx2_hp_q, CAN_TX_HP_BUFFER_SIZE)
+can_buffer(tx3_hp_q, CAN_TX_HP_BUFFER_SIZE)
 
 // FIXME:
 // cppcheck-suppress misra-c2012-9.3
 can_ring *can_queues[CAN_QUEUES_ARRAY_SIZE] = {&can_tx1_q, &can_tx2_q, &can_tx3_q};
+// cppcheck-suppress misra-c2012-9.3
+can_ring *can_hp_queues[CAN_QUEUES_ARRAY_SIZE] = {&can_tx1_hp_q, &can_tx2_hp_q, &can_tx3_hp_q};
+
+// frames whose arbitration ID (top 11 bits for extended IDs) is below this go
+// to the high priority queue, set by the host. 0 disables.
+uint16_t can_tx_hp_id_limit[CAN_QUEUES_ARRAY_SIZE] = {0U, 0U, 0U};
 
 // ********************* interrupt safe queue *********************
-bool can_pop(can_ring *q, CANPacket_t *elem) {
+CAN_FAST_CODE bool can_pop(can_ring *q, CANPacket_t *elem) {
   bool ret = 0;
 
   ENTER_CRITICAL();
@@ -60,7 +72,7 @@ bool can_pop(can_ring *q, CANPacket_t *elem) {
   return ret;
 }
 
-bool can_push(can_ring *q, const CANPacket_t *elem) {
+CAN_FAST_CODE bool can_push(can_ring *q, const CANPacket_t *elem) {
   bool ret = false;
   uint32_t next_w_ptr;
 
@@ -119,6 +131,21 @@ void can_clear(can_ring *q) {
   refresh_can_tx_slots_available();
 }
 
+void can_tx_clear(uint8_t bus_number) {
+  can_clear(can_hp_queues[bus_number]);
+  can_clear(can_queues[bus_number]);
+}
+
+// the hardware only holds one TX frame, so a high priority frame
+// waits for at most one frame already on the wire
+CAN_FAST_CODE bool can_tx_pop(uint8_t bus_number, CANPacket_t *to_send) {
+  bool ret = can_pop(can_hp_queues[bus_number], to_send);
+  if (!ret) {
+    ret = can_pop(can_queues[bus_number], to_send);
+  }
+  return ret;
+}
+
 // assign CAN numbering
 // bus num: CAN Bus numbers in panda, sent to/from USB
 //    Min: 0; Max: 127; Bit 7 marks message as receipt (bus 129 is receipt for but 1)
@@ -142,7 +169,7 @@ void can_init_all(void) {
     if (!current_board->has_canfd) {
       bus_config[i].can_data_speed = 0U;
     }
-    can_clear(can_queues[i]);
+    can_tx_clear(i);
     (void)can_init(i);
   }
 }
@@ -207,13 +234,19 @@ void ignition_can_hook(CANPacket_t *to_push) {
 }
 
 bool can_tx_check_min_slots_free(uint32_t min) {
+  // host frames can go to either queue. A high priority ring is smaller than a
+  // bulk transfer, so it has to be empty and the host splits its transfers
+  uint32_t hp_min = MIN(min, CAN_TX_HP_BUFFER_SIZE - 1U);
   return
     (can_slots_empty(&can_tx1_q) >= min) &&
     (can_slots_empty(&can_tx2_q) >= min) &&
-    (can_slots_empty(&can_tx3_q) >= min);
+    (can_slots_empty(&can_tx3_q) >= min) &&
+    (can_slots_empty(&can_tx1_hp_q) >= hp_min) &&
+    (can_slots_empty(&can_tx2_hp_q) >= hp_min) &&
+    (can_slots_empty(&can_tx3_hp_q) >= hp_min);
 }
 
-uint8_t calculate_checksum(const uint8_t *dat, uint32_t len) {
+CAN_FAST_CODE uint8_t calculate_checksum(const uint8_t *dat, uint32_t len) {
   uint8_t checksum = 0U;
   for (uint32_t i = 0U; i < len; i++) {
     checksum ^= dat[i];
@@ -221,20 +254,38 @@ uint8_t calculate_checksum(const uint8_t *dat, uint32_t len) {
   return checksum;
 }
 
-void can_set_checksum(CANPacket_t *packet) {
+CAN_FAST_CODE void can_set_checksum(CANPacket_t *packet) {
   packet->checksum = 0U;
   packet->checksum = calculate_checksum((uint8_t *) packet, CANPACKET_HEAD_SIZE + GET_LEN(packet));
 }
 
-bool can_check_checksum(CANPacket_t *packet) {
+CAN_FAST_CODE bool can_check_checksum(CANPacket_t *packet) {
   return (calculate_checksum((uint8_t *) packet, CANPACKET_HEAD_SIZE + GET_LEN(packet)) == 0U);
 }
 
-void can_send(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook) {
+CAN_FAST_CODE uint8_t can_tx_prio(const CANPacket_t *to_send, uint8_t bus_number) {
+  uint8_t prio = CAN_TX_PRIO_NORMAL;
+  if (bus_number < PANDA_BUS_CNT) {
+    uint32_t arb_id = (to_send->extended != 0U) ? (to_send->addr >> 18) : to_send->addr;
+    if (arb_id < can_tx_hp_id_limit[bus_number]) {
+      prio = CAN_TX_PRIO_HIGH;
+    }
+  }
+  return prio;
+}
+
+CAN_FAST_CODE void can_send(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook) {
+  can_send_prio(to_push, bus_number, skip_tx_hook, can_tx_prio(to_push, bus_number));
+}
+
+CAN_FAST_CODE void can_send_prio(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook, uint8_t prio) {
   if (skip_tx_hook || safety_tx_hook(to_push) != 0) {
     if (bus_number < PANDA_BUS_CNT) {
-      // add CAN packet to send queue
-      tx_buffer_overflow += can_push(can_queues[bus_number], to_push) ? 0U : 1U;
+      // add CAN packet to send queue. A full high priority queue drops the
+      // frame rather than spilling into the normal one, where it could
+      // leave after later frames with the same ID.
+      can_ring *q = (prio == CAN_TX_PRIO_HIGH) ? can_hp_queues[bus_number] : can_queues[bus_number];
+      tx_buffer_overflow += can_push(q, to_push) ? 0U : 1U;
       process_can(CAN_NUM_FROM_BUS_NUM(bus_number));
     }
   } else {
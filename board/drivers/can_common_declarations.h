@@ -46,6 +46,12 @@ void process_can(uint8_t can_number);
 // ********************* instantiate queues *********************
 #define CAN_QUEUES_ARRAY_SIZE 3
 extern can_ring *can_queues[CAN_QUEUES_ARRAY_SIZE];
+// drained before can_queues, see can_tx_prio
+extern can_ring *can_hp_queues[CAN_QUEUES_ARRAY_SIZE];
+extern uint16_t can_tx_hp_id_limit[CAN_QUEUES_ARRAY_SIZE];
+
+#define CAN_TX_PRIO_HIGH 0U
+#define CAN_TX_PRIO_NORMAL 1U
 
 // helpers
 #define WORD_TO_BYTE_ARRAY(dst8, src32) 0[dst8] = ((src32) & 0xFFU); 1[dst8] = (((src32) >> 8U) & 0xFFU); 2[dst8] = (((src32) >> 16U) & 0xFFU); 3[dst8] = (((src32) >> 24U) & 0xFFU)
@@ -85,4 +91,8 @@ uint8_t calculate_checksum(const uint8_t *dat, uint32_t len);
 void can_set_checksum(CANPacket_t *packet);
 bool can_check_checksum(CANPacket_t *packet);
 void can_send(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook);
+void can_send_prio(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook, uint8_t prio);
+uint8_t can_tx_prio(const CANPacket_t *to_send, uint8_t bus_number);
+bool can_tx_pop(uint8_t bus_number, CANPacket_t *to_send);
+void can_tx_clear(uint8_t bus_number);
 bool is_speed_valid(uint32_t speed, const uint32_t *all_speeds, uint8_t len);
@@ -84,7 +84,7 @@ void update_can_health_pkt(uint8_t can_number, uint32_t ir_reg) {
 
 // ***************************** CAN *****************************
 // FDFDCANx_IT1 IRQ Handler (TX)
-void process_can(uint8_t can_number) {
+CAN_FAST_CODE void process_can(uint8_t can_number) {
   if (can_number != 0xffU) {
     ENTER_CRITICAL();
 
@@ -94,8 +94,9 @@ void process_can(uint8_t can_number) {
     FDCANx->IR |= FDCAN_IR_TFE; // Clear Tx FIFO Empty flag
 
     if ((FDCANx->TXFQS & FDCAN_TXFQS_TFQF) == 0U) {
+      uint32_t bench_start = can_bench_start();
       CANPacket_t to_send;
-      if (can_pop(can_queues[bus_number], &to_send)) {
+      if (can_tx_pop(bus_number, &to_send)) {
         if (can_check_checksum(&to_send)) {
           can_health[can_number].total_tx_cnt += 1U;
 
@@ -121,7 +122,8 @@ void process_can(uint8_t can_number) {
             BYTE_ARRAY_TO_WORD(fifo->data_word[i], &to_send.data[i*4U]);
           }
 
-          FDCANx->TXBAR = (1UL << tx_index);
+          llcan_tx_request(FDCANx, tx_index);
+          TRACE(TRACE_EV_CAN_TX, bus_number, to_send.addr);
 
           // Send back to USB
           CANPacket_t to_push;
@@ -137,6 +139,7 @@ void process_can(uint8_t can_number) {
           can_set_checksum(&to_push);
 
           rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+          can_bench_end(CAN_BENCH_TX, bench_start);
         } else {
           can_health[can_number].total_tx_checksum_error_cnt += 1U;
         }
@@ -150,7 +153,7 @@ void process_can(uint8_t can_number) {
 
 // FDFDCANx_IT0 IRQ Handler (RX and errors)
 // blink blue when we are receiving CAN messages
-void can_rx(uint8_t can_number) {
+CAN_FAST_CODE void can_rx(uint8_t can_number) {
   FDCAN_GlobalTypeDef *FDCANx = CANIF_FROM_CAN_NUM(can_number);
   uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
 
@@ -159,6 +162,7 @@ void can_rx(uint8_t can_number) {
   // Clear all new messages from Rx FIFO 0
   FDCANx->IR |= FDCAN_IR_RF0N;
   while((FDCANx->RXF0S & FDCAN_RXF0S_F0FL) != 0U) {
+    uint32_t bench_start = can_bench_start();
     can_health[can_number].total_rx_cnt += 1U;
 
     // can is live
@@ -218,13 +222,26 @@ void can_rx(uint8_t can_number) {
 
       can_send(&to_send, bus_fwd_num, true);
       can_health[can_number].total_fwd_cnt += 1U;
+      TRACE(TRACE_EV_CAN_FWD, bus_fwd_num, to_send.addr);
     }
 
-    safety_rx_invalid += safety_rx_hook(&to_push) ? 0U : 1U;
+    bool rx_valid = safety_rx_hook(&to_push);
+    safety_rx_invalid += rx_valid ? 0U : 1U;
     ignition_can_hook(&to_push);
+    isotp_rx_hook(&to_push);
+    can_cache_rx(&to_push);
 
     led_set(LED_BLUE, true);
-    rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    TRACE(TRACE_EV_CAN_RX, bus_number, to_push.addr);
+    bool rx_delivered = true;
+    if (can_filter_check(&to_push)) {
+      if (!can_push(&can_rx_q, &to_push)) {
+        rx_delivered = false;
+        rx_buffer_overflow += 1U;
+        TRACE(TRACE_EV_CAN_RX_OVERFLOW, bus_number, to_push.addr);
+      }
+    }
+    can_stats_rx(&to_push, rx_valid, rx_delivered);
 
     // Enable CAN FD and BRS if CAN FD message was received
     if (!(bus_config[can_number].canfd_enabled) && (canfd_frame)) {
@@ -235,7 +252,8 @@ void can_rx(uint8_t can_number) {
     }
 
     // update read index
-    FDCANx->RXF0A = rx_fifo_idx;
+    llcan_rx_ack(FDCANx, rx_fifo_idx);
+    can_bench_end((bus_fwd_num != -1) ? CAN_BENCH_FWD : CAN_BENCH_RX, bench_start);
   }
 
   // Error handling
@@ -244,14 +262,14 @@ void can_rx(uint8_t can_number) {
   }
 }
 
-static void FDCAN1_IT0_IRQ_Handler(void) { can_rx(0); }
-static void FDCAN1_IT1_IRQ_Handler(void) { process_can(0); }
+CAN_FAST_CODE static void FDCAN1_IT0_IRQ_Handler(void) { can_rx(0); }
+CAN_FAST_CODE static void FDCAN1_IT1_IRQ_Handler(void) { process_can(0); }
 
-static void FDCAN2_IT0_IRQ_Handler(void) { can_rx(1); }
-static void FDCAN2_IT1_IRQ_Handler(void) { process_can(1); }
+CAN_FAST_CODE static void FDCAN2_IT0_IRQ_Handler(void) { can_rx(1); }
+CAN_FAST_CODE static void FDCAN2_IT1_IRQ_Handler(void) { process_can(1); }
 
-static void FDCAN3_IT0_IRQ_Handler(void) { can_rx(2);  }
-static void FDCAN3_IT1_IRQ_Handler(void) { process_can(2); }
+CAN_FAST_CODE static void FDCAN3_IT0_IRQ_Handler(void) { can_rx(2);  }
+CAN_FAST_CODE static void FDCAN3_IT1_IRQ_Handler(void) { process_can(2); }
 
 bool can_init(uint8_t can_number) {
   bool ret = false;
@@ -267,6 +285,7 @@ bool can_init(uint8_t can_number) {
     FDCAN_GlobalTypeDef *FDCANx = CANIF_FROM_CAN_NUM(can_number);
     ret &= can_set_speed(can_number);
     ret &= llcan_init(FDCANx);
+    TRACE(TRACE_EV_CAN_INIT, can_number, ret);
     // in case there are queued up messages
     process_can(can_number);
   }
@@ -2,6 +2,12 @@
 
 struct harness_t harness;
 
+static void harness_set_sbu_analog(bool analog) {
+  uint8_t mode = analog ? MODE_ANALOG : MODE_INPUT;
+  set_gpio_mode(current_board->harness_config->GPIO_SBU1, current_board->harness_config->pin_SBU1, mode);
+  set_gpio_mode(current_board->harness_config->GPIO_SBU2, current_board->harness_config->pin_SBU2, mode);
+}
+
 // The ignition relay is only used for testing purposes
 void set_intercept_relay(bool intercept, bool ignition_relay) {
   if (current_board->harness_config->has_harness) {
@@ -11,12 +17,18 @@ void set_intercept_relay(bool intercept, bool ignition_relay) {
       drive_relay = false;
     }
 
+    // masked so the tick can't start an SBU sample in between
+    ENTER_CRITICAL();
     if (drive_relay || ignition_relay) {
       harness.relay_driven = true;
     }
 
-    // wait until we're not reading the analog voltages anymore
-    while (harness.sbu_adc_lock) {}
+    // an SBU sample taken across a relay change is discarded. Pins are not
+    // 5V tolerant in ADC mode, so an in-flight sample gives them back first
+    harness.sbu_sample_valid = false;
+    if (harness.sbu_sampling) {
+      harness_set_sbu_analog(false);
+    }
 
     if (harness.status == HARNESS_STATUS_NORMAL) {
       set_gpio_output(current_board->harness_config->GPIO_relay_SBU1, current_board->harness_config->pin_relay_SBU1, !ignition_relay);
@@ -29,60 +41,85 @@ void set_intercept_relay(bool intercept, bool ignition_relay) {
     if (!(drive_relay || ignition_relay)) {
       harness.relay_driven = false;
     }
+    EXIT_CRITICAL();
   }
 }
 
 bool harness_check_ignition(void) {
-  bool ret = false;
-
-  // wait until we're not reading the analog voltages anymore
-  while (harness.sbu_adc_lock) {}
-
-  switch(harness.status){
-    case HARNESS_STATUS_NORMAL:
-      ret = !get_gpio_input(current_board->harness_config->GPIO_SBU1, current_board->harness_config->pin_SBU1);
-      break;
-    case HARNESS_STATUS_FLIPPED:
-      ret = !get_gpio_input(current_board->harness_config->GPIO_SBU2, current_board->harness_config->pin_SBU2);
-      break;
-    default:
-      break;
+  static bool ret = false;
+
+  // the SBU pins don't read as inputs while they're being sampled, keep the last value
+  if (!harness.sbu_sampling) {
+    switch(harness.status){
+      case HARNESS_STATUS_NORMAL:
+        ret = !get_gpio_input(current_board->harness_config->GPIO_SBU1, current_board->harness_config->pin_SBU1);
+        break;
+      case HARNESS_STATUS_FLIPPED:
+        ret = !get_gpio_input(current_board->harness_config->GPIO_SBU2, current_board->harness_config->pin_SBU2);
+        break;
+      default:
+        ret = false;
+        break;
+    }
   }
   return ret;
 }
 
+static uint8_t harness_orientation_from_sbu(void) {
+  uint8_t ret;
+  uint16_t detection_threshold = current_board->avdd_mV / 2U;
+
+  // Detect connection and orientation
+  if((harness.sbu1_voltage_mV < detection_threshold) || (harness.sbu2_voltage_mV < detection_threshold)){
+    if (harness.sbu1_voltage_mV < harness.sbu2_voltage_mV) {
+      // orientation flipped (PANDA_SBU1->HARNESS_SBU1(relay), PANDA_SBU2->HARNESS_SBU2(ign))
+      ret = HARNESS_STATUS_FLIPPED;
+    } else {
+      // orientation normal (PANDA_SBU2->HARNESS_SBU1(relay), PANDA_SBU1->HARNESS_SBU2(ign))
+      // (SBU1->SBU2 is the normal orientation connection per USB-C cable spec)
+      ret = HARNESS_STATUS_NORMAL;
+    }
+  } else {
+    ret = HARNESS_STATUS_NC;
+  }
+  return ret;
+}
+
+#ifndef BOOTSTUB
+// runs from the ADC DMA interrupt right after conversion
+static void harness_sbu_sampled(uint16_t sbu1_mV, uint16_t sbu2_mV) {
+  // Pins are not 5V tolerant in ADC mode
+  harness_set_sbu_analog(false);
+  if (harness.sbu_sample_valid && !harness.relay_driven) {
+    harness.sbu1_voltage_mV = sbu1_mV;
+    harness.sbu2_voltage_mV = sbu2_mV;
+    harness.sbu_sample_ready = true;
+  }
+  harness.sbu_sampling = false;
+}
+#endif
+
+// uses the SBU sample from the previous tick and requests the next one
 static uint8_t harness_detect_orientation(void) {
   uint8_t ret = harness.status;
 
   #ifndef BOOTSTUB
   // We can't detect orientation if the relay is being driven
   if (!harness.relay_driven && current_board->harness_config->has_harness) {
-    harness.sbu_adc_lock = true;
-    set_gpio_mode(current_board->harness_config->GPIO_SBU1, current_board->harness_config->pin_SBU1, MODE_ANALOG);
-    set_gpio_mode(current_board->harness_config->GPIO_SBU2, current_board->harness_config->pin_SBU2, MODE_ANALOG);
-
-    harness.sbu1_voltage_mV = adc_get_mV(current_board->harness_config->adc_channel_SBU1);
-    harness.sbu2_voltage_mV = adc_get_mV(current_board->harness_config->adc_channel_SBU2);
-    uint16_t detection_threshold = current_board->avdd_mV / 2U;
-
-    // Detect connection and orientation
-    if((harness.sbu1_voltage_mV < detection_threshold) || (harness.sbu2_voltage_mV < detection_threshold)){
-      if (harness.sbu1_voltage_mV < harness.sbu2_voltage_mV) {
-        // orientation flipped (PANDA_SBU1->HARNESS_SBU1(relay), PANDA_SBU2->HARNESS_SBU2(ign))
-        ret = HARNESS_STATUS_FLIPPED;
-      } else {
-        // orientation normal (PANDA_SBU2->HARNESS_SBU1(relay), PANDA_SBU1->HARNESS_SBU2(ign))
-        // (SBU1->SBU2 is the normal orientation connection per USB-C cable spec)
-        ret = HARNESS_STATUS_NORMAL;
-      }
-    } else {
-      ret = HARNESS_STATUS_NC;
+    if (harness.sbu_sample_ready) {
+      harness.sbu_sample_ready = false;
+      ret = harness_orientation_from_sbu();
     }
 
-    // Pins are not 5V tolerant in ADC mode
-    set_gpio_mode(current_board->harness_config->GPIO_SBU1, current_board->harness_config->pin_SBU1, MODE_INPUT);
-    set_gpio_mode(current_board->harness_config->GPIO_SBU2, current_board->harness_config->pin_SBU2, MODE_INPUT);
-    harness.sbu_adc_lock = false;
+    if (!harness.sbu_sampling) {
+      harness.sbu_sampling = true;
+      harness.sbu_sample_valid = true;
+      harness_set_sbu_analog(true);
+      if (!adc_sample_once(current_board->harness_config->adc_channel_SBU1, current_board->harness_config->adc_channel_SBU2, harness_sbu_sampled)) {
+        harness_set_sbu_analog(false);
+        harness.sbu_sampling = false;
+      }
+    }
   }
   #endif
 
@@ -100,8 +137,12 @@ void harness_init(void) {
   set_gpio_output(current_board->harness_config->GPIO_relay_SBU1, current_board->harness_config->pin_relay_SBU1, 1);
   set_gpio_output(current_board->harness_config->GPIO_relay_SBU2, current_board->harness_config->pin_relay_SBU2, 1);
 
-  // detect initial orientation
-  harness.status = harness_detect_orientation();
+  // detect initial orientation, before the background ADC scan runs
+  harness_set_sbu_analog(true);
+  harness.sbu1_voltage_mV = adc_raw_to_mV(adc_read_raw(current_board->harness_config->adc_channel_SBU1));
+  harness.sbu2_voltage_mV = adc_raw_to_mV(adc_read_raw(current_board->harness_config->adc_channel_SBU2));
+  harness_set_sbu_analog(false);
+  harness.status = harness_orientation_from_sbu();
 
   // keep buses connected by default
   set_intercept_relay(false, false);
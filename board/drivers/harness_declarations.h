@@ -9,7 +9,9 @@ struct harness_t {
   uint16_t sbu1_voltage_mV;
   uint16_t sbu2_voltage_mV;
   bool relay_driven;
-  bool sbu_adc_lock;
+  bool sbu_sampling;
+  bool sbu_sample_valid;
+  bool sbu_sample_ready;
 };
 extern struct harness_t harness;
 
@@ -1,12 +1,22 @@
 #include "registers_declarations.h"
 
-static reg register_map[REGISTER_MAP_SIZE];
+SRAM12_DATA static reg register_map[REGISTER_MAP_SIZE];
+static uint16_t register_map_len = 0U;
+static uint16_t register_check_idx = 0U;
 
-// Hash spread in first and second iterations seems to be reasonable.
-// See: tests/development/register_hashmap_spread.py
-// Also, check the collision warnings in the debug output, and minimize those.
-static uint16_t hash_addr(uint32_t input){
-  return (((input >> 16U) ^ ((((input + 1U) & 0xFFFFU) * HASHING_PRIME) & 0xFFFFU)) & REGISTER_MAP_SIZE);
+// Index of addr in the map, or where it would be inserted
+static uint16_t register_find(volatile uint32_t *addr) {
+  uint16_t lo = 0U;
+  uint16_t hi = register_map_len;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2U;
+    if ((uint32_t)register_map[mid].address < (uint32_t)addr) {
+      lo = mid + 1U;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
 }
 
 // Do not put bits in the check mask that get changed by the hardware
@@ -16,17 +26,27 @@ void register_set(volatile uint32_t *addr, uint32_t val, uint32_t mask){
   (*addr) = ((*addr) & (~mask)) | (val & mask);
 
   // Add these values to the map
-  uint16_t hash = hash_addr((uint32_t) addr);
-  uint16_t tries = REGISTER_MAP_SIZE;
-  while(CHECK_COLLISION(hash, addr) && (tries > 0U)) { hash = hash_addr((uint32_t) hash); tries--;}
-  if (tries != 0U){
-    register_map[hash].address = addr;
-    register_map[hash].value = (register_map[hash].value & (~mask)) | (val & mask);
-    register_map[hash].check_mask |= mask;
-  } else {
-    #ifdef DEBUG_FAULTS
-      print("Hash collision: address 0x"); puth((uint32_t) addr); print("!\n");
-    #endif
+  uint16_t i = register_find(addr);
+  if ((i >= register_map_len) || (register_map[i].address != addr)) {
+    if (register_map_len < REGISTER_MAP_SIZE) {
+      for (uint16_t j = register_map_len; j > i; j--) {
+        register_map[j] = register_map[j - 1U];
+      }
+      register_map[i].address = addr;
+      register_map[i].value = 0U;
+      register_map[i].check_mask = 0U;
+      register_map[i].logged_fault = false;
+      register_map_len++;
+    } else {
+      i = REGISTER_MAP_SIZE;
+      #ifdef DEBUG_FAULTS
+        print("Register map full: address 0x"); puth((uint32_t) addr); print("!\n");
+      #endif
+    }
+  }
+  if (i < REGISTER_MAP_SIZE) {
+    register_map[i].value = (register_map[i].value & (~mask)) | (val & mask);
+    register_map[i].check_mask |= mask;
   }
   EXIT_CRITICAL()
 }
@@ -43,26 +63,30 @@ void register_clear_bits(volatile uint32_t *addr, uint32_t val) {
   register_set(addr, (~val), val);
 }
 
-// To be called periodically
+// To be called periodically. Each call checks a bounded slice of the map,
+// so the time spent here does not grow with the number of registers.
 void check_registers(void){
-  for(uint16_t i=0U; i<REGISTER_MAP_SIZE; i++){
-    if((uint32_t) register_map[i].address != 0U){
-      ENTER_CRITICAL()
-      if((*(register_map[i].address) & register_map[i].check_mask) != (register_map[i].value & register_map[i].check_mask)){
-        if(!register_map[i].logged_fault){
-          print("Register 0x"); puth((uint32_t) register_map[i].address); print(" divergent! Map: 0x"); puth(register_map[i].value); print(" Reg: 0x"); puth(*(register_map[i].address)); print("\n");
-          register_map[i].logged_fault = true;
+  for (uint16_t n = 0U; n < REGISTER_CHECK_SLICE; n++) {
+    ENTER_CRITICAL()
+    if (register_check_idx >= register_map_len) {
+      register_check_idx = 0U;
+    }
+    if (register_map_len > 0U) {
+      reg *r = &register_map[register_check_idx];
+      if ((*(r->address) & r->check_mask) != (r->value & r->check_mask)) {
+        if (!r->logged_fault) {
+          print("Register 0x"); puth((uint32_t) r->address); print(" divergent! Map: 0x"); puth(r->value); print(" Reg: 0x"); puth(*(r->address)); print("\n");
+          r->logged_fault = true;
         }
         fault_occurred(FAULT_REGISTER_DIVERGENT);
       }
-      EXIT_CRITICAL()
+      register_check_idx++;
     }
+    EXIT_CRITICAL()
   }
 }
 
 void init_registers(void) {
-  for(uint16_t i=0U; i<REGISTER_MAP_SIZE; i++){
-    register_map[i].address = (volatile uint32_t *) 0U;
-    register_map[i].check_mask = 0U;
-  }
+  register_map_len = 0U;
+  register_check_idx = 0U;
 }
@@ -7,10 +7,10 @@ typedef struct reg {
   bool logged_fault;
 } reg;
 
-// 10 bit hash with 23 as a prime
-#define REGISTER_MAP_SIZE 0x3FFU
-#define HASHING_PRIME 23U
-#define CHECK_COLLISION(hash, addr) (((uint32_t) register_map[hash].address != 0U) && (register_map[hash].address != (addr)))
+// Sorted by address, looked up by binary search
+#define REGISTER_MAP_SIZE 0x180U
+// Entries verified per check_registers() call
+#define REGISTER_CHECK_SLICE 32U
 
 // Do not put bits in the check mask that get changed by the hardware
 void register_set(volatile uint32_t *addr, uint32_t val, uint32_t mask);
@@ -20,6 +20,6 @@ void register_set_bits(volatile uint32_t *addr, uint32_t val);
 // Clear individual bits. Also add them to the check_mask.
 // Do not use this to clear bits that get set by the hardware
 void register_clear_bits(volatile uint32_t *addr, uint32_t val);
-// To be called periodically
+// To be called periodically, checks the next REGISTER_CHECK_SLICE entries
 void check_registers(void);
 void init_registers(void);
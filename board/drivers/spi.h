@@ -119,6 +119,7 @@ void spi_rx_done(void) {
     // We got everything! Based on the endpoint specified, call the appropriate handler
     bool response_ack = false;
     checksum_valid = validate_checksum(&(spi_buf_rx[SPI_HEADER_SIZE]), spi_data_len_mosi + 1U);
+    TRACE(TRACE_EV_SPI_RX, spi_endpoint, spi_data_len_mosi);
     if (checksum_valid) {
       if (spi_endpoint == 0U) {
         if (spi_data_len_mosi >= sizeof(ControlPacket_t)) {
@@ -137,8 +138,12 @@ void spi_rx_done(void) {
           print("SPI: did not expect data for can_read\n");
         }
       } else if (spi_endpoint == 2U) {
-        comms_endpoint2_write(&spi_buf_rx[SPI_HEADER_SIZE], spi_data_len_mosi);
-        response_ack = true;
+        if ((spi_data_len_mosi == 0U) || comms_endpoint2_ready(spi_buf_rx[SPI_HEADER_SIZE], spi_data_len_mosi)) {
+          comms_endpoint2_write(&spi_buf_rx[SPI_HEADER_SIZE], spi_data_len_mosi);
+          response_ack = true;
+        } else {
+          response_ack = false;
+        }
       } else if (spi_endpoint == 3U) {
         if (spi_data_len_mosi > 0U) {
           if (spi_can_tx_ready) {
@@ -152,6 +157,30 @@ void spi_rx_done(void) {
         } else {
           print("SPI: did expect data for can_write\n");
         }
+      } else if (spi_endpoint == TRACE_SPI_ENDPOINT) {
+        if (spi_data_len_mosi == 0U) {
+          response_len = trace_read(&(spi_buf_tx[3]), MIN(spi_data_len_miso, SPI_BUF_SIZE - 4U));
+          response_ack = true;
+        } else {
+          print("SPI: did not expect data for trace_read\n");
+        }
+      } else if (spi_endpoint == PLAYBACK_SPI_ENDPOINT) {
+        comms_playback_write(&spi_buf_rx[SPI_HEADER_SIZE], spi_data_len_mosi);
+        response_ack = true;
+      } else if (spi_endpoint == CAN_STATS_SPI_ENDPOINT) {
+        if (spi_data_len_mosi == 0U) {
+          response_len = comms_can_stats_read(&(spi_buf_tx[3]), MIN(spi_data_len_miso, SPI_BUF_SIZE - 4U));
+          response_ack = true;
+        } else {
+          print("SPI: did not expect data for can_stats_read\n");
+        }
+      } else if (spi_endpoint == CAN_CACHE_SPI_ENDPOINT) {
+        if (spi_data_len_mosi == 0U) {
+          response_len = comms_can_cache_read(&(spi_buf_tx[3]), MIN(spi_data_len_miso, SPI_BUF_SIZE - 4U));
+          response_ack = true;
+        } else {
+          print("SPI: did not expect data for can_cache_read\n");
+        }
       } else if (spi_endpoint == 0xABU) {
         // test endpoint, send max response length
         response_len = spi_data_len_miso;
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+  Correction of the microsecond timer into a timebase shared by several
+  pandas, estimated by the host (python/timesync.py):
+
+    synced = local + offset + skew * (local - ref)
+
+  with skew in units of 2^-32. The host samples both clocks with control
+  0xb3, stages ref (0xb4) and offset (0xb5), then applies them with the
+  skew (0xb6). Events keep raw timer values and are corrected when they
+  are exported (trace, CAN stats and CAN cache), so each read uses the
+  latest estimate. A correction is valid for about half a timer wrap,
+  35 minutes, around its ref.
+
+  Readers run in any context and copy the correction under a seqlock:
+  time_sync_apply makes the sequence odd while it writes, with interrupts
+  masked, and a reader that it preempted retries its copy.
+*/
+
+#define TIME_SYNC_READ_TRIES 4U
+
+typedef struct {
+  uint32_t ref;
+  uint32_t offset;
+  int32_t skew;
+} time_sync_t;
+
+static time_sync_t time_sync;
+static volatile uint32_t time_sync_seq = 0U;  // odd while time_sync is written
+static time_sync_t time_sync_staged;
+
+uint32_t time_sync_correct(uint32_t local) {
+  time_sync_t c;
+  bool ok = false;
+  for (uint32_t i = 0U; (i < TIME_SYNC_READ_TRIES) && !ok; i++) {
+    uint32_t seq = time_sync_seq;
+    __DMB();
+    c = time_sync;
+    __DMB();
+    ok = ((seq & 1U) == 0U) && (seq == time_sync_seq);
+  }
+
+  // the host keeps applying, block it for one copy
+  if (!ok) {
+    ENTER_CRITICAL();
+    c = time_sync;
+    EXIT_CRITICAL();
+  }
+
+  int32_t dt = (int32_t)(local - c.ref);
+  int32_t adj = (int32_t)(((int64_t)dt * c.skew) / 4294967296LL);
+  return local + c.offset + (uint32_t)adj;
+}
+
+uint32_t synced_time_get(void) {
+  return time_sync_correct(microsecond_timer_get());
+}
+
+void time_sync_stage(bool offset, uint32_t value) {
+  if (offset) {
+    time_sync_staged.offset = value;
+  } else {
+    time_sync_staged.ref = value;
+  }
+}
+
+void time_sync_apply(int32_t skew) {
+  ENTER_CRITICAL();
+  time_sync_seq += 1U;
+  __DMB();
+  time_sync = time_sync_staged;
+  time_sync.skew = skew;
+  __DMB();
+  time_sync_seq += 1U;
+  EXIT_CRITICAL();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "trace_declarations.h"
+
+#if defined(ENABLE_TRACE) && !defined(BOOTSTUB)
+static trace_event_t trace_buf[TRACE_BUF_SIZE];
+// start one lap in, so the zeroed seq of an unwritten slot never matches
+static uint32_t trace_w_ptr = TRACE_BUF_SIZE;
+static uint32_t trace_r_ptr = TRACE_BUF_SIZE;
+
+// Safe to call from any context. The slot is reserved with a single atomic
+// increment, so nested ISRs never share a slot and nothing is masked.
+// While the event is written its seq is off the slot, see trace_read.
+void trace_event(uint16_t id, uint32_t arg0, uint32_t arg1) {
+  uint32_t idx = __atomic_fetch_add(&trace_w_ptr, 1U, __ATOMIC_RELAXED);
+  trace_event_t *ev = &trace_buf[idx & TRACE_BUF_MASK];
+  __atomic_store_n(&ev->seq, (uint16_t)((idx - 1U) & 0xFFFFU), __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  ev->ts = microsecond_timer_get();
+  ev->id = id;
+  ev->arg0 = arg0;
+  ev->arg1 = arg1;
+  __atomic_store_n(&ev->seq, (uint16_t)(idx & 0xFFFFU), __ATOMIC_RELEASE);
+}
+
+// Copies out as many whole events as fit. When the writers lapped the reader,
+// the oldest events are skipped; the host sees the gap in seq.
+// An event is only copied once its seq matches the read index. A writer
+// preempted by this read leaves its slot behind, the read stops there and
+// the next one picks it up.
+uint32_t trace_read(uint8_t *data, uint32_t max_len) {
+  uint32_t pos = 0U;
+
+  ENTER_CRITICAL();
+  uint32_t w_ptr = __atomic_load_n(&trace_w_ptr, __ATOMIC_ACQUIRE);
+  if ((w_ptr - trace_r_ptr) > TRACE_BUF_SIZE) {
+    trace_r_ptr = w_ptr - TRACE_BUF_SIZE;
+  }
+  while ((trace_r_ptr != w_ptr) && ((pos + sizeof(trace_event_t)) <= max_len)) {
+    const trace_event_t *slot = &trace_buf[trace_r_ptr & TRACE_BUF_MASK];
+    uint16_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    int16_t ahead = (int16_t)(uint16_t)(seq - (uint16_t)(trace_r_ptr & 0xFFFFU));
+    if (ahead != 0) {
+      if (((seq & TRACE_BUF_MASK) == (trace_r_ptr & TRACE_BUF_MASK)) && (ahead > 0)) {
+        // rewritten by a later lap
+        trace_r_ptr += 1U;
+        continue;
+      }
+      // being written, or reserved and not written yet
+      break;
+    }
+    trace_event_t ev = *slot;
+    ev.ts = time_sync_correct(ev.ts);
+    (void)memcpy(&data[pos], &ev, sizeof(trace_event_t));
+    pos += sizeof(trace_event_t);
+    trace_r_ptr += 1U;
+  }
+  EXIT_CRITICAL();
+
+  return pos;
+}
+
+void trace_clear(void) {
+  ENTER_CRITICAL();
+  trace_r_ptr = __atomic_load_n(&trace_w_ptr, __ATOMIC_ACQUIRE);
+  EXIT_CRITICAL();
+}
+#else
+void trace_event(uint16_t id, uint32_t arg0, uint32_t arg1) {
+  UNUSED(id);
+  UNUSED(arg0);
+  UNUSED(arg1);
+}
+
+uint32_t trace_read(uint8_t *data, uint32_t max_len) {
+  UNUSED(data);
+  UNUSED(max_len);
+  return 0U;
+}
+
+void trace_clear(void) {}
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+// ******************** Event trace ********************
+// Fixed-size binary events are written lock-free into a RAM ring
+// and drained by the host (control 0xa9 or SPI endpoint 4).
+
+typedef struct __attribute__((packed)) {
+  uint32_t ts;    // microsecond timer, corrected when read, see time_sync.h
+  uint16_t seq;   // low bits of the write index, written last
+  uint16_t id;
+  uint32_t arg0;
+  uint32_t arg1;
+} trace_event_t;
+
+// must be a power of two
+#define TRACE_BUF_SIZE 1024U
+#define TRACE_BUF_MASK (TRACE_BUF_SIZE - 1U)
+#define TRACE_SPI_ENDPOINT 4U
+
+// event ids, keep in sync with python/trace.py
+#define TRACE_EV_CAN_RX 1U        // bus, addr
+#define TRACE_EV_CAN_TX 2U        // bus, addr
+#define TRACE_EV_CAN_FWD 3U       // dst bus, addr
+#define TRACE_EV_CAN_RX_OVERFLOW 4U // bus, addr
+#define TRACE_EV_CAN_INIT 5U      // can number, ok
+#define TRACE_EV_SPI_RX 6U        // endpoint, mosi len
+#define TRACE_EV_SAFETY_MODE 7U   // mode, param
+#define TRACE_EV_CONTROL 8U       // request, param1
+#define TRACE_EV_HEARTBEAT_LOST 9U // heartbeat counter, safety mode
+
+#if defined(ENABLE_TRACE) && !defined(BOOTSTUB)
+  #define TRACE(id, arg0, arg1) trace_event((id), (uint32_t)(arg0), (uint32_t)(arg1))
+#else
+  #define TRACE(id, arg0, arg1)
+#endif
+
+void trace_event(uint16_t id, uint32_t arg0, uint32_t arg1);
+uint32_t trace_read(uint8_t *data, uint32_t max_len);
+void trace_clear(void);
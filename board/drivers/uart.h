@@ -4,9 +4,9 @@
 
 // ***************************** Definitions *****************************
 
-#define UART_BUFFER(x, size_rx, size_tx, uart_ptr, callback_ptr, overwrite_mode) \
+#define UART_BUFFER(x, size_rx, size_tx, uart_ptr, callback_ptr, overwrite_mode, tx_attr) \
   static uint8_t elems_rx_##x[size_rx]; \
-  static uint8_t elems_tx_##x[size_tx]; \
+  static uint8_t elems_tx_##x[size_tx] tx_attr; \
   extern uart_ring uart_ring_##x; \
   uart_ring uart_ring_##x = {  \
     .w_ptr_tx = 0, \
@@ -19,22 +19,26 @@
     .rx_fifo_size = (size_rx), \
     .uart = (uart_ptr), \
     .callback = (callback_ptr), \
-    .overwrite = (overwrite_mode) \
+    .overwrite = (overwrite_mode), \
+    .tx_dma_len = 0U, \
+    .dropped = 0U \
   };
 
 // ******************************** UART buffers ********************************
 
 // debug = USART2
-UART_BUFFER(debug, FIFO_SIZE_INT, FIFO_SIZE_INT, USART2, debug_ring_callback, true)
+UART_BUFFER(debug, FIFO_SIZE_INT, FIFO_SIZE_INT, USART2, debug_ring_callback, true, )
 
-// SOM debug = UART7
+// SOM debug = UART7, TX by DMA
 #ifdef STM32H7
-  UART_BUFFER(som_debug, FIFO_SIZE_INT, FIFO_SIZE_INT, UART7, NULL, true)
+  UART_BUFFER(som_debug, FIFO_SIZE_INT, FIFO_SIZE_INT, UART7, NULL, true, __attribute__((section(".sram12"))))
 #else
   // UART7 is not available on F4
-  UART_BUFFER(som_debug, 1U, 1U, NULL, NULL, true)
+  UART_BUFFER(som_debug, 1U, 1U, NULL, NULL, true, )
 #endif
 
+bool debug_log_binary = false;
+
 uart_ring *get_ring_by_number(int a) {
   uart_ring *ring = NULL;
   switch(a) {
@@ -76,12 +80,15 @@ bool injectc(uart_ring *q, char elem) {
   if ((next_w_ptr == q->r_ptr_rx) && q->overwrite) {
     // overwrite mode: drop oldest byte
     q->r_ptr_rx = (q->r_ptr_rx + 1U) % q->rx_fifo_size;
+    q->dropped += 1U;
   }
 
   if (next_w_ptr != q->r_ptr_rx) {
     q->elems_rx[q->w_ptr_rx] = elem;
     q->w_ptr_rx = next_w_ptr;
     ret = true;
+  } else {
+    q->dropped += 1U;
   }
   EXIT_CRITICAL();
 
@@ -95,15 +102,18 @@ bool put_char(uart_ring *q, char elem) {
   ENTER_CRITICAL();
   next_w_ptr = (q->w_ptr_tx + 1U) % q->tx_fifo_size;
 
-  if ((next_w_ptr == q->r_ptr_tx) && q->overwrite) {
-    // overwrite mode: drop oldest byte
+  // overwrite mode: drop oldest byte, unless DMA is still reading it
+  if ((next_w_ptr == q->r_ptr_tx) && q->overwrite && (q->tx_dma_len == 0U)) {
     q->r_ptr_tx = (q->r_ptr_tx + 1U) % q->tx_fifo_size;
+    q->dropped += 1U;
   }
 
   if (next_w_ptr != q->r_ptr_tx) {
     q->elems_tx[q->w_ptr_tx] = elem;
     q->w_ptr_tx = next_w_ptr;
     ret = true;
+  } else {
+    q->dropped += 1U;
   }
   EXIT_CRITICAL();
 
@@ -114,13 +124,18 @@ bool put_char(uart_ring *q, char elem) {
 
 void clear_uart_buff(uart_ring *q) {
   ENTER_CRITICAL();
-  q->w_ptr_tx = 0;
-  q->r_ptr_tx = 0;
+  // bytes in flight stay queued until their DMA completes
+  q->w_ptr_tx = (q->r_ptr_tx + q->tx_dma_len) % q->tx_fifo_size;
   q->w_ptr_rx = 0;
   q->r_ptr_rx = 0;
   EXIT_CRITICAL();
 }
 
+uint32_t uart_tx_free(const uart_ring *q) {
+  uint32_t used = ((q->w_ptr_tx + q->tx_fifo_size) - q->r_ptr_tx) % q->tx_fifo_size;
+  return q->tx_fifo_size - 1U - used;
+}
+
 // ************************ High-level debug functions **********************
 void putch(const char a) {
   // misra-c2012-17.7: serial debug function, ok to ignore output
@@ -129,15 +144,23 @@ void putch(const char a) {
 
 void print(const char *a) {
   for (const char *in = a; *in; in++) {
-    if (*in == '\n') putch('\r');
+    if ((*in == '\n') && !debug_log_binary) putch('\r');
     putch(*in);
   }
 }
 
 void puthx(uint32_t i, uint8_t len) {
-  const char c[] = "0123456789abcdef";
-  for (int pos = ((int)len * 4) - 4; pos > -4; pos -= 4) {
-    putch(c[(i >> (unsigned int)(pos)) & 0xFU]);
+  if (debug_log_binary) {
+    uint8_t n = (len + 1U) / 2U;
+    putch((char)(0x80U | n));
+    for (uint8_t b = 0U; b < n; b++) {
+      putch((char)((i >> (8U * b)) & 0xFFU));
+    }
+  } else {
+    const char c[] = "0123456789abcdef";
+    for (int pos = ((int)len * 4) - 4; pos > -4; pos -= 4) {
+      putch(c[(i >> (unsigned int)(pos)) & 0xFU]);
+    }
   }
 }
 
@@ -157,7 +180,7 @@ void hexdump(const void *a, int l) {
     for (int i=0; i < l; i++) {
       if ((i != 0) && ((i & 0xf) == 0)) print("\n");
       puthx(((const unsigned char*)a)[i], 2U);
-      print(" ");
+      if (!debug_log_binary) print(" ");
     }
   }
   print("\n");
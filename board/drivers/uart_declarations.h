@@ -17,8 +17,13 @@ typedef struct uart_ring {
   USART_TypeDef *uart;
   void (*callback)(struct uart_ring*);
   bool overwrite;
+  volatile uint16_t tx_dma_len; // bytes handed to TX DMA, 0 when idle
+  uint32_t dropped;             // bytes lost to a full ring
 } uart_ring;
 
+// compact debug log: numbers go out as a (0x80 | n) marker and n little endian bytes
+extern bool debug_log_binary;
+
 // ***************************** Function prototypes *****************************
 void debug_ring_callback(uart_ring *ring);
 void uart_tx_ring(uart_ring *q);
@@ -28,6 +33,7 @@ bool get_char(uart_ring *q, char *elem);
 bool injectc(uart_ring *q, char elem);
 bool put_char(uart_ring *q, char elem);
 void clear_uart_buff(uart_ring *q);
+uint32_t uart_tx_free(const uart_ring *q);
 // ************************ High-level debug functions **********************
 void putch(const char a);
 void print(const char *a);
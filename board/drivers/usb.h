@@ -7,6 +7,9 @@ static USB_Setup_TypeDef setup;
 static uint8_t* ep0_txdata = NULL;
 static uint16_t ep0_txlen = 0;
 static bool outep3_processing = false;
+static bool outep2_paused = false;
+// the next packet's port is not known before it arrives, assume the host keeps writing to the last one
+static uint8_t outep2_port = 0U;
 
 // Store the current interface alt setting.
 static int current_int0_alt_setting = 0;
@@ -591,6 +594,9 @@ void usb_irqhandler(void) {
       #endif
 
       if (endpoint == 2) {
+        if (len > 0) {
+          outep2_port = usbdata[0];
+        }
         comms_endpoint2_write((uint8_t *) usbdata, len);
       }
 
@@ -660,8 +666,13 @@ void usb_irqhandler(void) {
       #ifdef DEBUG_USB
         print("  OUT2 PACKET XFRC\n");
       #endif
-      USBx_OUTEP(2U)->DOEPTSIZ = (1UL << 19) | 0x40U;
-      USBx_OUTEP(2U)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+      // NAK kept until comms_endpoint2_resume_usb if the receiver is full
+      if (comms_endpoint2_ready(outep2_port, 0x40U)) {
+        USBx_OUTEP(2U)->DOEPTSIZ = (1UL << 19) | 0x40U;
+        USBx_OUTEP(2U)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+      } else {
+        outep2_paused = true;
+      }
     }
 
     if ((USBx_OUTEP(3U)->DOEPINT & USB_OTG_DOEPINT_XFRC) != 0U) {
@@ -796,3 +807,13 @@ void can_tx_comms_resume_usb(void) {
   }
   EXIT_CRITICAL();
 }
+
+void comms_endpoint2_resume_usb(void) {
+  ENTER_CRITICAL();
+  if (outep2_paused && comms_endpoint2_ready(outep2_port, 0x40U)) {
+    outep2_paused = false;
+    USBx_OUTEP(2U)->DOEPTSIZ = (1UL << 19) | 0x40U;
+    USBx_OUTEP(2U)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+  }
+  EXIT_CRITICAL();
+}
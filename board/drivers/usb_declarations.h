@@ -109,3 +109,4 @@ void refresh_can_tx_slots_available(void);
 
 // ***************************** USB port *****************************
 void can_tx_comms_resume_usb(void);
+void comms_endpoint2_resume_usb(void);
@@ -55,6 +55,14 @@ void early_initialization(void) {
 
   detect_board_type();
 
+#ifdef FIXED_BOARD
+  // image built for another board, wait in the bootstub's soft loader for a matching one
+  if (hw_type != FIXED_HW_TYPE) {
+    enter_bootloader_mode = ENTER_SOFTLOADER_MAGIC;
+    NVIC_SystemReset();
+  }
+#endif
+
   if (enter_bootloader_mode == ENTER_BOOTLOADER_MAGIC) {
     led_init();
     #ifdef PANDA
@@ -8,9 +8,13 @@
 #define CANFD
 #define ALLOW_DEBUG
 #define PANDA
+#define ENABLE_TRACE
 
 #define ENTER_CRITICAL() 0
 #define EXIT_CRITICAL() 0
+#define __DMB() __asm__ volatile("" ::: "memory")
+#define CAN_FAST_CODE
+#define SRAM12_DATA
 
 void print(const char *a) {
   printf("%s", a);
@@ -22,8 +26,17 @@ void puth(unsigned int i) {
 
 typedef struct {
   uint32_t CNT;
+  uint32_t SR;
+  uint32_t DIER;
+  uint32_t CCR2;
+  uint32_t CCR3;
 } TIM_TypeDef;
 
+#define TIM_SR_CC2IF (1U << 2)
+#define TIM_DIER_CC2IE (1U << 2)
+#define TIM_SR_CC3IF (1U << 3)
+#define TIM_DIER_CC3IE (1U << 3)
+
 TIM_TypeDef timer;
 TIM_TypeDef *MICROSECOND_TIMER = &timer;
 uint32_t microsecond_timer_get(void);
@@ -5,10 +5,110 @@
   #define APP_START_ADDRESS 0x8004000U
 #endif
 
+#include "crc.h"
+
 // flasher state variables
 uint32_t *prog_ptr = NULL;
 bool unlocked = false;
 
+// Streaming flash: 0xb7 starts the erase, EP2 data is only copied into a
+// ring and programmed from the main loop, 0xb8 finishes and reports the CRC
+// of what's in flash. EP2 NAKs while the ring is full.
+// The erase doesn't overlap with the transfer: the bootstub runs from the
+// bank being erased (F4 flash is single bank), so the CPU stalls on each
+// sector erase. What streaming saves is the round trip per 16 byte chunk.
+#define FLASH_STREAM_IDLE 0U
+#define FLASH_STREAM_ERASING 1U
+#define FLASH_STREAM_PROGRAMMING 2U
+#define FLASH_STREAM_DONE 3U
+#define FLASH_STREAM_ERROR 4U
+
+#define FLASH_STREAM_BUF_SIZE 0x4000U
+
+static uint8_t stream_buf[FLASH_STREAM_BUF_SIZE];
+static volatile uint32_t stream_w = 0U;  // bytes received
+static volatile uint32_t stream_r = 0U;  // bytes programmed
+static volatile uint8_t stream_state = FLASH_STREAM_IDLE;
+static volatile bool stream_finish = false;
+static uint8_t stream_sector = 0U;
+static uint8_t stream_last_sector = 0U;
+static uint32_t stream_crc = 0U;
+
+static bool flash_stream_active(void) {
+  return (stream_state == FLASH_STREAM_ERASING) || (stream_state == FLASH_STREAM_PROGRAMMING);
+}
+
+static bool flash_stream_start(uint8_t last_sector) {
+  bool ret = false;
+  if (unlocked && !flash_stream_active() && (last_sector >= 1U)) {
+    prog_ptr = (uint32_t *)APP_START_ADDRESS;
+    stream_w = 0U;
+    stream_r = 0U;
+    stream_finish = false;
+    stream_sector = 1U;
+    stream_last_sector = last_sector;
+    ret = flash_erase_sector_start(stream_sector, unlocked);
+    stream_state = ret ? FLASH_STREAM_ERASING : FLASH_STREAM_ERROR;
+  }
+  return ret;
+}
+
+static uint32_t flash_stream_pop_word(uint32_t n) {
+  uint32_t word = 0xFFFFFFFFU;
+  for (uint32_t i = 0U; i < n; i++) {
+    uint32_t b = stream_buf[(stream_r + i) % FLASH_STREAM_BUF_SIZE];
+    word = (word & ~(0xFFUL << (8U * i))) | (b << (8U * i));
+  }
+  return word;
+}
+
+// returns true if there was work to do
+static bool flash_stream_poll(void) {
+  bool ret = false;
+  if (stream_state == FLASH_STREAM_ERASING) {
+    ret = true;
+    if (!flash_busy()) {
+      if (stream_sector < stream_last_sector) {
+        stream_sector += 1U;
+        (void)flash_erase_sector_start(stream_sector, unlocked);
+      } else {
+        stream_state = FLASH_STREAM_PROGRAMMING;
+      }
+    }
+  } else if (stream_state == FLASH_STREAM_PROGRAMMING) {
+    // read before checking the ring, no data may arrive after the finish request
+    bool finish = stream_finish;
+    uint32_t avail = stream_w - stream_r;
+    if (avail >= 4U) {
+      ret = true;
+      led_set(LED_RED, 0);
+      while (avail >= 4U) {
+        flash_write_word(prog_ptr, flash_stream_pop_word(4U));
+        prog_ptr++;
+        stream_r += 4U;
+        avail -= 4U;
+      }
+      led_set(LED_RED, 1);
+      comms_endpoint2_resume_usb();
+    }
+    if (finish) {
+      if (avail > 0U) {
+        // pad the last word with erased bytes
+        flash_write_word(prog_ptr, flash_stream_pop_word(avail));
+        prog_ptr++;
+        stream_r += avail;
+      }
+      flush_write_buffer();
+      stream_crc = crc32((const uint8_t *)APP_START_ADDRESS, stream_r);
+      stream_state = FLASH_STREAM_DONE;
+      ret = true;
+    }
+  } else {
+    // nothing to do
+  }
+  return ret;
+}
+
 void spi_init(void);
 
 int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
@@ -24,6 +124,7 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
   resp_len = 0xc;
 
   int sec;
+  uint32_t stream_status[3];
   switch (req->request) {
     // **** 0xb0: flasher echo
     case 0xb0:
@@ -38,6 +139,9 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       led_set(LED_GREEN, 1);
       unlocked = true;
       prog_ptr = (uint32_t *)APP_START_ADDRESS;
+      if (!flash_stream_active()) {
+        stream_state = FLASH_STREAM_IDLE;
+      }
       break;
     // **** 0xb2: erase sector
     case 0xb2:
@@ -46,6 +150,23 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         resp[1] = 0xff;
       }
       break;
+    // **** 0xb7: start streaming flash, erasing sectors 1 - param1
+    case 0xb7:
+      if (flash_stream_start(req->param1)) {
+        resp[1] = 0xff;
+      }
+      break;
+    // **** 0xb8: streaming flash status, param1 = 1 marks the end of the data
+    case 0xb8:
+      if ((req->param1 == 1U) && flash_stream_active()) {
+        stream_finish = true;
+      }
+      stream_status[0] = stream_state;
+      stream_status[1] = stream_r;
+      stream_status[2] = (stream_state == FLASH_STREAM_DONE) ? stream_crc : 0U;
+      (void)memcpy(resp, stream_status, sizeof(stream_status));
+      resp_len = 0xc;
+      break;
     // **** 0xc1: get hardware type
     case 0xc1:
       resp[0] = hw_type;
@@ -111,15 +232,55 @@ int comms_can_read(uint8_t *data, uint32_t max_len) {
 
 void refresh_can_tx_slots_available(void) {}
 
+void comms_playback_write(const uint8_t *data, uint32_t len) {
+  UNUSED(data);
+  UNUSED(len);
+}
+
+uint32_t comms_can_stats_read(uint8_t *data, uint32_t max_len) {
+  UNUSED(data);
+  UNUSED(max_len);
+  return 0U;
+}
+
+uint32_t comms_can_cache_read(uint8_t *data, uint32_t max_len) {
+  UNUSED(data);
+  UNUSED(max_len);
+  return 0U;
+}
+
+bool comms_endpoint2_ready(uint8_t port, uint32_t len) {
+  bool ret = true;
+  UNUSED(port);
+  if (flash_stream_active()) {
+    ret = (FLASH_STREAM_BUF_SIZE - (stream_w - stream_r)) >= len;
+  }
+  return ret;
+}
+
 void comms_endpoint2_write(const uint8_t *data, uint32_t len) {
-  led_set(LED_RED, 0);
-  for (uint32_t i = 0; i < len/4; i++) {
-    flash_write_word(prog_ptr, *(uint32_t*)(data+(i*4)));
+  if (flash_stream_active()) {
+    uint32_t limit = flash_sector_end(stream_last_sector) - APP_START_ADDRESS;
+    if (stream_finish || ((stream_w + len) > limit) || !comms_endpoint2_ready(0U, len)) {
+      stream_state = FLASH_STREAM_ERROR;
+    } else {
+      for (uint32_t i = 0U; i < len; i++) {
+        stream_buf[(stream_w + i) % FLASH_STREAM_BUF_SIZE] = data[i];
+      }
+      stream_w += len;
+    }
+  } else if (stream_state == FLASH_STREAM_IDLE) {
+    led_set(LED_RED, 0);
+    for (uint32_t i = 0; i < len/4; i++) {
+      flash_write_word(prog_ptr, *(uint32_t*)(data+(i*4)));
 
-    //*(uint64_t*)(&spi_tx_buf[0x30+(i*4)]) = *prog_ptr;
-    prog_ptr++;
+      //*(uint64_t*)(&spi_tx_buf[0x30+(i*4)]) = *prog_ptr;
+      prog_ptr++;
+    }
+    led_set(LED_RED, 1);
+  } else {
+    // stream finished or failed, don't program anything else
   }
-  led_set(LED_RED, 1);
 }
 
 
@@ -150,10 +311,18 @@ void soft_flasher_start(void) {
   enable_interrupts();
 
   for (;;) {
-    // blink the green LED fast
+    // blink the green LED fast, streaming flash runs in between
     led_set(LED_GREEN, 0);
-    delay(500000);
+    for (uint32_t i = 0U; i < 100U; i++) {
+      if (!flash_stream_poll()) {
+        delay(5000);
+      }
+    }
     led_set(LED_GREEN, 1);
-    delay(500000);
+    for (uint32_t i = 0U; i < 100U; i++) {
+      if (!flash_stream_poll()) {
+        delay(5000);
+      }
+    }
   }
 }
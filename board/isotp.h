@@ -0,0 +1,286 @@
+/*
+  ISO 15765-2 transmit engine for diagnostics. The host submits a whole
+  PDU and the panda sends the single frame, or the first frame followed
+  by the consecutive frames at the pace the receiver's flow control asks
+  for. Every frame still goes through the safety tx hook.
+
+  PDUs are uploaded as in-band frames on ISOTP_BUS over the normal CAN
+  write path. The frame address is the ISO-TP target address, data[0] is
+  the chunk type:
+    ISOTP_CHUNK_START: [1] bus, [2:3] PDU length, [4:7] flow control
+                       address (bit 31 set for 29 bit), then payload
+    ISOTP_CHUNK_DATA:  payload from [1]
+    ISOTP_CHUNK_ABORT: stops the current transfer
+  The result comes back in the CAN RX stream as a frame on ISOTP_BUS with
+  the target address, [0] status and [1:2] payload bytes sent.
+
+  One transfer at a time, classic CAN frames padded to 8 bytes only.
+  Timing runs on compare channel 2 of the microsecond timer.
+*/
+
+#define ISOTP_BUS 6U
+#define ISOTP_MAX_LEN 4095U
+
+#define ISOTP_CHUNK_START 0U
+#define ISOTP_CHUNK_DATA 1U
+#define ISOTP_CHUNK_ABORT 2U
+
+#define ISOTP_STATUS_DONE 0U
+#define ISOTP_STATUS_REJECTED 1U  // bad request or blocked by safety
+#define ISOTP_STATUS_TIMEOUT 2U   // no flow control within N_Bs
+#define ISOTP_STATUS_OVERFLOW 3U  // receiver reported overflow
+#define ISOTP_STATUS_ABORTED 4U
+#define ISOTP_STATUS_BUSY 5U      // start while a transfer is running
+
+#define ISOTP_IDLE 0U
+#define ISOTP_LOADING 1U
+#define ISOTP_WAIT_FC 2U
+#define ISOTP_SENDING 3U
+
+#define ISOTP_N_BS_US 1000000U    // flow control timeout
+#define ISOTP_MAX_WAIT_FRAMES 16U // N_WFTmax
+#define ISOTP_BURST_FRAMES 8U     // frames queued per service call at STmin 0
+#define ISOTP_BURST_US 500U
+#define ISOTP_RETRY_US 1000U      // TX queue full
+#define ISOTP_PAD 0x00U
+#define ISOTP_INTERRUPT_RATE 12000U
+
+typedef struct {
+  uint8_t state;
+  uint8_t bus;
+  bool extended;
+  bool fc_extended;
+  uint32_t addr;
+  uint32_t fc_addr;
+  uint16_t len;
+  uint16_t loaded;
+  uint16_t sent;
+  uint8_t sn;
+  uint8_t bs;
+  uint8_t bs_cnt;
+  uint8_t wait_cnt;
+  uint32_t stmin_us;
+  uint32_t fc_start;
+  uint8_t buf[ISOTP_MAX_LEN];
+} isotp_session_t;
+
+static isotp_session_t isotp = {.state = ISOTP_IDLE};
+
+static void isotp_timer_arm(uint32_t delay_us) {
+  MICROSECOND_TIMER->CCR2 = microsecond_timer_get() + delay_us;
+  MICROSECOND_TIMER->SR = ~TIM_SR_CC2IF;
+  MICROSECOND_TIMER->DIER |= TIM_DIER_CC2IE;
+}
+
+static void isotp_timer_stop(void) {
+  MICROSECOND_TIMER->DIER &= ~TIM_DIER_CC2IE;
+  MICROSECOND_TIMER->SR = ~TIM_SR_CC2IF;
+}
+
+static void isotp_report(uint32_t addr, bool extended, uint8_t status, uint16_t sent) {
+  CANPacket_t to_push = {0};
+  to_push.bus = ISOTP_BUS;
+  to_push.extended = extended ? 1U : 0U;
+  to_push.addr = addr;
+  to_push.data_len_code = 3U;
+  to_push.data[0] = status;
+  to_push.data[1] = (uint8_t)(sent & 0xFFU);
+  to_push.data[2] = (uint8_t)(sent >> 8);
+  can_set_checksum(&to_push);
+  rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+}
+
+static void isotp_finish(uint8_t status) {
+  isotp_timer_stop();
+  isotp.state = ISOTP_IDLE;
+  isotp_report(isotp.addr, isotp.extended, status, isotp.sent);
+}
+
+static bool isotp_frame_send(const uint8_t *pci, uint8_t pci_len, uint16_t payload_len) {
+  CANPacket_t to_send = {0};
+  to_send.bus = isotp.bus;
+  to_send.extended = isotp.extended ? 1U : 0U;
+  to_send.addr = isotp.addr;
+  to_send.data_len_code = 8U;
+  (void)memset(to_send.data, ISOTP_PAD, 8U);
+  (void)memcpy(to_send.data, pci, pci_len);
+  (void)memcpy(&to_send.data[pci_len], &isotp.buf[isotp.sent], payload_len);
+
+  bool ret = (safety_tx_hook(&to_send) != 0);
+  if (ret) {
+    can_send(&to_send, isotp.bus, true);
+    isotp.sent += payload_len;
+  } else {
+    safety_tx_blocked += 1U;
+  }
+  return ret;
+}
+
+static uint32_t isotp_stmin_us(uint8_t stmin) {
+  uint32_t ret;
+  if (stmin <= 0x7FU) {
+    ret = (uint32_t)stmin * 1000U;
+  } else if ((stmin >= 0xF1U) && (stmin <= 0xF9U)) {
+    ret = ((uint32_t)stmin - 0xF0U) * 100U;
+  } else {
+    // reserved, use the longest
+    ret = 0x7FU * 1000U;
+  }
+  return ret;
+}
+
+static void isotp_wait_fc(void) {
+  isotp.state = ISOTP_WAIT_FC;
+  isotp.fc_start = microsecond_timer_get();
+  isotp_timer_arm(ISOTP_N_BS_US);
+}
+
+static void isotp_start(void) {
+  if (isotp.len <= 7U) {
+    uint8_t pci = (uint8_t)isotp.len;
+    isotp_finish(isotp_frame_send(&pci, 1U, isotp.len) ? ISOTP_STATUS_DONE : ISOTP_STATUS_REJECTED);
+  } else {
+    uint8_t pci[2] = {(uint8_t)(0x10U | (isotp.len >> 8)), (uint8_t)(isotp.len & 0xFFU)};
+    isotp.sn = 1U;
+    isotp.wait_cnt = 0U;
+    if (isotp_frame_send(pci, 2U, 6U)) {
+      isotp_wait_fc();
+    } else {
+      isotp_finish(ISOTP_STATUS_REJECTED);
+    }
+  }
+}
+
+// sends the next consecutive frames, called from the timer and on flow control
+void isotp_service(void) {
+  ENTER_CRITICAL();
+  if (isotp.state == ISOTP_WAIT_FC) {
+    if (get_ts_elapsed(microsecond_timer_get(), isotp.fc_start) >= ISOTP_N_BS_US) {
+      isotp_finish(ISOTP_STATUS_TIMEOUT);
+    }
+  } else if (isotp.state == ISOTP_SENDING) {
+    uint8_t burst = 0U;
+    while (isotp.state == ISOTP_SENDING) {
+      if (can_slots_empty(can_queues[isotp.bus]) == 0U) {
+        isotp_timer_arm(ISOTP_RETRY_US);
+        break;
+      }
+
+      uint8_t pci = 0x20U | isotp.sn;
+      if (!isotp_frame_send(&pci, 1U, (uint16_t)MIN((uint32_t)isotp.len - isotp.sent, 7U))) {
+        isotp_finish(ISOTP_STATUS_REJECTED);
+        break;
+      }
+      isotp.sn = (isotp.sn + 1U) & 0xFU;
+      isotp.bs_cnt += 1U;
+      burst += 1U;
+
+      if (isotp.sent >= isotp.len) {
+        isotp_finish(ISOTP_STATUS_DONE);
+      } else if ((isotp.bs != 0U) && (isotp.bs_cnt >= isotp.bs)) {
+        isotp_wait_fc();
+      } else if (isotp.stmin_us != 0U) {
+        isotp_timer_arm(isotp.stmin_us);
+        break;
+      } else if (burst >= ISOTP_BURST_FRAMES) {
+        isotp_timer_arm(ISOTP_BURST_US);
+        break;
+      } else {
+        // keep going
+      }
+    }
+  } else {
+    isotp_timer_stop();
+  }
+  EXIT_CRITICAL();
+}
+
+void isotp_timer_handler(void) {
+  // the flag also sets while the channel is unused
+  if (((MICROSECOND_TIMER->DIER & TIM_DIER_CC2IE) != 0U) && ((MICROSECOND_TIMER->SR & TIM_SR_CC2IF) != 0U)) {
+    MICROSECOND_TIMER->SR = ~TIM_SR_CC2IF;
+    isotp_service();
+  }
+}
+
+// every received frame, for the receiver's flow control
+void isotp_rx_hook(const CANPacket_t *msg) {
+  if ((isotp.state == ISOTP_WAIT_FC) && (GET_BUS(msg) == isotp.bus) && (GET_ADDR(msg) == isotp.fc_addr) &&
+      ((msg->extended != 0U) == isotp.fc_extended) && (GET_LEN(msg) >= 3U) && ((msg->data[0] & 0xF0U) == 0x30U)) {
+    ENTER_CRITICAL();
+    uint8_t fs = msg->data[0] & 0xFU;
+    if (fs == 0U) {
+      // clear to send
+      isotp.bs = msg->data[1];
+      isotp.bs_cnt = 0U;
+      isotp.stmin_us = isotp_stmin_us(msg->data[2]);
+      isotp.state = ISOTP_SENDING;
+      isotp_timer_stop();
+      isotp_service();
+    } else if (fs == 1U) {
+      isotp.wait_cnt += 1U;
+      if (isotp.wait_cnt > ISOTP_MAX_WAIT_FRAMES) {
+        isotp_finish(ISOTP_STATUS_TIMEOUT);
+      } else {
+        isotp_wait_fc();
+      }
+    } else {
+      isotp_finish(ISOTP_STATUS_OVERFLOW);
+    }
+    EXIT_CRITICAL();
+  }
+}
+
+// in-band chunk from the host
+void isotp_host_write(const CANPacket_t *chunk) {
+  uint8_t len = GET_LEN(chunk);
+  bool extended = (chunk->extended != 0U);
+
+  ENTER_CRITICAL();
+  if (len == 0U) {
+    // malformed
+  } else if (chunk->data[0] == ISOTP_CHUNK_ABORT) {
+    if (isotp.state != ISOTP_IDLE) {
+      isotp_finish(ISOTP_STATUS_ABORTED);
+    }
+  } else if (chunk->data[0] == ISOTP_CHUNK_START) {
+    uint16_t pdu_len = (len >= 8U) ? (uint16_t)(chunk->data[2] | ((uint32_t)chunk->data[3] << 8)) : 0U;
+    if ((isotp.state == ISOTP_WAIT_FC) || (isotp.state == ISOTP_SENDING)) {
+      isotp_report(GET_ADDR(chunk), extended, ISOTP_STATUS_BUSY, 0U);
+    } else if ((chunk->data[1] >= PANDA_BUS_CNT) || (pdu_len == 0U) || (pdu_len > ISOTP_MAX_LEN)) {
+      isotp_report(GET_ADDR(chunk), extended, ISOTP_STATUS_REJECTED, 0U);
+      isotp.state = ISOTP_IDLE;
+    } else {
+      uint32_t fc = chunk->data[4] | ((uint32_t)chunk->data[5] << 8) | ((uint32_t)chunk->data[6] << 16) | ((uint32_t)chunk->data[7] << 24);
+      isotp.bus = chunk->data[1];
+      isotp.addr = GET_ADDR(chunk);
+      isotp.extended = extended;
+      isotp.fc_addr = fc & 0x1FFFFFFFU;
+      isotp.fc_extended = ((fc >> 31) != 0U);
+      isotp.len = pdu_len;
+      isotp.sent = 0U;
+      isotp.loaded = MIN((uint16_t)(len - 8U), pdu_len);
+      (void)memcpy(isotp.buf, &chunk->data[8], isotp.loaded);
+      isotp.state = ISOTP_LOADING;
+    }
+  } else if ((chunk->data[0] == ISOTP_CHUNK_DATA) && (isotp.state == ISOTP_LOADING)) {
+    // chunks are padded up to a valid DLC
+    uint16_t n = MIN((uint16_t)(len - 1U), isotp.len - isotp.loaded);
+    (void)memcpy(&isotp.buf[isotp.loaded], &chunk->data[1], n);
+    isotp.loaded += n;
+  } else {
+    // data without a start
+  }
+
+  if ((isotp.state == ISOTP_LOADING) && (isotp.loaded == isotp.len)) {
+    isotp_start();
+  }
+  EXIT_CRITICAL();
+}
+
+void isotp_reset(void) {
+  ENTER_CRITICAL();
+  isotp_timer_stop();
+  isotp.state = ISOTP_IDLE;
+  EXIT_CRITICAL();
+}
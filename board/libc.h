@@ -29,7 +29,7 @@ void *memset(void *str, int c, unsigned int n) {
   (((uint32_t)(X) & (sizeof(uint32_t) - 1U)) | ((uint32_t)(Y) & (sizeof(uint32_t) - 1U)))
 
 // cppcheck-suppress misra-c2012-21.2
-void *memcpy(void *dest, const void *src, unsigned int len) {
+CAN_FAST_CODE void *memcpy(void *dest, const void *src, unsigned int len) {
   unsigned int n = len;
   uint8_t *d8 = dest;
   const uint8_t *s8 = src;
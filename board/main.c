@@ -15,6 +15,13 @@
 #include "health.h"
 
 #include "drivers/can_common.h"
+#include "can_filter.h"
+#include "isotp.h"
+#include "playback.h"
+#include "can_stats.h"
+#include "can_cache.h"
+#include "can_template.h"
+#include "drivers/can_bench.h"
 
 #ifdef STM32H7
   #include "drivers/fdcan.h"
@@ -26,8 +33,10 @@
 
 #include "obj/gitversion.h"
 
+#include "can_compress.h"
 #include "can_comms.h"
 #include "main_comms.h"
+#include "telemetry.h"
 
 // ********************* Serial debugging *********************
 
@@ -73,14 +82,40 @@ void send_interceptor_heartbeat(void) {
   memcpy(to_send.data, dat, sizeof(dat));
   
   can_set_checksum(&to_send);
-  can_send(&to_send, 1, true);
+  can_send_prio(&to_send, 1, true, CAN_TX_PRIO_HIGH);
 }
 
 // ****************************** safety mode ******************************
 
-// this is the only way to leave silent mode
-void set_safety_mode(uint16_t mode, uint16_t param) {
+// relay and CAN core changes requested by set_safety_mode. set_safety_mode runs
+// from the CAN RX and USB interrupts, so the slow parts are applied from the main loop
+typedef struct {
+  bool pending;
+  bool reinit_all;
+  bool intercept;
+  bool clear_obd_send;
+  uint8_t can_mode;
+  int can_silent;
+} safety_hw_config_t;
+
+static safety_hw_config_t safety_hw = {
+  .pending = false, .reinit_all = true, .intercept = false, .clear_obd_send = false,
+  .can_mode = CAN_MODE_NORMAL, .can_silent = ALL_CAN_SILENT,
+};
+static uint8_t applied_can_mode = CAN_MODE_NORMAL;
+
+// this is the only way to leave silent mode. reinit_all also resets every CAN
+// core and the CAN mode, it stays requested until the main loop applies it
+void set_safety_mode(uint16_t mode, uint16_t param, bool reinit_all) {
   uint16_t mode_copy = mode;
+
+  // hooks and config are swapped in one go, no frame sees a half set mode.
+  // Frames the old hooks approved must not go out under the new mode.
+  ENTER_CRITICAL();
+  for (uint8_t i = 0U; i < PANDA_BUS_CNT; i++) {
+    can_tx_clear(i);
+  }
+  can_template_clear();
   int err = set_safety_hooks(mode_copy, param);
   if (err == -1) {
     print("Error: safety set mode failed. Falling back to SILENT\n");
@@ -91,59 +126,84 @@ void set_safety_mode(uint16_t mode, uint16_t param) {
   }
   safety_tx_blocked = 0;
   safety_rx_invalid = 0;
+  EXIT_CRITICAL();
+  TRACE(TRACE_EV_SAFETY_MODE, mode_copy, param);
 
+  bool intercept = false;
+  bool clear_obd_send = false;
+  uint8_t can_mode = CAN_MODE_NORMAL;
+  int silent = ALL_CAN_LIVE; // stock is ALL_CAN_SILENT in SILENT
   switch (mode_copy) {
     case SAFETY_SILENT:
-      set_intercept_relay(false, false);
-      if (current_board->harness_config->has_harness) {
-        current_board->set_can_mode(CAN_MODE_NORMAL);
-      }
-      can_silent = ALL_CAN_LIVE; // stock is ALL_CAN_SILENT
-      break;
     case SAFETY_NOOUTPUT:
-      set_intercept_relay(false, false);
-      if (current_board->harness_config->has_harness) {
-        current_board->set_can_mode(CAN_MODE_NORMAL);
-      }
-      can_silent = ALL_CAN_LIVE;
       break;
     case SAFETY_ELM327:
-      set_intercept_relay(false, false);
       heartbeat_counter = 0U;
       heartbeat_lost = false;
-      if (current_board->harness_config->has_harness) {
-        // Clear any pending messages in the can core (i.e. sending while comma power is unplugged)
-        // TODO: rewrite using hardware queues rather than fifo to cancel specific messages
-        can_clear_send(CANIF_FROM_CAN_NUM(1), 1);
-        if (param == 0U) {
-          current_board->set_can_mode(CAN_MODE_OBD_CAN2);
-        } else {
-          current_board->set_can_mode(CAN_MODE_NORMAL);
-        }
-      }
-      can_silent = ALL_CAN_LIVE;
+      // Clear any pending messages in the can core (i.e. sending while comma power is unplugged)
+      // TODO: rewrite using hardware queues rather than fifo to cancel specific messages
+      clear_obd_send = true;
+      can_mode = (param == 0U) ? CAN_MODE_OBD_CAN2 : CAN_MODE_NORMAL;
       break;
     case SAFETY_HKG_ADAS_DRV_INTERCEPTOR:
       const bool is_intercept_active = param != 0U;
-      set_intercept_relay(is_intercept_active, false);
+      intercept = is_intercept_active;
       heartbeat_counter = is_intercept_active ? 0U : heartbeat_counter;
       heartbeat_lost = is_intercept_active ? false : heartbeat_lost;
-      if (current_board->harness_config->has_harness) {
-        current_board->set_can_mode(CAN_MODE_NORMAL);
-      }
-      can_silent = is_intercept_active ? ALL_CAN_LIVE : ALL_CAN_SILENT;
+      silent = is_intercept_active ? ALL_CAN_LIVE : ALL_CAN_SILENT;
       break;
     default:
-      set_intercept_relay(true, false);
+      intercept = true;
       heartbeat_counter = 0U;
       heartbeat_lost = false;
-      if (current_board->harness_config->has_harness) {
-        current_board->set_can_mode(CAN_MODE_NORMAL);
-      }
-      can_silent = ALL_CAN_LIVE;
       break;
   }
-  can_init_all();
+
+  ENTER_CRITICAL();
+  safety_hw.intercept = intercept;
+  safety_hw.clear_obd_send = clear_obd_send;
+  safety_hw.can_mode = can_mode;
+  safety_hw.can_silent = silent;
+  safety_hw.reinit_all = safety_hw.reinit_all || reinit_all;
+  safety_hw.pending = true;
+  EXIT_CRITICAL();
+}
+
+// only cores whose silent flag changes are reset, the bitrate never changes with the mode
+static void apply_safety_mode_hw(void) {
+  ENTER_CRITICAL();
+  safety_hw_config_t cfg = safety_hw;
+  safety_hw.pending = false;
+  safety_hw.reinit_all = false;
+  EXIT_CRITICAL();
+
+  if (cfg.pending) {
+    bool reinit_all = cfg.reinit_all;
+    set_intercept_relay(cfg.intercept, false);
+    if (current_board->harness_config->has_harness) {
+      if (cfg.clear_obd_send) {
+        can_clear_send(CANIF_FROM_CAN_NUM(1), 1);
+      }
+      if (reinit_all || (cfg.can_mode != applied_can_mode)) {
+        current_board->set_can_mode(cfg.can_mode);
+        applied_can_mode = cfg.can_mode;
+        reinit_all = true;
+      }
+    }
+
+    uint32_t silent_changed = (uint32_t)can_silent ^ (uint32_t)cfg.can_silent;
+    can_silent = cfg.can_silent;
+    if (reinit_all) {
+      can_init_all();
+    } else {
+      for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+        if ((silent_changed & (1UL << i)) != 0U) {
+          can_tx_clear(i);
+          (void)can_init(i);
+        }
+      }
+    }
+  }
 }
 
 bool is_car_safety_mode(uint16_t mode) {
@@ -155,6 +215,12 @@ bool is_car_safety_mode(uint16_t mode) {
 
 // ***************************** main code *****************************
 
+// compare channels of the microsecond timer
+static void microsecond_timer_handler(void) {
+  isotp_timer_handler();
+  playback_timer_handler();
+}
+
 // cppcheck-suppress unusedFunction ; used in headers not included in cppcheck
 // cppcheck-suppress misra-c2012-8.4
 void __initialize_hardware_early(void) {
@@ -185,9 +251,12 @@ static void tick_handler(void) {
     // tick drivers at 8Hz
     fan_tick();
     harness_tick();
+    adc_tick();
     simple_watchdog_kick();
     sound_tick();
     send_interceptor_heartbeat();
+    telemetry_tick();
+    check_registers();
 
     // re-init everything that uses harness status
     if (harness.status != prev_harness_status) {
@@ -195,8 +264,7 @@ static void tick_handler(void) {
       can_set_orientation(harness.status == HARNESS_STATUS_FLIPPED);
 
       // re-init everything that uses harness status
-      can_init_all();
-      set_safety_mode(current_safety_mode, current_safety_param);
+      set_safety_mode(current_safety_mode, current_safety_param, true);
       // set_power_save_state(power_save_status);
     }
 
@@ -274,6 +342,8 @@ static void tick_handler(void) {
             controls_allowed_countdown = 0U;
           }
 
+          TRACE(TRACE_EV_HEARTBEAT_LOST, heartbeat_counter, current_safety_mode);
+
           // set flag to indicate the heartbeat was lost
           if (is_car_safety_mode(current_safety_mode)) {
             heartbeat_lost = true;
@@ -283,7 +353,7 @@ static void tick_handler(void) {
           heartbeat_engaged = false;
 
           if (current_safety_mode != SAFETY_SILENT) {
-            set_safety_mode(SAFETY_SILENT, 0U);
+            set_safety_mode(SAFETY_SILENT, 0U, false);
           }
 
           // We do NOT want power save because we can't listen to CAN, and thus we can't react to SP requesting safety mode changes.
@@ -300,9 +370,6 @@ static void tick_handler(void) {
         }
       }
 
-      // check registers
-      check_registers();
-
       // set ignition_can to false after 2s of no CAN seen
       if (ignition_can_cnt > 2U) {
         ignition_can = false;
@@ -356,10 +423,17 @@ int main(void) {
     harness_init();
   }
 
+  // register the supply channels with the background ADC scan
+  (void)current_board->read_voltage_mV();
+  (void)current_board->read_current_mA();
+  adc_scan_init();
+
   // panda has an FPU, let's use it!
   enable_fpu();
 
   microsecond_timer_init();
+  REGISTER_INTERRUPT(TIM2_IRQn, microsecond_timer_handler, (ISOTP_INTERRUPT_RATE + PLAYBACK_INTERRUPT_RATE), FAULT_INTERRUPT_RATE_TIM2)
+  NVIC_EnableIRQ(TIM2_IRQn);
 
   current_board->set_siren(false);
   if (current_board->fan_max_rpm > 0U) {
@@ -367,7 +441,8 @@ int main(void) {
   }
 
   // init to SILENT and can silent
-  set_safety_mode(SAFETY_SILENT, 0U);
+  set_safety_mode(SAFETY_SILENT, 0U, false);
+  apply_safety_mode_hw();
 
   // enable CAN TXs
   enable_can_transceivers(true);
@@ -401,12 +476,14 @@ int main(void) {
 
   // LED should keep on blinking all the time
   while (true) {
+    apply_safety_mode_hw();
     if (power_save_status == POWER_SAVE_STATUS_DISABLED) {
       #ifdef DEBUG_FAULTS
       if (fault_status == FAULT_STATUS_NONE) {
       #endif
         // useful for debugging, fade breaks = panda is overloaded
         for (uint32_t fade = 0U; fade < MAX_LED_FADE; fade += 1U) {
+          apply_safety_mode_hw();
           led_set(LED_RED, true);
           delay(fade >> 4);
           led_set(LED_RED, false);
@@ -414,6 +491,7 @@ int main(void) {
         }
 
         for (uint32_t fade = MAX_LED_FADE; fade > 0U; fade -= 1U) {
+          apply_safety_mode_hw();
           led_set(LED_RED, true);
           delay(fade >> 4);
           led_set(LED_RED, false);
@@ -2,6 +2,7 @@ extern int _app_start[0xc000]; // Only first 3 sectors of size 0x4000 are used
 
 // Prototypes
 bool is_car_safety_mode(uint16_t mode);
+void telemetry_set_rate(uint16_t rate_hz);
 
 static int get_health_pkt(void *dat) {
   COMPILE_TIME_ASSERT(sizeof(struct health_t) <= USBPACKET_MAX_SIZE);
@@ -46,20 +47,52 @@ static int get_health_pkt(void *dat) {
   return sizeof(*health);
 }
 
+static int get_can_health_pkt(uint8_t can_number, void *dat) {
+  COMPILE_TIME_ASSERT(sizeof(can_health_t) <= USBPACKET_MAX_SIZE);
+  update_can_health_pkt(can_number, 0U);
+  can_health[can_number].can_speed = (bus_config[can_number].can_speed / 10U);
+  can_health[can_number].can_data_speed = (bus_config[can_number].can_data_speed / 10U);
+  can_health[can_number].canfd_enabled = bus_config[can_number].canfd_enabled;
+  can_health[can_number].brs_enabled = bus_config[can_number].brs_enabled;
+  can_health[can_number].canfd_non_iso = bus_config[can_number].canfd_non_iso;
+  (void)memcpy(dat, (uint8_t*)(&can_health[can_number]), sizeof(can_health_t));
+  return sizeof(can_health_t);
+}
+
+void comms_playback_write(const uint8_t *data, uint32_t len) {
+  playback_write(data, len);
+}
+
+uint32_t comms_can_stats_read(uint8_t *data, uint32_t max_len) {
+  return can_stats_read(data, max_len);
+}
+
+uint32_t comms_can_cache_read(uint8_t *data, uint32_t max_len) {
+  return can_cache_snapshot_stream(data, max_len);
+}
+
 // send on serial, first byte to select the ring
 void comms_endpoint2_write(const uint8_t *data, uint32_t len) {
   uart_ring *ur = get_ring_by_number(data[0]);
-  if ((len != 0U) && (ur != NULL)) {
+  if ((len != 0U) && (data[0] == PLAYBACK_EP2_PORT)) {
+    playback_write(&data[1], len - 1U);
+  } else if ((len != 0U) && (ur != NULL)) {
     if ((data[0] < 2U) || (data[0] >= 4U)) {
+      // never waits, room is checked by comms_endpoint2_ready and a full ring counts drops
       for (uint32_t i = 1; i < len; i++) {
-        while (!put_char(ur, data[i])) {
-          // wait
-        }
+        (void)put_char(ur, data[i]);
       }
     }
   }
 }
 
+// the SOM UART drains at its baud rate, so hold off the host until a packet for
+// it fits. The other ports never wait.
+bool comms_endpoint2_ready(uint8_t port, uint32_t len) {
+  uart_ring *ur = get_ring_by_number(port);
+  return (ur != &uart_ring_som_debug) || (ur->uart == NULL) || (uart_tx_free(ur) >= len);
+}
+
 int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
   unsigned int resp_len = 0;
   uart_ring *ur = NULL;
@@ -72,6 +105,10 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
   print("- param2 "); puth(req->param2); print("\n");
 #endif
 
+  if (req->request != 0xa9U) {
+    TRACE(TRACE_EV_CONTROL, req->request, req->param1);
+  }
+
   switch (req->request) {
     // **** 0xa8: get microsecond timer
     case 0xa8:
@@ -82,6 +119,47 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       resp[3] = ((time & 0xFF000000U) >> 24U);
       resp_len = 4U;
       break;
+    // **** 0xa9: read event trace, param1 = 1 to discard pending events
+    case 0xa9:
+      if (req->param1 == 1U) {
+        trace_clear();
+      } else {
+        resp_len = trace_read(resp, USBPACKET_MAX_SIZE);
+      }
+      break;
+    // **** 0xaa: set in-band telemetry rate in Hz, 0 disables
+    case 0xaa:
+      telemetry_set_rate(req->param1);
+      break;
+    // **** 0xab: set compressed CAN RX stream, see can_compress.h
+    case 0xab:
+      comms_can_set_compression(req->param1 != 0U);
+      break;
+    // **** 0xac: stage first address of a CAN RX filter rule
+    case 0xac:
+      can_filter_stage(false, ((uint32_t)req->param2 << 16) | req->param1);
+      break;
+    // **** 0xad: stage last address of a CAN RX filter rule
+    case 0xad:
+      can_filter_stage(true, ((uint32_t)req->param2 << 16) | req->param1);
+      break;
+    // **** 0xae: add CAN RX filter rule for staged range, param1 = action << 8 | bus, param2 = n
+    //            param1 = 0xFFFF clears all rules
+    case 0xae:
+      if (req->param1 == 0xFFFFU) {
+        can_filter_clear();
+      } else {
+        if (!can_filter_add(req->param1 & 0xFFU, req->param1 >> 8, req->param2)) {
+          print("Failed to add CAN RX filter rule\n");
+        }
+      }
+      break;
+    // **** 0xaf: send frames with arbitration ID below param2 on bus param1 ahead of other frames
+    case 0xaf:
+      if (req->param1 < PANDA_BUS_CNT) {
+        can_tx_hp_id_limit[req->param1] = req->param2;
+      }
+      break;
     // **** 0xb0: set IR power
     case 0xb0:
       current_board->set_ir_power(req->param1);
@@ -96,6 +174,26 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       resp[1] = ((fan_state.rpm & 0xFF00U) >> 8U);
       resp_len = 2;
       break;
+    // **** 0xb9: get microsecond timer and the synced time of the same instant, see time_sync.h
+    case 0xb9:
+      time = microsecond_timer_get();
+      (void)memcpy(resp, &time, 4U);
+      time = time_sync_correct(time);
+      (void)memcpy(&resp[4], &time, 4U);
+      resp_len = 8U;
+      break;
+    // **** 0xba: stage time sync reference, the timer value the offset is at
+    case 0xba:
+      time_sync_stage(false, ((uint32_t)req->param2 << 16) | req->param1);
+      break;
+    // **** 0xbb: stage time sync offset
+    case 0xbb:
+      time_sync_stage(true, ((uint32_t)req->param2 << 16) | req->param1);
+      break;
+    // **** 0xbc: apply staged time sync, skew = param2 << 16 | param1 in units of 2^-32
+    case 0xbc:
+      time_sync_apply((int32_t)(((uint32_t)req->param2 << 16) | req->param1));
+      break;
     // **** 0xc0: reset communications
     case 0xc0:
       comms_can_reset();
@@ -107,16 +205,8 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       break;
     // **** 0xc2: CAN health stats
     case 0xc2:
-      COMPILE_TIME_ASSERT(sizeof(can_health_t) <= USBPACKET_MAX_SIZE);
       if (req->param1 < 3U) {
-        update_can_health_pkt(req->param1, 0U);
-        can_health[req->param1].can_speed = (bus_config[req->param1].can_speed / 10U);
-        can_health[req->param1].can_data_speed = (bus_config[req->param1].can_data_speed / 10U);
-        can_health[req->param1].canfd_enabled = bus_config[req->param1].canfd_enabled;
-        can_health[req->param1].brs_enabled = bus_config[req->param1].brs_enabled;
-        can_health[req->param1].canfd_non_iso = bus_config[req->param1].canfd_non_iso;
-        resp_len = sizeof(can_health[req->param1]);
-        (void)memcpy(resp, (uint8_t*)(&can_health[req->param1]), resp_len);
+        resp_len = get_can_health_pkt(req->param1, resp);
       }
       break;
     // **** 0xc3: fetch MCU UID
@@ -224,7 +314,7 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
 
     // **** 0xdc: set safety mode
     case 0xdc:
-      set_safety_mode(req->param1, (uint16_t)req->param2);
+      set_safety_mode(req->param1, (uint16_t)req->param2, false);
       break;
     // **** 0xdd: get healthpacket and CANPacket versions
     case 0xdd:
@@ -320,6 +410,78 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
     case 0xe8:
       bus_config[req->param1].canfd_auto = req->param2 > 0U;
       break;
+    // **** 0xe9: debug log, param1 = uart, param2 = format for the debug uart (1: text, 2: compact binary). returns dropped bytes
+    case 0xe9:
+      ur = get_ring_by_number(req->param1);
+      if (!ur) {
+        break;
+      }
+      if ((ur == &uart_ring_debug) && (req->param2 != 0U)) {
+        debug_log_binary = (req->param2 == 2U);
+      }
+      (void)memcpy(resp, &ur->dropped, sizeof(ur->dropped));
+      resp_len = sizeof(ur->dropped);
+      break;
+    // **** 0xea: frame playback, param1 = command (0: status, 1: clear, 2: start, 3: stop), param2 = 1 to loop. returns status
+    case 0xea:
+      resp_len = playback_command(req->param1, req->param2, resp);
+      break;
+    // **** 0xeb: per-address CAN RX statistics, param1 = command (0: read next entries, 1: restart pass, 2: clear). restart returns the untracked frame count
+    case 0xeb:
+      if (req->param1 == 1U) {
+        can_stats_restart();
+        (void)memcpy(resp, &can_stats_untracked, sizeof(can_stats_untracked));
+        resp_len = sizeof(can_stats_untracked);
+      } else if (req->param1 == 2U) {
+        can_stats_clear();
+      } else {
+        resp_len = can_stats_read(resp, USBPACKET_MAX_SIZE);
+      }
+      break;
+    // **** 0xec: subscribe to the last value of a CAN address, param1 = addr & 0xFFFF,
+    //            param2 = addr >> 16 | bus << 13 | extended << 15
+    case 0xec:
+      if (!can_cache_subscribe((req->param2 >> 13) & 0x3U, ((uint32_t)(req->param2 & 0x1FFFU) << 16) | req->param1, (req->param2 >> 15) != 0U)) {
+        print("Failed to subscribe CAN address\n");
+      }
+      break;
+    // **** 0xed: CAN last-value cache, param1 = command (0: take snapshot, returns its length,
+    //            1: read snapshot at offset param2, 2: clear subscriptions)
+    case 0xed:
+      if (req->param1 == 0U) {
+        uint32_t len = can_cache_snapshot_take();
+        (void)memcpy(resp, &len, sizeof(len));
+        resp_len = sizeof(len);
+      } else if (req->param1 == 1U) {
+        resp_len = can_cache_snapshot_read(req->param2, resp, USBPACKET_MAX_SIZE);
+      } else if (req->param1 == 2U) {
+        can_cache_clear();
+      } else {
+        // unknown command
+      }
+      break;
+    // **** 0xee: add TX template with the staged layout for an address, packed as in 0xec.
+    //            param1 = param2 = 0xFFFF clears all templates
+    case 0xee:
+      if ((req->param1 == 0xFFFFU) && (req->param2 == 0xFFFFU)) {
+        can_template_clear();
+      } else if (!can_template_add((req->param2 >> 13) & 0x3U, ((uint32_t)(req->param2 & 0x1FFFU) << 16) | req->param1, (req->param2 >> 15) != 0U)) {
+        print("Failed to add CAN TX template\n");
+      } else {
+        // added
+      }
+      break;
+    // **** 0xef: stage TX template layout, param1 = counter, param2 = checksum, see can_template.h
+    case 0xef:
+      can_template_stage(req->param1, req->param2);
+      break;
+    // **** 0xf0: CAN path cycle benchmark, param1 = 1 starts, 2 stops. returns the results, see can_bench.h
+    case 0xf0:
+      if (req->param1 != 0U) {
+        can_bench_set(req->param1 == 1U);
+      }
+      resp_len = can_bench_read(resp);
+      break;
     // **** 0xf1: Clear CAN ring buffer.
     case 0xf1:
       if (req->param1 == 0xFFFFU) {
@@ -327,7 +489,7 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         can_clear(&can_rx_q);
       } else if (req->param1 < PANDA_BUS_CNT) {
         print("Clearing CAN Tx queue\n");
-        can_clear(can_queues[req->param1]);
+        can_tx_clear(req->param1);
       } else {
         print("Clearing CAN CAN ring buffer failed: wrong bus number\n");
       }
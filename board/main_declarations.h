@@ -10,9 +10,38 @@ typedef struct harness_configuration harness_configuration;
 void pwm_init(TIM_TypeDef *TIM, uint8_t channel);
 void pwm_set(TIM_TypeDef *TIM, uint8_t channel, uint8_t percentage);
 
+// single board builds, see board/SConscript
+#if defined(PANDA_BOARD_RED)
+  #define FIXED_BOARD board_red
+  #define FIXED_HW_TYPE HW_TYPE_RED_PANDA
+#elif defined(PANDA_BOARD_TRES)
+  #define FIXED_BOARD board_tres
+  #define FIXED_HW_TYPE HW_TYPE_TRES
+#elif defined(PANDA_BOARD_CUATRO)
+  #define FIXED_BOARD board_cuatro
+  #define FIXED_HW_TYPE HW_TYPE_CUATRO
+#elif defined(PANDA_BOARD_WHITE)
+  #define FIXED_BOARD board_white
+  #define FIXED_HW_TYPE HW_TYPE_WHITE_PANDA
+#elif defined(PANDA_BOARD_BLACK)
+  #define FIXED_BOARD board_black
+  #define FIXED_HW_TYPE HW_TYPE_BLACK_PANDA
+#elif defined(PANDA_BOARD_DOS)
+  #define FIXED_BOARD board_dos
+  #define FIXED_HW_TYPE HW_TYPE_DOS
+#else
+  // detected at runtime
+#endif
+
 // ********************* Globals **********************
 extern uint8_t hw_type;
-extern board *current_board;
+#ifdef FIXED_BOARD
+  // known at compile time, so the board functions can be inlined
+  extern struct board FIXED_BOARD;
+  #define current_board (&FIXED_BOARD)
+#else
+  extern board *current_board;
+#endif
 extern uint32_t uptime_cnt;
 extern bool green_led_enabled;
 
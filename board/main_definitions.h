@@ -4,7 +4,9 @@
 
 // ********************* Globals **********************
 uint8_t hw_type = 0;
+#ifndef FIXED_BOARD
 board *current_board;
+#endif
 uint32_t uptime_cnt = 0;
 bool green_led_enabled = false;
 
@@ -0,0 +1,216 @@
+/*
+  Timed CAN frame playback. The host uploads a sequence of records over
+  SPI endpoint PLAYBACK_SPI_ENDPOINT, or USB endpoint 2 with port
+  PLAYBACK_EP2_PORT, and starts it with control 0xea. Each record is a
+  u32 delay in us from the previous frame followed by the frame in the
+  CAN write format.
+
+  Frames are queued on the high priority TX queue by compare channel 3 of
+  the microsecond timer, and still go through the safety tx hook. Frames
+  due at once are queued PLAYBACK_BURST_FRAMES per interrupt, and a full
+  queue drops them into tx_buffer_overflow. The timing error is measured
+  when the frame is queued, arbitration on the bus comes on top of it.
+*/
+
+#define PLAYBACK_BUF_SIZE 0x4000U
+#define PLAYBACK_EP2_PORT 0x10U
+#define PLAYBACK_RECORD_HEAD_SIZE (4U + CANPACKET_HEAD_SIZE)
+#define PLAYBACK_START_US 1000U  // lead time after start
+#define PLAYBACK_LATE_US 50U     // counted as late above this
+#define PLAYBACK_BURST_FRAMES 8U   // frames queued per service call
+#define PLAYBACK_BURST_US 100U     // until the rest of a burst is queued
+#define PLAYBACK_INTERRUPT_RATE 12000U
+
+#define PLAYBACK_IDLE 0U
+#define PLAYBACK_RUNNING 1U
+#define PLAYBACK_DONE 2U
+
+#define PLAYBACK_CMD_STATUS 0U
+#define PLAYBACK_CMD_CLEAR 1U
+#define PLAYBACK_CMD_START 2U  // param2 bit 0: loop
+#define PLAYBACK_CMD_STOP 3U
+
+typedef struct __attribute__((packed)) {
+  uint8_t state;
+  uint8_t loop;
+  uint16_t frames;
+  uint32_t loaded;        // bytes
+  uint32_t sent;
+  uint32_t blocked;       // by safety
+  uint32_t loops;
+  uint32_t late;
+  uint32_t max_error_us;
+  uint32_t mean_error_us;
+} playback_status_t;
+
+static uint8_t playback_buf[PLAYBACK_BUF_SIZE];
+static uint32_t playback_len = 0U;
+static uint32_t playback_pos = 0U;
+static uint32_t playback_due = 0U;
+static uint32_t playback_error_sum = 0U;
+static bool playback_overflow = false;
+static playback_status_t playback = {0};
+
+static void playback_timer_stop(void) {
+  MICROSECOND_TIMER->DIER &= ~TIM_DIER_CC3IE;
+  MICROSECOND_TIMER->SR = ~TIM_SR_CC3IF;
+}
+
+static uint32_t playback_delay(uint32_t pos) {
+  return playback_buf[pos] | ((uint32_t)playback_buf[pos + 1U] << 8) | ((uint32_t)playback_buf[pos + 2U] << 16) | ((uint32_t)playback_buf[pos + 3U] << 24);
+}
+
+static uint32_t playback_record_len(uint32_t pos) {
+  return PLAYBACK_RECORD_HEAD_SIZE + dlc_to_len[playback_buf[pos + 4U] >> 4U];
+}
+
+// whole records only, on real buses. A loop must take some time.
+static bool playback_validate(bool loop) {
+  uint32_t pos = 0U;
+  uint32_t delays = 0U;
+  uint16_t frames = 0U;
+  bool ret = !playback_overflow;
+  while (ret && (pos < playback_len)) {
+    if ((pos + PLAYBACK_RECORD_HEAD_SIZE) > playback_len) {
+      ret = false;
+    } else if (((pos + playback_record_len(pos)) > playback_len) ||
+               (dlc_to_len[playback_buf[pos + 4U] >> 4U] > CANPACKET_DATA_SIZE_MAX) || (((playback_buf[pos + 4U] >> 1U) & 0x7U) >= PANDA_BUS_CNT)) {
+      ret = false;
+    } else {
+      delays |= playback_delay(pos);
+      pos += playback_record_len(pos);
+      frames += 1U;
+    }
+  }
+  playback.frames = frames;
+  return ret && (frames > 0U) && (!loop || (delays != 0U));
+}
+
+// queues the frames that are due, up to a burst, and arms the timer for the next one
+void playback_service(void) {
+  uint8_t burst = 0U;
+  ENTER_CRITICAL();
+  while (playback.state == PLAYBACK_RUNNING) {
+    uint32_t now = microsecond_timer_get();
+    if (((int32_t)(playback_due - now) > 0) || (burst >= PLAYBACK_BURST_FRAMES)) {
+      uint32_t wake = (burst >= PLAYBACK_BURST_FRAMES) ? (now + PLAYBACK_BURST_US) : playback_due;
+      MICROSECOND_TIMER->CCR3 = wake;
+      MICROSECOND_TIMER->SR = ~TIM_SR_CC3IF;
+      MICROSECOND_TIMER->DIER |= TIM_DIER_CC3IE;
+      // the compare only fires on a match, so check it did not pass meanwhile
+      if ((int32_t)(wake - microsecond_timer_get()) > 0) {
+        break;
+      }
+      burst = 0U;
+    } else {
+      CANPacket_t to_send = {0};
+      uint32_t len = playback_record_len(playback_pos);
+      (void)memcpy((uint8_t *)&to_send, &playback_buf[playback_pos + 4U], len - 4U);
+
+      uint32_t error = now - playback_due;
+      playback.max_error_us = MAX(playback.max_error_us, error);
+      playback.late += (error > PLAYBACK_LATE_US) ? 1U : 0U;
+      playback_error_sum += MIN(error, 0xFFFFFFFFU - playback_error_sum);
+
+      if (safety_tx_hook(&to_send) != 0) {
+        // a full high priority queue drops the frame, as in can_send_prio
+        if (can_push(can_hp_queues[to_send.bus], &to_send)) {
+          playback.sent += 1U;
+          process_can(CAN_NUM_FROM_BUS_NUM(to_send.bus));
+        } else {
+          tx_buffer_overflow += 1U;
+        }
+      } else {
+        safety_tx_blocked += 1U;
+        playback.blocked += 1U;
+      }
+
+      burst += 1U;
+      playback_pos += len;
+      if (playback_pos >= playback_len) {
+        playback_pos = 0U;
+        if (playback.loop != 0U) {
+          playback.loops += 1U;
+        } else {
+          playback.state = PLAYBACK_DONE;
+          playback_timer_stop();
+        }
+      }
+      playback_due += playback_delay(playback_pos);
+    }
+  }
+  EXIT_CRITICAL();
+}
+
+void playback_timer_handler(void) {
+  // the flag also sets while the channel is unused
+  if (((MICROSECOND_TIMER->DIER & TIM_DIER_CC3IE) != 0U) && ((MICROSECOND_TIMER->SR & TIM_SR_CC3IF) != 0U)) {
+    MICROSECOND_TIMER->SR = ~TIM_SR_CC3IF;
+    playback_service();
+  }
+}
+
+// upload, appended to the sequence
+void playback_write(const uint8_t *data, uint32_t len) {
+  ENTER_CRITICAL();
+  if (playback.state == PLAYBACK_RUNNING) {
+    playback_overflow = true;
+  } else if ((playback_len + len) > PLAYBACK_BUF_SIZE) {
+    playback_overflow = true;
+  } else {
+    (void)memcpy(&playback_buf[playback_len], data, len);
+    playback_len += len;
+  }
+  EXIT_CRITICAL();
+}
+
+static void playback_stop(void) {
+  playback_timer_stop();
+  if (playback.state == PLAYBACK_RUNNING) {
+    playback.state = PLAYBACK_IDLE;
+  }
+}
+
+static void playback_start(bool loop) {
+  playback_stop();
+  if (playback_validate(loop)) {
+    playback.state = PLAYBACK_RUNNING;
+    playback.loop = loop ? 1U : 0U;
+    playback.sent = 0U;
+    playback.blocked = 0U;
+    playback.loops = 0U;
+    playback.late = 0U;
+    playback.max_error_us = 0U;
+    playback_error_sum = 0U;
+    playback_pos = 0U;
+    playback_due = microsecond_timer_get() + PLAYBACK_START_US + playback_delay(0U);
+  }
+}
+
+// returns the status, a failed start leaves state as it was
+int playback_command(uint16_t cmd, uint16_t param, uint8_t *resp) {
+  ENTER_CRITICAL();
+  if (cmd == PLAYBACK_CMD_CLEAR) {
+    playback_stop();
+    playback.state = PLAYBACK_IDLE;
+    playback.frames = 0U;
+    playback_len = 0U;
+    playback_overflow = false;
+  } else if (cmd == PLAYBACK_CMD_START) {
+    playback_start((param & 1U) != 0U);
+  } else if (cmd == PLAYBACK_CMD_STOP) {
+    playback_stop();
+  } else {
+    // status only
+  }
+
+  playback.loaded = playback_overflow ? 0xFFFFFFFFU : playback_len;
+  playback.mean_error_us = ((playback.sent + playback.blocked) > 0U) ? (playback_error_sum / (playback.sent + playback.blocked)) : 0U;
+  (void)memcpy(resp, &playback, sizeof(playback_status_t));
+  EXIT_CRITICAL();
+
+  if (cmd == PLAYBACK_CMD_START) {
+    playback_service();
+  }
+  return sizeof(playback_status_t);
+}
@@ -5,14 +5,20 @@
 #include "boards/unused_funcs.h"
 
 // ///// Board definition and detection ///// //
+#include "drivers/adc.h"
 #include "stm32f4/lladc.h"
 #include "drivers/harness.h"
 #include "drivers/fan.h"
 #include "stm32f4/llfan.h"
 #include "drivers/clock_source.h"
+// black and dos build on white
 #include "boards/white.h"
-#include "boards/black.h"
-#include "boards/dos.h"
+#if !defined(FIXED_BOARD) || (FIXED_HW_TYPE == HW_TYPE_BLACK_PANDA)
+  #include "boards/black.h"
+#endif
+#if !defined(FIXED_BOARD) || (FIXED_HW_TYPE == HW_TYPE_DOS)
+  #include "boards/dos.h"
+#endif
 
 // Unused functions on F4
 void sound_tick(void) {}
@@ -23,18 +29,27 @@ void detect_board_type(void) {
   set_gpio_output(GPIOC, 5, 1);
   if(!detect_with_pull(GPIOB, 1, PULL_UP) && !detect_with_pull(GPIOB, 7, PULL_UP)){
     hw_type = HW_TYPE_DOS;
-    current_board = &board_dos;
   } else if((detect_with_pull(GPIOA, 4, PULL_DOWN)) || (detect_with_pull(GPIOA, 5, PULL_DOWN)) || (detect_with_pull(GPIOA, 6, PULL_DOWN)) || (detect_with_pull(GPIOA, 7, PULL_DOWN))){
     hw_type = HW_TYPE_WHITE_PANDA;
-    current_board = &board_white;
   } else if(detect_with_pull(GPIOA, 13, PULL_DOWN)) { // Rev AB deprecated, so no pullup means black. In REV C, A13 is pulled up to 5V with a 10K
     // grey is deprecated
   } else if(!detect_with_pull(GPIOB, 15, PULL_UP)) {
     // uno is deprecated
   } else {
     hw_type = HW_TYPE_BLACK_PANDA;
+  }
+
+#ifndef FIXED_BOARD
+  if (hw_type == HW_TYPE_DOS) {
+    current_board = &board_dos;
+  } else if (hw_type == HW_TYPE_WHITE_PANDA) {
+    current_board = &board_white;
+  } else if (hw_type == HW_TYPE_BLACK_PANDA) {
     current_board = &board_black;
+  } else {
+    // unsupported
   }
+#endif
 
   // Return A13 to the alt mode to fix SWD
   set_gpio_alternate(GPIOA, 13, GPIO_AF0_SWJ);
@@ -3,11 +3,13 @@ void register_set(volatile uint32_t *addr, uint32_t val, uint32_t mask);
 
 void adc_init(void) {
   register_set(&(ADC->CCR), ADC_CCR_TSVREFE | ADC_CCR_VBATE, 0xC30000U);
-  register_set(&(ADC1->CR2), ADC_CR2_ADON, 0xFF7F0F03U);
+  register_set(&(ADC1->CR1), ADC_CR1_SCAN, ADC_CR1_SCAN);
+  register_set(&(ADC1->CR2), ADC_CR2_ADON | ADC_CR2_DMA, 0xFF7F0F03U);
   register_set(&(ADC1->SMPR1), ADC_SMPR1_SMP12 | ADC_SMPR1_SMP13, 0x7FFFFFFU);
 }
 
-uint16_t adc_get_raw(uint8_t channel) {
+// injected conversions don't disturb the regular DMA scan
+uint16_t adc_read_raw(uint8_t channel) {
   // Select channel
   register_set(&(ADC1->JSQR), ((uint32_t) channel << 15U), 0x3FFFFFU);
 
@@ -19,6 +21,41 @@ uint16_t adc_get_raw(uint8_t channel) {
   return ADC1->JDR1;
 }
 
-uint16_t adc_get_mV(uint8_t channel) {
-  return (adc_get_raw(channel) * current_board->avdd_mV) / 4095U;
+uint16_t adc_raw_to_mV(uint16_t raw) {
+  return (raw * current_board->avdd_mV) / 4095U;
+}
+
+static void DMA2_Stream0_IRQ_Handler(void) {
+  DMA2->LIFCR = (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0);
+  ADC1->SR &= ~(ADC_SR_EOC | ADC_SR_OVR);
+  adc_scan_done();
+}
+
+void adc_scan_init(void) {
+  REGISTER_INTERRUPT(DMA2_Stream0_IRQn, DMA2_Stream0_IRQ_Handler, 100U, FAULT_INTERRUPT_RATE_ADC_DMA)
+
+  // ADC1 -> memory, DMA2 stream 0 channel 0
+  register_set(&(DMA2_Stream0->CR), (DMA_SxCR_PSIZE_0 | DMA_SxCR_MSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_TCIE), 0x1E077EFEU);
+  register_set(&(DMA2_Stream0->PAR), (uint32_t)&(ADC1->DR), 0xFFFFFFFFU);
+
+  NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+}
+
+void adc_scan_dma_start(const uint8_t *channels, uint8_t len, volatile uint16_t *res) {
+  uint32_t sqr3 = 0U;
+  for (uint8_t i = 0U; i < len; i++) {
+    sqr3 |= (uint32_t)channels[i] << (5U * i);
+  }
+  ADC1->SQR1 = (uint32_t)(len - 1U) << ADC_SQR1_L_Pos;
+  ADC1->SQR3 = sqr3;
+
+  DMA2_Stream0->CR &= ~DMA_SxCR_EN;
+  register_set(&(DMA2_Stream0->M0AR), (uint32_t)res, 0xFFFFFFFFU);
+  DMA2_Stream0->NDTR = len;
+  DMA2_Stream0->CR |= DMA_SxCR_EN;
+
+  // DMA requests stop after the last conversion with DDS=0, re-arm them
+  ADC1->CR2 &= ~ADC_CR2_DMA;
+  ADC1->CR2 |= ADC_CR2_DMA;
+  ADC1->CR2 |= ADC_CR2_SWSTART;
 }
@@ -7,17 +7,39 @@ void flash_unlock(void) {
   FLASH->KEYR = 0xCDEF89AB;
 }
 
-bool flash_erase_sector(uint8_t sector, bool unlocked) {
+bool flash_busy(void) {
+  return (FLASH->SR & FLASH_SR_BSY) != 0U;
+}
+
+// doesn't wait for the erase to finish, poll flash_busy. Code fetches from
+// the same bank stall until it's done.
+bool flash_erase_sector_start(uint8_t sector, bool unlocked) {
   // don't erase the bootloader(sector 0)
   if (sector != 0 && sector < 12 && unlocked) {
     FLASH->CR = (sector << 3) | FLASH_CR_SER;
     FLASH->CR |= FLASH_CR_STRT;
-    while (FLASH->SR & FLASH_SR_BSY);
     return true;
   }
   return false;
 }
 
+bool flash_erase_sector(uint8_t sector, bool unlocked) {
+  bool ret = flash_erase_sector_start(sector, unlocked);
+  while (flash_busy());
+  return ret;
+}
+
+// first address past the sector: 4x16K, 64K, then 128K sectors
+uint32_t flash_sector_end(uint8_t sector) {
+  uint32_t ret;
+  if (sector < 4U) {
+    ret = 0x8000000U + ((uint32_t)(sector + 1U) * 0x4000U);
+  } else {
+    ret = 0x8020000U + ((uint32_t)(sector - 4U) * 0x20000U);
+  }
+  return ret;
+}
+
 void flash_write_word(void *prog_ptr, uint32_t data) {
   uint32_t *pp = prog_ptr;
   FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
@@ -1,21 +1,22 @@
 #if defined(ENABLE_SPI) || defined(BOOTSTUB)
+// Per-transfer writes bypass register_set, these bits are not in the check mask.
 void llspi_miso_dma(uint8_t *addr, int len) {
   // disable DMA
   DMA2_Stream3->CR &= ~DMA_SxCR_EN;
-  register_clear_bits(&(SPI1->CR2), SPI_CR2_TXDMAEN);
+  SPI1->CR2 &= ~SPI_CR2_TXDMAEN;
 
   // setup source and length
-  register_set(&(DMA2_Stream3->M0AR), (uint32_t)addr, 0xFFFFFFFFU);
+  DMA2_Stream3->M0AR = (uint32_t)addr;
   DMA2_Stream3->NDTR = len;
 
   // enable DMA
-  register_set_bits(&(SPI1->CR2), SPI_CR2_TXDMAEN);
+  SPI1->CR2 |= SPI_CR2_TXDMAEN;
   DMA2_Stream3->CR |= DMA_SxCR_EN;
 }
 
 void llspi_mosi_dma(uint8_t *addr, int len) {
   // disable DMA
-  register_clear_bits(&(SPI1->CR2), SPI_CR2_RXDMAEN);
+  SPI1->CR2 &= ~SPI_CR2_RXDMAEN;
   DMA2_Stream2->CR &= ~DMA_SxCR_EN;
 
   // drain the bus
@@ -23,12 +24,12 @@ void llspi_mosi_dma(uint8_t *addr, int len) {
   (void)dat;
 
   // setup destination and length
-  register_set(&(DMA2_Stream2->M0AR), (uint32_t)addr, 0xFFFFFFFFU);
+  DMA2_Stream2->M0AR = (uint32_t)addr;
   DMA2_Stream2->NDTR = len;
 
   // enable DMA
   DMA2_Stream2->CR |= DMA_SxCR_EN;
-  register_set_bits(&(SPI1->CR2), SPI_CR2_RXDMAEN);
+  SPI1->CR2 |= SPI_CR2_RXDMAEN;
 }
 // SPI MOSI DMA FINISHED
 static void DMA2_Stream2_IRQ_Handler(void) {
@@ -83,7 +84,7 @@ void llspi_init(void) {
   // Enable SPI and the error interrupts
   // TODO: verify clock phase and polarity
   register_set(&(SPI1->CR1), SPI_CR1_SPE, 0xFFFFU);
-  register_set(&(SPI1->CR2), 0U, 0xF7U);
+  register_set(&(SPI1->CR2), 0U, 0xF7U & ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN));
 
   NVIC_EnableIRQ(DMA2_Stream2_IRQn);
   NVIC_EnableIRQ(DMA2_Stream3_IRQn);
@@ -10,6 +10,11 @@
 
 #define BOOTLOADER_ADDRESS 0x1FFF0004U
 
+// no ITCM, the flash ART accelerator caches the CAN path
+#define CAN_FAST_CODE
+#define CAN_FAST_CODE_IN_ITCM 0U
+#define SRAM12_DATA
+
 // Around (1Mbps / 8 bits/byte / 12 bytes per message)
 #define CAN_INTERRUPT_RATE 12000U
 
@@ -46,6 +51,10 @@
 
 #include "drivers/registers.h"
 #include "drivers/interrupts.h"
+#ifndef BOOTSTUB
+  #include "drivers/time_sync.h"
+#endif
+#include "drivers/trace.h"
 #include "drivers/gpio.h"
 #include "stm32f4/peripherals.h"
 #include "stm32f4/interrupt_handlers.h"
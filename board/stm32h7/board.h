@@ -5,6 +5,7 @@
 #include "boards/unused_funcs.h"
 
 // ///// Board definition and detection ///// //
+#include "drivers/adc.h"
 #include "stm32h7/lladc.h"
 #include "drivers/harness.h"
 #include "drivers/fan.h"
@@ -12,9 +13,14 @@
 #include "drivers/fake_siren.h"
 #include "stm32h7/sound.h"
 #include "drivers/clock_source.h"
+// tres builds on red, and cuatro on tres
 #include "boards/red.h"
-#include "boards/tres.h"
-#include "boards/cuatro.h"
+#if !defined(FIXED_BOARD) || (FIXED_HW_TYPE != HW_TYPE_RED_PANDA)
+  #include "boards/tres.h"
+#endif
+#if !defined(FIXED_BOARD) || (FIXED_HW_TYPE == HW_TYPE_CUATRO)
+  #include "boards/cuatro.h"
+#endif
 
 
 void detect_board_type(void) {
@@ -31,19 +37,28 @@ void detect_board_type(void) {
 
   if (id2 == 3U) {
     hw_type = HW_TYPE_CUATRO;
-    current_board = &board_cuatro;
   } else if (id1 == 0U) {
     hw_type = HW_TYPE_RED_PANDA;
-    current_board = &board_red;
   } else if (id1 == 1U) {
     // deprecated
     //hw_type = HW_TYPE_RED_PANDA_V2;
     hw_type = HW_TYPE_UNKNOWN;
   } else if (id1 == 2U) {
     hw_type = HW_TYPE_TRES;
-    current_board = &board_tres;
   } else {
     hw_type = HW_TYPE_UNKNOWN;
     print("Hardware type is UNKNOWN!\n");
   }
+
+#ifndef FIXED_BOARD
+  if (hw_type == HW_TYPE_CUATRO) {
+    current_board = &board_cuatro;
+  } else if (hw_type == HW_TYPE_RED_PANDA) {
+    current_board = &board_red;
+  } else if (hw_type == HW_TYPE_TRES) {
+    current_board = &board_tres;
+  } else {
+    // unsupported
+  }
+#endif
 }
@@ -14,12 +14,20 @@ void adc_init(void) {
   while(!(ADC1->ISR & ADC_ISR_ADRDY));
 }
 
-static uint16_t adc_get_raw(uint8_t channel) {
+static void adc_set_sample_time(uint8_t channel) {
+  if (channel < 10U) {
+    ADC1->SMPR1 = (ADC1->SMPR1 & ~(0x7UL << (channel * 3UL))) | (0x4UL << (channel * 3UL));
+  } else {
+    ADC1->SMPR2 = (ADC1->SMPR2 & ~(0x7UL << ((channel - 10U) * 3UL))) | (0x4UL << ((channel - 10U) * 3UL));
+  }
+}
+
+uint16_t adc_read_raw(uint8_t channel) {
   uint16_t res = 0U;
   ADC1->SQR1 &= ~(ADC_SQR1_L);
   ADC1->SQR1 = (uint32_t)channel << 6U;
 
-  ADC1->SMPR1 = 0x4UL << (channel * 3UL);
+  adc_set_sample_time(channel);
   ADC1->PCSEL_RES0 = (0x1UL << channel);
   ADC1->CFGR2 = (63UL << ADC_CFGR2_OVSR_Pos) | (0x6U << ADC_CFGR2_OVSS_Pos) | ADC_CFGR2_ROVSE;
 
@@ -34,6 +42,50 @@ static uint16_t adc_get_raw(uint8_t channel) {
   return res;
 }
 
-uint16_t adc_get_mV(uint8_t channel) {
-  return (adc_get_raw(channel) * current_board->avdd_mV) / 65535U;
+uint16_t adc_raw_to_mV(uint16_t raw) {
+  return (raw * current_board->avdd_mV) / 65535U;
+}
+
+static void DMA1_Stream2_IRQ_Handler(void) {
+  DMA1->LIFCR = (DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2);
+  ADC1->ISR |= (ADC_ISR_EOC | ADC_ISR_EOS | ADC_ISR_OVR);
+  adc_scan_done();
+}
+
+void adc_scan_init(void) {
+  REGISTER_INTERRUPT(DMA1_Stream2_IRQn, DMA1_Stream2_IRQ_Handler, 100U, FAULT_INTERRUPT_RATE_ADC_DMA)
+
+  // ADC1 -> memory, one-shot DMA mode
+  register_set(&(DMAMUX1_Channel2->CCR), 9U, 0xFFFFFFFFU);
+  register_set(&(DMA1_Stream2->CR), (DMA_SxCR_PSIZE_0 | DMA_SxCR_MSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_TCIE), 0x1E077EFEU);
+  register_set(&(DMA1_Stream2->PAR), (uint32_t)&(ADC1->DR), 0xFFFFFFFFU);
+  ADC1->CFGR = (ADC1->CFGR & ~(ADC_CFGR_DMNGT | ADC_CFGR_CONT)) | ADC_CFGR_DMNGT_0;
+
+  NVIC_EnableIRQ(DMA1_Stream2_IRQn);
+}
+
+void adc_scan_dma_start(const uint8_t *channels, uint8_t len, volatile uint16_t *res) {
+  uint32_t sqr1 = (uint32_t)(len - 1U);
+  uint32_t sqr2 = 0U;
+  uint32_t pcsel = 0U;
+  for (uint8_t i = 0U; i < len; i++) {
+    if (i < 4U) {
+      sqr1 |= (uint32_t)channels[i] << (ADC_SQR1_SQ1_Pos + (6U * i));
+    } else {
+      sqr2 |= (uint32_t)channels[i] << (ADC_SQR2_SQ5_Pos + (6U * (i - 4U)));
+    }
+    adc_set_sample_time(channels[i]);
+    pcsel |= (0x1UL << channels[i]);
+  }
+  ADC1->SQR1 = sqr1;
+  ADC1->SQR2 = sqr2;
+  ADC1->PCSEL_RES0 = pcsel;
+  ADC1->CFGR2 = (63UL << ADC_CFGR2_OVSR_Pos) | (0x6U << ADC_CFGR2_OVSS_Pos) | ADC_CFGR2_ROVSE;
+
+  DMA1_Stream2->CR &= ~DMA_SxCR_EN;
+  register_set(&(DMA1_Stream2->M0AR), (uint32_t)res, 0xFFFFFFFFU);
+  DMA1_Stream2->NDTR = len;
+  DMA1_Stream2->CR |= DMA_SxCR_EN;
+
+  ADC1->CR |= ADC_CR_ADSTART;
 }
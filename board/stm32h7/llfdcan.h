@@ -225,3 +225,12 @@ void llcan_clear_send(FDCAN_GlobalTypeDef *FDCANx) {
   bool ret = llcan_init(FDCANx);
   UNUSED(ret);
 }
+
+// releases RX FIFO 0 elements up to and including idx
+CAN_FAST_CODE void llcan_rx_ack(FDCAN_GlobalTypeDef *FDCANx, uint32_t idx) {
+  FDCANx->RXF0A = idx;
+}
+
+CAN_FAST_CODE void llcan_tx_request(FDCAN_GlobalTypeDef *FDCANx, uint32_t idx) {
+  FDCANx->TXBAR = (1UL << idx);
+}
@@ -51,3 +51,5 @@ void llcan_irq_disable(const FDCAN_GlobalTypeDef *FDCANx);
 void llcan_irq_enable(const FDCAN_GlobalTypeDef *FDCANx);
 bool llcan_init(FDCAN_GlobalTypeDef *FDCANx);
 void llcan_clear_send(FDCAN_GlobalTypeDef *FDCANx);
+void llcan_rx_ack(FDCAN_GlobalTypeDef *FDCANx, uint32_t idx);
+void llcan_tx_request(FDCAN_GlobalTypeDef *FDCANx, uint32_t idx);
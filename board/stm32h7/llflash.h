@@ -7,17 +7,33 @@ void flash_unlock(void) {
   FLASH->KEYR1 = 0xCDEF89AB;
 }
 
-bool flash_erase_sector(uint8_t sector, bool unlocked) {
+bool flash_busy(void) {
+  return (FLASH->SR1 & FLASH_SR_QW) != 0U;
+}
+
+// doesn't wait for the erase to finish, poll flash_busy. Code fetches from
+// the same bank stall until it's done.
+bool flash_erase_sector_start(uint8_t sector, bool unlocked) {
   // don't erase the bootloader(sector 0)
   if (sector != 0 && sector < 8 && unlocked) {
     FLASH->CR1 = (sector << 8) | FLASH_CR_SER;
     FLASH->CR1 |= FLASH_CR_START;
-    while (FLASH->SR1 & FLASH_SR_QW);
     return true;
   }
   return false;
 }
 
+bool flash_erase_sector(uint8_t sector, bool unlocked) {
+  bool ret = flash_erase_sector_start(sector, unlocked);
+  while (flash_busy());
+  return ret;
+}
+
+// first address past the sector, all sectors are 128K
+uint32_t flash_sector_end(uint8_t sector) {
+  return 0x8000000U + ((uint32_t)(sector + 1U) * 0x20000U);
+}
+
 void flash_write_word(void *prog_ptr, uint32_t data) {
   uint32_t *pp = prog_ptr;
   FLASH->CR1 |= FLASH_CR_PG;
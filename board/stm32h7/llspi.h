@@ -1,10 +1,11 @@
 #if defined(ENABLE_SPI) || defined(BOOTSTUB)
+// Per-transfer writes bypass register_set, these bits are not in the check mask.
 // master -> panda DMA start
 void llspi_mosi_dma(uint8_t *addr, int len) {
   // disable DMA + SPI
-  register_clear_bits(&(SPI4->CFG1), SPI_CFG1_RXDMAEN);
+  SPI4->CFG1 &= ~SPI_CFG1_RXDMAEN;
   DMA2_Stream2->CR &= ~DMA_SxCR_EN;
-  register_clear_bits(&(SPI4->CR1), SPI_CR1_SPE);
+  SPI4->CR1 &= ~SPI_CR1_SPE;
 
   // drain the bus
   while ((SPI4->SR & SPI_SR_RXP) != 0U) {
@@ -14,39 +15,39 @@ void llspi_mosi_dma(uint8_t *addr, int len) {
 
   // clear all pending
   SPI4->IFCR |= (0x1FFU << 3U);
-  register_set(&(SPI4->IER), 0, 0x3FFU);
+  SPI4->IER = 0U;
 
   // setup destination and length
-  register_set(&(DMA2_Stream2->M0AR), (uint32_t)addr, 0xFFFFFFFFU);
+  DMA2_Stream2->M0AR = (uint32_t)addr;
   DMA2_Stream2->NDTR = len;
 
   // enable DMA + SPI
   DMA2_Stream2->CR |= DMA_SxCR_EN;
-  register_set_bits(&(SPI4->CFG1), SPI_CFG1_RXDMAEN);
-  register_set_bits(&(SPI4->CR1), SPI_CR1_SPE);
+  SPI4->CFG1 |= SPI_CFG1_RXDMAEN;
+  SPI4->CR1 |= SPI_CR1_SPE;
 }
 
 // panda -> master DMA start
 void llspi_miso_dma(uint8_t *addr, int len) {
   // disable DMA + SPI
   DMA2_Stream3->CR &= ~DMA_SxCR_EN;
-  register_clear_bits(&(SPI4->CFG1), SPI_CFG1_TXDMAEN);
-  register_clear_bits(&(SPI4->CR1), SPI_CR1_SPE);
+  SPI4->CFG1 &= ~SPI_CFG1_TXDMAEN;
+  SPI4->CR1 &= ~SPI_CR1_SPE;
 
   // setup source and length
-  register_set(&(DMA2_Stream3->M0AR), (uint32_t)addr, 0xFFFFFFFFU);
+  DMA2_Stream3->M0AR = (uint32_t)addr;
   DMA2_Stream3->NDTR = len;
 
   // clear under-run while we were reading
   SPI4->IFCR |= (0x1FFU << 3U);
 
   // setup interrupt on TXC
-  register_set(&(SPI4->IER), (1U << SPI_IER_EOTIE_Pos), 0x3FFU);
+  SPI4->IER = (1U << SPI_IER_EOTIE_Pos);
 
   // enable DMA + SPI
-  register_set_bits(&(SPI4->CFG1), SPI_CFG1_TXDMAEN);
+  SPI4->CFG1 |= SPI_CFG1_TXDMAEN;
   DMA2_Stream3->CR |= DMA_SxCR_EN;
-  register_set_bits(&(SPI4->CR1), SPI_CR1_SPE);
+  SPI4->CR1 |= SPI_CR1_SPE;
 }
 
 static bool spi_tx_dma_done = false;
@@ -96,10 +97,11 @@ void llspi_init(void) {
   register_set(&(DMA2_Stream3->PAR), (uint32_t)&(SPI4->TXDR), 0xFFFFFFFFU);
 
   // Enable SPI
-  register_set(&(SPI4->IER), 0, 0x3FFU);
+  register_set(&(SPI4->IER), 0, 0x3FFU & ~SPI_IER_EOTIE);
   register_set(&(SPI4->CFG1), (7U << SPI_CFG1_DSIZE_Pos), SPI_CFG1_DSIZE_Msk);
   register_set(&(SPI4->UDRDR), 0xcd, 0xFFFFU);  // set under-run value for debugging
-  register_set(&(SPI4->CR1), SPI_CR1_SPE, 0xFFFFU);
+  register_set(&(SPI4->CR1), 0U, 0xFFFFU & ~SPI_CR1_SPE);  // SPE is toggled per transfer
+  SPI4->CR1 |= SPI_CR1_SPE;
   register_set(&(SPI4->CR2), 0, 0xFFFFU);
 
   NVIC_EnableIRQ(DMA2_Stream2_IRQn);
@@ -10,6 +10,7 @@ static void uart_rx_ring(uart_ring *q){
   if ((next_w_ptr == q->r_ptr_rx) && q->overwrite) {
     // overwrite mode: drop oldest byte
     q->r_ptr_rx = (q->r_ptr_rx + 1U) % q->rx_fifo_size;
+    q->dropped += 1U;
   }
 
   // Do not overwrite buffer data
@@ -19,15 +20,44 @@ static void uart_rx_ring(uart_ring *q){
     if (q->callback != NULL) {
       q->callback(q);
     }
+  } else {
+    q->dropped += 1U;
   }
 
   EXIT_CRITICAL();
 }
 
+// UART7 TX runs on DMA1 stream 3, one contiguous chunk of the ring at a time
+static void uart_tx_dma_start(uart_ring *q) {
+  if ((q->tx_dma_len == 0U) && (q->w_ptr_tx != q->r_ptr_tx)) {
+    uint16_t len = (q->w_ptr_tx > q->r_ptr_tx) ? (q->w_ptr_tx - q->r_ptr_tx) : (uint16_t)(q->tx_fifo_size - q->r_ptr_tx);
+    q->tx_dma_len = len;
+    DMA1_Stream3->M0AR = (uint32_t)&(q->elems_tx[q->r_ptr_tx]);
+    DMA1_Stream3->NDTR = len;
+    DMA1_Stream3->CR |= DMA_SxCR_EN;
+  }
+}
+
+static void DMA1_Stream3_IRQ_Handler(void) {
+  DMA1->LIFCR = (DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3);
+
+  ENTER_CRITICAL();
+  uart_ring *q = &uart_ring_som_debug;
+  q->r_ptr_tx = (q->r_ptr_tx + q->tx_dma_len) % q->tx_fifo_size;
+  q->tx_dma_len = 0U;
+  uart_tx_dma_start(q);
+  EXIT_CRITICAL();
+
+  // host writes to the SOM UART may be waiting for room
+  comms_endpoint2_resume_usb();
+}
+
 void uart_tx_ring(uart_ring *q){
   ENTER_CRITICAL();
-  // Send out next byte of TX buffer
-  if (q->w_ptr_tx != q->r_ptr_tx) {
+  if (q->uart == UART7) {
+    uart_tx_dma_start(q);
+  } else if (q->w_ptr_tx != q->r_ptr_tx) {
+    // Send out next byte of TX buffer
     // Only send if transmit register is empty (aka last byte has been sent)
     if ((q->uart->ISR & USART_ISR_TXE_TXFNF) != 0U) {
       q->uart->TDR = q->elems_tx[q->r_ptr_tx];   // This clears TXE
@@ -100,7 +130,15 @@ void uart_init(uart_ring *q, int baud) {
     // Enable interrupt on RX not empty
     q->uart->CR1 |= USART_CR1_RXNEIE;
 
+    // TX by DMA: memory -> UART7 TDR
+    REGISTER_INTERRUPT(DMA1_Stream3_IRQn, DMA1_Stream3_IRQ_Handler, 5000U, FAULT_INTERRUPT_RATE_UART_DMA)
+    register_set(&(DMAMUX1_Channel3->CCR), 80U, 0xFFFFFFFFU); // uart7_tx_dma
+    register_set(&(DMA1_Stream3->PAR), (uint32_t)&(q->uart->TDR), 0xFFFFFFFFU);
+    register_set(&(DMA1_Stream3->CR), (DMA_SxCR_DIR_0 | DMA_SxCR_MINC | DMA_SxCR_TCIE), 0x1E077EFEU);
+    register_set_bits(&(q->uart->CR3), USART_CR3_DMAT);
+
     // Enable UART interrupts
     NVIC_EnableIRQ(UART7_IRQn);
+    NVIC_EnableIRQ(DMA1_Stream3_IRQn);
   }
 }
@@ -44,6 +44,10 @@ defined in linker script */
 .word  _sbss
 /* end address for the .bss section. defined in linker script */
 .word  _ebss
+/* load, start and end address of the ITCM code. defined in linker script */
+.word  _siitcm_text
+.word  _sitcm_text
+.word  _eitcm_text
 /* stack used for SystemInit_ExtMemCtl; always internal RAM used */
 
 /**
@@ -78,6 +82,25 @@ LoopCopyDataInit:
   adds r4, r0, r3
   cmp r4, r1
   bcc CopyDataInit
+
+/* Copy the ITCM code from flash */
+  ldr r0, =_sitcm_text
+  ldr r1, =_eitcm_text
+  ldr r2, =_siitcm_text
+  movs r3, #0
+  b LoopCopyItcmInit
+
+CopyItcmInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyItcmInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyItcmInit
+  dsb
+  isb
 /* Zero fill the bss segment. */
   ldr r2, =_sbss
   ldr r4, =_ebss
@@ -11,6 +11,18 @@
 
 #define BOOTLOADER_ADDRESS 0x1FF09804U
 
+// CAN interrupt path, run from ITCM without flash wait states. Build with DISABLE_ITCM_CODE to compare.
+#if !defined(BOOTSTUB) && !defined(DISABLE_ITCM_CODE)
+  #define CAN_FAST_CODE __attribute__((section(".itcm_text")))
+  #define CAN_FAST_CODE_IN_ITCM 1U
+#else
+  #define CAN_FAST_CODE
+  #define CAN_FAST_CODE_IN_ITCM 0U
+#endif
+
+// large buffers only the CPU uses, kept out of DTCM which holds .data, .bss and the stack
+#define SRAM12_DATA __attribute__((section(".sram12")))
+
 /*
 An IRQ is received on message RX/TX (or RX errors), with
 separate IRQs for RX and TX.
@@ -59,6 +71,10 @@ separate IRQs for RX and TX.
 
 #include "drivers/registers.h"
 #include "drivers/interrupts.h"
+#ifndef BOOTSTUB
+  #include "drivers/time_sync.h"
+#endif
+#include "drivers/trace.h"
 #include "drivers/gpio.h"
 #include "stm32h7/peripherals.h"
 #include "stm32h7/interrupt_handlers.h"
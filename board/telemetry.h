@@ -0,0 +1,61 @@
+// ******************** In-band telemetry ********************
+// Health and CAN health packets are pushed into the CAN RX stream as
+// frames on a reserved bus, so the host gets them with its CAN reads.
+// Packets larger than CANPACKET_DATA_SIZE_MAX are split into chunks.
+//
+// addr: [19:16] record type, [15:8] packet version, [7:0] chunk index
+
+#define TELEMETRY_BUS 7U
+#define TELEMETRY_HEALTH 0U
+#define TELEMETRY_CAN_HEALTH 1U  // + can number
+
+#define TELEMETRY_TICK_HZ 8U
+
+static uint8_t telemetry_period = 0U;  // in ticks, 0 = disabled
+
+void telemetry_set_rate(uint16_t rate_hz) {
+  if (rate_hz == 0U) {
+    telemetry_period = 0U;
+  } else {
+    telemetry_period = TELEMETRY_TICK_HZ / MIN(rate_hz, TELEMETRY_TICK_HZ);
+  }
+}
+
+static void telemetry_push(uint8_t type, uint8_t version, const uint8_t *dat, uint32_t len) {
+  uint32_t chunk = 0U;
+  for (uint32_t pos = 0U; pos < len; pos += CANPACKET_DATA_SIZE_MAX) {
+    CANPacket_t to_push = {0};
+    uint32_t chunk_len = MIN(len - pos, CANPACKET_DATA_SIZE_MAX);
+
+    to_push.fd = (CANPACKET_DATA_SIZE_MAX > 8U) ? 1U : 0U;
+    to_push.bus = TELEMETRY_BUS;
+    to_push.extended = 1U;
+    to_push.addr = ((uint32_t)type << 16) | ((uint32_t)version << 8) | chunk;
+    to_push.data_len_code = (CANPACKET_DATA_SIZE_MAX > 8U) ? 15U : 8U;
+    (void)memcpy(to_push.data, &dat[pos], chunk_len);
+    can_set_checksum(&to_push);
+
+    rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    chunk += 1U;
+  }
+}
+
+// called at 8Hz
+void telemetry_tick(void) {
+  static uint8_t tick_cnt = 0U;
+
+  if (telemetry_period != 0U) {
+    tick_cnt += 1U;
+    if (tick_cnt >= telemetry_period) {
+      tick_cnt = 0U;
+
+      uint8_t dat[USBPACKET_MAX_SIZE];
+      int len = get_health_pkt(dat);
+      telemetry_push(TELEMETRY_HEALTH, HEALTH_PACKET_VERSION, dat, (uint32_t)len);
+      for (uint8_t i = 0U; i < PANDA_CAN_CNT; i++) {
+        len = get_can_health_pkt(i, dat);
+        telemetry_push(TELEMETRY_CAN_HEALTH + i, CAN_HEALTH_PACKET_VERSION, dat, (uint32_t)len);
+      }
+    }
+  }
+}
@@ -25,7 +25,8 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-// Optimized for minimal code size.
+// Word oriented with an unrolled round loop, whole blocks are hashed straight
+// from the input. The bootstub hashes the full app image on every boot.
 
 void *memcpy(void *str1, const void *str2, unsigned int n);
 
@@ -33,54 +34,74 @@ void *memcpy(void *str1, const void *str2, unsigned int n);
 
 #define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static void SHA1_Transform(SHA_CTX* ctx) {
-    uint32_t W[80];
-    uint32_t A, B, C, D, E;
-    uint8_t* p = ctx->buf;
+#define LOAD_BE32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+                      ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+// message schedule kept as a 16 word ring
+#define W(t) (W[(t) & 15] = rol(1, W[((t) + 13) & 15] ^ W[((t) + 8) & 15] ^ \
+                                   W[((t) + 2) & 15] ^ W[(t) & 15]))
+
+#define F1(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F2(b, c, d) ((b) ^ (c) ^ (d))
+#define F3(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+
+#define ROUND(a, b, c, d, e, f, k, w) do { \
+    (e) += rol(5, (a)) + f((b), (c), (d)) + (k) + (w); \
+    (b) = rol(30, (b)); \
+} while (0)
+
+#define ROUND5(t, f, k, w) do { \
+    ROUND(A, B, C, D, E, f, k, w((t) + 0)); \
+    ROUND(E, A, B, C, D, f, k, w((t) + 1)); \
+    ROUND(D, E, A, B, C, f, k, w((t) + 2)); \
+    ROUND(C, D, E, A, B, f, k, w((t) + 3)); \
+    ROUND(B, C, D, E, A, f, k, w((t) + 4)); \
+} while (0)
+
+#define WIN(t) (W[(t)])
+
+static void SHA1_Transform(uint32_t* state, const uint8_t* p) {
+    uint32_t W[16];
+    uint32_t A = state[0];
+    uint32_t B = state[1];
+    uint32_t C = state[2];
+    uint32_t D = state[3];
+    uint32_t E = state[4];
     int t;
 
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
+    for (t = 0; t < 16; ++t) {
+        W[t] = LOAD_BE32(p + (4 * t));
     }
 
-    for(; t < 80; t++) {
-        W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
-    }
-
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-
-    for(t = 0; t < 80; t++) {
-        uint32_t tmp = rol(5,A) + E + W[t];
-
-        if (t < 20)
-            tmp += (D^(B&(C^D))) + 0x5A827999;
-        else if ( t < 40)
-            tmp += (B^C^D) + 0x6ED9EBA1;
-        else if ( t < 60)
-            tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
-        else
-            tmp += (B^C^D) + 0xCA62C1D6;
-
-        E = D;
-        D = C;
-        C = rol(30,B);
-        B = A;
-        A = tmp;
-    }
-
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
+    ROUND5(0, F1, 0x5A827999, WIN);
+    ROUND5(5, F1, 0x5A827999, WIN);
+    ROUND5(10, F1, 0x5A827999, WIN);
+    ROUND(A, B, C, D, E, F1, 0x5A827999, W[15]);
+    ROUND(E, A, B, C, D, F1, 0x5A827999, W(16));
+    ROUND(D, E, A, B, C, F1, 0x5A827999, W(17));
+    ROUND(C, D, E, A, B, F1, 0x5A827999, W(18));
+    ROUND(B, C, D, E, A, F1, 0x5A827999, W(19));
+
+    ROUND5(20, F2, 0x6ED9EBA1, W);
+    ROUND5(25, F2, 0x6ED9EBA1, W);
+    ROUND5(30, F2, 0x6ED9EBA1, W);
+    ROUND5(35, F2, 0x6ED9EBA1, W);
+
+    ROUND5(40, F3, 0x8F1BBCDC, W);
+    ROUND5(45, F3, 0x8F1BBCDC, W);
+    ROUND5(50, F3, 0x8F1BBCDC, W);
+    ROUND5(55, F3, 0x8F1BBCDC, W);
+
+    ROUND5(60, F2, 0xCA62C1D6, W);
+    ROUND5(65, F2, 0xCA62C1D6, W);
+    ROUND5(70, F2, 0xCA62C1D6, W);
+    ROUND5(75, F2, 0xCA62C1D6, W);
+
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
 }
 
 static const HASH_VTAB SHA_VTAB = {
@@ -108,13 +129,28 @@ void SHA_update(SHA_CTX* ctx, const void* data, int len) {
 
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
+    // top up a partial block first
+    if (i != 0) {
+        while ((len > 0) && (i < 64)) {
+            ctx->buf[i++] = *p++;
+            len--;
+        }
         if (i == 64) {
-            SHA1_Transform(ctx);
+            SHA1_Transform(ctx->state, ctx->buf);
             i = 0;
         }
     }
+
+    // whole blocks straight from the input
+    while (len >= 64) {
+        SHA1_Transform(ctx->state, p);
+        p += 64;
+        len -= 64;
+    }
+
+    while (len-- > 0) {
+        ctx->buf[i++] = *p++;
+    }
 }
 
 
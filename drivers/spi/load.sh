@@ -12,7 +12,7 @@ sudo dmesg -C
 
 #sudo rmmod -f spidev_panda
 sudo rmmod spidev_panda || true
-sudo insmod spidev_panda.ko
+sudo insmod spidev_panda.ko ${CAN_NETDEV:+can_netdev=1}
 
 sudo su -c "echo 'file $DIR/spidev_panda.c +p' > /sys/kernel/debug/dynamic_debug/control"
 sudo su -c "echo 'file $DIR/spi_panda.h +p' > /sys/kernel/debug/dynamic_debug/control"
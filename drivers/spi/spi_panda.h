@@ -1,6 +1,7 @@
 #include <linux/delay.h>
 #include <linux/spi/spi.h>
 #include <linux/spi/spidev.h>
+#include <linux/version.h>
 
 #define SPI_SYNC 0x5AU
 #define SPI_HACK 0x79U
@@ -53,11 +54,11 @@ static long panda_wait_for_ack(struct spidev_data *spidev, u8 ack_val, u8 length
   return -1;
 }
 
-static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *spi, unsigned long arg) {
+// pt->tx_buf and pt->rx_buf are user pointers if user is set, kernel pointers otherwise
+static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *spi, const struct spi_panda_transfer *pt, bool user) {
   u16 rx_len;
   long retval = -1;
   struct spi_header header;
-  struct spi_panda_transfer pt;
 
   struct spi_transfer t = {
     .len = 0,
@@ -70,20 +71,16 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
   spi_message_init(&m);
   spi_message_add_tail(&t, &m);
 
-  // read struct from user
-  if (!access_ok(VERIFY_WRITE, arg, sizeof(pt))) {
-    return -1;
+  if (pt->tx_length >= bufsiz) {
+    return -EMSGSIZE;
   }
-  if (copy_from_user(&pt, (void __user *)arg, sizeof(pt))) {
-    return -1;
-  }
-  dev_dbg(&spi->dev, "ep: %d, tx len: %d\n", pt.endpoint, pt.tx_length);
+  dev_dbg(&spi->dev, "ep: %d, tx len: %d\n", pt->endpoint, pt->tx_length);
 
   // send header
   header.sync = 0x5a;
-  header.endpoint = pt.endpoint;
-  header.tx_len = pt.tx_length;
-  header.max_rx_len = pt.rx_length_max;
+  header.endpoint = pt->endpoint;
+  header.tx_len = pt->tx_length;
+  header.max_rx_len = pt->rx_length_max;
   memcpy(spidev->tx_buffer, &header, sizeof(header));
   spidev->tx_buffer[sizeof(header)] = panda_calc_checksum(spidev->tx_buffer, sizeof(header));
 
@@ -103,12 +100,18 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
 
   // send data
   dev_dbg(&spi->dev, "sending data\n");
-  retval = copy_from_user(spidev->tx_buffer, (const u8 __user *)(uintptr_t)pt.tx_buf, pt.tx_length);
-  spidev->tx_buffer[pt.tx_length] = panda_calc_checksum(spidev->tx_buffer, pt.tx_length);
-  t.len = pt.tx_length + 1;
+  if (user) {
+    if (copy_from_user(spidev->tx_buffer, (const u8 __user *)(uintptr_t)pt->tx_buf, pt->tx_length)) {
+      return -EFAULT;
+    }
+  } else if (pt->tx_length > 0U) {
+    memcpy(spidev->tx_buffer, (const u8 *)(uintptr_t)pt->tx_buf, pt->tx_length);
+  }
+  spidev->tx_buffer[pt->tx_length] = panda_calc_checksum(spidev->tx_buffer, pt->tx_length);
+  t.len = pt->tx_length + 1;
   retval = spidev_sync(spidev, &m);
 
-  if (pt.expect_disconnect) {
+  if (pt->expect_disconnect) {
     return 0;
   }
 
@@ -123,7 +126,7 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
   t.rx_buf = spidev->rx_buffer + 3;
   rx_len = (spidev->rx_buffer[2] << 8) | (spidev->rx_buffer[1]);
   dev_dbg(&spi->dev, "rx len %u\n", rx_len);
-  if (rx_len > pt.rx_length_max) {
+  if ((rx_len > pt->rx_length_max) || ((3U + rx_len + 1U) > bufsiz)) {
     dev_dbg(&spi->dev, "RX len greater than max\n");
     return -1;
   }
@@ -140,21 +143,68 @@ static long panda_transfer_raw(struct spidev_data *spidev, struct spi_device *sp
     return -1;
   }
 
-  retval = copy_to_user((u8 __user *)(uintptr_t)pt.rx_buf, spidev->rx_buffer + 3, rx_len);
+  if (user) {
+    if (copy_to_user((u8 __user *)(uintptr_t)pt->rx_buf, spidev->rx_buffer + 3, rx_len)) {
+      return -EFAULT;
+    }
+  } else if (rx_len > 0U) {
+    memcpy((u8 *)(uintptr_t)pt->rx_buf, spidev->rx_buffer + 3, rx_len);
+  }
 
   return rx_len;
 }
 
-static long panda_transfer(struct spidev_data *spidev, struct spi_device *spi, unsigned long arg) {
+static long panda_transfer_retry(struct spidev_data *spidev, struct spi_device *spi, const struct spi_panda_transfer *pt, bool user) {
   int i;
-  int ret;
+  long ret = -1;
   dev_dbg(&spi->dev, "=== XFER start ===\n");
   for (i = 0; i < 20; i++) {
-    ret = panda_transfer_raw(spidev, spi, arg);
-    if (ret >= 0) {
+    ret = panda_transfer_raw(spidev, spi, pt, user);
+    if ((ret >= 0) || (ret == -EFAULT)) {
       break;
     }
   }
   dev_dbg(&spi->dev, "took %d tries\n", i+1);
   return ret;
 }
+
+static long panda_transfer(struct spidev_data *spidev, struct spi_device *spi, unsigned long arg) {
+  struct spi_panda_transfer pt;
+
+  // read struct from user, access_ok lost its type argument in 5.0
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+  if (!access_ok((void __user *)arg, sizeof(pt))) {
+#else
+  if (!access_ok(VERIFY_WRITE, arg, sizeof(pt))) {
+#endif
+    return -1;
+  }
+  if (copy_from_user(&pt, (void __user *)arg, sizeof(pt))) {
+    return -1;
+  }
+  return panda_transfer_retry(spidev, spi, &pt, true);
+}
+
+// in-kernel transfer, caller holds buf_lock
+static long panda_transfer_kernel(struct spidev_data *spidev, u8 endpoint, const void *tx, u16 tx_len, void *rx, u16 rx_len_max) {
+  struct spi_panda_transfer pt = {
+    .rx_buf = (uintptr_t)rx,
+    .tx_buf = (uintptr_t)tx,
+    .tx_length = tx_len,
+    .rx_length_max = rx_len_max,
+    .timeout = 0,
+    .endpoint = endpoint,
+    .expect_disconnect = 0,
+  };
+  return panda_transfer_retry(spidev, spidev->spi, &pt, false);
+}
+
+static long panda_control_kernel(struct spidev_data *spidev, u8 request, u16 param1, u16 param2, void *rx, u16 rx_len_max) {
+  struct __attribute__((packed)) {
+    u8 request;
+    u16 param1;
+    u16 param2;
+    u16 length;
+  } setup = {request, param1, param2, rx_len_max};
+  return panda_transfer_kernel(spidev, 0, &setup, sizeof(setup), rx, rx_len_max);
+}
@@ -0,0 +1,696 @@
+#include <linux/netdevice.h>
+#include <linux/kthread.h>
+#include <linux/skbuff.h>
+#include <linux/wait.h>
+#include <linux/can.h>
+#include <linux/can/dev.h>
+#include <linux/can/error.h>
+#include <linux/version.h>
+
+/*
+ * SocketCAN mode: with can_netdev=1 every panda gets one CAN netdev per bus.
+ * A kernel thread owns the CAN endpoints while any of them is up, so don't
+ * run the python CAN stack against the same panda at the same time.
+ * Safety mode, version, serial and health are exposed in sysfs on the SPI
+ * device, reachable as /sys/class/net/canX/device/. The heartbeat is sent
+ * when userspace writes the heartbeat attribute, never by the driver, so
+ * the firmware's heartbeat check still catches a dead userspace.
+ *
+ * RX is polled every can_poll_us, and read again right away while the
+ * panda has more queued. No panda has a line to signal RX data to the SOM.
+ *
+ * The module is built for the agnos kernel, 4.9 (see pull-src.sh). The CAN
+ * part also follows the API changes up to 6.x with the guards below.
+ */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+  #define panda_can_dlc2len can_fd_dlc2len
+  #define panda_can_len2dlc can_fd_len2dlc
+#else
+  #define panda_can_dlc2len can_dlc2len
+  #define panda_can_len2dlc can_len2dlc
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+  // netif_rx is safe from any context, netif_rx_ni is gone
+  #define panda_netif_rx netif_rx
+#else
+  #define panda_netif_rx netif_rx_ni
+#endif
+
+// before 4.11 there are no fixed bitrate tables, the kernel computes a bit
+// timing for the requested bitrate and do_set_bittiming checks the table
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 11, 0)
+  #define PANDA_CAN_NO_BITRATE_CONST
+#endif
+
+static bool can_netdev;
+module_param(can_netdev, bool, S_IRUGO);
+MODULE_PARM_DESC(can_netdev, "register a SocketCAN netdev for each panda bus");
+
+static unsigned can_poll_us = 1000;
+module_param(can_poll_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(can_poll_us, "CAN RX poll interval while idle");
+
+#define PANDA_CAN_BUS_CNT 3
+#define PANDA_XFER_SIZE (0x40 * 31)  // same batch size as python/spi.py
+#define PANDA_CAN_PACKET_VERSION 4
+#define PANDA_CANPACKET_HEAD_SIZE 6
+#define PANDA_CANPACKET_MAX_SIZE (PANDA_CANPACKET_HEAD_SIZE + CANFD_MAX_DLEN)
+#define PANDA_EP_CAN_RX 1
+#define PANDA_EP_CAN_TX 3
+#define PANDA_CAN_TX_QUEUE_MAX 256
+#define PANDA_CAN_RX_XFERS_MAX 8
+#define PANDA_HEALTH_MS 500
+
+struct panda_can {
+  struct spidev_data *spidev;
+  struct net_device *netdev[PANDA_CAN_BUS_CNT];
+  struct task_struct *thread;
+  wait_queue_head_t wait;
+  struct sk_buff_head tx_queue;
+  unsigned open_cnt;  // protected by rtnl
+
+  u16 safety_mode;
+  u16 safety_param;
+  unsigned long next_health;
+
+  u8 tx_buf[PANDA_XFER_SIZE];
+  u32 rx_len;
+  u8 rx_buf[PANDA_XFER_SIZE + PANDA_CANPACKET_MAX_SIZE];
+};
+
+struct panda_can_priv {
+  struct can_priv can;  // must be first
+  struct panda_can *pc;
+  u8 bus;
+  struct can_berr_counter bec;
+};
+
+// same tables as the firmware, in bit/s
+static const u32 panda_can_bitrates[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 1000000};
+static const u32 panda_can_data_bitrates[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 1000000, 2000000, 5000000};
+
+#ifdef PANDA_CAN_NO_BITRATE_CONST
+// only for the kernel's bit timing calculation, the firmware sets its own.
+// All table bitrates divide this clock exactly.
+#define PANDA_CAN_CALC_CLOCK 80000000U
+static const struct can_bittiming_const panda_can_bittiming_const = {
+  .name = "panda",
+  .tseg1_min = 1,
+  .tseg1_max = 256,
+  .tseg2_min = 1,
+  .tseg2_max = 128,
+  .sjw_max = 128,
+  .brp_min = 1,
+  .brp_max = 512,
+  .brp_inc = 1,
+};
+#endif
+
+static bool panda_can_bitrate_valid(u32 bitrate, const u32 *table, unsigned n) {
+  unsigned i;
+  for (i = 0; i < n; i++) {
+    if (table[i] == bitrate) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static long panda_can_control(struct panda_can *pc, u8 request, u16 param1, u16 param2, void *rx, u16 rx_len_max) {
+  long ret;
+  mutex_lock(&pc->spidev->buf_lock);
+  ret = panda_control_kernel(pc->spidev, request, param1, param2, rx, rx_len_max);
+  mutex_unlock(&pc->spidev->buf_lock);
+  return ret;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static void panda_can_wake_queues(struct panda_can *pc) {
+  int i;
+  for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+    if (netif_running(pc->netdev[i]) && netif_queue_stopped(pc->netdev[i])) {
+      netif_wake_queue(pc->netdev[i]);
+    }
+  }
+}
+
+// pack queued frames into one transfer, never splitting a frame
+static void panda_can_tx(struct panda_can *pc) {
+  struct sk_buff_head batch;
+  struct sk_buff *skb;
+  unsigned long flags;
+  u32 pos = 0;
+  long ret;
+
+  __skb_queue_head_init(&batch);
+  while ((skb = skb_peek(&pc->tx_queue)) != NULL) {
+    struct canfd_frame *cf = (struct canfd_frame *)skb->data;
+    struct panda_can_priv *priv = netdev_priv(skb->dev);
+    u8 *hdr = &pc->tx_buf[pos];
+    u32 addr;
+    u32 word;
+    u8 ext;
+    int i;
+
+    if ((pos + PANDA_CANPACKET_HEAD_SIZE + cf->len) > PANDA_XFER_SIZE) {
+      break;
+    }
+    skb = skb_dequeue(&pc->tx_queue);
+
+    ext = (cf->can_id & CAN_EFF_FLAG) ? 1U : 0U;
+    addr = cf->can_id & (ext ? CAN_EFF_MASK : CAN_SFF_MASK);
+    word = (addr << 3) | (ext << 2);
+    hdr[0] = (panda_can_len2dlc(cf->len) << 4) | (priv->bus << 1) | (can_is_canfd_skb(skb) ? 1U : 0U);
+    hdr[1] = word & 0xFFU;
+    hdr[2] = (word >> 8) & 0xFFU;
+    hdr[3] = (word >> 16) & 0xFFU;
+    hdr[4] = (word >> 24) & 0xFFU;
+    memcpy(&hdr[PANDA_CANPACKET_HEAD_SIZE], cf->data, cf->len);
+    hdr[5] = 0U;
+    for (i = 0; i < (PANDA_CANPACKET_HEAD_SIZE + cf->len); i++) {
+      hdr[5] ^= hdr[i];
+    }
+    pos += PANDA_CANPACKET_HEAD_SIZE + cf->len;
+    __skb_queue_tail(&batch, skb);
+  }
+
+  if (pos == 0U) {
+    return;
+  }
+
+  ret = panda_transfer_kernel(pc->spidev, PANDA_EP_CAN_TX, pc->tx_buf, pos, NULL, 0);
+  if (ret < 0) {
+    // panda tx buffers full or link error, retry the batch next round
+    spin_lock_irqsave(&pc->tx_queue.lock, flags);
+    skb_queue_splice(&batch, &pc->tx_queue);
+    spin_unlock_irqrestore(&pc->tx_queue.lock, flags);
+    return;
+  }
+
+  while ((skb = __skb_dequeue(&batch)) != NULL) {
+    struct canfd_frame *cf = (struct canfd_frame *)skb->data;
+    skb->dev->stats.tx_packets++;
+    skb->dev->stats.tx_bytes += cf->len;
+    consume_skb(skb);
+  }
+
+  if (skb_queue_len(&pc->tx_queue) < (PANDA_CAN_TX_QUEUE_MAX / 2)) {
+    panda_can_wake_queues(pc);
+  }
+}
+
+static void panda_can_rx_frame(struct panda_can *pc, const u8 *pkt, u8 len) {
+  u8 bus = (pkt[0] >> 1) & 0x7U;
+  bool fd = (pkt[0] & 0x1U) != 0U;
+  u32 word = pkt[1] | (pkt[2] << 8) | (pkt[3] << 16) | ((u32)pkt[4] << 24);
+  struct net_device *dev;
+  struct canfd_frame *cf;
+  struct sk_buff *skb;
+
+  if (bus >= PANDA_CAN_BUS_CNT) {
+    return;  // telemetry
+  }
+  dev = pc->netdev[bus];
+  if (!netif_running(dev)) {
+    return;
+  }
+
+  if ((pkt[1] & 0x1U) != 0U) {
+    // rejected by the safety mode
+    dev->stats.tx_dropped++;
+    return;
+  }
+  if ((pkt[1] & 0x2U) != 0U) {
+    // returned, local echo is done by the CAN core
+    return;
+  }
+
+  if (fd) {
+    skb = alloc_canfd_skb(dev, &cf);
+  } else {
+    skb = alloc_can_skb(dev, (struct can_frame **)&cf);
+  }
+  if (skb == NULL) {
+    dev->stats.rx_dropped++;
+    return;
+  }
+
+  cf->can_id = word >> 3;
+  if ((word & 0x4U) != 0U) {
+    cf->can_id |= CAN_EFF_FLAG;
+  }
+  cf->len = len;
+  memcpy(cf->data, &pkt[PANDA_CANPACKET_HEAD_SIZE], len);
+
+  dev->stats.rx_packets++;
+  dev->stats.rx_bytes += len;
+  panda_netif_rx(skb);
+}
+
+// frames may straddle transfers, a partial one is kept for the next read
+static void panda_can_rx_parse(struct panda_can *pc) {
+  u32 pos = 0;
+
+  while ((pc->rx_len - pos) >= PANDA_CANPACKET_HEAD_SIZE) {
+    const u8 *pkt = &pc->rx_buf[pos];
+    u8 len = panda_can_dlc2len(pkt[0] >> 4);
+    u8 checksum = 0U;
+    int i;
+
+    if ((pc->rx_len - pos) < (PANDA_CANPACKET_HEAD_SIZE + len)) {
+      break;
+    }
+    for (i = 0; i < (PANDA_CANPACKET_HEAD_SIZE + len); i++) {
+      checksum ^= pkt[i];
+    }
+    if (checksum != 0U) {
+      // lost sync with the stream, drop what we have
+      pc->netdev[0]->stats.rx_errors++;
+      pc->rx_len = 0;
+      return;
+    }
+
+    panda_can_rx_frame(pc, pkt, len);
+    pos += PANDA_CANPACKET_HEAD_SIZE + len;
+  }
+
+  memmove(pc->rx_buf, &pc->rx_buf[pos], pc->rx_len - pos);
+  pc->rx_len -= pos;
+}
+
+// returns true if the panda may still have data
+static bool panda_can_rx(struct panda_can *pc) {
+  long ret;
+  int i;
+
+  for (i = 0; i < PANDA_CAN_RX_XFERS_MAX; i++) {
+    ret = panda_transfer_kernel(pc->spidev, PANDA_EP_CAN_RX, NULL, 0, &pc->rx_buf[pc->rx_len], PANDA_XFER_SIZE);
+    if (ret <= 0) {
+      return ret < 0;
+    }
+    pc->rx_len += ret;
+    panda_can_rx_parse(pc);
+    if (ret < PANDA_XFER_SIZE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void panda_can_health(struct panda_can *pc) {
+  u8 health[16];
+  int i;
+
+  for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+    struct net_device *dev = pc->netdev[i];
+    struct panda_can_priv *priv = netdev_priv(dev);
+    enum can_state state;
+
+    if (!netif_running(dev)) {
+      continue;
+    }
+    // can_health_t prefix: bus_off, bus_off_cnt, error_warning, error_passive, LECs, REC, TEC
+    if (panda_control_kernel(pc->spidev, 0xc2, i, 0, health, sizeof(health)) < 13) {
+      continue;
+    }
+    priv->bec.rxerr = health[11];
+    priv->bec.txerr = health[12];
+
+    if (health[0] != 0U) {
+      state = CAN_STATE_BUS_OFF;
+    } else if (health[6] != 0U) {
+      state = CAN_STATE_ERROR_PASSIVE;
+    } else if (health[5] != 0U) {
+      state = CAN_STATE_ERROR_WARNING;
+    } else {
+      state = CAN_STATE_ERROR_ACTIVE;
+    }
+
+    if (state != priv->can.state) {
+      struct can_frame *cf;
+      struct sk_buff *skb = alloc_can_err_skb(dev, &cf);
+      enum can_state tx_state = (priv->bec.txerr >= priv->bec.rxerr) ? state : CAN_STATE_ERROR_ACTIVE;
+      enum can_state rx_state = (priv->bec.rxerr >= priv->bec.txerr) ? state : CAN_STATE_ERROR_ACTIVE;
+
+      can_change_state(dev, skb ? cf : NULL, tx_state, rx_state);
+      if (skb != NULL) {
+        cf->data[6] = priv->bec.txerr;
+        cf->data[7] = priv->bec.rxerr;
+        panda_netif_rx(skb);
+      }
+    }
+  }
+}
+
+static int panda_can_thread(void *data) {
+  struct panda_can *pc = data;
+  bool rx_left;
+
+  while (!kthread_should_stop()) {
+    mutex_lock(&pc->spidev->buf_lock);
+    panda_can_tx(pc);
+    rx_left = panda_can_rx(pc);
+    if (time_after_eq(jiffies, pc->next_health)) {
+      panda_can_health(pc);
+      pc->next_health = jiffies + msecs_to_jiffies(PANDA_HEALTH_MS);
+    }
+    mutex_unlock(&pc->spidev->buf_lock);
+
+    // the panda still has RX queued, read it without sleeping
+    if (!rx_left) {
+      (void)wait_event_interruptible_hrtimeout(pc->wait, kthread_should_stop() || !skb_queue_empty(&pc->tx_queue),
+                                               ns_to_ktime((u64)can_poll_us * NSEC_PER_USEC));
+    }
+  }
+  return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static int panda_can_open(struct net_device *dev) {
+  struct panda_can_priv *priv = netdev_priv(dev);
+  struct panda_can *pc = priv->pc;
+  u8 versions[3];
+  int err;
+
+  if (pc->open_cnt == 0U) {
+    if ((panda_can_control(pc, 0xdd, 0, 0, versions, sizeof(versions)) < 3) || (versions[1] != PANDA_CAN_PACKET_VERSION)) {
+      netdev_err(dev, "unsupported panda CAN packet version\n");
+      return -EPROTO;
+    }
+  }
+
+  err = open_candev(dev);
+  if (err) {
+    return err;
+  }
+
+  if (pc->open_cnt == 0U) {
+    pc->rx_len = 0;
+    pc->next_health = jiffies;
+    pc->thread = kthread_run(panda_can_thread, pc, "panda_can");
+    if (IS_ERR(pc->thread)) {
+      err = PTR_ERR(pc->thread);
+      pc->thread = NULL;
+      close_candev(dev);
+      return err;
+    }
+  }
+  pc->open_cnt++;
+
+  priv->can.state = CAN_STATE_ERROR_ACTIVE;
+  netif_start_queue(dev);
+  return 0;
+}
+
+static int panda_can_stop(struct net_device *dev) {
+  struct panda_can_priv *priv = netdev_priv(dev);
+  struct panda_can *pc = priv->pc;
+
+  netif_stop_queue(dev);
+  pc->open_cnt--;
+  if (pc->open_cnt == 0U) {
+    kthread_stop(pc->thread);
+    pc->thread = NULL;
+    skb_queue_purge(&pc->tx_queue);
+  }
+  priv->can.state = CAN_STATE_STOPPED;
+  close_candev(dev);
+  return 0;
+}
+
+static netdev_tx_t panda_can_start_xmit(struct sk_buff *skb, struct net_device *dev) {
+  struct panda_can_priv *priv = netdev_priv(dev);
+  struct panda_can *pc = priv->pc;
+  struct canfd_frame *cf = (struct canfd_frame *)skb->data;
+
+  if (can_dropped_invalid_skb(dev, skb)) {
+    return NETDEV_TX_OK;
+  }
+  if ((cf->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) != 0U) {
+    // panda has no remote frames
+    dev->stats.tx_dropped++;
+    kfree_skb(skb);
+    return NETDEV_TX_OK;
+  }
+
+  skb_queue_tail(&pc->tx_queue, skb);
+  if (skb_queue_len(&pc->tx_queue) >= PANDA_CAN_TX_QUEUE_MAX) {
+    int i;
+    for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+      netif_stop_queue(pc->netdev[i]);
+    }
+  }
+  wake_up(&pc->wait);
+  return NETDEV_TX_OK;
+}
+
+static const struct net_device_ops panda_can_netdev_ops = {
+  .ndo_open = panda_can_open,
+  .ndo_stop = panda_can_stop,
+  .ndo_start_xmit = panda_can_start_xmit,
+  .ndo_change_mtu = can_change_mtu,
+};
+
+static int panda_can_set_bittiming(struct net_device *dev) {
+  struct panda_can_priv *priv = netdev_priv(dev);
+  long ret;
+  if (!panda_can_bitrate_valid(priv->can.bittiming.bitrate, panda_can_bitrates, ARRAY_SIZE(panda_can_bitrates))) {
+    return -EINVAL;
+  }
+  ret = panda_can_control(priv->pc, 0xde, priv->bus, priv->can.bittiming.bitrate / 100U, NULL, 0);
+  return (ret < 0) ? -EIO : 0;
+}
+
+static int panda_can_set_data_bittiming(struct net_device *dev) {
+  struct panda_can_priv *priv = netdev_priv(dev);
+  long ret;
+  if (!panda_can_bitrate_valid(priv->can.data_bittiming.bitrate, panda_can_data_bitrates, ARRAY_SIZE(panda_can_data_bitrates))) {
+    return -EINVAL;
+  }
+  ret = panda_can_control(priv->pc, 0xf9, priv->bus, priv->can.data_bittiming.bitrate / 100U, NULL, 0);
+  return (ret < 0) ? -EIO : 0;
+}
+
+static int panda_can_set_mode(struct net_device *dev, enum can_mode mode) {
+  // the firmware recovers from bus off on its own
+  return (mode == CAN_MODE_START) ? 0 : -EOPNOTSUPP;
+}
+
+static int panda_can_get_berr_counter(const struct net_device *dev, struct can_berr_counter *bec) {
+  const struct panda_can_priv *priv = netdev_priv(dev);
+  *bec = priv->bec;
+  return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+
+static struct panda_can *panda_can_from_dev(struct device *dev) {
+  struct spidev_data *spidev = spi_get_drvdata(to_spi_device(dev));
+  return spidev->can;
+}
+
+static ssize_t safety_mode_show(struct device *dev, struct device_attribute *attr, char *buf) {
+  struct panda_can *pc = panda_can_from_dev(dev);
+  return sprintf(buf, "%u %u\n", pc->safety_mode, pc->safety_param);
+}
+
+// "<mode> [param]". Most modes need a heartbeat, see heartbeat_store
+static ssize_t safety_mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  struct panda_can *pc = panda_can_from_dev(dev);
+  unsigned int mode;
+  unsigned int param = 0;
+
+  if ((sscanf(buf, "%u %u", &mode, &param) < 1) || (mode > 0xFFFFU) || (param > 0xFFFFU)) {
+    return -EINVAL;
+  }
+  if (panda_can_control(pc, 0xdc, mode, param, NULL, 0) < 0) {
+    return -EIO;
+  }
+  pc->safety_mode = mode;
+  pc->safety_param = param;
+  return count;
+}
+static DEVICE_ATTR_RW(safety_mode);
+
+// "<engaged>", sends one heartbeat. The process driving the panda writes it
+// about every 100 ms, like Panda.send_heartbeat, and the firmware falls back
+// to a safe mode when the writes stop.
+static ssize_t heartbeat_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+  unsigned int engaged;
+
+  if ((kstrtouint(buf, 0, &engaged) != 0) || (engaged > 1U)) {
+    return -EINVAL;
+  }
+  if (panda_can_control(panda_can_from_dev(dev), 0xf3, engaged, 0, NULL, 0) < 0) {
+    return -EIO;
+  }
+  return count;
+}
+static DEVICE_ATTR_WO(heartbeat);
+
+static ssize_t version_show(struct device *dev, struct device_attribute *attr, char *buf) {
+  long ret = panda_can_control(panda_can_from_dev(dev), 0xd6, 0, 0, buf, 0x40);
+  if (ret < 0) {
+    return -EIO;
+  }
+  buf[ret] = '\n';
+  return ret + 1;
+}
+static DEVICE_ATTR_RO(version);
+
+static ssize_t serial_show(struct device *dev, struct device_attribute *attr, char *buf) {
+  u8 dat[0x20];
+  long ret = panda_can_control(panda_can_from_dev(dev), 0xd0, 0, 0, dat, sizeof(dat));
+  if (ret < 0x1a) {
+    return -EIO;
+  }
+  return sprintf(buf, "%.16s %.10s\n", dat, &dat[0x10]);
+}
+static DEVICE_ATTR_RO(serial);
+
+// raw health_t, see board/health.h
+static ssize_t health_show(struct device *dev, struct device_attribute *attr, char *buf) {
+  long ret = panda_can_control(panda_can_from_dev(dev), 0xd2, 0, 0, buf, 0x40);
+  return (ret < 0) ? -EIO : ret;
+}
+static DEVICE_ATTR_RO(health);
+
+static struct attribute *panda_can_attrs[] = {
+  &dev_attr_safety_mode.attr,
+  &dev_attr_heartbeat.attr,
+  &dev_attr_version.attr,
+  &dev_attr_serial.attr,
+  &dev_attr_health.attr,
+  NULL,
+};
+
+static const struct attribute_group panda_can_attr_group = {
+  .attrs = panda_can_attrs,
+};
+
+/*-------------------------------------------------------------------------*/
+
+// spidev->tx_buffer/rx_buffer stay allocated while the netdevs exist
+static int panda_can_probe(struct spidev_data *spidev) {
+  struct panda_can *pc;
+  int err;
+  int i;
+
+  if (!can_netdev) {
+    return 0;
+  }
+
+  pc = kzalloc(sizeof(*pc), GFP_KERNEL);
+  if (!pc) {
+    return -ENOMEM;
+  }
+  pc->spidev = spidev;
+  init_waitqueue_head(&pc->wait);
+  skb_queue_head_init(&pc->tx_queue);
+  spidev->can = pc;
+
+  spidev->tx_buffer = kmalloc(bufsiz, GFP_KERNEL);
+  spidev->rx_buffer = kmalloc(bufsiz, GFP_KERNEL);
+  if (!spidev->tx_buffer || !spidev->rx_buffer) {
+    err = -ENOMEM;
+    goto fail;
+  }
+
+  for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+    struct net_device *dev = alloc_candev(sizeof(struct panda_can_priv), 0);
+    struct panda_can_priv *priv;
+
+    if (!dev) {
+      err = -ENOMEM;
+      goto fail;
+    }
+    priv = netdev_priv(dev);
+    priv->pc = pc;
+    priv->bus = i;
+#ifdef PANDA_CAN_NO_BITRATE_CONST
+    priv->can.clock.freq = PANDA_CAN_CALC_CLOCK;
+    priv->can.bittiming_const = &panda_can_bittiming_const;
+    priv->can.data_bittiming_const = &panda_can_bittiming_const;
+#else
+    priv->can.bitrate_const = panda_can_bitrates;
+    priv->can.bitrate_const_cnt = ARRAY_SIZE(panda_can_bitrates);
+    priv->can.data_bitrate_const = panda_can_data_bitrates;
+    priv->can.data_bitrate_const_cnt = ARRAY_SIZE(panda_can_data_bitrates);
+#endif
+    priv->can.bittiming.bitrate = 500000;
+    priv->can.data_bittiming.bitrate = 2000000;
+    priv->can.ctrlmode_supported = CAN_CTRLMODE_FD;
+    priv->can.do_set_bittiming = panda_can_set_bittiming;
+    priv->can.do_set_data_bittiming = panda_can_set_data_bittiming;
+    priv->can.do_set_mode = panda_can_set_mode;
+    priv->can.do_get_berr_counter = panda_can_get_berr_counter;
+
+    dev->netdev_ops = &panda_can_netdev_ops;
+    dev->dev_port = i;
+    SET_NETDEV_DEV(dev, &spidev->spi->dev);
+    pc->netdev[i] = dev;
+  }
+
+  for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+    err = register_candev(pc->netdev[i]);
+    if (err) {
+      while (--i >= 0) {
+        unregister_candev(pc->netdev[i]);
+      }
+      goto fail;
+    }
+  }
+
+  err = sysfs_create_group(&spidev->spi->dev.kobj, &panda_can_attr_group);
+  if (err) {
+    for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+      unregister_candev(pc->netdev[i]);
+    }
+    goto fail;
+  }
+  return 0;
+
+fail:
+  for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+    if (pc->netdev[i]) {
+      free_candev(pc->netdev[i]);
+    }
+  }
+  kfree(spidev->tx_buffer);
+  spidev->tx_buffer = NULL;
+  kfree(spidev->rx_buffer);
+  spidev->rx_buffer = NULL;
+  spidev->can = NULL;
+  kfree(pc);
+  return err;
+}
+
+static void panda_can_remove(struct spidev_data *spidev) {
+  struct panda_can *pc = spidev->can;
+  int i;
+
+  if (!pc) {
+    return;
+  }
+
+  sysfs_remove_group(&spidev->spi->dev.kobj, &panda_can_attr_group);
+  for (i = 0; i < PANDA_CAN_BUS_CNT; i++) {
+    unregister_candev(pc->netdev[i]);
+    free_candev(pc->netdev[i]);
+  }
+
+  mutex_lock(&device_list_lock);
+  spidev->can = NULL;
+  if (spidev->users == 0) {
+    kfree(spidev->tx_buffer);
+    spidev->tx_buffer = NULL;
+    kfree(spidev->rx_buffer);
+    spidev->rx_buffer = NULL;
+  }
+  mutex_unlock(&device_list_lock);
+  kfree(pc);
+}
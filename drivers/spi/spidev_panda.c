@@ -86,6 +86,9 @@ struct spidev_data {
 	u8			*tx_buffer;
 	u8			*rx_buffer;
 	u32			speed_hz;
+
+	/* SocketCAN mode, see spi_panda_can.h */
+	struct panda_can	*can;
 };
 
 static LIST_HEAD(device_list);
@@ -355,6 +358,7 @@ spidev_get_ioc_message(unsigned int cmd, struct spi_ioc_transfer __user *u_ioc,
 
 
 #include "spi_panda.h"
+#include "spi_panda_can.h"
 
 static long
 spidev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
@@ -651,11 +655,14 @@ static int spidev_release(struct inode *inode, struct file *filp)
 	if (!spidev->users) {
 		int		dofree;
 
-		kfree(spidev->tx_buffer);
-		spidev->tx_buffer = NULL;
+		/* the CAN netdevs keep using the buffers */
+		if (!spidev->can) {
+			kfree(spidev->tx_buffer);
+			spidev->tx_buffer = NULL;
 
-		kfree(spidev->rx_buffer);
-		spidev->rx_buffer = NULL;
+			kfree(spidev->rx_buffer);
+			spidev->rx_buffer = NULL;
+		}
 
 		spin_lock_irq(&spidev->spi_lock);
 		if (spidev->spi)
@@ -800,9 +807,11 @@ static int spidev_probe(struct spi_device *spi)
 
 	spidev->speed_hz = spi->max_speed_hz;
 
-	if (status == 0)
+	if (status == 0) {
 		spi_set_drvdata(spi, spidev);
-	else
+		if (panda_can_probe(spidev) < 0)
+			dev_warn(&spi->dev, "CAN netdev setup failed\n");
+	} else
 		kfree(spidev);
 
 	return status;
@@ -812,6 +821,8 @@ static int spidev_remove(struct spi_device *spi)
 {
 	struct spidev_data	*spidev = spi_get_drvdata(spi);
 
+	panda_can_remove(spidev);
+
 	/* make sure ops on existing fds can abort cleanly */
 	spin_lock_irq(&spidev->spi_lock);
 	spidev->spi = NULL;
@@ -0,0 +1,933 @@
+#include "panda_client.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/spi/spidev.h>
+#include <linux/usbdevice_fs.h>
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+static const uint8_t dlc_to_len[16] = {0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U, 12U, 16U, 20U, 24U, 32U, 48U, 64U};
+
+// USB, see Panda.USB_VIDS and USB_PIDS
+static const uint16_t usb_vids[] = {0xbbaaU, 0x3801U};
+static const uint16_t usb_pids[] = {0xddeeU, 0xddccU};
+#define USB_CAN_EP_IN 0x81U
+#define USB_CAN_EP_OUT 0x03U
+#define USB_RX_URBS 4U
+#define USB_RX_LEN 16384U
+#define USB_TX_LEN 4096U
+
+// SPI, see python/spi.py
+#define SPI_SYNC 0x5AU
+#define SPI_HACK 0x79U
+#define SPI_DACK 0x85U
+#define SPI_NACK 0x1FU
+#define SPI_CHECKSUM_START 0xABU
+#define SPI_SPEED_HZ 50000000U
+#define SPI_XFER_SIZE (0x40U * 31U)
+#define SPI_BUF_LEN 2048U
+#define SPI_PREREAD_LEN (0x40U + 1U)
+#define SPI_ACK_TIMEOUT_MS 100U
+#define SPI_LOOP_TIMEOUT_MS 100U
+// bounds the time one panda holds the loop
+#define SPI_MAX_READS 8U
+
+#define RX_QUEUE_LEN 16384U
+#define RX_BATCH 256U
+#define TX_QUEUE_LEN 65536U
+
+#define PANDA_LOOP_MAX_EVENTS 32
+
+enum {
+  WATCH_TIMER,
+  WATCH_USB,
+};
+
+typedef struct {
+  int kind;
+  panda_dev_t *dev;
+} panda_watch_t;
+
+struct panda_dev {
+  bool spi;
+  bool connected;
+  int fd;
+  char serial[PANDA_SERIAL_LEN];
+  panda_loop_t *loop;
+  panda_dev_t *next;
+  panda_watch_t watch;
+
+  // USB
+  struct usbdevfs_urb rx_urbs[USB_RX_URBS];
+  uint8_t rx_bufs[USB_RX_URBS][USB_RX_LEN];
+  struct usbdevfs_urb tx_urb;
+  uint8_t tx_urb_buf[USB_TX_LEN];
+  bool tx_busy;
+  uint32_t urbs_in_flight;
+
+  // SPI
+  uint8_t spi_tx[SPI_BUF_LEN];
+  uint8_t spi_rx[SPI_BUF_LEN];
+  uint8_t spi_can_rx[SPI_XFER_SIZE];
+
+  // CAN
+  uint8_t rx_partial[PANDA_CANPACKET_SIZE_MAX];
+  size_t rx_partial_len;
+  panda_can_frame_t rx_batch[RX_BATCH];
+  panda_can_frame_t *rx_q;
+  size_t rx_q_get;
+  size_t rx_q_len;
+  uint8_t tx_q[TX_QUEUE_LEN];
+  size_t tx_q_len;
+  panda_can_cb_t cb;
+  void *cb_user;
+  panda_stats_t stats;
+};
+
+struct panda_loop {
+  int epfd;
+  int timer_fd;
+  uint32_t spi_poll_us;
+  bool timer_armed;
+  panda_watch_t timer_watch;
+  panda_dev_t *devs;
+};
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000U) + ((uint64_t)ts.tv_nsec / 1000000U);
+}
+
+// ***************************** framing *****************************
+
+size_t panda_can_pack(const panda_can_frame_t *frame, uint8_t *out) {
+  size_t ret = 0U;
+  uint8_t dlc = 0U;
+  while ((dlc < 16U) && (dlc_to_len[dlc] != frame->len)) {
+    dlc++;
+  }
+  if ((dlc < 16U) && (frame->bus < 8U)) {
+    uint32_t extended = (frame->addr >= 0x800U) ? 1U : 0U;
+    uint32_t word_4b = (frame->addr << 3) | (extended << 2);
+    out[0] = (uint8_t)((dlc << 4) | (frame->bus << 1) | (frame->fd & 1U));
+    out[1] = (uint8_t)(word_4b & 0xFFU);
+    out[2] = (uint8_t)((word_4b >> 8) & 0xFFU);
+    out[3] = (uint8_t)((word_4b >> 16) & 0xFFU);
+    out[4] = (uint8_t)((word_4b >> 24) & 0xFFU);
+    uint8_t checksum = 0U;
+    for (size_t i = 0U; i < 5U; i++) {
+      checksum ^= out[i];
+    }
+    for (size_t i = 0U; i < frame->len; i++) {
+      checksum ^= frame->data[i];
+    }
+    out[5] = checksum;
+    (void)memcpy(&out[PANDA_CANPACKET_HEAD_SIZE], frame->data, frame->len);
+    ret = PANDA_CANPACKET_HEAD_SIZE + frame->len;
+  }
+  return ret;
+}
+
+int panda_can_unpack(const uint8_t *buf, size_t len, panda_can_frame_t *out, size_t max_frames, size_t *consumed) {
+  int n = 0;
+  size_t pos = 0U;
+  while (((size_t)n < max_frames) && ((len - pos) >= PANDA_CANPACKET_HEAD_SIZE)) {
+    const uint8_t *pkt = &buf[pos];
+    uint8_t data_len = dlc_to_len[pkt[0] >> 4];
+    if ((len - pos) < (PANDA_CANPACKET_HEAD_SIZE + data_len)) {
+      break;
+    }
+
+    uint8_t checksum = 0U;
+    for (size_t i = 0U; i < (PANDA_CANPACKET_HEAD_SIZE + data_len); i++) {
+      checksum ^= pkt[i];
+    }
+    if (checksum != 0U) {
+      n = -1;
+      break;
+    }
+    pos += PANDA_CANPACKET_HEAD_SIZE + data_len;
+
+    uint8_t bus = (pkt[0] >> 1) & 0x7U;
+    if (bus != PANDA_TELEMETRY_BUS) {
+      panda_can_frame_t *f = &out[n];
+      f->addr = ((uint32_t)pkt[4] << 21) | ((uint32_t)pkt[3] << 13) | ((uint32_t)pkt[2] << 5) | ((uint32_t)pkt[1] >> 3);
+      f->bus = bus;
+      if (((pkt[1] >> 1) & 1U) != 0U) {
+        f->bus += PANDA_BUS_RETURNED;
+      }
+      if ((pkt[1] & 1U) != 0U) {
+        f->bus += PANDA_BUS_REJECTED;
+      }
+      f->fd = pkt[0] & 1U;
+      f->len = data_len;
+      (void)memcpy(f->data, &pkt[PANDA_CANPACKET_HEAD_SIZE], data_len);
+      n++;
+    }
+  }
+  *consumed = pos;
+  return n;
+}
+
+static void rx_deliver(panda_dev_t *dev, const panda_can_frame_t *frames, size_t n) {
+  dev->stats.rx_frames += n;
+  if (dev->cb != NULL) {
+    dev->cb(dev, frames, n, dev->cb_user);
+  } else {
+    for (size_t i = 0U; i < n; i++) {
+      if (dev->rx_q_len < RX_QUEUE_LEN) {
+        dev->rx_q[(dev->rx_q_get + dev->rx_q_len) % RX_QUEUE_LEN] = frames[i];
+        dev->rx_q_len++;
+      } else {
+        dev->stats.rx_dropped++;
+      }
+    }
+  }
+}
+
+// unpacks all whole packets, returns the bytes used
+static size_t rx_unpack(panda_dev_t *dev, const uint8_t *dat, size_t len) {
+  size_t pos = 0U;
+  while (true) {
+    size_t consumed = 0U;
+    int n = panda_can_unpack(&dat[pos], len - pos, dev->rx_batch, RX_BATCH, &consumed);
+    if (n < 0) {
+      // the stream is out of sync, drops the transfer
+      dev->stats.rx_checksum_errors++;
+      pos = len;
+      break;
+    }
+    rx_deliver(dev, dev->rx_batch, (size_t)n);
+    pos += consumed;
+    if ((size_t)n < RX_BATCH) {
+      break;
+    }
+  }
+  return pos;
+}
+
+// CAN RX stream data, a packet may continue in the next transfer
+static void rx_data(panda_dev_t *dev, const uint8_t *dat, size_t len) {
+  size_t pos = 0U;
+  dev->stats.rx_bytes += len;
+
+  if (dev->rx_partial_len > 0U) {
+    size_t need = PANDA_CANPACKET_HEAD_SIZE + dlc_to_len[dev->rx_partial[0] >> 4];
+    size_t n = MIN(need - dev->rx_partial_len, len);
+    (void)memcpy(&dev->rx_partial[dev->rx_partial_len], dat, n);
+    dev->rx_partial_len += n;
+    pos = n;
+    if (dev->rx_partial_len == need) {
+      (void)rx_unpack(dev, dev->rx_partial, need);
+      dev->rx_partial_len = 0U;
+    }
+  }
+
+  if (dev->rx_partial_len == 0U) {
+    pos += rx_unpack(dev, &dat[pos], len - pos);
+    dev->rx_partial_len = len - pos;
+    (void)memcpy(dev->rx_partial, &dat[pos], dev->rx_partial_len);
+  }
+}
+
+static void tx_consume(panda_dev_t *dev, size_t len) {
+  (void)memmove(dev->tx_q, &dev->tx_q[len], dev->tx_q_len - len);
+  dev->tx_q_len -= len;
+  dev->stats.tx_bytes += len;
+}
+
+// ***************************** USB *****************************
+
+static int read_sysfs(const char *dir, const char *name, char *buf, size_t len) {
+  char path[512];
+  (void)snprintf(path, sizeof(path), "%s/%s", dir, name);
+  int ret = -1;
+  FILE *f = fopen(path, "re");
+  if (f != NULL) {
+    if (fgets(buf, (int)len, f) != NULL) {
+      buf[strcspn(buf, "\n")] = '\0';
+      ret = 0;
+    }
+    (void)fclose(f);
+  }
+  return ret;
+}
+
+static bool usb_is_panda(const char *dir) {
+  char vid[8];
+  char pid[8];
+  bool ret = false;
+  if ((read_sysfs(dir, "idVendor", vid, sizeof(vid)) == 0) && (read_sysfs(dir, "idProduct", pid, sizeof(pid)) == 0)) {
+    uint16_t v = (uint16_t)strtoul(vid, NULL, 16);
+    uint16_t p = (uint16_t)strtoul(pid, NULL, 16);
+    for (size_t i = 0U; i < (sizeof(usb_vids) / sizeof(usb_vids[0])); i++) {
+      for (size_t j = 0U; j < (sizeof(usb_pids) / sizeof(usb_pids[0])); j++) {
+        ret = ret || ((v == usb_vids[i]) && (p == usb_pids[j]));
+      }
+    }
+  }
+  return ret;
+}
+
+// calls fn for each USB panda until it returns true
+static bool usb_foreach(bool (*fn)(const char *dir, const char *serial, void *ctx), void *ctx) {
+  bool ret = false;
+  DIR *d = opendir("/sys/bus/usb/devices");
+  if (d != NULL) {
+    const struct dirent *e;
+    while (!ret && ((e = readdir(d)) != NULL)) {
+      char dir[300];
+      char serial[PANDA_SERIAL_LEN];
+      // interfaces have a ':' in their name
+      if ((e->d_name[0] == '.') || (strchr(e->d_name, ':') != NULL)) {
+        continue;
+      }
+      (void)snprintf(dir, sizeof(dir), "/sys/bus/usb/devices/%s", e->d_name);
+      if (usb_is_panda(dir)) {
+        if (read_sysfs(dir, "serial", serial, sizeof(serial)) != 0) {
+          serial[0] = '\0';
+        }
+        ret = fn(dir, serial, ctx);
+      }
+    }
+    (void)closedir(d);
+  }
+  return ret;
+}
+
+typedef struct {
+  char (*serials)[PANDA_SERIAL_LEN];
+  int max;
+  int cnt;
+} usb_list_ctx_t;
+
+static bool usb_list_cb(const char *dir, const char *serial, void *ctx) {
+  usb_list_ctx_t *c = (usb_list_ctx_t *)ctx;
+  (void)dir;
+  if (c->cnt < c->max) {
+    (void)snprintf(c->serials[c->cnt], PANDA_SERIAL_LEN, "%s", serial);
+  }
+  c->cnt++;
+  return false;
+}
+
+int panda_usb_list(char serials[][PANDA_SERIAL_LEN], int max) {
+  usb_list_ctx_t ctx = {.serials = serials, .max = max, .cnt = 0};
+  (void)usb_foreach(usb_list_cb, &ctx);
+  return ctx.cnt;
+}
+
+typedef struct {
+  const char *serial;
+  char path[64];
+  char found_serial[PANDA_SERIAL_LEN];
+} usb_find_ctx_t;
+
+static bool usb_find_cb(const char *dir, const char *serial, void *ctx) {
+  usb_find_ctx_t *c = (usb_find_ctx_t *)ctx;
+  char busnum[8];
+  char devnum[8];
+  bool ret = false;
+  if (((c->serial == NULL) || (strcmp(c->serial, serial) == 0)) &&
+      (read_sysfs(dir, "busnum", busnum, sizeof(busnum)) == 0) && (read_sysfs(dir, "devnum", devnum, sizeof(devnum)) == 0)) {
+    (void)snprintf(c->path, sizeof(c->path), "/dev/bus/usb/%03d/%03d", atoi(busnum), atoi(devnum));
+    (void)snprintf(c->found_serial, sizeof(c->found_serial), "%s", serial);
+    ret = true;
+  }
+  return ret;
+}
+
+static int usb_submit(panda_dev_t *dev, struct usbdevfs_urb *urb, uint8_t ep, uint8_t *buf, size_t len) {
+  (void)memset(urb, 0, sizeof(*urb));
+  urb->type = USBDEVFS_URB_TYPE_BULK;
+  urb->endpoint = ep;
+  urb->buffer = buf;
+  urb->buffer_length = (int)len;
+  urb->usercontext = dev;
+  int ret = ioctl(dev->fd, USBDEVFS_SUBMITURB, urb);
+  if (ret < 0) {
+    ret = -errno;
+    dev->stats.transfer_errors++;
+    if (ret == -ENODEV) {
+      dev->connected = false;
+    }
+  } else {
+    dev->urbs_in_flight++;
+  }
+  return ret;
+}
+
+static void usb_kick_tx(panda_dev_t *dev) {
+  if (dev->connected && !dev->tx_busy && (dev->tx_q_len > 0U)) {
+    size_t len = MIN(dev->tx_q_len, USB_TX_LEN);
+    (void)memcpy(dev->tx_urb_buf, dev->tx_q, len);
+    if (usb_submit(dev, &dev->tx_urb, USB_CAN_EP_OUT, dev->tx_urb_buf, len) == 0) {
+      // the firmware reassembles packets split across transfers
+      tx_consume(dev, len);
+      dev->tx_busy = true;
+    }
+  }
+}
+
+// handles the completed transfers
+static void usb_reap(panda_dev_t *dev, bool block) {
+  while (dev->urbs_in_flight > 0U) {
+    struct usbdevfs_urb *urb = NULL;
+    if (ioctl(dev->fd, block ? USBDEVFS_REAPURB : USBDEVFS_REAPURBNDELAY, &urb) < 0) {
+      if (errno == ENODEV) {
+        dev->connected = false;
+      }
+      break;
+    }
+    dev->urbs_in_flight--;
+
+    if ((urb->status == -ENODEV) || (urb->status == -ESHUTDOWN)) {
+      dev->connected = false;
+    } else if ((urb->status != 0) && (urb->status != -ENOENT) && (urb->status != -ECONNRESET)) {
+      dev->stats.transfer_errors++;
+    } else {
+    }
+
+    if (urb == &dev->tx_urb) {
+      dev->tx_busy = false;
+      if (!block) {
+        usb_kick_tx(dev);
+      }
+    } else {
+      if (urb->status == 0) {
+        rx_data(dev, (const uint8_t *)urb->buffer, (size_t)urb->actual_length);
+      }
+      // discarded transfers are not resubmitted
+      if (!block && dev->connected && (urb->status != -ENOENT) && (urb->status != -ECONNRESET)) {
+        (void)usb_submit(dev, urb, USB_CAN_EP_IN, (uint8_t *)urb->buffer, USB_RX_LEN);
+      }
+    }
+  }
+}
+
+static void usb_close(panda_dev_t *dev) {
+  for (uint32_t i = 0U; i < USB_RX_URBS; i++) {
+    (void)ioctl(dev->fd, USBDEVFS_DISCARDURB, &dev->rx_urbs[i]);
+  }
+  if (dev->tx_busy) {
+    (void)ioctl(dev->fd, USBDEVFS_DISCARDURB, &dev->tx_urb);
+  }
+  usb_reap(dev, true);
+  unsigned int iface = 0U;
+  (void)ioctl(dev->fd, USBDEVFS_RELEASEINTERFACE, &iface);
+}
+
+static int usb_control(panda_dev_t *dev, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, uint8_t *buf, uint16_t len, uint32_t timeout_ms) {
+  struct usbdevfs_ctrltransfer ct = {
+    .bRequestType = request_type,
+    .bRequest = request,
+    .wValue = value,
+    .wIndex = index,
+    .wLength = len,
+    .timeout = timeout_ms,
+    .data = buf,
+  };
+  int ret = ioctl(dev->fd, USBDEVFS_CONTROL, &ct);
+  return (ret < 0) ? -errno : ret;
+}
+
+// ***************************** SPI *****************************
+
+static uint8_t spi_checksum(const uint8_t *dat, size_t len) {
+  uint8_t ret = SPI_CHECKSUM_START;
+  for (size_t i = 0U; i < len; i++) {
+    ret ^= dat[i];
+  }
+  return ret;
+}
+
+static int spi_xfer(const panda_dev_t *dev, const uint8_t *tx, uint8_t *rx, size_t len) {
+  struct spi_ioc_transfer t;
+  (void)memset(&t, 0, sizeof(t));
+  t.tx_buf = (uint64_t)(uintptr_t)tx;
+  t.rx_buf = (uint64_t)(uintptr_t)rx;
+  t.len = (uint32_t)len;
+  t.speed_hz = SPI_SPEED_HZ;
+  t.bits_per_word = 8U;
+  return (ioctl(dev->fd, SPI_IOC_MESSAGE(1), &t) < 0) ? -errno : 0;
+}
+
+// clocks out tx until the panda answers with ack, its answer is left in spi_rx
+static int spi_wait_ack(panda_dev_t *dev, uint8_t ack, uint8_t tx, size_t len, uint32_t timeout_ms) {
+  int ret = -ETIMEDOUT;
+  uint64_t start = now_ms();
+  (void)memset(dev->spi_tx, tx, len);
+  do {
+    int err = spi_xfer(dev, dev->spi_tx, dev->spi_rx, len);
+    if (err < 0) {
+      ret = err;
+      break;
+    }
+    if (dev->spi_rx[0] == SPI_NACK) {
+      ret = -EAGAIN;
+      break;
+    }
+    if (dev->spi_rx[0] == ack) {
+      ret = 0;
+      break;
+    }
+  } while ((now_ms() - start) < timeout_ms);
+  return ret;
+}
+
+static int spi_transfer_once(panda_dev_t *dev, uint8_t endpoint, const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t max_rx, uint32_t timeout_ms) {
+  uint8_t hdr[7];
+  uint16_t max_rx_len = MAX(max_rx, 0x40U);
+  hdr[0] = SPI_SYNC;
+  hdr[1] = endpoint;
+  hdr[2] = tx_len & 0xFFU;
+  hdr[3] = tx_len >> 8;
+  hdr[4] = max_rx_len & 0xFFU;
+  hdr[5] = max_rx_len >> 8;
+  hdr[6] = spi_checksum(hdr, 6U);
+
+  int ret = spi_xfer(dev, hdr, dev->spi_rx, sizeof(hdr));
+  if (ret == 0) {
+    ret = spi_wait_ack(dev, SPI_HACK, 0x11U, 1U, SPI_ACK_TIMEOUT_MS);
+  }
+  if (ret == 0) {
+    if (tx_len > 0U) {
+      (void)memcpy(dev->spi_tx, tx, tx_len);
+    }
+    dev->spi_tx[tx_len] = spi_checksum(tx, tx_len);
+    ret = spi_xfer(dev, dev->spi_tx, dev->spi_rx, tx_len + 1U);
+  }
+  if (ret == 0) {
+    ret = spi_wait_ack(dev, SPI_DACK, 0x13U, 3U + SPI_PREREAD_LEN, timeout_ms);
+  }
+  if (ret == 0) {
+    uint16_t rlen = dev->spi_rx[1] | ((uint16_t)dev->spi_rx[2] << 8);
+    if (rlen > max_rx_len) {
+      ret = -EMSGSIZE;
+    } else {
+      if ((rlen + 1U) > SPI_PREREAD_LEN) {
+        size_t remaining = (rlen + 1U) - SPI_PREREAD_LEN;
+        (void)memset(dev->spi_tx, 0, remaining);
+        ret = spi_xfer(dev, dev->spi_tx, &dev->spi_rx[3U + SPI_PREREAD_LEN], remaining);
+      }
+      if (ret == 0) {
+        if (spi_checksum(dev->spi_rx, 3U + rlen + 1U) != 0U) {
+          ret = -EBADMSG;
+        } else {
+          (void)memcpy(rx, &dev->spi_rx[3], MIN(rlen, max_rx));
+          ret = MIN(rlen, max_rx);
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+// retries until timeout_ms, a NACK is returned as -EAGAIN unless retry_nack
+static int spi_transfer(panda_dev_t *dev, uint8_t endpoint, const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t max_rx, uint32_t timeout_ms, bool retry_nack) {
+  int ret = -EINVAL;
+  if ((tx_len <= SPI_XFER_SIZE) && (max_rx <= SPI_XFER_SIZE)) {
+    uint64_t start = now_ms();
+    // shared with the python library
+    (void)flock(dev->fd, LOCK_EX);
+    do {
+      ret = spi_transfer_once(dev, endpoint, tx, tx_len, rx, max_rx, timeout_ms);
+      if ((ret == -EAGAIN) && !retry_nack) {
+        break;
+      }
+    } while ((ret < 0) && ((now_ms() - start) < timeout_ms));
+    (void)flock(dev->fd, LOCK_UN);
+  }
+  return ret;
+}
+
+static void spi_flush_tx(panda_dev_t *dev) {
+  while (dev->tx_q_len > 0U) {
+    uint16_t len = MIN(dev->tx_q_len, SPI_XFER_SIZE);
+    int ret = spi_transfer(dev, 3U, dev->tx_q, len, dev->spi_rx, 0U, SPI_LOOP_TIMEOUT_MS, false);
+    if (ret == -EAGAIN) {
+      // the panda's TX queue is full, retried on the next poll
+      dev->stats.tx_nacks++;
+      break;
+    }
+    if (ret < 0) {
+      dev->stats.transfer_errors++;
+      break;
+    }
+    tx_consume(dev, len);
+  }
+}
+
+static void spi_service(panda_dev_t *dev) {
+  for (uint32_t i = 0U; i < SPI_MAX_READS; i++) {
+    int ret = spi_transfer(dev, 1U, NULL, 0U, dev->spi_can_rx, SPI_XFER_SIZE, SPI_LOOP_TIMEOUT_MS, true);
+    if (ret < 0) {
+      dev->stats.transfer_errors++;
+      break;
+    }
+    rx_data(dev, dev->spi_can_rx, (size_t)ret);
+    if (ret < (int)SPI_XFER_SIZE) {
+      break;
+    }
+  }
+  spi_flush_tx(dev);
+}
+
+// ***************************** devices *****************************
+
+static panda_dev_t *dev_new(bool spi, int fd) {
+  panda_dev_t *dev = calloc(1U, sizeof(panda_dev_t));
+  if (dev != NULL) {
+    dev->rx_q = calloc(RX_QUEUE_LEN, sizeof(panda_can_frame_t));
+    if (dev->rx_q == NULL) {
+      free(dev);
+      dev = NULL;
+    }
+  }
+  if (dev != NULL) {
+    dev->spi = spi;
+    dev->fd = fd;
+    dev->connected = true;
+    dev->watch.kind = spi ? WATCH_TIMER : WATCH_USB;
+    dev->watch.dev = dev;
+  }
+  return dev;
+}
+
+static void dev_free(panda_dev_t *dev) {
+  (void)close(dev->fd);
+  free(dev->rx_q);
+  free(dev);
+}
+
+// resets the CAN stream and checks that the panda speaks our CAN packet version
+static int dev_start(panda_dev_t *dev) {
+  uint8_t versions[3];
+  int ret = panda_control_write(dev, 0xc0U, 0U, 0U, 1000U);
+  if (ret >= 0) {
+    ret = panda_control_read(dev, 0xddU, 0U, 0U, versions, sizeof(versions), 1000U);
+  }
+  if (ret >= 0) {
+    ret = ((ret == 3) && (versions[1] == PANDA_CAN_PACKET_VERSION)) ? 0 : -EPROTO;
+  }
+  return ret;
+}
+
+panda_dev_t *panda_open_usb(const char *serial) {
+  usb_find_ctx_t ctx = {.serial = serial};
+  panda_dev_t *dev = NULL;
+  int err = ENODEV;
+
+  if (usb_foreach(usb_find_cb, &ctx)) {
+    int fd = open(ctx.path, O_RDWR | O_CLOEXEC);
+    unsigned int iface = 0U;
+    if (fd < 0) {
+      err = errno;
+    } else if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &iface) < 0) {
+      err = errno;
+      (void)close(fd);
+    } else {
+      dev = dev_new(false, fd);
+      if (dev == NULL) {
+        err = ENOMEM;
+        (void)close(fd);
+      }
+    }
+  }
+
+  if (dev != NULL) {
+    (void)snprintf(dev->serial, sizeof(dev->serial), "%s", ctx.found_serial);
+    int ret = dev_start(dev);
+    for (uint32_t i = 0U; (ret == 0) && (i < USB_RX_URBS); i++) {
+      ret = usb_submit(dev, &dev->rx_urbs[i], USB_CAN_EP_IN, dev->rx_bufs[i], USB_RX_LEN);
+    }
+    if (ret < 0) {
+      err = -ret;
+      panda_close(dev);
+      dev = NULL;
+    }
+  }
+  if (dev == NULL) {
+    errno = err;
+  }
+  return dev;
+}
+
+panda_dev_t *panda_open_spi(const char *path) {
+  panda_dev_t *dev = NULL;
+  int err = 0;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    err = errno;
+  } else {
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8U;
+    uint32_t speed = SPI_SPEED_HZ;
+    if ((ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0) || (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) ||
+        (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)) {
+      err = errno;
+      (void)close(fd);
+    } else {
+      dev = dev_new(true, fd);
+      if (dev == NULL) {
+        err = ENOMEM;
+        (void)close(fd);
+      }
+    }
+  }
+
+  if (dev != NULL) {
+    uint8_t uid[12];
+    int ret = panda_control_read(dev, 0xc3U, 0U, 0U, uid, sizeof(uid), 100U);
+    if (ret == (int)sizeof(uid)) {
+      for (size_t i = 0U; i < sizeof(uid); i++) {
+        (void)snprintf(&dev->serial[i * 2U], 3U, "%02x", uid[i]);
+      }
+      ret = dev_start(dev);
+    } else if (ret >= 0) {
+      ret = -EPROTO;
+    } else {
+    }
+    if (ret < 0) {
+      err = -ret;
+      panda_close(dev);
+      dev = NULL;
+    }
+  }
+  if (dev == NULL) {
+    errno = err;
+  }
+  return dev;
+}
+
+void panda_close(panda_dev_t *dev) {
+  if (dev != NULL) {
+    if (dev->loop != NULL) {
+      (void)panda_loop_remove(dev->loop, dev);
+    }
+    if (!dev->spi) {
+      usb_close(dev);
+    }
+    dev_free(dev);
+  }
+}
+
+const char *panda_get_serial(const panda_dev_t *dev) {
+  return dev->serial;
+}
+
+bool panda_is_spi(const panda_dev_t *dev) {
+  return dev->spi;
+}
+
+bool panda_connected(const panda_dev_t *dev) {
+  return dev->connected;
+}
+
+int panda_control_read(panda_dev_t *dev, uint8_t request, uint16_t value, uint16_t index, uint8_t *buf, uint16_t len, uint32_t timeout_ms) {
+  int ret;
+  if (dev->spi) {
+    uint8_t req[7] = {request, value & 0xFFU, value >> 8, index & 0xFFU, index >> 8, len & 0xFFU, len >> 8};
+    ret = spi_transfer(dev, 0U, req, sizeof(req), buf, len, timeout_ms, true);
+  } else {
+    ret = usb_control(dev, PANDA_REQUEST_IN, request, value, index, buf, len, timeout_ms);
+  }
+  return ret;
+}
+
+int panda_control_write(panda_dev_t *dev, uint8_t request, uint16_t value, uint16_t index, uint32_t timeout_ms) {
+  int ret;
+  if (dev->spi) {
+    uint8_t req[7] = {request, value & 0xFFU, value >> 8, index & 0xFFU, index >> 8, 0U, 0U};
+    ret = spi_transfer(dev, 0U, req, sizeof(req), dev->spi_rx, 0U, timeout_ms, true);
+  } else {
+    ret = usb_control(dev, PANDA_REQUEST_OUT, request, value, index, NULL, 0U, timeout_ms);
+  }
+  return ret;
+}
+
+size_t panda_can_send(panda_dev_t *dev, const panda_can_frame_t *frames, size_t n) {
+  size_t i = 0U;
+  while ((i < n) && ((dev->tx_q_len + PANDA_CANPACKET_SIZE_MAX) <= TX_QUEUE_LEN)) {
+    size_t len = panda_can_pack(&frames[i], &dev->tx_q[dev->tx_q_len]);
+    if (len == 0U) {
+      break;
+    }
+    dev->tx_q_len += len;
+    i++;
+  }
+  dev->stats.tx_frames += i;
+
+  if (dev->spi) {
+    spi_flush_tx(dev);
+  } else {
+    usb_kick_tx(dev);
+  }
+  return i;
+}
+
+size_t panda_can_recv(panda_dev_t *dev, panda_can_frame_t *out, size_t max_frames) {
+  size_t n = MIN(max_frames, dev->rx_q_len);
+  for (size_t i = 0U; i < n; i++) {
+    out[i] = dev->rx_q[dev->rx_q_get];
+    dev->rx_q_get = (dev->rx_q_get + 1U) % RX_QUEUE_LEN;
+  }
+  dev->rx_q_len -= n;
+  return n;
+}
+
+void panda_set_can_callback(panda_dev_t *dev, panda_can_cb_t cb, void *user) {
+  dev->cb = cb;
+  dev->cb_user = user;
+}
+
+void panda_get_stats(const panda_dev_t *dev, panda_stats_t *stats) {
+  *stats = dev->stats;
+  stats->tx_pending = (uint32_t)(dev->tx_q_len + (dev->tx_busy ? (size_t)dev->tx_urb.buffer_length : 0U));
+}
+
+// ***************************** loop *****************************
+
+panda_loop_t *panda_loop_new(uint32_t spi_poll_us) {
+  panda_loop_t *loop = calloc(1U, sizeof(panda_loop_t));
+  if (loop != NULL) {
+    loop->spi_poll_us = MAX(spi_poll_us, 100U);
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loop->timer_watch.kind = WATCH_TIMER;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &loop->timer_watch};
+    if ((loop->epfd < 0) || (loop->timer_fd < 0) || (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->timer_fd, &ev) < 0)) {
+      int err = errno;
+      if (loop->epfd >= 0) {
+        (void)close(loop->epfd);
+      }
+      if (loop->timer_fd >= 0) {
+        (void)close(loop->timer_fd);
+      }
+      free(loop);
+      loop = NULL;
+      errno = err;
+    }
+  }
+  return loop;
+}
+
+void panda_loop_free(panda_loop_t *loop) {
+  if (loop != NULL) {
+    while (loop->devs != NULL) {
+      (void)panda_loop_remove(loop, loop->devs);
+    }
+    (void)close(loop->timer_fd);
+    (void)close(loop->epfd);
+    free(loop);
+  }
+}
+
+// the timer runs while there are SPI pandas
+static void loop_update_timer(panda_loop_t *loop) {
+  bool spi = false;
+  for (const panda_dev_t *d = loop->devs; d != NULL; d = d->next) {
+    spi = spi || d->spi;
+  }
+  if (spi != loop->timer_armed) {
+    struct itimerspec its;
+    (void)memset(&its, 0, sizeof(its));
+    if (spi) {
+      its.it_interval.tv_sec = loop->spi_poll_us / 1000000U;
+      its.it_interval.tv_nsec = (long)(loop->spi_poll_us % 1000000U) * 1000L;
+      its.it_value = its.it_interval;
+    }
+    (void)timerfd_settime(loop->timer_fd, 0, &its, NULL);
+    loop->timer_armed = spi;
+  }
+}
+
+int panda_loop_add(panda_loop_t *loop, panda_dev_t *dev) {
+  int ret = 0;
+  if (dev->loop != NULL) {
+    ret = -EBUSY;
+  } else if (!dev->spi) {
+    // usbfs signals completed transfers as writable
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = &dev->watch};
+    ret = (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, dev->fd, &ev) < 0) ? -errno : 0;
+  }
+
+  if (ret == 0) {
+    dev->loop = loop;
+    dev->next = loop->devs;
+    loop->devs = dev;
+    loop_update_timer(loop);
+  }
+  return ret;
+}
+
+int panda_loop_remove(panda_loop_t *loop, panda_dev_t *dev) {
+  int ret = -ENOENT;
+  for (panda_dev_t **d = &loop->devs; *d != NULL; d = &(*d)->next) {
+    if (*d == dev) {
+      *d = dev->next;
+      if (!dev->spi) {
+        (void)epoll_ctl(loop->epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+      }
+      dev->loop = NULL;
+      dev->next = NULL;
+      loop_update_timer(loop);
+      ret = 0;
+      break;
+    }
+  }
+  return ret;
+}
+
+int panda_loop_fd(const panda_loop_t *loop) {
+  return loop->epfd;
+}
+
+int panda_loop_run(panda_loop_t *loop, int timeout_ms) {
+  struct epoll_event events[PANDA_LOOP_MAX_EVENTS];
+  int n = epoll_wait(loop->epfd, events, PANDA_LOOP_MAX_EVENTS, timeout_ms);
+  if (n < 0) {
+    n = (errno == EINTR) ? 0 : -errno;
+  }
+
+  for (int i = 0; i < n; i++) {
+    const panda_watch_t *w = (const panda_watch_t *)events[i].data.ptr;
+    if (w->kind == WATCH_TIMER) {
+      uint64_t expirations;
+      if (read(loop->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        expirations = 0U;
+      }
+      for (panda_dev_t *d = loop->devs; d != NULL; d = d->next) {
+        if (d->spi) {
+          spi_service(d);
+        }
+      }
+    } else {
+      panda_dev_t *dev = w->dev;
+      usb_reap(dev, false);
+      if (!dev->connected || ((events[i].events & (EPOLLHUP | EPOLLERR)) != 0U)) {
+        // unplugged, stops polling the fd
+        dev->connected = false;
+        (void)epoll_ctl(loop->epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+      }
+    }
+  }
+  return n;
+}
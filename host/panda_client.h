@@ -0,0 +1,112 @@
+#pragma once
+
+// native host client for pandas, a C counterpart of python/__init__.py for
+// rigs that run many pandas or need steady, low overhead CAN I/O
+//
+// One panda_loop_t services any number of pandas from one thread: CAN
+// reads and writes of USB pandas are asynchronous usbfs transfers,
+// SPI pandas are polled on a timer. Received
+// frames are queued per panda, or handed to a callback from
+// panda_loop_run().
+// Control requests are synchronous, do them outside of a callback or
+// from another thread only while the loop is not running.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PANDA_CAN_PACKET_VERSION 4U
+#define PANDA_CANPACKET_HEAD_SIZE 6U
+#define PANDA_CANPACKET_DATA_SIZE_MAX 64U
+#define PANDA_CANPACKET_SIZE_MAX (PANDA_CANPACKET_HEAD_SIZE + PANDA_CANPACKET_DATA_SIZE_MAX)
+#define PANDA_TELEMETRY_BUS 7U
+#define PANDA_SERIAL_LEN 32U
+
+// bus offsets of frames the panda sent back, like the python library
+#define PANDA_BUS_RETURNED 128U
+#define PANDA_BUS_REJECTED 192U
+
+#define PANDA_REQUEST_IN 0xC0U
+#define PANDA_REQUEST_OUT 0x40U
+
+typedef struct {
+  uint32_t addr;
+  uint8_t bus;
+  uint8_t len;
+  uint8_t fd;
+  uint8_t data[PANDA_CANPACKET_DATA_SIZE_MAX];
+} panda_can_frame_t;
+
+typedef struct {
+  uint64_t rx_frames;
+  uint64_t rx_bytes;
+  uint64_t rx_dropped;      // received while the RX queue was full
+  uint64_t rx_checksum_errors;
+  uint64_t tx_frames;       // queued by panda_can_send
+  uint64_t tx_bytes;
+  uint64_t tx_nacks;        // the panda's CAN TX queue was full
+  uint64_t transfer_errors;
+  uint32_t tx_pending;      // bytes queued, not yet on the panda
+} panda_stats_t;
+
+typedef struct panda_dev panda_dev_t;
+typedef struct panda_loop panda_loop_t;
+
+typedef void (*panda_can_cb_t)(panda_dev_t *dev, const panda_can_frame_t *frames, size_t n, void *user);
+
+// ***************************** framing *****************************
+
+// packs one frame, returns its length or 0 if the data length is invalid
+size_t panda_can_pack(const panda_can_frame_t *frame, uint8_t *out);
+
+// unpacks whole packets of buf, returns the number of frames and sets consumed to
+// the bytes used, the rest is the start of a packet continued in the next transfer.
+// Telemetry packets are skipped. Returns -1 on a checksum error.
+int panda_can_unpack(const uint8_t *buf, size_t len, panda_can_frame_t *out, size_t max_frames, size_t *consumed);
+
+// ***************************** devices *****************************
+
+// serials of the USB pandas, returns how many there are
+int panda_usb_list(char serials[][PANDA_SERIAL_LEN], int max);
+
+// the first panda if serial is NULL, NULL on error with errno set
+panda_dev_t *panda_open_usb(const char *serial);
+panda_dev_t *panda_open_spi(const char *path);
+void panda_close(panda_dev_t *dev);
+
+const char *panda_get_serial(const panda_dev_t *dev);
+bool panda_is_spi(const panda_dev_t *dev);
+// false once a USB panda is unplugged
+bool panda_connected(const panda_dev_t *dev);
+
+// return the number of bytes transferred or -errno
+int panda_control_read(panda_dev_t *dev, uint8_t request, uint16_t value, uint16_t index, uint8_t *buf, uint16_t len, uint32_t timeout_ms);
+int panda_control_write(panda_dev_t *dev, uint8_t request, uint16_t value, uint16_t index, uint32_t timeout_ms);
+
+// queues frames to send, returns how many were queued. Stops at a frame
+// with an invalid length or when the TX queue is full.
+size_t panda_can_send(panda_dev_t *dev, const panda_can_frame_t *frames, size_t n);
+// takes received frames from the RX queue, unused while a callback is set
+size_t panda_can_recv(panda_dev_t *dev, panda_can_frame_t *out, size_t max_frames);
+void panda_set_can_callback(panda_dev_t *dev, panda_can_cb_t cb, void *user);
+void panda_get_stats(const panda_dev_t *dev, panda_stats_t *stats);
+
+// ***************************** loop *****************************
+
+panda_loop_t *panda_loop_new(uint32_t spi_poll_us);
+void panda_loop_free(panda_loop_t *loop);
+int panda_loop_add(panda_loop_t *loop, panda_dev_t *dev);
+int panda_loop_remove(panda_loop_t *loop, panda_dev_t *dev);
+// an epoll fd that is readable when panda_loop_run has work, to nest the loop in another one
+int panda_loop_fd(const panda_loop_t *loop);
+// handles the pending events, waits up to timeout_ms for one (-1 forever).
+// Returns the number of events handled or -errno.
+int panda_loop_run(panda_loop_t *loop, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,8 @@ from .constants import FW_PATH, McuType
 from .dfu import PandaDFU
 from .spi import PandaSpiHandle, PandaSpiException, PandaProtocolMismatch
 from .usb import PandaUsbHandle
+from .timesync import TIME_SYNC_SAMPLE_STRUCT
+from .trace import TRACE_BUF_SIZE, TRACE_EVENT_STRUCT, TRACE_SPI_ENDPOINT, unpack_trace_buffer
 from .utils import logger
 
 __version__ = '0.0.10'
@@ -24,6 +26,63 @@ CANPACKET_HEAD_SIZE = 0x6
 DLC_TO_LEN = [0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64]
 LEN_TO_DLC = {length: dlc for (dlc, length) in enumerate(DLC_TO_LEN)}
 PANDA_BUS_CNT = 3
+CAN_TX_HP_BUFFER_SIZE = 32  # board/drivers/can_common.h
+
+# in-band telemetry records arrive as frames on this bus, see board/telemetry.h
+TELEMETRY_BUS = 7
+TELEMETRY_HEALTH = 0
+TELEMETRY_CAN_HEALTH = 1
+
+# firmware ISO-TP transmit, PDUs and results are frames on this bus, see board/isotp.h
+ISOTP_BUS = 6
+ISOTP_MAX_LEN = 4095
+ISOTP_CHUNK_START = 0
+ISOTP_CHUNK_DATA = 1
+ISOTP_CHUNK_ABORT = 2
+
+# timed frame playback upload, see board/playback.h
+PLAYBACK_SPI_ENDPOINT = 5
+PLAYBACK_EP2_PORT = 0x10
+PLAYBACK_STATUS_STRUCT = struct.Struct("<BBHIIIIIII")
+
+# per-address CAN RX statistics, see board/can_stats.h
+CAN_STATS_SPI_ENDPOINT = 6
+CAN_STATS_ENTRY_STRUCT = struct.Struct("<IBBHIIIIIHH")
+CAN_STATS_KEYS = ("addr", "bus", "dlc", "dlc_changes", "count", "last_ts", "min_gap_us", "max_gap_us", "ewma_gap_us", "invalid", "lost")
+
+
+def unpack_can_stats(dat):
+  ret = []
+  for i in range(0, len(dat) - CAN_STATS_ENTRY_STRUCT.size + 1, CAN_STATS_ENTRY_STRUCT.size):
+    entry = dict(zip(CAN_STATS_KEYS, CAN_STATS_ENTRY_STRUCT.unpack_from(dat, i), strict=True))
+    entry["extended"] = bool(entry["addr"] >> 31)
+    entry["addr"] &= 0x1FFFFFFF
+    if entry["count"] < 2:
+      entry["min_gap_us"] = None
+    ret.append(entry)
+  return ret
+
+
+# CAN path cycle benchmark, see board/drivers/can_bench.h
+CAN_BENCH_STRUCT = struct.Struct("<IIIIIIIIIBB")
+
+# last-value cache snapshot, see board/can_cache.h
+CAN_CACHE_SPI_ENDPOINT = 7
+CAN_CACHE_SLOT_HEAD_STRUCT = struct.Struct("<IIIB")
+CAN_CACHE_SNAPSHOT_SIZE = 64 * (CAN_CACHE_SLOT_HEAD_STRUCT.size + 64)  # board/can_cache.h
+
+
+def unpack_can_cache(dat):
+  """{(bus, addr): (timestamp_us, count, data)}, data is None before the first frame"""
+  ret = {}
+  pos = 0
+  while pos + CAN_CACHE_SLOT_HEAD_STRUCT.size <= len(dat):
+    key, ts, count, dlc = CAN_CACHE_SLOT_HEAD_STRUCT.unpack_from(dat, pos)
+    pos += CAN_CACHE_SLOT_HEAD_STRUCT.size
+    data = bytes(dat[pos:pos + DLC_TO_LEN[dlc]])
+    pos += DLC_TO_LEN[dlc]
+    ret[((key >> 29) & 0x3, key & 0x1FFFFFFF)] = (ts, count, data if count > 0 else None)
+  return ret
 
 
 def calculate_checksum(data):
@@ -32,8 +91,11 @@ def calculate_checksum(data):
     res ^= b
   return res
 
-def pack_can_buffer(arr, fd=False):
+def pack_can_buffer(arr, fd=False, high_priority=False):
+  """high_priority frames go to the panda's high priority TX queue, see can_comms.h.
+  Their chunks fit in that queue, the panda only takes a chunk once it is empty."""
   snds = [b'']
+  n = 0
   for address, dat, bus in arr:
     assert len(dat) in LEN_TO_DLC
     #logger.debug("  W 0x%x: 0x%s", address, dat.hex())
@@ -41,7 +103,7 @@ def pack_can_buffer(arr, fd=False):
     extended = 1 if address >= 0x800 else 0
     data_len_code = LEN_TO_DLC[len(dat)]
     header = bytearray(CANPACKET_HEAD_SIZE)
-    word_4b = address << 3 | extended << 2
+    word_4b = address << 3 | extended << 2 | int(high_priority) << 1
     header[0] = (data_len_code << 4) | (bus << 1) | int(fd)
     header[1] = word_4b & 0xFF
     header[2] = (word_4b >> 8) & 0xFF
@@ -50,12 +112,15 @@ def pack_can_buffer(arr, fd=False):
     header[5] = calculate_checksum(header[:5] + dat)
 
     snds[-1] += header + dat
-    if len(snds[-1]) > 256: # Limit chunks to 256 bytes
+    n += 1
+    if len(snds[-1]) > 256 or (high_priority and n % (CAN_TX_HP_BUFFER_SIZE - 1) == 0): # Limit chunks to 256 bytes
       snds.append(b'')
 
   return snds
 
-def unpack_can_buffer(dat):
+def unpack_can_buffer(dat, telemetry=None):
+  """Telemetry frames are never returned as CAN messages. If telemetry is
+  a list, they are appended to it as (addr, data)."""
   ret = []
 
   while len(dat) >= CANPACKET_HEAD_SIZE:
@@ -82,11 +147,150 @@ def unpack_can_buffer(dat):
     data = dat[CANPACKET_HEAD_SIZE:(CANPACKET_HEAD_SIZE+data_len)]
     dat = dat[(CANPACKET_HEAD_SIZE+data_len):]
 
+    if bus == TELEMETRY_BUS:
+      if telemetry is not None:
+        telemetry.append((address, data))
+      continue
+
     ret.append((address, data, bus))
 
   return (ret, dat)
 
 
+def pack_isotp_pdu(addr, dat, bus, fc_addr, chunk_size=8):
+  """In-band chunks for a whole ISO-TP PDU, as (addr, dat, bus) for pack_can_buffer.
+  chunk_size is the largest CAN packet payload of the panda, 8 or 64."""
+  assert 0 < len(dat) <= ISOTP_MAX_LEN
+  fc = fc_addr | ((1 << 31) if fc_addr >= 0x800 else 0)
+  start = struct.pack("<BBHI", ISOTP_CHUNK_START, bus, len(dat), fc)
+  first = chunk_size - len(start)
+  chunks = [start + dat[:first]]
+  for i in range(first, len(dat), chunk_size - 1):
+    chunks.append(bytes([ISOTP_CHUNK_DATA]) + dat[i:i + chunk_size - 1])
+  # pad up to a valid length, the panda ignores bytes past the PDU
+  chunks = [c.ljust(next(n for n in DLC_TO_LEN if n >= len(c)), b"\x00") for c in chunks]
+  return [(addr, c, ISOTP_BUS) for c in chunks]
+
+
+def pack_playback(frames, fd=False):
+  """Playback records for (delay_us, addr, dat, bus), delay_us is from the previous frame."""
+  return b"".join(struct.pack("<I", delay_us) + pack_can_buffer([(addr, dat, bus)], fd=fd)[0] for delay_us, addr, dat, bus in frames)
+
+
+# compressed CAN RX stream record tags, see board/can_compress.h
+CAN_COMPRESS_RAW = 0
+CAN_COMPRESS_DEF = 1
+CAN_COMPRESS_DELTA = 2
+CAN_COMPRESS_SAME = 3
+CAN_COMPRESS_RESET = 4
+
+class CanRxDecompressor:
+  """Host side of the compressed CAN RX stream. unpack() has the same
+  contract as unpack_can_buffer. Call reset() whenever the panda's
+  dictionary is reset.
+
+  When the stream gets out of sync, e.g. after a lost transfer, what can't
+  be decoded is dropped until the panda's next RESET record. self.desyncs
+  counts how often that happened."""
+  def __init__(self):
+    self.desyncs = 0
+    self.reset()
+
+  def reset(self, generation=None):
+    # token -> (first 5 header bytes, payload)
+    self.dictionary: dict[int, tuple[bytes, bytes]] = {}
+    self.generation = generation
+
+  def _desync(self):
+    if self.generation is not None:
+      logger.error("CAN compression: stream out of sync, dropping until the next reset")
+      self.desyncs += 1
+    self.reset()
+
+  @staticmethod
+  def _find_reset(dat):
+    for i in range(len(dat) - 2):
+      if dat[i] == CAN_COMPRESS_RESET and dat[i + 1] ^ dat[i + 2] == 0xFF:
+        return i
+    return -1
+
+  def unpack(self, dat, telemetry=None):
+    ret = []
+
+    while len(dat) > 0:
+      if self.generation is None:
+        i = self._find_reset(dat)
+        if i < 0:
+          # a RESET may be split across transfers
+          dat = dat[-2:]
+          break
+        dat = dat[i:]
+
+      rec = dat
+      tag = dat[0]
+      pkt = None
+      valid = True
+      if tag == CAN_COMPRESS_RESET:
+        if len(dat) < 3:
+          break
+        valid = dat[1] ^ dat[2] == 0xFF
+        self.reset(dat[1])
+        dat = dat[3:]
+      elif tag in (CAN_COMPRESS_RAW, CAN_COMPRESS_DEF):
+        offset = 1 if tag == CAN_COMPRESS_RAW else 2
+        if len(dat) < offset + CANPACKET_HEAD_SIZE:
+          break
+        pkt_len = CANPACKET_HEAD_SIZE + DLC_TO_LEN[dat[offset] >> 4]
+        if len(dat) < offset + pkt_len:
+          break
+
+        pkt = bytes(dat[offset:offset + pkt_len])
+        if tag == CAN_COMPRESS_DEF:
+          self.dictionary[dat[1]] = (pkt[:CANPACKET_HEAD_SIZE - 1], pkt[CANPACKET_HEAD_SIZE:])
+        dat = dat[offset + pkt_len:]
+      elif tag in (CAN_COMPRESS_DELTA, CAN_COMPRESS_SAME):
+        if len(dat) < 3:
+          break
+        token = dat[1]
+        entry = self.dictionary.get(token)
+
+        used = 3
+        if entry is not None and tag == CAN_COMPRESS_DELTA:
+          mask_len = (len(entry[1]) + 7) // 8
+          if len(dat) < used + mask_len:
+            break
+          mask = dat[used:used + mask_len]
+          changed = sum(bin(b).count("1") for b in mask)
+          if len(dat) < used + mask_len + changed:
+            break
+
+          xor = iter(dat[used + mask_len:used + mask_len + changed])
+          head, data = entry
+          entry = (head, bytes((d ^ next(xor)) if (mask[i // 8] >> (i % 8)) & 1 else d for i, d in enumerate(data)))
+          self.dictionary[token] = entry
+          used += mask_len + changed
+
+        valid = entry is not None
+        if valid:
+          assert self.generation is not None
+          pkt = entry[0] + bytes([dat[2] ^ self.generation]) + entry[1]
+        dat = dat[used:]
+      else:
+        valid = False
+
+      # a stale entry or generation fails the checksum, as does a misaligned record
+      if not valid or (pkt is not None and calculate_checksum(pkt) != 0):
+        self._desync()
+        dat = rec[1:]
+        continue
+
+      if pkt is not None:
+        msgs, _ = unpack_can_buffer(pkt, telemetry)
+        ret.extend(msgs)
+
+    return (ret, dat)
+
+
 def ensure_version(desc, lib_field, panda_field, fn):
   @wraps(fn)
   def wrapper(self, *args, **kwargs):
@@ -136,6 +340,12 @@ class Panda:
   F4_DEVICES = [HW_TYPE_WHITE_PANDA, HW_TYPE_GREY_PANDA, HW_TYPE_BLACK_PANDA, HW_TYPE_UNO, HW_TYPE_DOS]
   H7_DEVICES = [HW_TYPE_RED_PANDA, HW_TYPE_RED_PANDA_V2, HW_TYPE_TRES, HW_TYPE_CUATRO]
 
+  SINGLE_BOARD_FW = {
+    HW_TYPE_RED_PANDA: "panda_h7_red.bin.signed",
+    HW_TYPE_TRES: "panda_h7_tres.bin.signed",
+    HW_TYPE_CUATRO: "panda_h7_cuatro.bin.signed",
+  }
+
   INTERNAL_DEVICES = (HW_TYPE_UNO, HW_TYPE_DOS, HW_TYPE_TRES, HW_TYPE_CUATRO)
   HAS_OBD = (HW_TYPE_BLACK_PANDA, HW_TYPE_UNO, HW_TYPE_DOS, HW_TYPE_RED_PANDA, HW_TYPE_RED_PANDA_V2, HW_TYPE_TRES, HW_TYPE_CUATRO)
 
@@ -146,6 +356,36 @@ class Panda:
     HW_TYPE_CUATRO: 12500,
   }
 
+  CAN_FILTER_PASS = 0
+  CAN_FILTER_DROP = 1
+  CAN_FILTER_DECIMATE = 2
+  CAN_FILTER_ON_CHANGE = 3
+
+  # firmware ISO-TP results, see board/isotp.h
+  ISOTP_STATUS_DONE = 0
+  ISOTP_STATUS_REJECTED = 1
+  ISOTP_STATUS_TIMEOUT = 2
+  ISOTP_STATUS_OVERFLOW = 3
+  ISOTP_STATUS_ABORTED = 4
+  ISOTP_STATUS_BUSY = 5
+
+  PLAYBACK_IDLE = 0
+  PLAYBACK_RUNNING = 1
+  PLAYBACK_DONE = 2
+
+  TX_CHECKSUM_NONE = 0
+  TX_CHECKSUM_SUM8 = 1
+  TX_CHECKSUM_SUM8_ADDR = 2
+  TX_CHECKSUM_XOR8 = 3
+  TX_CHECKSUM_CRC8_J1850 = 4
+  TX_CHECKSUM_CRC8_AUTOSAR = 5
+
+  # streaming flash states, see board/flasher.h
+  FLASH_STREAM_ERASING = 1
+  FLASH_STREAM_PROGRAMMING = 2
+  FLASH_STREAM_DONE = 3
+  FLASH_STREAM_TIMEOUT_MS = 60000
+
   HARNESS_STATUS_NC = 0
   HARNESS_STATUS_NORMAL = 1
   HARNESS_STATUS_FLIPPED = 2
@@ -156,6 +396,10 @@ class Panda:
     self._handle: BaseHandle
     self._handle_open = False
     self.can_rx_overflow_buffer = b''
+    self._can_rx_decompressor: CanRxDecompressor | None = None
+    self._telemetry_chunks: dict[int, tuple[int, bytes]] = {}
+    self.streamed_health: dict | None = None
+    self.streamed_can_health: list[dict | None] = [None] * PANDA_BUS_CNT
     self._can_speed_kbps = can_speed_kbps
 
     if cli and serial is None:
@@ -447,16 +691,21 @@ class Panda:
     logger.info("flash: unlocking")
     handle.controlWrite(Panda.REQUEST_IN, 0xb1, 0, 0, b'')
 
-    # erase sectors
-    logger.info(f"flash: erasing sectors 1 - {last_sector}")
-    for i in range(1, last_sector + 1):
-      handle.controlWrite(Panda.REQUEST_IN, 0xb2, i, 0, b'')
+    # newer bootstubs erase in the background and take the image as one stream
+    dat = handle.controlRead(Panda.REQUEST_IN, 0xb7, last_sector, 0, 0xc)
+    if len(dat) >= 2 and dat[1] == 0xff:
+      Panda._flash_stream(handle, code)
+    else:
+      # erase sectors
+      logger.info(f"flash: erasing sectors 1 - {last_sector}")
+      for i in range(1, last_sector + 1):
+        handle.controlWrite(Panda.REQUEST_IN, 0xb2, i, 0, b'')
 
-    # flash over EP2
-    STEP = 0x10
-    logger.info("flash: flashing")
-    for i in range(0, len(code), STEP):
-      handle.bulkWrite(2, code[i:i + STEP])
+      # flash over EP2
+      STEP = 0x10
+      logger.info("flash: flashing")
+      for i in range(0, len(code), STEP):
+        handle.bulkWrite(2, code[i:i + STEP])
 
     # reset
     logger.info("flash: resetting")
@@ -465,7 +714,34 @@ class Panda:
     except Exception:
       pass
 
-  def flash(self, fn=None, code=None, reconnect=True):
+  @staticmethod
+  def _flash_stream(handle, code):
+    # the bootstub NAKs while its buffer is full. It stalls during each sector
+    # erase, which happens before programming, so the first chunks wait on the whole erase
+    STEP = 0x4000
+    logger.info("flash: streaming")
+    for i in range(0, len(code), STEP):
+      handle.bulkWrite(2, code[i:i + STEP], timeout=Panda.FLASH_STREAM_TIMEOUT_MS)
+
+    # mark the end of the image and wait for the device to program and checksum it
+    handle.controlRead(Panda.REQUEST_IN, 0xb8, 1, 0, 0xc)
+    start = time.monotonic()
+    while True:
+      state, length, crc = struct.unpack("<III", handle.controlRead(Panda.REQUEST_IN, 0xb8, 0, 0, 0xc))
+      if state not in (Panda.FLASH_STREAM_ERASING, Panda.FLASH_STREAM_PROGRAMMING):
+        break
+      assert time.monotonic() - start < Panda.FLASH_STREAM_TIMEOUT_MS / 1e3, "flash: timed out waiting for the device"
+      time.sleep(0.01)
+
+    assert state == Panda.FLASH_STREAM_DONE, f"flash: streaming failed, state {state}"
+    assert length == len(code), f"flash: device programmed {length} bytes, expected {len(code)}"
+    assert crc == binascii.crc32(code), "flash: CRC mismatch"
+    logger.info("flash: CRC verified")
+
+  def flash(self, fn=None, code=None, reconnect=True, single_board=False):
+    """single_board: flash the image built only for this board type, see board/SConscript"""
+    if not fn and single_board:
+      fn = os.path.join(FW_PATH, Panda.SINGLE_BOARD_FW[self.get_type()])
     if self.up_to_date(fn=fn):
       logger.info("flash: already up to date")
       return
@@ -549,6 +825,9 @@ class Panda:
   @ensure_health_packet_version
   def health(self):
     dat = self._handle.controlRead(Panda.REQUEST_IN, 0xd2, 0, 0, self.HEALTH_STRUCT.size)
+    return self._parse_health(dat)
+
+  def _parse_health(self, dat):
     a = self.HEALTH_STRUCT.unpack(dat)
     return {
       "uptime": a[0],
@@ -581,6 +860,10 @@ class Panda:
 
   @ensure_can_health_packet_version
   def can_health(self, can_number):
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc2, int(can_number), 0, self.CAN_HEALTH_STRUCT.size)
+    return self._parse_can_health(dat)
+
+  def _parse_can_health(self, dat):
     LEC_ERROR_CODE = {
       0: "No error",
       1: "Stuff error",
@@ -591,7 +874,6 @@ class Panda:
       6: "CRCError",
       7: "NoChange",
     }
-    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xc2, int(can_number), 0, self.CAN_HEALTH_STRUCT.size)
     a = self.CAN_HEALTH_STRUCT.unpack(dat)
     return {
       "bus_off": a[0],
@@ -622,6 +904,52 @@ class Panda:
       "can_core_reset_count": a[25],
     }
 
+  def set_can_rx_filters(self, rules):
+    """Filters which received frames are delivered to the host, see board/can_filter.h.
+    rules: list of (bus, addr_lo, addr_hi, action, n), first match wins. bus None matches any bus.
+    An empty list delivers everything again."""
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xae, 0xFFFF, 0, b'')
+    for bus, addr_lo, addr_hi, action, n in rules:
+      self._handle.controlWrite(Panda.REQUEST_OUT, 0xac, addr_lo & 0xFFFF, addr_lo >> 16, b'')
+      self._handle.controlWrite(Panda.REQUEST_OUT, 0xad, addr_hi & 0xFFFF, addr_hi >> 16, b'')
+      self._handle.controlWrite(Panda.REQUEST_OUT, 0xae, (action << 8) | (0xFF if bus is None else bus), n, b'')
+
+  def set_can_tx_priority_limit(self, bus, limit):
+    """Frames sent on bus with an arbitration ID below limit (top 11 bits for extended IDs)
+    skip ahead of frames already queued, like can_send(high_priority=True). 0 disables.
+    Changing it while frames are queued can reorder frames of an address that changes class."""
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xaf, bus, limit, b'')
+
+  def set_telemetry_rate(self, rate_hz):
+    """Stream health and CAN health inside the CAN RX stream at rate_hz (max 8, 0 disables).
+    The latest records are kept in streamed_health and streamed_can_health, updated by can_recv."""
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xaa, int(rate_hz), 0, b'')
+
+  def _process_telemetry(self, records):
+    for addr, data in records:
+      rtype, version, chunk = (addr >> 16) & 0xF, (addr >> 8) & 0xFF, addr & 0xFF
+
+      # chunks arrive in order, restart on chunk 0 and discard on a gap
+      if chunk == 0:
+        self._telemetry_chunks[rtype] = (0, data)
+      elif rtype in self._telemetry_chunks and self._telemetry_chunks[rtype][0] == chunk - 1:
+        self._telemetry_chunks[rtype] = (chunk, self._telemetry_chunks[rtype][1] + data)
+      else:
+        self._telemetry_chunks.pop(rtype, None)
+        continue
+
+      buf = self._telemetry_chunks[rtype][1]
+      if rtype == TELEMETRY_HEALTH:
+        if len(buf) >= self.HEALTH_STRUCT.size:
+          del self._telemetry_chunks[rtype]
+          if version == self.HEALTH_PACKET_VERSION:
+            self.streamed_health = self._parse_health(buf[:self.HEALTH_STRUCT.size])
+      elif TELEMETRY_CAN_HEALTH <= rtype < TELEMETRY_CAN_HEALTH + PANDA_BUS_CNT:
+        if len(buf) >= self.CAN_HEALTH_STRUCT.size:
+          del self._telemetry_chunks[rtype]
+          if version == self.CAN_HEALTH_PACKET_VERSION:
+            self.streamed_can_health[rtype - TELEMETRY_CAN_HEALTH] = self._parse_can_health(buf[:self.CAN_HEALTH_STRUCT.size])
+
   # ******************* control *******************
 
   def get_version(self):
@@ -761,17 +1089,30 @@ class Panda:
 
   def can_reset_communications(self):
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xc0, 0, 0, b'')
+    # the panda turns compression off on reset
+    self._can_rx_decompressor = None
+
+  def set_can_rx_compression(self, enabled):
+    """Switches the CAN RX stream to the compressed format of board/can_compress.h.
+    A packet split across the switch is lost."""
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xab, int(enabled), 0, b'')
+    self.can_rx_overflow_buffer = b''
+    self._can_rx_decompressor = CanRxDecompressor() if enabled else None
 
   @ensure_can_packet_version
-  def can_send_many(self, arr, *, fd=False, timeout=CAN_SEND_TIMEOUT_MS):
-    snds = pack_can_buffer(arr, fd=fd)
+  def can_send_many(self, arr, *, fd=False, timeout=CAN_SEND_TIMEOUT_MS, high_priority=False):
+    """high_priority frames skip ahead of frames already queued. Frames of one
+    address can leave out of order if only some of them are high_priority, so
+    an address should always use the same class. Frames that find the high
+    priority queue full are dropped and counted in tx_buffer_overflow."""
+    snds = pack_can_buffer(arr, fd=fd, high_priority=high_priority)
     for tx in snds:
       while len(tx) > 0:
         bs = self._handle.bulkWrite(3, tx, timeout=timeout)
         tx = tx[bs:]
 
-  def can_send(self, addr, dat, bus, *, fd=False, timeout=CAN_SEND_TIMEOUT_MS):
-    self.can_send_many([[addr, dat, bus]], fd=fd, timeout=timeout)
+  def can_send(self, addr, dat, bus, *, fd=False, timeout=CAN_SEND_TIMEOUT_MS, high_priority=False):
+    self.can_send_many([[addr, dat, bus]], fd=fd, timeout=timeout, high_priority=high_priority)
 
   @ensure_can_packet_version
   def can_recv(self):
@@ -783,9 +1124,57 @@ class Panda:
       except (usb1.USBErrorIO, usb1.USBErrorOverflow):
         logger.error("CAN: BAD RECV, RETRYING")
         time.sleep(0.1)
-    msgs, self.can_rx_overflow_buffer = unpack_can_buffer(self.can_rx_overflow_buffer + dat)
+    telemetry: list[tuple[int, bytes]] = []
+    unpack = unpack_can_buffer if self._can_rx_decompressor is None else self._can_rx_decompressor.unpack
+    msgs, self.can_rx_overflow_buffer = unpack(self.can_rx_overflow_buffer + dat, telemetry)
+    self._process_telemetry(telemetry)
     return msgs
 
+  def isotp_send(self, addr, dat, bus, fc_addr, *, timeout=CAN_SEND_TIMEOUT_MS):
+    """Sends a whole ISO-TP PDU, the panda does the segmentation and flow control.
+    The result arrives from can_recv() as a message on ISOTP_BUS, see isotp_result."""
+    chunk_size = 64 if self._mcu_type == McuType.H7 else 8
+    self.can_send_many(pack_isotp_pdu(addr, dat, bus, fc_addr, chunk_size), fd=(chunk_size > 8), timeout=timeout)
+
+  def isotp_abort(self):
+    self.can_send(0, bytes([ISOTP_CHUNK_ABORT]), ISOTP_BUS)
+
+  @staticmethod
+  def isotp_result(dat):
+    """(status, payload bytes sent) of an ISOTP_BUS message"""
+    return dat[0], dat[1] | (dat[2] << 8)
+
+  def _playback_command(self, cmd, param=0):
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xea, cmd, param, PLAYBACK_STATUS_STRUCT.size)
+    keys = ("state", "loop", "frames", "loaded", "sent", "blocked", "loops", "late", "max_error_us", "mean_error_us")
+    return dict(zip(keys, PLAYBACK_STATUS_STRUCT.unpack(dat), strict=True))
+
+  def playback_load(self, frames, *, fd=False):
+    """Replaces the playback sequence with (delay_us, addr, dat, bus) frames.
+    The panda holds 16 kB, about 900 classic frames."""
+    self._playback_command(1)
+    dat = pack_playback(frames, fd=fd)
+    if self.spi:
+      self._handle.bulkWrite(PLAYBACK_SPI_ENDPOINT, dat)
+    else:
+      for i in range(0, len(dat), 0x3f):
+        self._handle.bulkWrite(2, struct.pack("B", PLAYBACK_EP2_PORT) + dat[i:i + 0x3f])
+    status = self._playback_command(0)
+    if status["loaded"] != len(dat):
+      raise ValueError(f"playback sequence too large ({len(dat)} bytes)")
+
+  def playback_start(self, loop=False):
+    """Plays the loaded sequence, timed by the panda. Frames still go through safety.
+    Returns False if the sequence is invalid."""
+    return self._playback_command(2, int(loop))["state"] == Panda.PLAYBACK_RUNNING
+
+  def playback_stop(self):
+    self._playback_command(3)
+
+  def playback_status(self):
+    """state, frame counters, loops and the queueing error vs schedule in us (late: above 50 us)"""
+    return self._playback_command(0)
+
   def can_clear(self, bus):
     """Clears all messages from the specified internal CAN ringbuffer as
     though it were drained.
@@ -816,6 +1205,31 @@ class Panda:
       ret += self._handle.bulkWrite(2, struct.pack("B", port_number) + ln[i:i + 0x20])
     return ret
 
+  def serial_dropped(self, port_number) -> int:
+    """Bytes lost to a full ring on this uart since boot."""
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xe9, port_number, 0, 4)
+    return struct.unpack("<I", dat)[0]
+
+  def set_debug_log_binary(self, binary: bool) -> None:
+    """Compact debug log format, see decode_debug_log."""
+    self._handle.controlRead(Panda.REQUEST_IN, 0xe9, Panda.SERIAL_DEBUG, 2 if binary else 1, 4)
+
+  @staticmethod
+  def decode_debug_log(dat: bytes) -> str:
+    """Expands the compact debug log: a (0x80 | n) byte is followed by an n byte little endian number."""
+    out = []
+    i = 0
+    while i < len(dat):
+      b = dat[i]
+      if b & 0x80:
+        n = b & 0x7F
+        out.append(int.from_bytes(dat[i+1:i+1+n], "little").to_bytes(n, "big").hex())
+        i += 1 + n
+      else:
+        out.append(chr(b))
+        i += 1
+    return "".join(out)
+
   def serial_clear(self, port_number):
     """Clears all messages (tx and rx) from the specified internal uart
     ringbuffer as though it were drained.
@@ -839,6 +1253,109 @@ class Panda:
     dat = self._handle.controlRead(Panda.REQUEST_IN, 0xa8, 0, 0, 4)
     return struct.unpack("I", dat)[0]
 
+  def get_time_sync_sample(self):
+    """(microsecond timer, synced time) of the same instant, see python/timesync.py"""
+    dat = self._handle.controlRead(Panda.REQUEST_IN, 0xb9, 0, 0, TIME_SYNC_SAMPLE_STRUCT.size)
+    return TIME_SYNC_SAMPLE_STRUCT.unpack(dat)
+
+  def set_time_sync(self, ref, offset, skew):
+    """synced = timer + offset + skew * (timer - ref) / 2^32, all 32-bit"""
+    skew &= 0xFFFFFFFF
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xba, ref & 0xFFFF, ref >> 16, b'')
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xbb, offset & 0xFFFF, offset >> 16, b'')
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xbc, skew & 0xFFFF, skew >> 16, b'')
+
+  def clear_time_sync(self):
+    self.set_time_sync(0, 0, 0)
+
+  # ****************** Trace *****************
+  def read_trace(self):
+    """Drains the firmware event trace ring. Returns a list of TraceEvent."""
+    if self.spi:
+      dat = self._handle.bulkRead(TRACE_SPI_ENDPOINT, TRACE_BUF_SIZE * TRACE_EVENT_STRUCT.size)
+    else:
+      ret = []
+      while 1:
+        lret = bytes(self._handle.controlRead(Panda.REQUEST_IN, 0xa9, 0, 0, 0x40))
+        if len(lret) == 0:
+          break
+        ret.append(lret)
+      dat = b''.join(ret)
+    return unpack_trace_buffer(dat)
+
+  def clear_trace(self):
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xa9, 1, 0, b'')
+
+  # ****************** CAN stats *****************
+  def get_can_stats(self):
+    """Per-address RX statistics kept by the panda since the last clear.
+    Returns (entries, frames of addresses that did not fit in the table)."""
+    untracked = struct.unpack("I", self._handle.controlRead(Panda.REQUEST_IN, 0xeb, 1, 0, 4))[0]
+    ret = []
+    while 1:
+      if self.spi:
+        lret = bytes(self._handle.bulkRead(CAN_STATS_SPI_ENDPOINT, 0x1000))
+      else:
+        lret = bytes(self._handle.controlRead(Panda.REQUEST_IN, 0xeb, 0, 0, 0x40))
+      if len(lret) == 0:
+        break
+      ret.append(lret)
+    return unpack_can_stats(b''.join(ret)), untracked
+
+  def clear_can_stats(self):
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xeb, 2, 0, b'')
+
+  # ****************** CAN cycle benchmark *****************
+  def _can_bench(self, cmd):
+    dat = CAN_BENCH_STRUCT.unpack(self._handle.controlRead(Panda.REQUEST_IN, 0xf0, cmd, 0, CAN_BENCH_STRUCT.size))
+    ret = {"core_mhz": dat[9], "itcm": bool(dat[10])}
+    for i, kind in enumerate(("rx", "fwd", "tx")):
+      ret[kind] = dict(zip(("frames", "cycles_mean", "cycles_max"), dat[i * 3:i * 3 + 3], strict=True))
+    return ret
+
+  def can_bench_start(self):
+    """Times every frame on the CAN interrupt path in core cycles until stopped"""
+    self._can_bench(1)
+
+  def can_bench_stop(self):
+    return self._can_bench(2)
+
+  def can_bench_results(self):
+    """frames, mean and max cycles per received (rx), forwarded (fwd) and sent (tx) frame"""
+    return self._can_bench(0)
+
+  # ****************** CAN TX templates *****************
+  def set_can_tx_template(self, bus, addr, counter=None, checksum=None):
+    """The panda stamps the counter and checksum of frames the host sends to addr on bus,
+    before its safety check, see board/can_template.h. set_safety_mode clears all templates.
+    counter: (byte, lsb position, bits), checksum: (Panda.TX_CHECKSUM_*, byte).
+    Addresses of 0x800 and above are extended."""
+    counter_cfg = 0 if counter is None else ((1 << 15) | ((counter[2] - 1) << 9) | (counter[1] << 6) | counter[0])
+    checksum_cfg = 0 if checksum is None else ((checksum[0] << 6) | checksum[1])
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xef, counter_cfg, checksum_cfg, b'')
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xee, addr & 0xFFFF, (addr >> 16) | (bus << 13) | (int(addr >= 0x800) << 15), b'')
+
+  def clear_can_tx_templates(self):
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xee, 0xFFFF, 0xFFFF, b'')
+
+  # ****************** CAN last-value cache *****************
+  def set_can_cache(self, addrs):
+    """Replaces the cached addresses with a list of (bus, addr), up to 64.
+    Addresses of 0x800 and above are extended."""
+    self._handle.controlWrite(Panda.REQUEST_OUT, 0xed, 2, 0, b'')
+    for bus, addr in addrs:
+      self._handle.controlWrite(Panda.REQUEST_OUT, 0xec, addr & 0xFFFF, (addr >> 16) | (bus << 13) | (int(addr >= 0x800) << 15), b'')
+
+  def read_can_cache(self):
+    """Latest frame of every cached address, see unpack_can_cache"""
+    if self.spi:
+      # the handle reads until a short transfer, which ends the snapshot
+      dat = self._handle.bulkRead(CAN_CACHE_SPI_ENDPOINT, CAN_CACHE_SNAPSHOT_SIZE)
+    else:
+      length = struct.unpack("I", self._handle.controlRead(Panda.REQUEST_IN, 0xed, 0, 0, 4))[0]
+      dat = b''.join(bytes(self._handle.controlRead(Panda.REQUEST_IN, 0xed, 1, i, 0x40)) for i in range(0, length, 0x40))
+    return unpack_can_cache(dat)
+
   # ******************* IR *******************
   def set_ir_power(self, percentage):
     self._handle.controlWrite(Panda.REQUEST_OUT, 0xb0, int(percentage), 0, b'')
@@ -0,0 +1,303 @@
+# append-only binary CAN log, see scripts/can_log.py
+#
+# A log is a directory of segments. Each segment is a data file that is
+# preallocated, memory-mapped and filled with blocks of frames, plus an
+# index file with one entry per finished block: its time range, position
+# and a bloom filter of the (bus, addr) it holds. Readers find blocks by
+# binary search on time and skip those whose filter misses the address,
+# only the frames of matching blocks are decoded.
+#
+# data file: header, then blocks of [block header][record]...
+#   header: magic, version, segment number, created (ns), committed length.
+#           Only the first committed length bytes are valid, a reader of a
+#           crashed log ignores the rest.
+#   block header: magic, base timestamp (ns)
+#   record: timestamp (us after the block base), addr, bus, length, data.
+#           The bus is the whole byte, echoed (bus + 128) and rejected
+#           (bus + 192) frames keep their flags.
+#
+# Timestamps never go backwards within a log, an earlier one is stored as
+# the previous one.
+import bisect
+import mmap
+import os
+import struct
+import time
+from collections.abc import Iterator
+from typing import NamedTuple
+
+CANLOG_MAGIC = b"PNDCANLG"
+CANLOG_VERSION = 2
+CANLOG_HEADER_STRUCT = struct.Struct("<8sHHIQQ")
+CANLOG_HEADER_SIZE = 64
+CANLOG_COMMITTED_OFFSET = 24
+CANLOG_BLOCK_STRUCT = struct.Struct("<IQ")
+CANLOG_BLOCK_MAGIC = 0x4B4C4243
+CANLOG_RECORD_STRUCT = struct.Struct("<IIBB")
+CANLOG_INDEX_STRUCT = struct.Struct("<QQQII32s")
+CANLOG_BLOOM_BITS = 256
+
+CANLOG_SEGMENT_SIZE = 64 * 1024 * 1024
+CANLOG_BLOCK_FRAMES = 4096
+# a block spans at most this long, its record timestamps are 32-bit us
+CANLOG_BLOCK_SPAN_NS = 60 * 1000000000
+
+DATA_SUFFIX = ".canlog"
+INDEX_SUFFIX = ".canidx"
+
+
+class CanLogFrame(NamedTuple):
+  ts: int  # ns
+  bus: int
+  addr: int
+  dat: bytes
+
+
+class CanLogBlock(NamedTuple):
+  t_first: int
+  t_last: int
+  offset: int
+  length: int
+  count: int
+  bloom: int
+
+
+# bloom filter key of a (bus, addr)
+def _key(bus: int, addr: int) -> int:
+  return (addr & 0x1FFFFFFF) | ((bus & 0xFF) << 29)
+
+
+def _bloom(key: int) -> int:
+  h = (key * 2654435761) & 0xFFFFFFFF
+  return (1 << (h >> 24)) | (1 << ((h >> 16) & 0xFF))
+
+
+def _segment_path(path: str, n: int, suffix: str) -> str:
+  return os.path.join(path, f"{n:06d}{suffix}")
+
+
+def _segment_numbers(path: str) -> list[int]:
+  return sorted(int(f[:-len(DATA_SUFFIX)]) for f in os.listdir(path) if f.endswith(DATA_SUFFIX) and f[:-len(DATA_SUFFIX)].isdigit())
+
+
+class CanLogWriter:
+  """Appends frames to the log at path, in a new segment after any existing ones."""
+  def __init__(self, path: str, segment_size: int = CANLOG_SEGMENT_SIZE, block_frames: int = CANLOG_BLOCK_FRAMES) -> None:
+    os.makedirs(path, exist_ok=True)
+    self.path = path
+    self.segment_size = segment_size
+    self.block_frames = block_frames
+    segments = _segment_numbers(path)
+    self.segment = (segments[-1] + 1) if len(segments) else 0
+    self.last_ts = 0
+    if len(segments):
+      last = _Segment(path, segments[-1])
+      if len(last.blocks):
+        self.last_ts = last.blocks[-1].t_last
+      last.close()
+    self.frames = 0
+    self._mm: mmap.mmap | None = None
+    self._bloom_cache: dict[int, int] = {}
+    self._open_segment()
+
+  def _open_segment(self) -> None:
+    self._data_f = open(_segment_path(self.path, self.segment, DATA_SUFFIX), "w+b")
+    self._data_f.truncate(self.segment_size)
+    self._mm = mmap.mmap(self._data_f.fileno(), self.segment_size)
+    CANLOG_HEADER_STRUCT.pack_into(self._mm, 0, CANLOG_MAGIC, CANLOG_VERSION, CANLOG_HEADER_SIZE, self.segment, time.time_ns(), CANLOG_HEADER_SIZE)
+    self._index_f = open(_segment_path(self.path, self.segment, INDEX_SUFFIX), "wb")
+    self.pos = CANLOG_HEADER_SIZE
+    self._block_start: int | None = None
+
+  def _close_block(self) -> None:
+    if self._block_start is not None:
+      entry = CANLOG_INDEX_STRUCT.pack(self._block_base, self._block_last, self._block_start, self.pos - self._block_start,
+                                       self._block_count, self._block_bloom.to_bytes(CANLOG_BLOOM_BITS // 8, "little"))
+      self._index_f.write(entry)
+      self._index_f.flush()
+      self._block_start = None
+
+  def _close_segment(self) -> None:
+    assert self._mm is not None
+    self._close_block()
+    self._mm.close()
+    self._mm = None
+    self._data_f.truncate(self.pos)
+    self._data_f.close()
+    self._index_f.close()
+
+  def write(self, msgs, ts: int | None = None) -> None:
+    """Appends (addr, dat, bus) frames received at ts (ns, now if None). Frames given as
+    (addr, dat, bus, ts), like SocketPanda.can_recv_ts, carry their own timestamp."""
+    assert self._mm is not None
+    batch_ts = time.time_ns() if ts is None else ts
+    mm = self._mm
+    for msg in msgs:
+      addr, dat, bus = msg[0], msg[1], msg[2]
+      t = msg[3] if (len(msg) > 3 and msg[3] is not None) else batch_ts
+      t = max(t, self.last_ts)
+      self.last_ts = t
+
+      rec_len = CANLOG_RECORD_STRUCT.size + len(dat)
+      if self._block_start is not None and (self._block_count >= self.block_frames or (t - self._block_base) >= CANLOG_BLOCK_SPAN_NS):
+        self._close_block()
+      if (self.pos + CANLOG_BLOCK_STRUCT.size + rec_len) > self.segment_size:
+        self._commit()
+        self._close_segment()
+        self.segment += 1
+        self._open_segment()
+        mm = self._mm
+      if self._block_start is None:
+        self._block_start = self.pos
+        self._block_base = t
+        self._block_last = t
+        self._block_count = 0
+        self._block_bloom = 0
+        CANLOG_BLOCK_STRUCT.pack_into(mm, self.pos, CANLOG_BLOCK_MAGIC, t)
+        self.pos += CANLOG_BLOCK_STRUCT.size
+
+      key = _key(bus, addr)
+      bloom = self._bloom_cache.get(key)
+      if bloom is None:
+        bloom = self._bloom_cache[key] = _bloom(key)
+      CANLOG_RECORD_STRUCT.pack_into(mm, self.pos, (t - self._block_base) // 1000, addr, bus, len(dat))
+      mm[self.pos + CANLOG_RECORD_STRUCT.size:self.pos + rec_len] = dat
+      self.pos += rec_len
+      self._block_last = t
+      self._block_count += 1
+      self._block_bloom |= bloom
+      self.frames += 1
+    self._commit()
+
+  def _commit(self) -> None:
+    assert self._mm is not None
+    struct.pack_into("<Q", self._mm, CANLOG_COMMITTED_OFFSET, self.pos)
+
+  def close(self) -> None:
+    if self._mm is not None:
+      self._commit()
+      self._close_segment()
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args) -> None:
+    self.close()
+
+
+class _Segment:
+  def __init__(self, path: str, n: int) -> None:
+    self.n = n
+    with open(_segment_path(path, n, DATA_SUFFIX), "rb") as f:
+      self.mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    magic, version, header_size, _, self.created, committed = CANLOG_HEADER_STRUCT.unpack_from(self.mm, 0)
+    assert magic == CANLOG_MAGIC and version == CANLOG_VERSION, f"not a CAN log segment: {n}"
+    self.committed = min(committed, len(self.mm))
+
+    self.blocks: list[CanLogBlock] = []
+    try:
+      with open(_segment_path(path, n, INDEX_SUFFIX), "rb") as f:
+        idx = f.read()
+    except FileNotFoundError:
+      idx = b""
+    for i in range(len(idx) // CANLOG_INDEX_STRUCT.size):
+      t_first, t_last, offset, length, count, bloom = CANLOG_INDEX_STRUCT.unpack_from(idx, i * CANLOG_INDEX_STRUCT.size)
+      if offset + length <= self.committed:
+        self.blocks.append(CanLogBlock(t_first, t_last, offset, length, count, int.from_bytes(bloom, "little")))
+
+    # the block being written when the log was read or the writer stopped
+    pos = (self.blocks[-1].offset + self.blocks[-1].length) if len(self.blocks) else header_size
+    while pos + CANLOG_BLOCK_STRUCT.size <= self.committed:
+      magic, base = CANLOG_BLOCK_STRUCT.unpack_from(self.mm, pos)
+      if magic != CANLOG_BLOCK_MAGIC:
+        break
+      end, count, bloom, t_last = pos + CANLOG_BLOCK_STRUCT.size, 0, 0, base
+      while end + CANLOG_RECORD_STRUCT.size <= self.committed:
+        dt, addr, bus, dlen = CANLOG_RECORD_STRUCT.unpack_from(self.mm, end)
+        if end + CANLOG_RECORD_STRUCT.size + dlen > self.committed:
+          break
+        # a new block starts with its magic where a record would be
+        if dt == CANLOG_BLOCK_MAGIC and count > 0:
+          break
+        end += CANLOG_RECORD_STRUCT.size + dlen
+        count += 1
+        bloom |= _bloom(_key(bus, addr))
+        t_last = base + dt * 1000
+      self.blocks.append(CanLogBlock(base, t_last, pos, end - pos, count, bloom))
+      pos = end
+    self.t_first = [b.t_first for b in self.blocks]
+
+  def frames(self, block: CanLogBlock) -> Iterator[CanLogFrame]:
+    base = block.t_first
+    pos = block.offset + CANLOG_BLOCK_STRUCT.size
+    for _ in range(block.count):
+      dt, addr, bus, dlen = CANLOG_RECORD_STRUCT.unpack_from(self.mm, pos)
+      pos += CANLOG_RECORD_STRUCT.size
+      yield CanLogFrame(base + dt * 1000, bus, addr, bytes(self.mm[pos:pos + dlen]))
+      pos += dlen
+
+  def close(self) -> None:
+    self.mm.close()
+
+
+class CanLogReader:
+  """Random access to a log by time range and address. Frame timestamps are
+  kept in us, so t_start and t_end match to the us."""
+  def __init__(self, path: str) -> None:
+    self.segments = [_Segment(path, n) for n in _segment_numbers(path)]
+    self.segments = [s for s in self.segments if len(s.blocks)]
+
+  def __len__(self) -> int:
+    return sum(b.count for s in self.segments for b in s.blocks)
+
+  def time_range(self) -> tuple[int, int] | None:
+    if len(self.segments) == 0:
+      return None
+    return self.segments[0].blocks[0].t_first, self.segments[-1].blocks[-1].t_last
+
+  def blocks(self, t_start: int | None = None, t_end: int | None = None, keys: set[tuple[int, int]] | None = None) -> Iterator[tuple[_Segment, CanLogBlock]]:
+    """Blocks that may hold frames in [t_start, t_end] of the (bus, addr) in keys."""
+    bloom = None
+    if keys is not None:
+      bloom = [_bloom(_key(bus, addr)) for bus, addr in keys]
+    seg_first = [s.blocks[0].t_first for s in self.segments]
+    si = 0 if t_start is None else max(bisect.bisect_right(seg_first, t_start) - 1, 0)
+    for s in self.segments[si:]:
+      if t_end is not None and s.blocks[0].t_first > t_end:
+        break
+      bi = 0 if t_start is None else max(bisect.bisect_right(s.t_first, t_start) - 1, 0)
+      for b in s.blocks[bi:]:
+        if t_end is not None and b.t_first > t_end:
+          return
+        if t_start is not None and b.t_last < t_start:
+          continue
+        if bloom is not None and not any((b.bloom & m) == m for m in bloom):
+          continue
+        yield s, b
+
+  def query(self, t_start: int | None = None, t_end: int | None = None, bus: int | None = None, addr: int | None = None,
+            keys: set[tuple[int, int]] | None = None) -> Iterator[CanLogFrame]:
+    """Frames in [t_start, t_end] (ns), of one bus and/or address or of a set of (bus, addr)."""
+    if keys is None and bus is not None and addr is not None:
+      keys = {(bus, addr)}
+    for s, b in self.blocks(t_start, t_end, keys):
+      for f in s.frames(b):
+        if t_start is not None and f.ts < t_start:
+          continue
+        if t_end is not None and f.ts > t_end:
+          return
+        if keys is not None and (f.bus, f.addr) not in keys:
+          continue
+        if (bus is not None and f.bus != bus) or (addr is not None and f.addr != addr):
+          continue
+        yield f
+
+  def close(self) -> None:
+    for s in self.segments:
+      s.close()
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args) -> None:
+    self.close()
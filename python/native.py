@@ -0,0 +1,242 @@
+# bindings of the native host client in host/, see host/panda_client.h
+import os
+import struct
+
+from cffi import FFI
+
+from .base import TIMEOUT
+from .constants import BASEDIR
+
+LIBPANDACLIENT_FN = os.path.join(BASEDIR, "host", "libpandaclient.so")
+
+ffi = FFI()
+ffi.cdef("""
+#define PANDA_SERIAL_LEN 32
+
+typedef struct {
+  uint32_t addr;
+  uint8_t bus;
+  uint8_t len;
+  uint8_t fd;
+  uint8_t data[64];
+} panda_can_frame_t;
+
+typedef struct {
+  uint64_t rx_frames;
+  uint64_t rx_bytes;
+  uint64_t rx_dropped;
+  uint64_t rx_checksum_errors;
+  uint64_t tx_frames;
+  uint64_t tx_bytes;
+  uint64_t tx_nacks;
+  uint64_t transfer_errors;
+  uint32_t tx_pending;
+} panda_stats_t;
+
+typedef struct panda_dev panda_dev_t;
+typedef struct panda_loop panda_loop_t;
+
+size_t panda_can_pack(const panda_can_frame_t *frame, uint8_t *out);
+int panda_can_unpack(const uint8_t *buf, size_t len, panda_can_frame_t *out, size_t max_frames, size_t *consumed);
+
+int panda_usb_list(char serials[][PANDA_SERIAL_LEN], int max);
+panda_dev_t *panda_open_usb(const char *serial);
+panda_dev_t *panda_open_spi(const char *path);
+void panda_close(panda_dev_t *dev);
+const char *panda_get_serial(const panda_dev_t *dev);
+bool panda_is_spi(const panda_dev_t *dev);
+bool panda_connected(const panda_dev_t *dev);
+int panda_control_read(panda_dev_t *dev, uint8_t request, uint16_t value, uint16_t index, uint8_t *buf, uint16_t len, uint32_t timeout_ms);
+int panda_control_write(panda_dev_t *dev, uint8_t request, uint16_t value, uint16_t index, uint32_t timeout_ms);
+size_t panda_can_send(panda_dev_t *dev, const panda_can_frame_t *frames, size_t n);
+size_t panda_can_recv(panda_dev_t *dev, panda_can_frame_t *out, size_t max_frames);
+void panda_get_stats(const panda_dev_t *dev, panda_stats_t *stats);
+
+panda_loop_t *panda_loop_new(uint32_t spi_poll_us);
+void panda_loop_free(panda_loop_t *loop);
+int panda_loop_add(panda_loop_t *loop, panda_dev_t *dev);
+int panda_loop_remove(panda_loop_t *loop, panda_dev_t *dev);
+int panda_loop_fd(const panda_loop_t *loop);
+int panda_loop_run(panda_loop_t *loop, int timeout_ms);
+""")
+
+_lib = None
+
+
+def lib():
+  global _lib
+  if _lib is None:
+    if not os.path.exists(LIBPANDACLIENT_FN):
+      raise FileNotFoundError(f"{LIBPANDACLIENT_FN} is not built, run scons")
+    _lib = ffi.dlopen(LIBPANDACLIENT_FN)
+  return _lib
+
+
+RECV_BATCH = 1024
+STATS_FIELDS = [f for f, _ in ffi.typeof("panda_stats_t").fields]
+
+
+def _check(ret: int) -> int:
+  if ret < 0:
+    raise OSError(-ret, os.strerror(-ret))
+  return ret
+
+
+def _frames(arr, fd=False):
+  frames = ffi.new("panda_can_frame_t[]", max(len(arr), 1))
+  for i, (addr, dat, bus) in enumerate(arr):
+    frames[i].addr = addr
+    frames[i].bus = bus
+    frames[i].len = len(dat)
+    frames[i].fd = int(fd)
+    ffi.memmove(frames[i].data, dat, len(dat))
+  return frames
+
+
+def _tuples(frames, n):
+  return [(f.addr, bytes(ffi.buffer(f.data, f.len)), f.bus) for f in (frames[i] for i in range(n))]
+
+
+def can_pack(arr, fd=False) -> bytes:
+  """Same as b"".join(pack_can_buffer(arr, fd))."""
+  frames = _frames(arr, fd)
+  out = ffi.new("uint8_t[]", 70)
+  ret = b""
+  for i in range(len(arr)):
+    n = lib().panda_can_pack(frames + i, out)
+    assert n > 0, f"invalid CAN frame: {arr[i]}"
+    ret += bytes(ffi.buffer(out, n))
+  return ret
+
+
+def can_unpack(dat: bytes):
+  """Same contract as unpack_can_buffer, without telemetry."""
+  frames = ffi.new("panda_can_frame_t[]", max(len(dat) // 6, 1))
+  consumed = ffi.new("size_t *")
+  n = lib().panda_can_unpack(dat, len(dat), frames, len(frames), consumed)
+  assert n >= 0, "CAN packet checksum incorrect"
+  return _tuples(frames, n), dat[consumed[0]:]
+
+
+class NativePanda:
+  """A panda handled by the native client. CAN I/O happens in a NativePandaLoop,
+  can_send_many queues frames and can_recv returns what the loop received."""
+  def __init__(self, serial: str | None = None, spi: bool = False, spi_path: str = "/dev/spidev0.0") -> None:
+    if spi:
+      dev = lib().panda_open_spi(spi_path.encode())
+    else:
+      dev = lib().panda_open_usb(ffi.NULL if serial is None else serial.encode())
+    if dev == ffi.NULL:
+      errno = ffi.errno
+      raise OSError(errno, f"failed to open panda: {os.strerror(errno)}")
+    self._dev = dev
+    self._recv_buf = ffi.new("panda_can_frame_t[]", RECV_BATCH)
+    self.loop: NativePandaLoop | None = None
+
+  @staticmethod
+  def list() -> list[str]:
+    serials = ffi.new("char[64][32]")
+    n = lib().panda_usb_list(serials, 64)
+    return [ffi.string(serials[i]).decode() for i in range(min(n, 64))]
+
+  def close(self) -> None:
+    if self._dev is not None:
+      if self.loop is not None:
+        self.loop.remove(self)
+      lib().panda_close(self._dev)
+      self._dev = None
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args) -> None:
+    self.close()
+
+  @property
+  def serial(self) -> str:
+    return ffi.string(lib().panda_get_serial(self._dev)).decode()
+
+  @property
+  def spi(self) -> bool:
+    return bool(lib().panda_is_spi(self._dev))
+
+  @property
+  def connected(self) -> bool:
+    return bool(lib().panda_connected(self._dev))
+
+  def control_read(self, request: int, value: int, index: int, length: int, timeout: int = TIMEOUT) -> bytes:
+    buf = ffi.new("uint8_t[]", max(length, 1))
+    n = _check(lib().panda_control_read(self._dev, request, value, index, buf, length, timeout))
+    return bytes(ffi.buffer(buf, n))
+
+  def control_write(self, request: int, value: int, index: int, timeout: int = TIMEOUT) -> None:
+    _check(lib().panda_control_write(self._dev, request, value, index, timeout))
+
+  def can_send_many(self, arr, *, fd=False) -> int:
+    """Queues (addr, dat, bus) frames, returns how many fit in the TX queue."""
+    return int(lib().panda_can_send(self._dev, _frames(arr, fd), len(arr)))
+
+  def can_send(self, addr, dat, bus, *, fd=False) -> int:
+    return self.can_send_many([(addr, dat, bus)], fd=fd)
+
+  def can_recv(self):
+    ret = []
+    while True:
+      n = lib().panda_can_recv(self._dev, self._recv_buf, RECV_BATCH)
+      ret += _tuples(self._recv_buf, n)
+      if n < RECV_BATCH:
+        return ret
+
+  def stats(self) -> dict[str, int]:
+    s = ffi.new("panda_stats_t *")
+    lib().panda_get_stats(self._dev, s)
+    return {f: getattr(s, f) for f in STATS_FIELDS}
+
+  # a few of the Panda requests
+  def set_safety_mode(self, mode: int, param: int = 0) -> None:
+    self.control_write(0xdc, mode, param)
+
+  def send_heartbeat(self, engaged: bool = True) -> None:
+    self.control_write(0xf3, int(engaged), 0)
+
+  def get_microsecond_timer(self) -> int:
+    return int(struct.unpack("I", self.control_read(0xa8, 0, 0, 4))[0])
+
+
+class NativePandaLoop:
+  """Services the CAN I/O of its pandas from one thread, the GIL is released
+  while run() waits and transfers."""
+  def __init__(self, spi_poll_us: int = 1000) -> None:
+    self._loop = lib().panda_loop_new(spi_poll_us)
+    if self._loop == ffi.NULL:
+      raise OSError(ffi.errno, "failed to create panda loop")
+    self.pandas: list[NativePanda] = []
+
+  def add(self, p: NativePanda) -> None:
+    _check(lib().panda_loop_add(self._loop, p._dev))
+    p.loop = self
+    self.pandas.append(p)
+
+  def remove(self, p: NativePanda) -> None:
+    lib().panda_loop_remove(self._loop, p._dev)
+    p.loop = None
+    self.pandas.remove(p)
+
+  def fileno(self) -> int:
+    return int(lib().panda_loop_fd(self._loop))
+
+  def run(self, timeout_ms: int = 0) -> int:
+    return _check(lib().panda_loop_run(self._loop, timeout_ms))
+
+  def close(self) -> None:
+    if self._loop is not None:
+      for p in list(self.pandas):
+        self.remove(p)
+      lib().panda_loop_free(self._loop)
+      self._loop = None
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args) -> None:
+    self.close()
@@ -1,3 +1,6 @@
+import ctypes
+import errno
+import os
 import socket
 import struct
 
@@ -22,6 +25,12 @@ CAN_HEADER_FMT = "=IBB2x"
 CAN_HEADER_LEN = struct.calcsize(CAN_HEADER_FMT)
 CAN_MAX_DLEN = 8
 CANFD_MAX_DLEN = 64
+CAN_MTU = CAN_HEADER_LEN + CAN_MAX_DLEN
+CANFD_MTU = CAN_HEADER_LEN + CANFD_MAX_DLEN
+
+CAN_EFF_FLAG = 0x80000000
+CAN_EFF_MASK = 0x1FFFFFFF
+CAN_SFF_MASK = 0x7FF
 
 CANFD_BRS = 0x01 # bit rate switch (second bitrate for payload data)
 CANFD_FDF = 0x04 # mark CAN FD for dual use of struct canfd_frame
@@ -30,6 +39,111 @@ CANFD_FDF = 0x04 # mark CAN FD for dual use of struct canfd_frame
 # https://github.com/torvalds/linux/blob/47ac09b91befbb6a235ab620c32af719f8208399/include/uapi/asm-generic/socket.h#L61
 SO_RXQ_OVFL = 40
 
+# kernel RX timestamps, hardware ones when the driver has them
+SO_TIMESTAMPING = 37
+SCM_TIMESTAMPING = SO_TIMESTAMPING
+SOF_TIMESTAMPING_RX_HARDWARE = 1 << 2
+SOF_TIMESTAMPING_RX_SOFTWARE = 1 << 3
+SOF_TIMESTAMPING_SOFTWARE = 1 << 4
+SOF_TIMESTAMPING_RAW_HARDWARE = 1 << 6
+
+SYSFS_NET = "/sys/class/net"
+
+# recvmmsg/sendmmsg through libc, None where they don't exist
+try:
+  _libc: ctypes.CDLL | None = ctypes.CDLL(None, use_errno=True)
+except OSError:
+  _libc = None
+if _libc is not None and not (hasattr(_libc, "recvmmsg") and hasattr(_libc, "sendmmsg")):
+  _libc = None
+
+class _iovec(ctypes.Structure):
+  _fields_ = [("iov_base", ctypes.c_void_p), ("iov_len", ctypes.c_size_t)]
+
+class _msghdr(ctypes.Structure):
+  _fields_ = [("msg_name", ctypes.c_void_p), ("msg_namelen", ctypes.c_uint32),
+              ("msg_iov", ctypes.POINTER(_iovec)), ("msg_iovlen", ctypes.c_size_t),
+              ("msg_control", ctypes.c_void_p), ("msg_controllen", ctypes.c_size_t),
+              ("msg_flags", ctypes.c_int)]
+
+class _mmsghdr(ctypes.Structure):
+  _fields_ = [("msg_hdr", _msghdr), ("msg_len", ctypes.c_uint)]
+
+CMSG_HEADER_FMT = "@Nii"  # struct cmsghdr
+CMSG_HEADER_LEN = struct.calcsize(CMSG_HEADER_FMT)
+CMSG_ALIGN = ctypes.sizeof(ctypes.c_size_t)
+CMSG_CONTROL_LEN = 128  # struct timespec[3] and a u32 with their headers
+
+class MMsgBuffer:
+  """Preallocated frames and control buffers for batches of up to n frames."""
+  def __init__(self, n:int) -> None:
+    self.n = n
+    self.frames = (ctypes.c_uint8 * (n * CANFD_MTU))()
+    self.control = (ctypes.c_uint8 * (n * CMSG_CONTROL_LEN))()
+    self.iov = (_iovec * n)()
+    self.msgs = (_mmsghdr * n)()
+    frames_addr = ctypes.addressof(self.frames)
+    for i in range(n):
+      self.iov[i].iov_base = frames_addr + i * CANFD_MTU
+      self.iov[i].iov_len = CANFD_MTU
+      hdr = self.msgs[i].msg_hdr
+      hdr.msg_iov = ctypes.pointer(self.iov[i])
+      hdr.msg_iovlen = 1
+    self.frames_view = memoryview(self.frames).cast("B")
+    self.control_view = memoryview(self.control).cast("B")
+
+  def recv(self, fd:int) -> int:
+    """Receives up to n frames without blocking, returns how many."""
+    control_addr = ctypes.addressof(self.control)
+    for i in range(self.n):
+      self.iov[i].iov_len = CANFD_MTU
+      hdr = self.msgs[i].msg_hdr
+      hdr.msg_control = control_addr + i * CMSG_CONTROL_LEN
+      hdr.msg_controllen = CMSG_CONTROL_LEN
+    assert _libc is not None
+    cnt = _libc.recvmmsg(fd, self.msgs, self.n, socket.MSG_DONTWAIT, None)
+    if cnt < 0:
+      err = ctypes.get_errno()
+      if err in (errno.EAGAIN, errno.EWOULDBLOCK):
+        return 0
+      raise OSError(err, os.strerror(err))
+    return cnt
+
+  def send(self, fd:int, lens:list[int]) -> None:
+    """Sends the first len(lens) frames, each lens[i] bytes long."""
+    for i, frame_len in enumerate(lens):
+      self.iov[i].iov_len = frame_len
+      hdr = self.msgs[i].msg_hdr
+      hdr.msg_control = None
+      hdr.msg_controllen = 0
+    assert _libc is not None
+    sent = 0
+    while sent < len(lens):
+      cnt = _libc.sendmmsg(fd, ctypes.byref(self.msgs, sent * ctypes.sizeof(_mmsghdr)), len(lens) - sent, 0)
+      if cnt < 0:
+        err = ctypes.get_errno()
+        raise OSError(err, os.strerror(err))
+      sent += cnt
+
+  def control_data(self, i:int) -> tuple[int | None, int | None]:
+    """(timestamp in ns, socket drop count) of received frame i, None if missing."""
+    ts, dropped = None, None
+    base = i * CMSG_CONTROL_LEN
+    pos = 0
+    end = self.msgs[i].msg_hdr.msg_controllen
+    while pos + CMSG_HEADER_LEN <= end:
+      cmsg_len, level, cmsg_type = struct.unpack_from(CMSG_HEADER_FMT, self.control_view, base + pos)
+      if cmsg_len < CMSG_HEADER_LEN:
+        break
+      data = base + pos + CMSG_HEADER_LEN
+      if level == socket.SOL_SOCKET and cmsg_type == SCM_TIMESTAMPING:
+        sw_s, sw_ns, _, _, hw_s, hw_ns = struct.unpack_from("@qqqqqq", self.control_view, data)
+        ts = (hw_s * 1000000000 + hw_ns) if (hw_s or hw_ns) else (sw_s * 1000000000 + sw_ns)
+      elif level == socket.SOL_SOCKET and cmsg_type == SO_RXQ_OVFL:
+        dropped = struct.unpack_from("@I", self.control_view, data)[0]
+      pos += (cmsg_len + CMSG_ALIGN - 1) & ~(CMSG_ALIGN - 1)
+    return ts, dropped
+
 import typing
 @typing.no_type_check # mypy struggles with macOS here...
 def create_socketcan(interface:str, recv_buffer_size:int, fd:bool) -> socket.socket:
@@ -40,14 +154,17 @@ def create_socketcan(interface:str, recv_buffer_size:int, fd:bool) -> socket.soc
   socketcan.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, recv_buffer_size)
   # TODO: why is it always 2x the requested size?
   assert socketcan.getsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF) == recv_buffer_size * 2
-  # TODO: how to dectect and alert on buffer overflow?
+  # frames dropped for a full receive buffer, see SocketPanda.rx_dropped
   socketcan.setsockopt(socket.SOL_SOCKET, SO_RXQ_OVFL, 1)
+  socketcan.setsockopt(socket.SOL_SOCKET, SO_TIMESTAMPING, SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                       SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE)
   socketcan.bind((interface,))
   return socketcan
 
 # Panda class substitute for socketcan device (to support using the uds/iso-tp/xcp/ccp library)
+# Frames are read and written up to batch_size per syscall with recvmmsg/sendmmsg.
 class SocketPanda():
-  def __init__(self, interface:str="can0", bus:int=0, fd:bool=False, recv_buffer_size:int=212992) -> None:
+  def __init__(self, interface:str="can0", bus:int=0, fd:bool=False, recv_buffer_size:int=212992, batch_size:int=256) -> None:
     self.interface = interface
     self.bus = bus
     self.fd = fd
@@ -55,42 +172,121 @@ class SocketPanda():
     self.data_len = CANFD_MAX_DLEN if fd else CAN_MAX_DLEN
     self.recv_buffer_size = recv_buffer_size
     self.socket = create_socketcan(interface, recv_buffer_size, fd)
+    self.mmsg = MMsgBuffer(batch_size) if _libc is not None else None
+    # frames the kernel dropped for a full receive buffer since the socket was opened
+    self.rx_dropped = 0
 
   def __del__(self):
     self.socket.close()
 
-  def get_serial(self) -> tuple[int, int]:
-    return (0, 0) # TODO: implemented in panda socketcan driver
+  # attributes of the spidev_panda SocketCAN mode (drivers/spi/spi_panda_can.h)
+  def _attr_path(self, name:str) -> str:
+    return os.path.join(SYSFS_NET, self.interface, "device", name)
 
-  def get_version(self) -> int:
-    return 0 # TODO: implemented in panda socketcan driver
+  def is_panda(self) -> bool:
+    """False for a SocketCAN interface that isn't backed by spidev_panda."""
+    return os.path.exists(self._attr_path("safety_mode"))
+
+  # None if the interface isn't backed by a panda
+  def _read_attr(self, name:str, binary:bool=False):
+    if not self.is_panda():
+      return None
+    with open(self._attr_path(name), "rb") as f:
+      dat = f.read()
+    return dat if binary else dat.decode("utf8").strip()
+
+  def _write_attr(self, name:str, value:str) -> None:
+    # a plain SocketCAN interface has nothing to set, a failed write raises
+    if self.is_panda():
+      with open(self._attr_path(name), "w") as f:
+        f.write(value)
+
+  def get_serial(self) -> tuple[str | None, str | None]:
+    serial = self._read_attr("serial")
+    if serial is None:
+      return (None, None)
+    dongle_id, secret = serial.split(" ", 1)
+    return (dongle_id, secret)
+
+  def get_version(self) -> str | None:
+    return self._read_attr("version")
+
+  def get_health_raw(self) -> bytes | None:
+    """Raw health packet, unpack with Panda.HEALTH_STRUCT."""
+    return self._read_attr("health", binary=True)
 
   def can_clear(self, bus:int) -> None:
-    # TODO: implemented in panda socketcan driver
+    # drops whatever the socket has buffered, the driver's TX queue drains on its own
     self.socket.close()
     self.socket = create_socketcan(self.interface, self.recv_buffer_size, self.fd)
+    self.rx_dropped = 0
 
   def set_safety_mode(self, mode:int, param=0) -> None:
-    pass # TODO: implemented in panda socketcan driver
+    self._write_attr("safety_mode", f"{int(mode)} {int(param)}")
+
+  def send_heartbeat(self, engaged=True) -> None:
+    """Needed about every 100 ms in most safety modes, the driver doesn't send it on its own."""
+    self._write_attr("heartbeat", str(int(engaged)))
 
   def has_obd(self) -> bool:
-    return False # TODO: implemented in panda socketcan driver
+    return False # not exposed by the driver
+
+  def _can_id(self, addr:int) -> int:
+    return (addr | CAN_EFF_FLAG) if addr >= 0x800 else addr
+
+  def _addr(self, can_id:int) -> int:
+    return (can_id & CAN_EFF_MASK) if (can_id & CAN_EFF_FLAG) else (can_id & CAN_SFF_MASK)
+
+  def can_send_many(self, arr, timeout=0) -> None:
+    if self.mmsg is None:
+      for addr, dat, bus in arr:
+        self.can_send(addr, dat, bus, timeout)
+      return
+
+    frame_len = CAN_HEADER_LEN + self.data_len
+    for start in range(0, len(arr), self.mmsg.n):
+      batch = arr[start:start + self.mmsg.n]
+      for i, (addr, dat, _) in enumerate(batch):
+        off = i * CANFD_MTU
+        struct.pack_into(CAN_HEADER_FMT, self.mmsg.frames_view, off, self._can_id(addr), len(dat), self.flags)
+        self.mmsg.frames_view[off + CAN_HEADER_LEN:off + frame_len] = bytes(dat).ljust(self.data_len, b'\x00')
+      self.mmsg.send(self.socket.fileno(), [frame_len] * len(batch))
 
   def can_send(self, addr, dat, bus=0, timeout=0) -> None:
     msg_len = len(dat)
     msg_dat = dat.ljust(self.data_len, b'\x00')
-    can_frame = struct.pack(CAN_HEADER_FMT, addr, msg_len, self.flags) + msg_dat
+    can_frame = struct.pack(CAN_HEADER_FMT, self._can_id(addr), msg_len, self.flags) + msg_dat
     self.socket.sendto(can_frame, (self.interface,))
 
   def can_recv(self) -> list[tuple[int, bytes, int]]:
+    return [(addr, dat, bus) for addr, dat, bus, _ in self.can_recv_ts()]
+
+  def can_recv_ts(self) -> list[tuple[int, bytes, int, int | None]]:
+    """Like can_recv, with the kernel RX timestamp in ns of each frame."""
     msgs = list()
-    while True:
-      try:
-        dat, _ = self.socket.recvfrom(self.recv_buffer_size, socket.MSG_DONTWAIT)
-        assert len(dat) == CAN_HEADER_LEN + self.data_len, f"ERROR: received {len(dat)} bytes"
-        can_id, msg_len, _ = struct.unpack(CAN_HEADER_FMT, dat[:CAN_HEADER_LEN])
-        msg_dat = dat[CAN_HEADER_LEN:CAN_HEADER_LEN+msg_len]
-        msgs.append((can_id, msg_dat, self.bus))
-      except BlockingIOError:
+    if self.mmsg is None:
+      while True:
+        try:
+          dat = self.socket.recv(CANFD_MTU, socket.MSG_DONTWAIT)
+        except BlockingIOError:
+          break # buffered data exhausted
+        # FD sockets get classic frames too
+        assert len(dat) in (CAN_MTU, CANFD_MTU), f"ERROR: received {len(dat)} bytes"
+        can_id, msg_len, _ = struct.unpack_from(CAN_HEADER_FMT, dat)
+        msgs.append((self._addr(can_id), dat[CAN_HEADER_LEN:CAN_HEADER_LEN+msg_len], self.bus, None))
+      return msgs
+
+    fd = self.socket.fileno()
+    view = self.mmsg.frames_view
+    while (cnt := self.mmsg.recv(fd)) > 0:
+      for i in range(cnt):
+        assert self.mmsg.msgs[i].msg_len in (CAN_MTU, CANFD_MTU), f"ERROR: received {self.mmsg.msgs[i].msg_len} bytes"
+        off = i * CANFD_MTU
+        can_id, msg_len, _ = struct.unpack_from(CAN_HEADER_FMT, view, off)
+        ts, dropped = self.mmsg.control_data(i)
+        if dropped is not None:
+          self.rx_dropped = dropped
+        msgs.append((self._addr(can_id), bytes(view[off + CAN_HEADER_LEN:off + CAN_HEADER_LEN + msg_len]), self.bus, ts))
+      if cnt < self.mmsg.n:
         break # buffered data exhausted
     return msgs
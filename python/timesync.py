@@ -0,0 +1,147 @@
+# host side of the clock sync, see board/drivers/time_sync.h
+#
+# Each exchange reads the panda's microsecond timer (control 0xb9) between
+# two host clock reads. The host time at the midpoint of the fastest
+# exchanges of a burst is paired with the timer value. A least squares fit
+# over recent pairs gives the panda's offset and skew, which are then
+# applied on the panda so its exported timestamps are host clock
+# microseconds, modulo 2^32. Pandas synced to the same host clock share
+# one timebase.
+import math
+import struct
+import time
+from collections import deque
+from typing import NamedTuple
+
+TIME_SYNC_SAMPLE_STRUCT = struct.Struct("<II")
+SKEW_SCALE = 1 << 32
+TIMER_WRAP = 1 << 32
+
+
+class TimeSyncSample(NamedTuple):
+  t_send: int  # host clock, ns
+  local: int   # panda timer, us
+  synced: int  # panda synced time, us
+  t_recv: int  # host clock, ns
+
+  @property
+  def rtt_us(self) -> float:
+    return (self.t_recv - self.t_send) / 1000
+
+  @property
+  def host_us(self) -> float:
+    return (self.t_send + self.t_recv) / 2000
+
+  @property
+  def error_us(self) -> float:
+    """synced time minus the host time at the midpoint"""
+    err = (self.synced - self.host_us) % TIMER_WRAP
+    return err - TIMER_WRAP if err >= TIMER_WRAP / 2 else err
+
+
+def apply_correction(local: int, ref: int, offset: int, skew: int) -> int:
+  """Same as time_sync_correct in the firmware."""
+  dt = ((local - ref + TIMER_WRAP // 2) % TIMER_WRAP) - TIMER_WRAP // 2
+  adj = abs(dt * skew) // SKEW_SCALE
+  return (local + offset + (adj if dt * skew >= 0 else -adj)) % TIMER_WRAP
+
+
+def to_host_ns(ts: int, near_ns: int) -> int:
+  """Host clock time of a synced 32-bit timestamp, the one closest to near_ns."""
+  near_us = near_ns // 1000
+  dt = ((ts - near_us + TIMER_WRAP // 2) % TIMER_WRAP) - TIMER_WRAP // 2
+  return (near_us + dt) * 1000
+
+
+def exchange(panda, n: int = 8, clock=time.monotonic_ns) -> list[TimeSyncSample]:
+  ret = []
+  for _ in range(n):
+    t_send = clock()
+    local, synced = panda.get_time_sync_sample()
+    ret.append(TimeSyncSample(t_send, local, synced, clock()))
+  return ret
+
+
+class ClockSync:
+  """Offset and skew of one panda's timer against a host clock."""
+  def __init__(self, window: int = 32, best_of: int = 2) -> None:
+    # (unwrapped timer us, host us, rtt us) of each burst
+    self.points: deque[tuple[int, float, float]] = deque(maxlen=window)
+    self.best_of = best_of
+    self.min_rtt_us = math.inf
+    self._last_local: int | None = None
+    self._wraps = 0
+    self.skew = 0.0
+    self._fit: tuple[float, float, float] | None = None  # mean timer, mean host, slope
+
+  def _unwrap(self, local: int) -> int:
+    if self._last_local is not None and local < self._last_local and (self._last_local - local) > TIMER_WRAP // 2:
+      self._wraps += 1
+    self._last_local = local
+    return local + self._wraps * TIMER_WRAP
+
+  def add(self, samples: list[TimeSyncSample]) -> bool:
+    """Adds a burst of exchanges, False if it was too slow to be used."""
+    samples = sorted(samples, key=lambda s: s.local)
+    unwrapped = {s: self._unwrap(s.local) for s in samples}
+    best = sorted(samples, key=lambda s: s.rtt_us)[:self.best_of]
+    rtt = sum(s.rtt_us for s in best) / len(best)
+
+    # a burst slowed down by the bus or the scheduler has a wide error band
+    if rtt > 3 * self.min_rtt_us + 100:
+      return False
+    self.min_rtt_us = min(self.min_rtt_us, best[0].rtt_us)
+    local = sum(unwrapped[s] for s in best) / len(best)
+    host = sum(s.host_us for s in best) / len(best)
+    self.points.append((int(round(local)), host, rtt))
+    self._update()
+    return True
+
+  def _update(self) -> None:
+    # weighted least squares of host time over timer, faster exchanges weigh more
+    w = [1 / max(r, 1.0) ** 2 for _, _, r in self.points]
+    sw = sum(w)
+    mx = sum(wi * x for wi, (x, _, _) in zip(w, self.points, strict=True)) / sw
+    my = sum(wi * y for wi, (_, y, _) in zip(w, self.points, strict=True)) / sw
+    sxx = sum(wi * (x - mx) ** 2 for wi, (x, _, _) in zip(w, self.points, strict=True))
+    sxy = sum(wi * (x - mx) * (y - my) for wi, (x, y, _) in zip(w, self.points, strict=True))
+    slope = (sxy / sxx) if (len(self.points) > 1 and sxx > 0) else 1.0
+    self.skew = slope - 1
+    self._fit = (mx, my, slope)
+
+  @property
+  def ready(self) -> bool:
+    return self._fit is not None
+
+  def to_host_us(self, local: int) -> float:
+    assert self._fit is not None
+    mx, my, slope = self._fit
+    return my + slope * (self._unwrap_near(local) - mx)
+
+  def _unwrap_near(self, local: int) -> int:
+    # the unwrapped timer value closest to the fit
+    assert self._fit is not None
+    mx = self._fit[0]
+    return local + round((mx - local) / TIMER_WRAP) * TIMER_WRAP
+
+  def residual_us(self) -> float:
+    """RMS distance of the bursts from the fit"""
+    if self._fit is None:
+      return math.nan
+    mx, my, slope = self._fit
+    return math.sqrt(sum((y - (my + slope * (x - mx))) ** 2 for x, y, _ in self.points) / len(self.points))
+
+  def correction(self, ref: int) -> tuple[int, int, int]:
+    """(ref, offset, skew) for Panda.set_time_sync, accurate around the timer value ref"""
+    host = self.to_host_us(ref)
+    offset = (int(round(host)) - ref) % TIMER_WRAP
+    skew = max(-(1 << 31), min((1 << 31) - 1, int(round(self.skew * SKEW_SCALE))))
+    return ref, offset, skew
+
+
+def sync_panda(panda, sync: ClockSync, n: int = 8, clock=time.monotonic_ns) -> list[TimeSyncSample]:
+  """One round: a burst of exchanges, then the updated correction is applied."""
+  samples = exchange(panda, n, clock)
+  if sync.add(samples):
+    panda.set_time_sync(*sync.correction(samples[-1].local))
+  return samples
@@ -0,0 +1,72 @@
+# decoder for the firmware event trace (board/drivers/trace.h)
+import struct
+from typing import NamedTuple
+
+TRACE_EVENT_STRUCT = struct.Struct("<IHHII")
+TRACE_BUF_SIZE = 1024
+TRACE_SPI_ENDPOINT = 4
+
+# keep in sync with board/drivers/trace_declarations.h
+TRACE_EVENTS = {
+  1: ("CAN_RX", "bus", "addr"),
+  2: ("CAN_TX", "bus", "addr"),
+  3: ("CAN_FWD", "dst_bus", "addr"),
+  4: ("CAN_RX_OVERFLOW", "bus", "addr"),
+  5: ("CAN_INIT", "can", "ok"),
+  6: ("SPI_RX", "endpoint", "len"),
+  7: ("SAFETY_MODE", "mode", "param"),
+  8: ("CONTROL", "request", "param1"),
+  9: ("HEARTBEAT_LOST", "counter", "mode"),
+}
+ADDR_ARGS = ("addr", "request")
+
+
+class TraceEvent(NamedTuple):
+  ts: int
+  seq: int
+  id: int
+  arg0: int
+  arg1: int
+
+  @property
+  def name(self) -> str:
+    return TRACE_EVENTS.get(self.id, (f"EV_{self.id}",))[0]
+
+
+def unpack_trace_buffer(dat: bytes) -> list[TraceEvent]:
+  n = len(dat) // TRACE_EVENT_STRUCT.size
+  return [TraceEvent(*TRACE_EVENT_STRUCT.unpack_from(dat, i * TRACE_EVENT_STRUCT.size)) for i in range(n)]
+
+
+def count_dropped(events: list[TraceEvent], last_seq: int | None = None) -> int:
+  """Number of events lost to ring overruns, from gaps in the 16-bit sequence."""
+  dropped = 0
+  for ev in events:
+    if last_seq is not None:
+      dropped += (ev.seq - last_seq - 1) & 0xFFFF
+    last_seq = ev.seq
+  return dropped
+
+
+def render_timeline(events: list[TraceEvent], t0: int | None = None) -> list[str]:
+  """One line per event: time since t0, delta to the previous event, name and args. Times in us."""
+  lines = []
+  if len(events) == 0:
+    return lines
+
+  t0 = events[0].ts if t0 is None else t0
+  prev_ts, prev_seq = t0, None
+  for ev in events:
+    if prev_seq is not None and ((ev.seq - prev_seq) & 0xFFFF) != 1:
+      lines.append(f"{'':>12} {'':>8}  ... {(ev.seq - prev_seq - 1) & 0xFFFF} events dropped")
+
+    # 32-bit microsecond timer wraps every ~71 minutes
+    t = (ev.ts - t0) & 0xFFFFFFFF
+    dt = (ev.ts - prev_ts) & 0xFFFFFFFF
+    name, a0_name, a1_name = TRACE_EVENTS.get(ev.id, (f"EV_{ev.id}", "arg0", "arg1"))
+    a0 = f"{a0_name}=0x{ev.arg0:X}" if a0_name in ADDR_ARGS else f"{a0_name}={ev.arg0}"
+    a1 = f"{a1_name}=0x{ev.arg1:X}" if a1_name in ADDR_ARGS else f"{a1_name}={ev.arg1}"
+    lines.append(f"{t:>12} {'+' + str(dt):>8}  {name:<16} {a0} {a1}")
+
+    prev_ts, prev_seq = ev.ts, ev.seq
+  return lines
@@ -153,11 +153,11 @@ static inline void handle_interceptor_heartbeat_opt(const CANPacket_t *to_push)
     print("ADAS_DRV_INTERCEPTOR_OPT_MSG: requested_safety_mode="); puth(opt_msg.requested_safety_mode);
     print(", requested_safety_param="); puth(opt_msg.requested_safety_param); print("\n");
 #endif
-    set_safety_mode(opt_msg.requested_safety_mode, opt_msg.requested_safety_param);
+    set_safety_mode(opt_msg.requested_safety_mode, opt_msg.requested_safety_param, false);
   }
 }
 
-bool safety_rx_hook(const CANPacket_t *to_push) {
+CAN_FAST_CODE bool safety_rx_hook(const CANPacket_t *to_push) {
   bool controls_allowed_prev = controls_allowed;
 
   bool valid = rx_msg_safety_check(to_push, &current_safety_config, current_hooks);
@@ -206,7 +206,7 @@ static bool tx_msg_safety_check(const CANPacket_t *to_send, const CanMsg msg_lis
   return whitelisted;
 }
 
-bool safety_tx_hook(CANPacket_t *to_send) {
+CAN_FAST_CODE bool safety_tx_hook(CANPacket_t *to_send) {
   bool whitelisted = tx_msg_safety_check(to_send, current_safety_config.tx_msgs, current_safety_config.tx_msgs_len);
   if ((current_safety_mode == SAFETY_ALLOUTPUT) || (current_safety_mode == SAFETY_ELM327)) {
     whitelisted = true;
@@ -232,7 +232,7 @@ static int get_fwd_bus(int bus_num) {
   return destination_bus;
 }
 
-int safety_fwd_hook(int bus_num, int addr) {
+CAN_FAST_CODE int safety_fwd_hook(int bus_num, int addr) {
   bool blocked = relay_malfunction || current_safety_config.disable_forwarding;
 
   // Block messages that are being checked for relay malfunctions. Safety modes can opt out of this
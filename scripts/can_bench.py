@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+# Cycles per frame on the CAN interrupt path, see board/drivers/can_bench.h.
+# Run once on a normal build and once on a DISABLE_ITCM_CODE=1 build to see
+# what running the CAN_FAST_CODE functions from ITCM saves.
+import argparse
+import time
+
+from opendbc.car.structs import CarParams
+from panda import Panda
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--seconds", type=float, default=5.)
+  args = parser.parse_args()
+
+  p = Panda()
+  p.set_safety_mode(CarParams.SafetyModel.allOutput)
+  p.set_can_loopback(True)
+  p.can_clear(0xFFFF)
+
+  p.can_bench_start()
+  end = time.monotonic() + args.seconds
+  while time.monotonic() < end:
+    # keep all three TX rings busy, the loopback frames come back as RX
+    p.can_send_many([(0x100 + i, bytes(8), i % 3) for i in range(96)], timeout=0)
+    p.can_recv()
+  ret = p.can_bench_stop()
+
+  print(f"{'ITCM' if ret['itcm'] else 'flash'} build, {ret['core_mhz']} MHz core")
+  for kind in ("rx", "fwd", "tx"):
+    r = ret[kind]
+    print(f"{kind:>3}: {r['frames']:8d} frames, {r['cycles_mean']:5d} cycles mean, {r['cycles_max']:5d} max")
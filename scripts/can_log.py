@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+import argparse
+import time
+
+from panda.python.canlog import CANLOG_SEGMENT_SIZE, CanLogReader, CanLogWriter
+
+
+def record(args):
+  if args.socketcan is not None:
+    from panda.python.socketpanda import SocketPanda
+    p = SocketPanda(args.socketcan, bus=args.bus, fd=True)
+    recv = p.can_recv_ts
+  else:
+    from panda import Panda
+    p = Panda(args.serial)
+    p.set_safety_mode(Panda.SAFETY_ALLOUTPUT)
+    p.can_clear(0xFFFF)
+    recv = p.can_recv
+
+  t_start = time.monotonic()
+  with CanLogWriter(args.path, segment_size=args.segment_mb * 1024 * 1024) as log:
+    try:
+      while True:
+        msgs = recv()
+        if len(msgs):
+          log.write(msgs)
+        elif args.socketcan is None:
+          time.sleep(0.001)
+        if args.status and (time.monotonic() - t_start) > args.status:
+          print(f"{log.frames} frames, segment {log.segment}")
+          t_start = time.monotonic()
+    except KeyboardInterrupt:
+      pass
+    print(f"{log.frames} frames written")
+
+
+def query(args):
+  ns = lambda t: None if t is None else int(t * 1e9)
+  with CanLogReader(args.path) as log:
+    if args.summary:
+      r = log.time_range()
+      blocks = sum(len(s.blocks) for s in log.segments)
+      print(f"{len(log)} frames in {len(log.segments)} segments, {blocks} blocks, time range {r}")
+      return
+    for f in log.query(ns(args.start), ns(args.end), args.bus, args.addr):
+      print(f"{f.ts / 1e9:.6f} {f.bus} {f.addr:#x} {f.dat.hex()}")
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Record CAN traffic to an indexed binary log and query it")
+  sub = parser.add_subparsers(dest="cmd", required=True)
+
+  rec = sub.add_parser("record")
+  rec.add_argument("path")
+  rec.add_argument("--serial", default=None)
+  rec.add_argument("--socketcan", default=None, help="record a SocketCAN interface instead of a panda")
+  rec.add_argument("--bus", type=int, default=0, help="bus number of the SocketCAN interface")
+  rec.add_argument("--segment-mb", type=int, default=CANLOG_SEGMENT_SIZE // (1024 * 1024))
+  rec.add_argument("--status", type=float, default=5.0, help="seconds between status lines, 0 for none")
+  rec.set_defaults(func=record)
+
+  q = sub.add_parser("query")
+  q.add_argument("path")
+  q.add_argument("--start", type=float, default=None, help="unix time (s)")
+  q.add_argument("--end", type=float, default=None, help="unix time (s)")
+  q.add_argument("--bus", type=int, default=None)
+  q.add_argument("--addr", type=lambda x: int(x, 0), default=None)
+  q.add_argument("--summary", action="store_true")
+  q.set_defaults(func=query)
+
+  args = parser.parse_args()
+  args.func(args)
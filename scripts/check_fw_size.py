@@ -65,6 +65,11 @@ def check_space(file, mcu):
       if line[0] in RAM:
         calcs[".dtcmram"] += int(line[1], 16)
         pop = True
+      if line[0] == ".itcm_text":
+        # runs from ITCM, loaded from flash
+        calcs[".flash"] += int(line[1], 16)
+        calcs[".itcmram"] += int(line[1], 16)
+        pop = True
       if pop:
         result.pop(line[0])
 
@@ -86,6 +91,9 @@ if __name__ == "__main__":
   # red panda
   check_space("../board/obj/bootstub.panda_h7.elf", "H7")
   check_space("../board/obj/panda_h7.elf", "H7")
+  # single board images
+  for board in ("red", "tres", "cuatro"):
+    check_space(f"../board/obj/panda_h7_{board}.elf", "H7")
   # black panda
   check_space("../board/obj/bootstub.panda.elf", "F4")
   check_space("../board/obj/panda.elf", "F4")
@@ -0,0 +1,31 @@
+#!/usr/bin/env python3
+import argparse
+import time
+
+from panda import Panda
+from panda.python.timesync import ClockSync, sync_panda
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Sync the clocks of several pandas to this host's monotonic clock")
+  parser.add_argument("serials", nargs="*", help="pandas to sync, all of them if none")
+  parser.add_argument("--period", type=float, default=0.5, help="seconds between exchange bursts")
+  parser.add_argument("--burst", type=int, default=8, help="exchanges per burst")
+  args = parser.parse_args()
+
+  serials = args.serials if len(args.serials) else Panda.list()
+  pandas = [Panda(s) for s in serials]
+  syncs = [ClockSync() for _ in pandas]
+  for p in pandas:
+    p.clear_time_sync()
+
+  try:
+    while True:
+      for s, p, sync in zip(serials, pandas, syncs, strict=True):
+        samples = sync_panda(p, sync, args.burst, time.monotonic_ns)
+        best = min(samples, key=lambda x: x.rtt_us)
+        # the error of the correction applied by the previous burst
+        print(f"{s}: skew {sync.skew * 1e6:+8.3f} ppm  residual {sync.residual_us():6.1f} us  rtt {best.rtt_us:6.1f} us  "
+              f"error {best.error_us:+8.1f} us")
+      time.sleep(args.period)
+  except KeyboardInterrupt:
+    pass
@@ -19,4 +19,4 @@ rm obj/*
 scons -u
 cd obj
 RELEASE_NAME=$(awk '{print $1}' version)
-zip -j ../../release/panda-$RELEASE_NAME.zip version panda.bin.signed bootstub.panda.bin panda_h7.bin.signed bootstub.panda_h7.bin
+zip -j ../../release/panda-$RELEASE_NAME.zip version panda.bin.signed bootstub.panda.bin panda_h7.bin.signed bootstub.panda_h7.bin panda_h7_red.bin.signed panda_h7_tres.bin.signed panda_h7_cuatro.bin.signed
@@ -0,0 +1,38 @@
+#!/usr/bin/env python3
+import argparse
+import time
+
+from panda import Panda
+from panda.python.trace import count_dropped, render_timeline
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Stream the firmware event trace as a timeline")
+  parser.add_argument("--serial", default=None)
+  parser.add_argument("--raw", action="store_true", help="print undecoded events")
+  args = parser.parse_args()
+
+  p = Panda(args.serial)
+  p.clear_trace()
+
+  t0 = None
+  last_seq = None
+  dropped = 0
+  try:
+    while True:
+      events = p.read_trace()
+      if len(events) == 0:
+        time.sleep(0.01)
+        continue
+
+      dropped += count_dropped(events, last_seq)
+      if t0 is None:
+        t0 = events[0].ts
+
+      if args.raw:
+        for ev in events:
+          print(ev)
+      else:
+        print("\n".join(render_timeline(events, t0)))
+      last_seq = events[-1].seq
+  except KeyboardInterrupt:
+    print(f"\n{dropped} events dropped")
@@ -80,6 +80,23 @@ def test_throughput(p):
 
     print("loopback 100 messages at speed %d, comp speed is %.2f, percent %.2f" % (speed, comp_kbps, saturation_pct))
 
+def test_can_cycle_benchmark(p):
+  p.set_safety_mode(CarParams.SafetyModel.allOutput)
+  p.set_can_loopback(True)
+  p.set_can_speed_kbps(0, 500)
+
+  p.can_bench_start()
+  time_many_sends(p, 0)
+  res = p.can_bench_stop()
+  print("CAN path cycles:", res)
+
+  assert res["itcm"] == (p.get_type() in Panda.H7_DEVICES)
+  for kind in ("rx", "tx"):
+    assert res[kind]["frames"] >= 100
+    assert 0 < res[kind]["cycles_mean"] <= res[kind]["cycles_max"]
+    # a frame must cost well under its own time on the bus, ~100 us at 1 Mbps
+    assert res[kind]["cycles_mean"] < 20 * res["core_mhz"]
+
 # this will fail if you have hardware serial connected
 def test_serial_debug(p):
   _ = p.serial_read(Panda.SERIAL_DEBUG)  # junk
@@ -0,0 +1,440 @@
+// Host build of the firmware CAN path: the real fdcan.h interrupt handlers
+// and spi.h protocol run against the simulated controllers in sim_fdcan.h,
+// on a virtual microsecond timer. emu_run() drives it with generated bus
+// traffic and a host polling over SPI, see libpanda_emu_py.py. Every frame
+// the firmware handles takes isr_frame_ns of virtual time, during which the
+// buses keep going, so a slow enough handler loses frames in the RX FIFOs.
+#include <time.h>
+
+#include "fake_stm.h"
+#include "config.h"
+#include "can.h"
+
+#define ENABLE_SPI
+
+void set_safety_mode(uint16_t mode, uint16_t param, bool reinit_all) { }
+
+typedef struct harness_configuration harness_configuration;
+void refresh_can_tx_slots_available(void);
+void can_tx_comms_resume_usb(void) { };
+void can_tx_comms_resume_spi(void);
+
+#define LED_BLUE 2U
+void led_set(uint8_t color, bool enabled) { UNUSED(color); UNUSED(enabled); }
+
+uint8_t sim_uid[12];
+#define UID_BASE sim_uid
+
+#include "health.h"
+#include "faults.h"
+#include "libc.h"
+#include "drivers/time_sync.h"
+#include "drivers/trace.h"
+#include "boards/board_declarations.h"
+#include "safety/safety.h"
+#include "main_definitions.h"
+#include "drivers/can_common.h"
+#include "can_filter.h"
+#include "isotp.h"
+#include "playback.h"
+#include "can_stats.h"
+#include "can_cache.h"
+#include "can_template.h"
+
+#include "sim_fdcan.h"
+#include "drivers/interrupts_declarations.h"
+
+interrupt interrupts[NUM_INTERRUPTS];
+
+// ***************************** bench *****************************
+// drivers/can_bench.h on host time, without the time spent simulating the
+// buses while a handler runs
+
+#define CAN_BENCH_RX 0U
+#define CAN_BENCH_FWD 1U
+#define CAN_BENCH_TX 2U
+#define CAN_BENCH_CNT 3U
+
+static uint64_t emu_bench_ns[CAN_BENCH_CNT];
+static uint32_t emu_bench_max[CAN_BENCH_CNT];
+static uint32_t emu_bench_frames[CAN_BENCH_CNT];
+
+static uint64_t emu_sim_ns = 0U;
+
+static uint64_t host_ns(void) {
+  struct timespec ts;
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+uint32_t can_bench_start(void) {
+  return (uint32_t)(host_ns() - emu_sim_ns);
+}
+
+void can_bench_end(uint8_t kind, uint32_t start) {
+  uint32_t ns = (uint32_t)(host_ns() - emu_sim_ns) - start;
+  emu_bench_ns[kind] += ns;
+  emu_bench_max[kind] = MAX(emu_bench_max[kind], ns);
+  emu_bench_frames[kind] += 1U;
+}
+
+#include "drivers/fdcan.h"
+
+can_ring *rx_q = &can_rx_q;
+can_ring *tx1_q = &can_tx1_q;
+can_ring *tx2_q = &can_tx2_q;
+can_ring *tx3_q = &can_tx3_q;
+
+#include "comms_definitions.h"
+#include "can_compress.h"
+#include "can_comms.h"
+
+int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
+  UNUSED(req);
+  UNUSED(resp);
+  return 0;
+}
+bool comms_endpoint2_ready(uint8_t port, uint32_t len) { UNUSED(port); UNUSED(len); return true; }
+void comms_endpoint2_write(const uint8_t *data, uint32_t len) { UNUSED(data); UNUSED(len); }
+void comms_playback_write(const uint8_t *data, uint32_t len) { playback_write(data, len); }
+uint32_t comms_can_stats_read(uint8_t *data, uint32_t max_len) { return can_stats_read(data, max_len); }
+uint32_t comms_can_cache_read(uint8_t *data, uint32_t max_len) { return can_cache_snapshot_stream(data, max_len); }
+
+#include "drivers/spi.h"
+
+// ***************************** SPI *****************************
+// DMA completions are run in place, one call is one host transfer
+
+static uint8_t *spi_sim_mosi;
+static uint8_t *spi_sim_miso;
+
+void llspi_init(void) { }
+void llspi_mosi_dma(uint8_t *addr, int len) { UNUSED(len); spi_sim_mosi = addr; }
+void llspi_miso_dma(uint8_t *addr, int len) { UNUSED(len); spi_sim_miso = addr; }
+
+// like python/spi.py: header, ACK, data, response. Returns the response length, -1 on NACK
+int emu_spi_xfer(uint8_t endpoint, const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t max_rx) {
+  int ret = -1;
+  uint16_t rx_len = MIN(max_rx, (uint16_t)(SPI_BUF_SIZE - 4U));
+  if (tx_len <= (SPI_BUF_SIZE - SPI_HEADER_SIZE - 1U)) {
+    uint8_t header[SPI_HEADER_SIZE] = {SPI_SYNC_BYTE, endpoint, tx_len & 0xFFU, tx_len >> 8, rx_len & 0xFFU, rx_len >> 8, SPI_CHECKSUM_START};
+    for (uint8_t i = 0U; i < (SPI_HEADER_SIZE - 1U); i++) {
+      header[SPI_HEADER_SIZE - 1U] ^= header[i];
+    }
+    (void)memcpy(spi_sim_mosi, header, SPI_HEADER_SIZE);
+    spi_rx_done();
+    bool ack = (spi_sim_miso[0] == SPI_HACK);
+    spi_tx_done(false);
+
+    if (ack) {
+      uint8_t checksum = SPI_CHECKSUM_START;
+      for (uint16_t i = 0U; i < tx_len; i++) {
+        spi_sim_mosi[i] = tx[i];
+        checksum ^= tx[i];
+      }
+      spi_sim_mosi[tx_len] = checksum;
+      spi_rx_done();
+      if (spi_sim_miso[0] == SPI_DACK) {
+        ret = spi_sim_miso[1] | (spi_sim_miso[2] << 8);
+        (void)memcpy(rx, &spi_sim_miso[3], MIN((uint16_t)ret, rx_len));
+      }
+      spi_tx_done(false);
+    }
+  }
+  return ret;
+}
+
+// ***************************** traffic *****************************
+
+typedef struct {
+  uint32_t load_pct[FDCAN_SIM_CNT];  // offered load of each bus, 0 for none
+  int8_t forward[FDCAN_SIM_CNT];     // forwarding bus, -1 for none
+  uint32_t addr_base;
+  uint32_t addr_cnt;
+  uint32_t frame_len;                // 0 to 8 bytes
+  uint32_t host_rx_period_us;        // SPI reads of host_rx_len, 0 for none
+  uint32_t host_rx_len;
+  uint32_t host_tx_period_us;        // SPI writes of host_tx_batch frames, 0 for none
+  uint32_t host_tx_batch;
+  uint8_t host_tx_bus;
+  uint32_t isr_frame_ns;             // firmware time per frame handled
+  uint32_t duration_us;
+} emu_config_t;
+
+typedef struct {
+  uint32_t offered[FDCAN_SIM_CNT];   // frames the generator put on the bus
+  uint32_t rx[FDCAN_SIM_CNT];        // frames can_rx took from the controller
+  uint32_t rx_lost[FDCAN_SIM_CNT];   // overwritten in the controller's RX FIFO
+  uint32_t sent[FDCAN_SIM_CNT];      // frames the controller put on the bus
+  uint32_t rx_overflow;
+  uint32_t tx_overflow;
+  uint32_t rx_q_max;
+  uint32_t tx_q_max;
+  uint32_t host_rx_bytes;
+  uint32_t host_tx_frames;
+  uint32_t host_tx_nack;             // writes refused for lack of TX slots
+  uint32_t bench_frames[CAN_BENCH_CNT];
+  uint32_t bench_ns_mean[CAN_BENCH_CNT];
+  uint32_t bench_ns_max[CAN_BENCH_CNT];
+} emu_result_t;
+
+#define EMU_NEVER 0xFFFFFFFFFFFFFFFFULL
+
+typedef struct {
+  uint64_t next_gen_ns;
+  uint64_t wire_end_ns;  // EMU_NEVER while idle
+  bool wire_tx;
+  CANPacket_t wire_frame;
+  uint32_t gen_cnt;
+} emu_bus_t;
+
+static uint64_t emu_now_ns = 0U;
+static const emu_config_t *emu_cfg = NULL;  // while emu_run runs
+static uint64_t emu_end_ns;
+static emu_result_t *emu_res;
+static emu_bus_t emu_buses[FDCAN_SIM_CNT];
+static bool emu_rx_irq[FDCAN_SIM_CNT];
+static bool emu_tx_irq[FDCAN_SIM_CNT];
+
+// worst case bit stuffing, interframe space included
+static uint64_t emu_frame_ns(uint8_t can_number, const CANPacket_t *msg) {
+  uint32_t data_bits = dlc_to_len[msg->data_len_code] * 8U;
+  uint32_t bits = (msg->extended != 0U) ? (67U + data_bits + ((53U + data_bits) / 4U)) : (47U + data_bits + ((33U + data_bits) / 4U));
+  return ((uint64_t)bits * 10000000ULL) / MAX(fdcan_sim_speed(can_number), 1U);
+}
+
+static void emu_set_time(uint64_t ns) {
+  emu_now_ns = ns;
+  MICROSECOND_TIMER->CNT = (uint32_t)(ns / 1000U);
+}
+
+static uint32_t emu_ring_depth(const can_ring *q) {
+  return (q->w_ptr + q->fifo_size - q->r_ptr) % q->fifo_size;
+}
+
+// brings the firmware side to its state after boot, with output enabled.
+// false if the message RAM address is taken
+bool emu_init(void) {
+  bool ret = fdcan_sim_init();
+  can_silent = ALL_CAN_LIVE;
+  for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+    bus_config[i].forwarding_bus = -1;
+    can_tx_clear(i);
+    (void)memset(&can_health[i], 0, sizeof(can_health_t));
+    (void)can_init(i);
+  }
+  can_clear(&can_rx_q);
+  comms_can_reset();
+  spi_init();
+  refresh_can_tx_slots_available();
+  rx_buffer_overflow = 0U;
+  tx_buffer_overflow = 0U;
+  emu_set_time(0U);
+  return ret;
+}
+
+static void emu_generate(emu_bus_t *b, const emu_config_t *cfg, uint8_t bus) {
+  CANPacket_t *msg = &b->wire_frame;
+  (void)memset(msg, 0, sizeof(CANPacket_t));
+  msg->addr = cfg->addr_base + (b->gen_cnt % MAX(cfg->addr_cnt, 1U));
+  msg->extended = (msg->addr >= 0x800U) ? 1U : 0U;
+  msg->bus = bus;
+  msg->data_len_code = MIN(cfg->frame_len, 8U);
+  (void)memcpy(msg->data, &b->gen_cnt, MIN(dlc_to_len[msg->data_len_code], 4U));
+  b->gen_cnt += 1U;
+}
+
+static void emu_host_tx(const emu_config_t *cfg, emu_result_t *res) {
+  static uint8_t buf[SPI_BUF_SIZE];
+  static uint32_t cnt = 0U;  // continues across runs, the addresses cycle anyway
+  uint32_t pos = 0U;
+  uint32_t n = 0U;
+  for (uint32_t i = 0U; i < cfg->host_tx_batch; i++) {
+    CANPacket_t msg = {0};
+    msg.addr = cfg->addr_base + 0x400U + (cnt % MAX(cfg->addr_cnt, 1U));
+    msg.extended = (msg.addr >= 0x800U) ? 1U : 0U;
+    msg.bus = cfg->host_tx_bus;
+    msg.data_len_code = MIN(cfg->frame_len, 8U);
+    (void)memcpy(msg.data, &cnt, MIN(dlc_to_len[msg.data_len_code], 4U));
+    can_set_checksum(&msg);
+    uint32_t len = CANPACKET_HEAD_SIZE + dlc_to_len[msg.data_len_code];
+    if ((pos + len) > (SPI_BUF_SIZE - SPI_HEADER_SIZE - 1U)) {
+      break;
+    }
+    (void)memcpy(&buf[pos], &msg, len);
+    pos += len;
+    cnt += 1U;
+    n += 1U;
+  }
+  uint8_t resp[4];
+  if (emu_spi_xfer(3U, buf, pos, resp, sizeof(resp)) >= 0) {
+    res->host_tx_frames += n;
+  } else {
+    res->host_tx_nack += 1U;
+  }
+}
+
+// idle buses start the next frame, the lower address wins arbitration
+static void emu_bus_start(void) {
+  for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+    emu_bus_t *b = &emu_buses[i];
+    if (b->wire_end_ns == EMU_NEVER) {
+      CANPacket_t tx;
+      bool tx_ready = fdcan_sim_tx_peek(i, &tx);
+      bool gen_ready = (b->next_gen_ns <= emu_now_ns);
+      if (gen_ready) {
+        emu_generate(b, emu_cfg, i);
+      }
+      if (tx_ready && (!gen_ready || (tx.addr < b->wire_frame.addr))) {
+        b->gen_cnt -= gen_ready ? 1U : 0U;
+        b->wire_frame = tx;
+        b->wire_tx = true;
+        b->wire_end_ns = emu_now_ns + emu_frame_ns(i, &tx);
+      } else if (gen_ready) {
+        b->wire_tx = false;
+        b->wire_end_ns = emu_now_ns + emu_frame_ns(i, &b->wire_frame);
+        b->next_gen_ns += (emu_frame_ns(i, &b->wire_frame) * 100U) / emu_cfg->load_pct[i];
+      } else {
+        // idle
+      }
+    }
+  }
+}
+
+static uint64_t emu_bus_next(void) {
+  uint64_t ret = EMU_NEVER;
+  for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+    ret = MIN(ret, (emu_buses[i].wire_end_ns != EMU_NEVER) ? emu_buses[i].wire_end_ns : emu_buses[i].next_gen_ns);
+  }
+  return ret;
+}
+
+// frames that leave the wire now reach the controllers, their interrupts are left pending
+static void emu_bus_end(void) {
+  for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+    emu_bus_t *b = &emu_buses[i];
+    if (b->wire_end_ns == emu_now_ns) {
+      b->wire_end_ns = EMU_NEVER;
+      if (b->wire_tx) {
+        emu_res->sent[i] += 1U;
+        fdcan_sim_tx_done(i);
+        emu_tx_irq[i] = true;
+      } else {
+        emu_res->offered[i] += 1U;
+        fdcan_sim_rx(i, &b->wire_frame);
+        emu_rx_irq[i] = true;
+      }
+    }
+  }
+}
+
+// runs the buses until the given time, no firmware runs meanwhile
+static void emu_bus_advance(uint64_t until) {
+  while (emu_now_ns < until) {
+    emu_bus_start();
+    emu_set_time(MIN(until, emu_bus_next()));
+    emu_bus_end();
+  }
+}
+
+// a saturated can_rx never empties the FIFO, time stops at the end of the
+// run so it gets out
+void emu_isr_frame(void) {
+  if (emu_cfg != NULL) {
+    uint64_t t = host_ns();
+    emu_bus_advance(MIN(emu_now_ns + emu_cfg->isr_frame_ns, emu_end_ns));
+    emu_sim_ns += host_ns() - t;
+  }
+}
+
+// the CAN interrupts, until none is pending
+static void emu_service_irqs(void) {
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+      if (emu_rx_irq[i]) {
+        emu_rx_irq[i] = false;
+        can_rx(i);
+        fdcan_sim_regs[i].IR = 0U;
+        pending = true;
+      }
+      if (emu_tx_irq[i]) {
+        emu_tx_irq[i] = false;
+        process_can(i);
+        fdcan_sim_regs[i].IR = 0U;
+        pending = true;
+      }
+    }
+  }
+}
+
+// runs cfg->duration_us of virtual time from the current state
+void emu_run(const emu_config_t *cfg, emu_result_t *res) {
+  static uint8_t host_buf[SPI_BUF_SIZE];
+  uint32_t rx_base[FDCAN_SIM_CNT];
+  uint32_t lost_base[FDCAN_SIM_CNT];
+  uint32_t rx_overflow_base = rx_buffer_overflow;
+  uint32_t tx_overflow_base = tx_buffer_overflow;
+
+  (void)memset(res, 0, sizeof(emu_result_t));
+  (void)memset(emu_bench_ns, 0, sizeof(emu_bench_ns));
+  (void)memset(emu_bench_max, 0, sizeof(emu_bench_max));
+  (void)memset(emu_bench_frames, 0, sizeof(emu_bench_frames));
+  emu_cfg = cfg;
+  emu_res = res;
+
+  uint64_t start = emu_now_ns;
+  uint64_t end = start + ((uint64_t)cfg->duration_us * 1000U);
+  emu_end_ns = end;
+  uint64_t next_host_rx = (cfg->host_rx_period_us > 0U) ? start : EMU_NEVER;
+  uint64_t next_host_tx = (cfg->host_tx_period_us > 0U) ? start : EMU_NEVER;
+  for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+    (void)memset(&emu_buses[i], 0, sizeof(emu_bus_t));
+    emu_buses[i].next_gen_ns = (cfg->load_pct[i] > 0U) ? start : EMU_NEVER;
+    emu_buses[i].wire_end_ns = EMU_NEVER;
+    emu_rx_irq[i] = false;
+    emu_tx_irq[i] = false;
+    bus_config[i].forwarding_bus = cfg->forward[i];
+    rx_base[i] = can_health[i].total_rx_cnt;
+    lost_base[i] = can_health[i].total_rx_lost_cnt;
+  }
+
+  while (emu_now_ns < end) {
+    emu_bus_start();
+    // the handlers may have run past the next event
+    uint64_t next = MIN(MIN(end, emu_bus_next()), MIN(next_host_rx, next_host_tx));
+    emu_set_time(MAX(next, emu_now_ns));
+    emu_bus_end();
+    emu_service_irqs();
+
+    if (next_host_rx <= emu_now_ns) {
+      int len = emu_spi_xfer(1U, NULL, 0U, host_buf, cfg->host_rx_len);
+      res->host_rx_bytes += (len > 0) ? (uint32_t)len : 0U;
+      next_host_rx += (uint64_t)cfg->host_rx_period_us * 1000U;
+    }
+    if (next_host_tx <= emu_now_ns) {
+      emu_host_tx(cfg, res);
+      next_host_tx += (uint64_t)cfg->host_tx_period_us * 1000U;
+    }
+    emu_service_irqs();
+
+    res->rx_q_max = MAX(res->rx_q_max, emu_ring_depth(&can_rx_q));
+    for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+      res->tx_q_max = MAX(res->tx_q_max, emu_ring_depth(can_queues[i]));
+    }
+  }
+  emu_cfg = NULL;
+
+  for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+    res->rx[i] = can_health[i].total_rx_cnt - rx_base[i];
+    res->rx_lost[i] = can_health[i].total_rx_lost_cnt - lost_base[i];
+  }
+  res->rx_overflow = rx_buffer_overflow - rx_overflow_base;
+  res->tx_overflow = tx_buffer_overflow - tx_overflow_base;
+  for (uint8_t k = 0U; k < CAN_BENCH_CNT; k++) {
+    res->bench_frames[k] = emu_bench_frames[k];
+    res->bench_ns_mean[k] = (emu_bench_frames[k] > 0U) ? (uint32_t)(emu_bench_ns[k] / emu_bench_frames[k]) : 0U;
+    res->bench_ns_max[k] = emu_bench_max[k];
+  }
+}
@@ -0,0 +1,90 @@
+import os
+from cffi import FFI
+
+libpanda_dir = os.path.dirname(os.path.abspath(__file__))
+libpanda_emu_fn = os.path.join(libpanda_dir, "libpanda_emu.so")
+
+ffi = FFI()
+
+ffi.cdef("""
+typedef struct {
+  uint32_t load_pct[3];
+  int8_t forward[3];
+  uint32_t addr_base;
+  uint32_t addr_cnt;
+  uint32_t frame_len;
+  uint32_t host_rx_period_us;
+  uint32_t host_rx_len;
+  uint32_t host_tx_period_us;
+  uint32_t host_tx_batch;
+  uint8_t host_tx_bus;
+  uint32_t isr_frame_ns;
+  uint32_t duration_us;
+} emu_config_t;
+
+typedef struct {
+  uint32_t offered[3];
+  uint32_t rx[3];
+  uint32_t rx_lost[3];
+  uint32_t sent[3];
+  uint32_t rx_overflow;
+  uint32_t tx_overflow;
+  uint32_t rx_q_max;
+  uint32_t tx_q_max;
+  uint32_t host_rx_bytes;
+  uint32_t host_tx_frames;
+  uint32_t host_tx_nack;
+  uint32_t bench_frames[3];
+  uint32_t bench_ns_mean[3];
+  uint32_t bench_ns_max[3];
+} emu_result_t;
+
+bool emu_init(void);
+void emu_run(const emu_config_t *cfg, emu_result_t *res);
+int emu_spi_xfer(uint8_t endpoint, const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t max_rx);
+int set_safety_hooks(uint16_t mode, uint16_t param);
+""")
+
+libpanda_emu = ffi.dlopen(libpanda_emu_fn)
+
+RESULT_FIELDS = [f for f, _ in ffi.typeof("emu_result_t").fields]
+BENCH_KINDS = ("rx", "fwd", "tx")
+# a guess for the H7 CAN interrupt path, replace it with can_bench numbers from a panda
+ISR_FRAME_NS = 5000
+
+
+def run_traffic(load=(0, 0, 0), forward=(-1, -1, -1), addr_base=0x100, addr_cnt=16, frame_len=8,
+                host_rx_period_us=1000, host_rx_len=0x40*31, host_tx_period_us=0, host_tx_batch=0, host_tx_bus=0,
+                isr_frame_ns=ISR_FRAME_NS, duration_us=1000000):
+  """Runs the emulator for duration_us of virtual time, continuing from its current state.
+  load is the offered load of each bus in percent, the host reads CAN over SPI every
+  host_rx_period_us and writes host_tx_batch frames every host_tx_period_us. Each frame
+  the firmware receives or sends takes isr_frame_ns of virtual time."""
+  cfg = ffi.new("emu_config_t *", {
+    "load_pct": list(load), "forward": list(forward), "addr_base": addr_base, "addr_cnt": addr_cnt, "frame_len": frame_len,
+    "host_rx_period_us": host_rx_period_us, "host_rx_len": host_rx_len,
+    "host_tx_period_us": host_tx_period_us, "host_tx_batch": host_tx_batch, "host_tx_bus": host_tx_bus,
+    "isr_frame_ns": isr_frame_ns, "duration_us": duration_us,
+  })
+  res = ffi.new("emu_result_t *")
+  libpanda_emu.emu_run(cfg, res)
+
+  ret = {}
+  for f in RESULT_FIELDS:
+    v = getattr(res, f)
+    ret[f] = v if isinstance(v, int) else list(v)
+  ret["bench"] = {k: {"frames": res.bench_frames[i], "ns_mean": res.bench_ns_mean[i], "ns_max": res.bench_ns_max[i]}
+                  for i, k in enumerate(BENCH_KINDS)}
+  return ret
+
+
+if __name__ == "__main__":
+  # sweep of bus 0 load, forwarded to bus 2 and read by a host polling every ms
+  assert libpanda_emu.emu_init(), "message RAM address is taken"
+  print("load  offered  rx_lost  rx_overflow  tx_overflow  rx_q_max  tx_q_max  ns/rx  ns/fwd  ns/tx")
+  for load in (10, 30, 50, 70, 90, 100):
+    libpanda_emu.emu_init()
+    r = run_traffic(load=(load, 0, 0), forward=(2, -1, -1))
+    b = r["bench"]
+    print(f"{load:4d}  {r['offered'][0]:7d}  {r['rx_lost'][0]:7d}  {r['rx_overflow']:11d}  {r['tx_overflow']:11d}  "
+          f"{r['rx_q_max']:8d}  {r['tx_q_max']:8d}  {b['rx']['ns_mean']:5d}  {b['fwd']['ns_mean']:6d}  {b['tx']['ns_mean']:5d}")
@@ -43,10 +43,76 @@ extern can_ring *tx3_q;
 bool can_pop(can_ring *q, CANPacket_t *elem);
 bool can_push(can_ring *q, CANPacket_t *elem);
 void can_set_checksum(CANPacket_t *packet);
+bool can_check_checksum(CANPacket_t *packet);
 int comms_can_read(uint8_t *data, uint32_t max_len);
 void comms_can_write(uint8_t *data, uint32_t len);
 void comms_can_reset(void);
+void comms_can_set_compression(bool enabled);
 uint32_t can_slots_empty(can_ring *q);
+bool can_tx_check_min_slots_free(uint32_t min);
+void can_send(CANPacket_t *to_push, uint8_t bus_number, bool skip_tx_hook);
+bool can_tx_pop(uint8_t bus_number, CANPacket_t *to_send);
+void can_tx_clear(uint8_t bus_number);
+extern uint16_t can_tx_hp_id_limit[3];
+extern uint32_t tx_buffer_overflow;
+""")
+
+ffi.cdef("""
+void can_filter_clear(void);
+void can_filter_stage(bool last, uint32_t addr);
+bool can_filter_add(uint8_t bus, uint8_t action, uint16_t n);
+bool can_filter_check(const CANPacket_t *pkt);
+extern uint32_t can_filter_dropped;
+""")
+
+ffi.cdef("""
+typedef struct {
+  uint32_t CNT;
+  uint32_t SR;
+  uint32_t DIER;
+  uint32_t CCR2;
+  uint32_t CCR3;
+} TIM_TypeDef;
+extern TIM_TypeDef *MICROSECOND_TIMER;
+
+void isotp_service(void);
+void isotp_rx_hook(const CANPacket_t *msg);
+void isotp_reset(void);
+
+void playback_write(const uint8_t *data, uint32_t len);
+void playback_service(void);
+int playback_command(uint16_t cmd, uint16_t param, uint8_t *resp);
+
+void can_stats_rx(const CANPacket_t *msg, bool valid, bool delivered);
+uint32_t can_stats_read(uint8_t *data, uint32_t max_len);
+void can_stats_restart(void);
+void can_stats_clear(void);
+extern uint32_t can_stats_untracked;
+
+bool can_cache_subscribe(uint8_t bus, uint32_t addr, bool extended);
+void can_cache_rx(const CANPacket_t *msg);
+void can_cache_clear(void);
+uint32_t can_cache_snapshot(uint8_t *data, uint32_t max_len);
+uint32_t can_cache_snapshot_take(void);
+uint32_t can_cache_snapshot_read(uint32_t offset, uint8_t *data, uint32_t max_len);
+uint32_t can_cache_snapshot_stream(uint8_t *data, uint32_t max_len);
+
+void can_template_clear(void);
+void can_template_stage(uint16_t counter, uint16_t checksum);
+bool can_template_add(uint8_t bus, uint32_t addr, bool extended);
+void can_template_apply(uint8_t bus, CANPacket_t *msg);
+""")
+
+ffi.cdef("""
+void trace_event(uint16_t id, uint32_t arg0, uint32_t arg1);
+uint32_t trace_read(uint8_t *data, uint32_t max_len);
+void trace_clear(void);
+""")
+
+ffi.cdef("""
+uint32_t time_sync_correct(uint32_t local);
+void time_sync_stage(bool offset, uint32_t value);
+void time_sync_apply(int32_t skew);
 """)
 
 class CANPacket:
@@ -66,6 +132,16 @@ class Panda(Protocol):
   tx3_q: Any
   def can_set_checksum(self, p: CANPacket) -> None: ...
 
+  # trace
+  def trace_event(self, id: int, arg0: int, arg1: int) -> None: ...
+  def trace_read(self, data: Any, max_len: int) -> int: ...
+  def trace_clear(self) -> None: ...
+
+  # time sync
+  def time_sync_correct(self, local: int) -> int: ...
+  def time_sync_stage(self, offset: bool, value: int) -> None: ...
+  def time_sync_apply(self, skew: int) -> None: ...
+
   # safety
   def set_safety_hooks(self, mode: int, param: int) -> int: ...
 
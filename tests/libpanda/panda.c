@@ -5,7 +5,7 @@
 bool can_init(uint8_t can_number) { return true; }
 void process_can(uint8_t can_number) { }
 //int safety_tx_hook(CANPacket_t *to_send) { return 1; }
-void set_safety_mode(uint16_t mode, uint16_t param) { }
+void set_safety_mode(uint16_t mode, uint16_t param, bool reinit_all) { }
 
 typedef struct harness_configuration harness_configuration;
 void refresh_can_tx_slots_available(void);
@@ -15,10 +15,18 @@ void can_tx_comms_resume_spi(void) { };
 #include "health.h"
 #include "faults.h"
 #include "libc.h"
+#include "drivers/time_sync.h"
+#include "drivers/trace.h"
 #include "boards/board_declarations.h"
 #include "safety/safety.h"
 #include "main_definitions.h"
 #include "drivers/can_common.h"
+#include "can_filter.h"
+#include "isotp.h"
+#include "playback.h"
+#include "can_stats.h"
+#include "can_cache.h"
+#include "can_template.h"
 
 can_ring *rx_q = &can_rx_q;
 can_ring *tx1_q = &can_tx1_q;
@@ -26,4 +34,5 @@ can_ring *tx2_q = &can_tx2_q;
 can_ring *tx3_q = &can_tx3_q;
 
 #include "comms_definitions.h"
+#include "can_compress.h"
 #include "can_comms.h"
@@ -0,0 +1,225 @@
+// simulated H7 FDCAN controllers for the host emulator
+//
+// Registers are plain memory. The two writes with side effects, RXF0A and
+// TXBAR, go through llcan_rx_ack and llcan_tx_request, which apply them
+// and then let the emulator run the time the firmware spent on the frame.
+// The message RAM is mapped at its real address, fdcan.h computes element
+// addresses in 32 bits.
+#include <sys/mman.h>
+
+typedef int32_t IRQn_Type;
+#define FDCAN1_IT0_IRQn 19
+#define FDCAN2_IT0_IRQn 20
+#define FDCAN1_IT1_IRQn 21
+#define FDCAN2_IT1_IRQn 22
+#define FDCAN3_IT0_IRQn 159
+#define FDCAN3_IT1_IRQn 160
+#define NUM_INTERRUPTS 163U
+#define CAN_INTERRUPT_RATE 16000U
+
+typedef struct {
+  volatile uint32_t IR;
+  volatile uint32_t PSR;
+  volatile uint32_t ECR;
+  volatile uint32_t RXF0S;
+  volatile uint32_t TXFQS;
+} FDCAN_GlobalTypeDef;
+
+#define FDCAN_IR_RF0N (1UL << 0)
+#define FDCAN_IR_RF0L (1UL << 3)
+#define FDCAN_IR_TFE (1UL << 11)
+#define FDCAN_IR_EP (1UL << 23)
+#define FDCAN_IR_BO (1UL << 25)
+#define FDCAN_IR_PEA (1UL << 27)
+#define FDCAN_IR_PED (1UL << 28)
+
+#define FDCAN_PSR_LEC_Pos 0U
+#define FDCAN_PSR_LEC (0x7UL << FDCAN_PSR_LEC_Pos)
+#define FDCAN_PSR_EP_Pos 5U
+#define FDCAN_PSR_EP (0x1UL << FDCAN_PSR_EP_Pos)
+#define FDCAN_PSR_EW_Pos 6U
+#define FDCAN_PSR_EW (0x1UL << FDCAN_PSR_EW_Pos)
+#define FDCAN_PSR_BO_Pos 7U
+#define FDCAN_PSR_BO (0x1UL << FDCAN_PSR_BO_Pos)
+#define FDCAN_PSR_DLEC_Pos 8U
+#define FDCAN_PSR_DLEC (0x7UL << FDCAN_PSR_DLEC_Pos)
+#define FDCAN_ECR_TEC_Pos 0U
+#define FDCAN_ECR_TEC (0xFFUL << FDCAN_ECR_TEC_Pos)
+#define FDCAN_ECR_REC_Pos 8U
+#define FDCAN_ECR_REC (0x7FUL << FDCAN_ECR_REC_Pos)
+
+#define FDCAN_RXF0S_F0FL 0x7FUL
+#define FDCAN_RXF0S_F0GI_Pos 8U
+#define FDCAN_RXF0S_F0PI_Pos 16U
+#define FDCAN_RXF0S_F0F (1UL << 24)
+#define FDCAN_TXFQS_TFFL 0x3FUL
+#define FDCAN_TXFQS_TFQPI_Pos 16U
+#define FDCAN_TXFQS_TFQF (1UL << 21)
+
+#define FDCAN_SIM_CNT 3U
+
+FDCAN_GlobalTypeDef fdcan_sim_regs[FDCAN_SIM_CNT];
+#define FDCAN1 (&fdcan_sim_regs[0])
+#define FDCAN2 (&fdcan_sim_regs[1])
+#define FDCAN3 (&fdcan_sim_regs[2])
+
+#include "drivers/fdcan_declarations.h"
+#include "stm32h7/llfdcan_declarations.h"
+
+typedef struct {
+  uint32_t speed;   // kbps * 10
+  bool silent;
+  uint32_t rx_get;
+  uint32_t rx_put;
+  uint32_t rx_fill;
+  bool tx_pending;
+  uint32_t init_cnt;
+} fdcan_sim_t;
+
+static fdcan_sim_t fdcan_sim[FDCAN_SIM_CNT];
+
+static canfd_fifo *fdcan_sim_rx_el(uint8_t can_number, uint32_t idx) {
+  return (canfd_fifo *)(uintptr_t)(FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET) + (idx * FDCAN_RX_FIFO_0_EL_SIZE));
+}
+
+static canfd_fifo *fdcan_sim_tx_el(uint8_t can_number) {
+  return (canfd_fifo *)(uintptr_t)(FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET) + (FDCAN_RX_FIFO_0_EL_CNT * FDCAN_RX_FIFO_0_EL_SIZE));
+}
+
+static void fdcan_sim_update_regs(uint8_t can_number) {
+  const fdcan_sim_t *s = &fdcan_sim[can_number];
+  FDCAN_GlobalTypeDef *FDCANx = &fdcan_sim_regs[can_number];
+  FDCANx->RXF0S = s->rx_fill | (s->rx_get << FDCAN_RXF0S_F0GI_Pos) | (s->rx_put << FDCAN_RXF0S_F0PI_Pos) |
+                  ((s->rx_fill == FDCAN_RX_FIFO_0_EL_CNT) ? FDCAN_RXF0S_F0F : 0U);
+  FDCANx->TXFQS = s->tx_pending ? FDCAN_TXFQS_TFQF : FDCAN_TX_FIFO_EL_CNT;
+}
+
+// virtual time the firmware spends on each frame it handles, see emulator.c
+void emu_isr_frame(void);
+
+// maps the message RAM, false if the address is taken
+bool fdcan_sim_init(void) {
+  static bool mapped = false;
+  if (!mapped) {
+    uintptr_t base = FDCAN_START_ADDRESS & ~0xFFFUL;
+    size_t len = ((FDCAN_START_ADDRESS + (FDCAN_SIM_CNT * FDCAN_OFFSET) - base) + 0xFFFUL) & ~0xFFFUL;
+    void *ram = mmap((void *)base, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    mapped = (ram == (void *)base);
+  }
+  for (uint8_t i = 0U; i < FDCAN_SIM_CNT; i++) {
+    (void)memset(&fdcan_sim[i], 0, sizeof(fdcan_sim_t));
+    (void)memset(&fdcan_sim_regs[i], 0, sizeof(FDCAN_GlobalTypeDef));
+    fdcan_sim_update_regs(i);
+  }
+  return mapped;
+}
+
+// a frame was received from the bus, the oldest one is overwritten when the FIFO is full
+void fdcan_sim_rx(uint8_t can_number, const CANPacket_t *msg) {
+  fdcan_sim_t *s = &fdcan_sim[can_number];
+  canfd_fifo *fifo = fdcan_sim_rx_el(can_number, s->rx_put);
+  fifo->header[0] = (msg->extended << 30) | ((msg->extended != 0U) ? msg->addr : (msg->addr << 18));
+  fifo->header[1] = (msg->data_len_code << 16) | (msg->fd << 21);
+  for (uint32_t i = 0U; i < ((dlc_to_len[msg->data_len_code] + 3U) / 4U); i++) {
+    BYTE_ARRAY_TO_WORD(fifo->data_word[i], &msg->data[i * 4U]);
+  }
+
+  s->rx_put = (s->rx_put + 1U) % FDCAN_RX_FIFO_0_EL_CNT;
+  if (s->rx_fill < FDCAN_RX_FIFO_0_EL_CNT) {
+    s->rx_fill += 1U;
+    fdcan_sim_regs[can_number].IR |= FDCAN_IR_RF0N;
+  } else {
+    // like the hardware, the get index moves past the overwritten element
+    s->rx_get = (s->rx_get + 1U) % FDCAN_RX_FIFO_0_EL_CNT;
+    fdcan_sim_regs[can_number].IR |= FDCAN_IR_RF0L;
+  }
+  fdcan_sim_update_regs(can_number);
+}
+
+// the pending TX element, false if there is none or the controller is silent
+bool fdcan_sim_tx_peek(uint8_t can_number, CANPacket_t *msg) {
+  const fdcan_sim_t *s = &fdcan_sim[can_number];
+  bool ret = s->tx_pending && !s->silent;
+  if (ret) {
+    const canfd_fifo *fifo = fdcan_sim_tx_el(can_number);
+    (void)memset(msg, 0, sizeof(CANPacket_t));
+    msg->extended = (fifo->header[0] >> 30) & 0x1U;
+    msg->addr = (msg->extended != 0U) ? (fifo->header[0] & 0x1FFFFFFFU) : ((fifo->header[0] >> 18) & 0x7FFU);
+    msg->data_len_code = (fifo->header[1] >> 16) & 0xFU;
+    msg->fd = (fifo->header[1] >> 21) & 0x1U;
+    msg->bus = can_number;
+    for (uint32_t i = 0U; i < ((dlc_to_len[msg->data_len_code] + 3U) / 4U); i++) {
+      WORD_TO_BYTE_ARRAY(&msg->data[i * 4U], fifo->data_word[i]);
+    }
+  }
+  return ret;
+}
+
+// the pending TX element is on the bus, frees the FIFO
+void fdcan_sim_tx_done(uint8_t can_number) {
+  fdcan_sim[can_number].tx_pending = false;
+  fdcan_sim_regs[can_number].IR |= FDCAN_IR_TFE;
+  fdcan_sim_update_regs(can_number);
+}
+
+uint32_t fdcan_sim_speed(uint8_t can_number) {
+  return fdcan_sim[can_number].speed;
+}
+
+// ***************************** llcan *****************************
+
+bool llcan_set_speed(FDCAN_GlobalTypeDef *FDCANx, uint32_t speed, uint32_t data_speed, bool non_iso, bool loopback, bool silent) {
+  UNUSED(data_speed);
+  UNUSED(non_iso);
+  UNUSED(loopback);
+  fdcan_sim_t *s = &fdcan_sim[CAN_NUM_FROM_CANIF(FDCANx)];
+  s->speed = speed;
+  s->silent = silent;
+  return true;
+}
+
+void llcan_irq_disable(const FDCAN_GlobalTypeDef *FDCANx) {
+  UNUSED(FDCANx);
+}
+
+void llcan_irq_enable(const FDCAN_GlobalTypeDef *FDCANx) {
+  UNUSED(FDCANx);
+}
+
+bool llcan_init(FDCAN_GlobalTypeDef *FDCANx) {
+  uint8_t can_number = CAN_NUM_FROM_CANIF(FDCANx);
+  fdcan_sim_t *s = &fdcan_sim[can_number];
+  s->rx_get = 0U;
+  s->rx_put = 0U;
+  s->rx_fill = 0U;
+  s->tx_pending = false;
+  s->init_cnt += 1U;
+  FDCANx->IR = 0U;
+  fdcan_sim_update_regs(can_number);
+  return true;
+}
+
+void llcan_clear_send(FDCAN_GlobalTypeDef *FDCANx) {
+  (void)llcan_init(FDCANx);
+}
+
+// acknowledging an element releases it and all older ones
+void llcan_rx_ack(FDCAN_GlobalTypeDef *FDCANx, uint32_t idx) {
+  uint8_t can_number = CAN_NUM_FROM_CANIF(FDCANx);
+  fdcan_sim_t *s = &fdcan_sim[can_number];
+  if (s->rx_fill > 0U) {
+    uint32_t acked = ((idx + FDCAN_RX_FIFO_0_EL_CNT - s->rx_get) % FDCAN_RX_FIFO_0_EL_CNT) + 1U;
+    s->rx_fill -= MIN(acked, s->rx_fill);
+    s->rx_get = (idx + 1U) % FDCAN_RX_FIFO_0_EL_CNT;
+  }
+  fdcan_sim_update_regs(can_number);
+  emu_isr_frame();
+}
+
+void llcan_tx_request(FDCAN_GlobalTypeDef *FDCANx, uint32_t idx) {
+  uint8_t can_number = CAN_NUM_FROM_CANIF(FDCANx);
+  UNUSED(idx);
+  fdcan_sim[can_number].tx_pending = true;
+  fdcan_sim_update_regs(can_number);
+  emu_isr_frame();
+}
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+import unittest
+
+from panda.python import CAN_CACHE_SNAPSHOT_SIZE, unpack_can_cache
+from panda.python.spi import XFER_SIZE
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+ffi = libpanda_py.ffi
+
+
+def rx(addr, dat, bus=0):
+  lpp.can_cache_rx(libpanda_py.make_CANPacket(addr, bus, dat))
+
+
+def snapshot_usb():
+  length = lpp.can_cache_snapshot_take()
+  dat = b""
+  buf = ffi.new("uint8_t[64]")
+  for offset in range(0, length, 64):
+    n = lpp.can_cache_snapshot_read(offset, buf, 64)
+    dat += bytes(buf[0:n])
+  return unpack_can_cache(dat)
+
+
+def snapshot_spi():
+  # as PandaSpiHandle.bulkRead
+  dat = b""
+  buf = ffi.new(f"uint8_t[{XFER_SIZE}]")
+  for _ in range(-(-CAN_CACHE_SNAPSHOT_SIZE // XFER_SIZE)):
+    n = lpp.can_cache_snapshot_stream(buf, XFER_SIZE)
+    dat += bytes(buf[0:n])
+    if n < XFER_SIZE:
+      break
+  return unpack_can_cache(dat)
+
+
+class TestCanCache(unittest.TestCase):
+  def setUp(self):
+    lpp.can_cache_clear()
+    lpp.MICROSECOND_TIMER.CNT = 0
+
+  def test_last_value(self):
+    self.assertTrue(lpp.can_cache_subscribe(0, 0x100, False))
+    self.assertTrue(lpp.can_cache_subscribe(2, 0x18DAF110, True))
+    self.assertTrue(lpp.can_cache_subscribe(1, 0x200, False))
+    self.assertTrue(lpp.can_cache_subscribe(0, 0x100, False))
+    self.assertFalse(lpp.can_cache_subscribe(3, 0x100, False))
+
+    rx(0x100, b"\x01\x02")
+    lpp.MICROSECOND_TIMER.CNT = 1234
+    rx(0x100, b"\x03" * 8)
+    rx(0x100, b"\xff", bus=1)
+    rx(0x18DAF110, b"\x02\x3e\x00", bus=2)
+    rx(0x300, b"")
+
+    snap = snapshot_usb()
+    self.assertEqual(list(snap), [(0, 0x100), (2, 0x18DAF110), (1, 0x200)])
+    self.assertEqual(snap[(0, 0x100)], (1234, 2, b"\x03" * 8))
+    self.assertEqual(snap[(2, 0x18DAF110)], (1234, 1, b"\x02\x3e\x00"))
+    self.assertEqual(snap[(1, 0x200)], (0, 0, None))
+
+  def test_capacity(self):
+    for addr in range(64):
+      self.assertTrue(lpp.can_cache_subscribe(0, addr, False))
+    self.assertFalse(lpp.can_cache_subscribe(0, 64, False))
+    for addr in range(64):
+      rx(addr, bytes([addr] * 8))
+
+    snap = snapshot_usb()
+    self.assertEqual(len(snap), 64)
+    self.assertTrue(all(snap[(0, a)][2] == bytes([a] * 8) for a in range(64)))
+
+    # only whole slots when the buffer is short
+    buf = ffi.new("uint8_t[100]")
+    self.assertEqual(lpp.can_cache_snapshot(buf, 100), 4 * (13 + 8))
+
+    # a full snapshot of CAN FD frames takes several SPI transfers
+    for addr in range(64):
+      rx(addr, bytes([addr] * 64))
+    for _ in range(2):
+      snap = snapshot_spi()
+      self.assertEqual(len(snap), 64)
+      self.assertTrue(all(snap[(0, a)][2] == bytes([a] * 64) for a in range(64)))
+
+
+if __name__ == "__main__":
+  unittest.main()
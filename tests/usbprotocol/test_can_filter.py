@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+import unittest
+
+from panda import Panda
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+
+
+def add_rule(bus, addr_lo, addr_hi, action, n=0):
+  lpp.can_filter_stage(False, addr_lo)
+  lpp.can_filter_stage(True, addr_hi)
+  return lpp.can_filter_add(0xFF if bus is None else bus, action, n)
+
+
+def delivered(addr, bus, dat=b"\x00" * 8):
+  return lpp.can_filter_check(libpanda_py.make_CANPacket(addr, bus, dat))
+
+
+class TestCanFilter(unittest.TestCase):
+  def setUp(self):
+    lpp.can_filter_clear()
+
+  def tearDown(self):
+    lpp.can_filter_clear()
+
+  def test_no_rules(self):
+    for addr in (0x0, 0x100, 0x7FF, 0x18DAF110):
+      self.assertTrue(delivered(addr, 0))
+
+  def test_drop_first_match_wins(self):
+    self.assertTrue(add_rule(0, 0x200, 0x200, Panda.CAN_FILTER_PASS))
+    self.assertTrue(add_rule(None, 0x100, 0x2FF, Panda.CAN_FILTER_DROP))
+
+    self.assertTrue(delivered(0x200, 0))
+    self.assertFalse(delivered(0x200, 1))
+    self.assertFalse(delivered(0x150, 2))
+    self.assertTrue(delivered(0x300, 0))
+    self.assertEqual(lpp.can_filter_dropped, 2)
+
+  def test_decimate(self):
+    self.assertTrue(add_rule(1, 0x100, 0x101, Panda.CAN_FILTER_DECIMATE, 4))
+    for addr in (0x100, 0x101):
+      self.assertEqual([delivered(addr, 1) for _ in range(12)], [True, False, False, False] * 3)
+    # other buses untouched
+    self.assertTrue(all(delivered(0x100, 0) for _ in range(4)))
+
+  def test_on_change(self):
+    self.assertTrue(add_rule(0, 0x0, 0x7FF, Panda.CAN_FILTER_ON_CHANGE))
+    self.assertTrue(delivered(0x123, 0, b"\x01"))
+    self.assertFalse(delivered(0x123, 0, b"\x01"))
+    self.assertTrue(delivered(0x123, 0, b"\x02"))
+    self.assertFalse(delivered(0x123, 0, b"\x02"))
+    # DLC change counts as a change
+    self.assertTrue(delivered(0x123, 0, b"\x02\x00"))
+
+  def test_on_change_refresh(self):
+    self.assertTrue(add_rule(0, 0x0, 0x7FF, Panda.CAN_FILTER_ON_CHANGE, 3))
+    self.assertEqual([delivered(0x123, 0) for _ in range(7)], [True, False, False, True, False, False, True])
+
+  def test_extended_state(self):
+    # a standard and an extended ID with the same number keep their own state
+    self.assertTrue(add_rule(0, 0x0, 0x1FFFFFFF, Panda.CAN_FILTER_DECIMATE, 2))
+    std, ext = libpanda_py.make_CANPacket(0x123, 0, b"\x00"), libpanda_py.make_CANPacket(0x123, 0, b"\x00")
+    ext[0].extended = 1
+    self.assertEqual([lpp.can_filter_check(p) for p in (std, ext, std, ext)], [True, True, False, False])
+
+  def test_comms_reset(self):
+    self.assertTrue(add_rule(None, 0x0, 0x7FF, Panda.CAN_FILTER_DROP))
+    self.assertFalse(delivered(0x100, 0))
+    lpp.comms_can_reset()
+    self.assertTrue(delivered(0x100, 0))
+    self.assertEqual(lpp.can_filter_dropped, 0)
+
+  def test_invalid_rules(self):
+    self.assertFalse(add_rule(0, 0x200, 0x100, Panda.CAN_FILTER_DROP))
+    self.assertFalse(add_rule(0, 0x100, 0x200, 7))
+    for _ in range(32):
+      self.assertTrue(add_rule(0, 0x100, 0x200, Panda.CAN_FILTER_PASS))
+    self.assertFalse(add_rule(0, 0x100, 0x200, Panda.CAN_FILTER_PASS))
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+import unittest
+
+from panda.python import unpack_can_stats
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+ffi = libpanda_py.ffi
+
+
+def rx(addr, dat, bus=0, us=0, valid=True, delivered=True):
+  lpp.MICROSECOND_TIMER.CNT = (lpp.MICROSECOND_TIMER.CNT + us) & 0xFFFFFFFF
+  lpp.can_stats_rx(libpanda_py.make_CANPacket(addr, bus, dat), valid, delivered)
+
+
+def read_pass():
+  dat = b""
+  buf = ffi.new("uint8_t[64]")
+  while (n := lpp.can_stats_read(buf, 64)) > 0:
+    dat += bytes(buf[0:n])
+  return {(e["bus"], e["addr"]): e for e in unpack_can_stats(dat)}
+
+
+class TestCanStats(unittest.TestCase):
+  def setUp(self):
+    lpp.can_stats_clear()
+    lpp.MICROSECOND_TIMER.CNT = 0xFFFFFF00
+
+  def test_gaps(self):
+    rx(0x100, b"\x00" * 8)
+    for gap in (1000, 1200, 800, 1000):
+      rx(0x100, b"\x00" * 8, us=gap)
+    rx(0x100, b"\x00" * 4, us=1000, valid=False)
+    rx(0x100, b"\x00" * 8, us=1000, delivered=False)
+    rx(0x100, b"", bus=2, us=10)
+
+    stats = read_pass()
+    self.assertEqual(len(stats), 2)
+    e = stats[(0, 0x100)]
+    self.assertEqual(e["count"], 7)
+    self.assertEqual((e["min_gap_us"], e["max_gap_us"]), (800, 1200))
+    self.assertAlmostEqual(e["ewma_gap_us"], 1000, delta=50)
+    self.assertEqual((e["dlc"], e["dlc_changes"], e["invalid"], e["lost"]), (8, 2, 1, 1))
+    self.assertFalse(e["extended"])
+    self.assertEqual(stats[(2, 0x100)]["count"], 1)
+    self.assertIsNone(stats[(2, 0x100)]["min_gap_us"])
+
+  def test_incremental_read(self):
+    addrs = list(range(0x700, 0x740))
+    for addr in addrs:
+      rx(addr, b"\x01")
+    rx(0x18DAF110, b"\x01")
+
+    # two entries per 64 byte read, the next pass starts over
+    for _ in range(2):
+      stats = read_pass()
+      self.assertEqual(sorted(a for _, a in stats), addrs + [0x18DAF110])
+    self.assertTrue(stats[(0, 0x18DAF110)]["extended"])
+
+  def test_table_full(self):
+    for addr in range(0x300):
+      rx(addr, b"")
+    tracked = sum(e["count"] for e in read_pass().values())
+    self.assertEqual(tracked + lpp.can_stats_untracked, 0x300)
+    self.assertLessEqual(tracked, 256)
+    self.assertGreater(tracked, 200)
+
+
+if __name__ == "__main__":
+  unittest.main()
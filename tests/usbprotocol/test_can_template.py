@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+import unittest
+
+from opendbc.car.structs import CarParams
+from panda import Panda, pack_can_buffer
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+
+
+def crc8(dat, poly):
+  crc = 0xFF
+  for b in dat:
+    crc ^= b
+    for _ in range(8):
+      crc = ((crc << 1) ^ poly) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+  return crc ^ 0xFF
+
+
+def add(bus, addr, counter=None, checksum=None):
+  counter_cfg = 0 if counter is None else ((1 << 15) | ((counter[2] - 1) << 9) | (counter[1] << 6) | counter[0])
+  checksum_cfg = 0 if checksum is None else ((checksum[0] << 6) | checksum[1])
+  lpp.can_template_stage(counter_cfg, checksum_cfg)
+  return lpp.can_template_add(bus, addr, addr >= 0x800)
+
+
+def send(addr, dat, bus=0):
+  pkt = libpanda_py.make_CANPacket(addr, bus, dat)
+  lpp.can_template_apply(bus, pkt)
+  return bytes(pkt[0].data[0:len(dat)])
+
+
+class TestCanTemplate(unittest.TestCase):
+  def setUp(self):
+    lpp.can_template_clear()
+
+  def test_crc_reference(self):
+    self.assertEqual(crc8(b"123456789", 0x1D), 0x4B)
+    self.assertEqual(crc8(b"123456789", 0x2F), 0xDF)
+
+  def test_counter(self):
+    self.assertTrue(add(0, 0x2E4, counter=(7, 4, 2)))
+    # counter wraps at 2 bits, other bits of the byte are kept
+    outs = [send(0x2E4, b"\x00" * 7 + b"\x3f")[7] for _ in range(5)]
+    self.assertEqual(outs, [0x0f, 0x1f, 0x2f, 0x3f, 0x0f])
+    # other bus and address untouched
+    self.assertEqual(send(0x2E4, b"\x00" * 8, bus=1), b"\x00" * 8)
+    self.assertEqual(send(0x2E5, b"\x00" * 8), b"\x00" * 8)
+
+  def test_checksums(self):
+    dat = bytes(range(1, 9))
+    cases = [
+      (Panda.TX_CHECKSUM_SUM8, 0x123, 7, lambda d: sum(d[:7]) & 0xFF),
+      (Panda.TX_CHECKSUM_SUM8_ADDR, 0x2E4, 7, lambda d: (0xE4 + 0x02 + 8 + sum(d[:7])) & 0xFF),
+      (Panda.TX_CHECKSUM_XOR8, 0x18DAF110, 0, lambda d: d[1] ^ d[2] ^ d[3] ^ d[4] ^ d[5] ^ d[6] ^ d[7]),
+      (Panda.TX_CHECKSUM_CRC8_J1850, 0x200, 0, lambda d: crc8(d[1:], 0x1D)),
+      (Panda.TX_CHECKSUM_CRC8_AUTOSAR, 0x201, 0, lambda d: crc8(d[1:], 0x2F)),
+    ]
+    for checksum_type, addr, byte, ref in cases:
+      with self.subTest(checksum_type=checksum_type):
+        self.assertTrue(add(0, addr, checksum=(checksum_type, byte)))
+        out = send(addr, dat)
+        self.assertEqual(out[byte], ref(out))
+
+  def test_counter_then_checksum(self):
+    # checksum covers the stamped counter
+    self.assertTrue(add(2, 0x100, counter=(0, 0, 4), checksum=(Panda.TX_CHECKSUM_CRC8_J1850, 7)))
+    out = send(0x100, b"\xf0" + b"\x00" * 7, bus=2)
+    self.assertEqual(out[0], 0xf0)
+    self.assertEqual(out[7], crc8(out[:7], 0x1D))
+
+  def test_host_frames(self):
+    # stamped when the host sends them, on both priority classes, and the frame checksum redone
+    lpp.set_safety_hooks(CarParams.SafetyModel.allOutput, 0)
+    self.assertTrue(add(1, 0x2E4, counter=(0, 0, 4), checksum=(Panda.TX_CHECKSUM_SUM8, 7)))
+    pkt = libpanda_py.ffi.new('CANPacket_t *')
+    try:
+      for i, high in enumerate((False, True)):
+        dat = pack_can_buffer([(0x2E4, b"\xa0" + b"\x00" * 7, 1)], high_priority=high)[0]
+        lpp.comms_can_write(dat, len(dat))
+        self.assertTrue(lpp.can_tx_pop(1, pkt))
+        out = bytes(pkt[0].data[0:8])
+        self.assertEqual(out[0], 0xa0 | i)
+        self.assertEqual(out[7], sum(out[:7]) & 0xFF)
+        self.assertTrue(lpp.can_check_checksum(pkt))
+    finally:
+      lpp.can_tx_clear(1)
+
+  def test_invalid(self):
+    self.assertFalse(add(0, 0x100, counter=(0, 6, 4)))
+    self.assertFalse(add(0, 0x100, counter=(3, 0, 4), checksum=(Panda.TX_CHECKSUM_SUM8, 3)))
+    self.assertFalse(add(0, 0x100, checksum=(9, 3)))
+    self.assertFalse(add(3, 0x100, checksum=(Panda.TX_CHECKSUM_SUM8, 3)))
+    for addr in range(32):
+      self.assertTrue(add(0, addr, checksum=(Panda.TX_CHECKSUM_SUM8, 0)))
+    self.assertFalse(add(0, 0x100, checksum=(Panda.TX_CHECKSUM_SUM8, 0)))
+    self.assertTrue(add(0, 5, counter=(1, 0, 4)))
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+import os
+import tempfile
+import unittest
+
+from panda.python.canlog import CANLOG_HEADER_SIZE, DATA_SUFFIX, CanLogReader, CanLogWriter
+
+
+def make_traffic(n, t0=1_000_000_000_000):
+  # 1 frame per ms, cycling over 20 addresses on 3 buses
+  return [(0x100 + (i % 20), bytes([i & 0xFF] * (8 if i % 2 else 64)), i % 3, t0 + i * 1000000) for i in range(n)]
+
+
+class TestCanLog(unittest.TestCase):
+  def setUp(self):
+    self.tmp = tempfile.TemporaryDirectory()
+    self.path = self.tmp.name
+
+  def tearDown(self):
+    self.tmp.cleanup()
+
+  def test_roundtrip_segments(self):
+    msgs = make_traffic(5000)
+    with CanLogWriter(self.path, segment_size=64 * 1024, block_frames=100) as log:
+      for i in range(0, len(msgs), 37):
+        log.write(msgs[i:i + 37])
+    self.assertGreater(len(os.listdir(self.path)), 2)
+
+    with CanLogReader(self.path) as log:
+      self.assertEqual(len(log), len(msgs))
+      self.assertEqual([(f.addr, f.dat, f.bus, f.ts) for f in log.query()], msgs)
+      self.assertEqual(log.time_range(), (msgs[0][3], msgs[-1][3]))
+
+  def test_query(self):
+    msgs = make_traffic(3000)
+    with CanLogWriter(self.path, block_frames=64) as log:
+      log.write(msgs)
+
+    with CanLogReader(self.path) as log:
+      t_start, t_end = msgs[1000][3], msgs[1999][3]
+      got = list(log.query(t_start, t_end))
+      self.assertEqual(len(got), 1000)
+
+      got = [(f.addr, f.dat, f.bus, f.ts) for f in log.query(t_start, t_end, bus=1, addr=0x101)]
+      self.assertEqual(got, [m for m in msgs[1000:2000] if m[2] == 1 and m[0] == 0x101])
+
+      # only blocks in the time range are visited
+      blocks = list(log.blocks(t_start, t_end))
+      self.assertLessEqual(len(blocks), 1000 // 64 + 2)
+      # an address that was never logged reads (almost) nothing
+      self.assertEqual(list(log.query(bus=0, addr=0x7FF)), [])
+
+  def test_echoed_frames(self):
+    # frames the panda sent (bus + 128) and rejected (bus + 192) keep their flags
+    msgs = [(0x18DAF110, b"\x02\x10\x03", bus, 2_000_000_000 + i * 1000) for i, bus in enumerate((0, 128, 2, 130, 192, 194))]
+    with CanLogWriter(self.path) as log:
+      log.write(msgs)
+
+    with CanLogReader(self.path) as log:
+      self.assertEqual([(f.addr, f.dat, f.bus, f.ts) for f in log.query()], msgs)
+      self.assertEqual([f.ts for f in log.query(bus=130, addr=0x18DAF110)], [msgs[3][3]])
+      self.assertEqual(list(log.query(bus=1, addr=0x18DAF110)), [])
+
+  def test_unclosed_log(self):
+    msgs = make_traffic(500)
+    log = CanLogWriter(self.path, block_frames=128)
+    log.write(msgs)
+
+    # a reader sees the committed frames while the writer is open, unindexed tail included
+    with CanLogReader(self.path) as r:
+      self.assertEqual(len(list(r.query())), 500)
+      self.assertEqual(len(list(r.query(bus=2, addr=0x102))), len([m for m in msgs if m[2] == 2 and m[0] == 0x102]))
+    log.close()
+
+    # timestamps going backwards are clamped
+    with CanLogWriter(self.path) as log:
+      log.write([(0x200, b"\x01", 0)], ts=msgs[-1][3] - 1000)
+    with CanLogReader(self.path) as r:
+      self.assertEqual(len(r.segments), 2)
+      self.assertEqual(list(r.query(bus=0, addr=0x200))[0].ts, msgs[-1][3])
+
+    data = os.path.join(self.path, f"000001{DATA_SUFFIX}")
+    self.assertGreater(os.path.getsize(data), CANLOG_HEADER_SIZE)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -3,13 +3,16 @@ import random
 import unittest
 
 from opendbc.car.structs import CarParams
-from panda import DLC_TO_LEN, USBPACKET_MAX_SIZE, pack_can_buffer, unpack_can_buffer
+from panda import DLC_TO_LEN, USBPACKET_MAX_SIZE, CanRxDecompressor, pack_can_buffer, unpack_can_buffer
 from panda.tests.libpanda import libpanda_py
 
 lpp = libpanda_py.libpanda
 
 CHUNK_SIZE = USBPACKET_MAX_SIZE
 TX_QUEUES = (lpp.tx1_q, lpp.tx2_q, lpp.tx3_q)
+CAN_COMPRESS_REFRESH = 4096  # board/can_compress.h
+CAN_TX_HP_BUFFER_SIZE = 32  # board/drivers/can_common.h
+MAX_CAN_MSGS_PER_SPI_BULK_TRANSFER = 170  # board/config.h
 
 
 def unpackage_can_msg(pkt):
@@ -45,6 +48,77 @@ class TestPandaComms(unittest.TestCase):
 
       assert unpackage_can_msg(can_pkt_rx) == message
 
+  def test_tx_priority(self):
+    bus = 0
+    lpp.can_tx_hp_id_limit[bus] = 0x100
+    try:
+      for addr in (0x300, 0x50, 0x200, 0x18DAF110, 0x00C00000):
+        lpp.can_send(libpanda_py.make_CANPacket(addr, bus, b"test"), bus, True)
+
+      # frames below the limit leave first, each level in FIFO order
+      order = []
+      pkt = libpanda_py.ffi.new('CANPacket_t *')
+      while lpp.can_tx_pop(bus, pkt):
+        order.append(pkt[0].addr)
+      assert order == [0x50, 0x00C00000, 0x300, 0x200, 0x18DAF110]
+    finally:
+      lpp.can_tx_hp_id_limit[bus] = 0
+      lpp.can_tx_clear(bus)
+
+  def test_tx_priority_host_class(self):
+    bus = 1
+    lpp.set_safety_hooks(CarParams.SafetyModel.allOutput, 0)
+    try:
+      msgs = [(0x300, b"low", bus), (0x301, b"high", bus)]
+      lpp.comms_can_write(pack_can_buffer(msgs[:1])[0], len(pack_can_buffer(msgs[:1])[0]))
+      high = pack_can_buffer(msgs[1:], high_priority=True)[0]
+      lpp.comms_can_write(high, len(high))
+
+      pkt = libpanda_py.ffi.new('CANPacket_t *')
+      sent = []
+      while lpp.can_tx_pop(bus, pkt):
+        # the class bit is cleared and the checksum redone
+        assert pkt[0].returned == 0 and lpp.can_check_checksum(pkt)
+        sent.append(unpackage_can_msg(pkt))
+      assert sent == msgs[::-1]
+
+      # a full high priority queue drops frames instead of reordering them behind the normal queue
+      overflow = lpp.tx_buffer_overflow
+      n = CAN_TX_HP_BUFFER_SIZE + 10
+      for i in range(n):
+        high = pack_can_buffer([(0x10, bytes([i]), bus)], high_priority=True)[0]
+        lpp.comms_can_write(high, len(high))
+      assert lpp.tx_buffer_overflow - overflow == n - (CAN_TX_HP_BUFFER_SIZE - 1)
+      sent = []
+      while lpp.can_tx_pop(bus, pkt):
+        sent.append(pkt[0].data[0])
+      assert sent == list(range(CAN_TX_HP_BUFFER_SIZE - 1))
+    finally:
+      lpp.can_tx_clear(bus)
+
+  def test_tx_priority_flow_control(self):
+    bus = 2
+    lpp.set_safety_hooks(CarParams.SafetyModel.allOutput, 0)
+    try:
+      # the host is held off until the high priority queue is empty again
+      assert lpp.can_tx_check_min_slots_free(MAX_CAN_MSGS_PER_SPI_BULK_TRANSFER)
+      high = pack_can_buffer([(0x10, b"high", bus)], high_priority=True)[0]
+      lpp.comms_can_write(high, len(high))
+      assert not lpp.can_tx_check_min_slots_free(MAX_CAN_MSGS_PER_SPI_BULK_TRANSFER)
+      lpp.can_tx_clear(bus)
+      assert lpp.can_tx_check_min_slots_free(MAX_CAN_MSGS_PER_SPI_BULK_TRANSFER)
+
+      # and splits its high priority transfers to fit in that queue
+      msgs = [(0x10, b"", bus)] * 100
+      overflow = lpp.tx_buffer_overflow
+      for tx in pack_can_buffer(msgs, high_priority=True):
+        assert len(tx) <= (CAN_TX_HP_BUFFER_SIZE - 1) * 6
+        lpp.comms_can_write(tx, len(tx))
+        lpp.can_tx_clear(bus)
+      assert lpp.tx_buffer_overflow == overflow
+    finally:
+      lpp.can_tx_clear(bus)
+
   def test_comms_reset_rx(self):
     # store some test messages in the queue
     test_msg = (0x100, b"test", 0)
@@ -156,6 +230,117 @@ class TestPandaComms(unittest.TestCase):
     self.assertEqual(len(rx_msgs), len(msgs))
     self.assertEqual(rx_msgs, msgs)
 
+  def test_can_receive_compressed(self):
+    # periodic traffic with a rolling counter, more addresses than dictionary entries
+    addrs = [(random.randint(1, (1 << 29) - 1), random.randint(0, 2)) for _ in range(300)]
+    payloads = {a: bytearray(random.getrandbits(8) for _ in range(DLC_TO_LEN[random.randrange(0, len(DLC_TO_LEN))])) for a in addrs}
+    msgs = []
+    for i in range(40):
+      for a in addrs:
+        dat = payloads[a]
+        if len(dat) > 0:
+          dat[0] = i & 0xFF
+        if random.random() < 0.05:
+          payloads[a] = dat = bytearray(random.getrandbits(8) for _ in range(DLC_TO_LEN[random.randrange(0, len(DLC_TO_LEN))]))
+        msgs.append((a[0], bytes(dat), a[1]))
+
+    # a returned frame is passed through raw
+    msgs.append((0x123, b"test", 128))
+    packets = [libpanda_py.make_CANPacket(m[0], m[2] & 0x7, m[1]) for m in msgs]
+    packets[-1][0].returned = 1
+    lpp.can_set_checksum(packets[-1])
+
+    lpp.comms_can_set_compression(True)
+    decompressor = CanRxDecompressor()
+
+    rx_msgs = []
+    rx_bytes = 0
+    overflow_buf = b""
+    dat = libpanda_py.ffi.new(f"uint8_t[{CHUNK_SIZE}]")
+    while True:
+      while lpp.can_slots_empty(lpp.rx_q) > 0 and len(packets) > 0:
+        lpp.can_push(lpp.rx_q, packets.pop(0))
+
+      rx_len = lpp.comms_can_read(dat, random.randint(1, CHUNK_SIZE))
+      if rx_len == 0 and len(packets) == 0:
+        break
+      rx_bytes += rx_len
+      unpacked_msgs, overflow_buf = decompressor.unpack(overflow_buf + bytes(dat[0:rx_len]))
+      rx_msgs.extend(unpacked_msgs)
+
+    self.assertEqual(rx_msgs, msgs)
+    raw_bytes = sum(6 + len(m[1]) for m in msgs)
+    self.assertLess(rx_bytes, raw_bytes * 0.6)
+
+    # reset turns compression off
+    lpp.comms_can_reset()
+    lpp.can_push(lpp.rx_q, libpanda_py.make_CANPacket(0x100, 0, b"test"))
+    rx_len = lpp.comms_can_read(dat, CHUNK_SIZE)
+    self.assertEqual(unpack_can_buffer(bytes(dat[0:rx_len]))[0], [(0x100, b"test", 0)])
+
+  def _compressed_read(self, packets, drop=None):
+    """Reads the packets through the compressed stream, skipping the transfers for which drop(i) is true."""
+    decompressor = CanRxDecompressor()
+    rx_msgs = []
+    overflow_buf = b""
+    dat = libpanda_py.ffi.new(f"uint8_t[{CHUNK_SIZE}]")
+    packets = list(packets)
+    i = 0
+    while True:
+      while lpp.can_slots_empty(lpp.rx_q) > 0 and len(packets) > 0:
+        lpp.can_push(lpp.rx_q, packets.pop(0))
+
+      rx_len = lpp.comms_can_read(dat, CHUNK_SIZE)
+      if rx_len == 0 and len(packets) == 0:
+        break
+      if drop is not None and drop(i):
+        overflow_buf = b""
+      else:
+        unpacked_msgs, overflow_buf = decompressor.unpack(overflow_buf + bytes(dat[0:rx_len]))
+        rx_msgs.extend(unpacked_msgs)
+      i += 1
+    return rx_msgs, decompressor
+
+  def test_can_receive_compressed_extended(self):
+    # a standard and an extended frame with the same id get their own entries
+    std = libpanda_py.make_CANPacket(0x123, 0, b"\x01\x02")
+    ext = libpanda_py.make_CANPacket(0x123, 0, b"\x03\x04")
+    ext[0].extended = 1
+    lpp.can_set_checksum(ext)
+
+    lpp.comms_can_set_compression(True)
+    dat = libpanda_py.ffi.new(f"uint8_t[{CHUNK_SIZE}]")
+    for p in (std, ext):
+      lpp.can_push(lpp.rx_q, p)
+    first = lpp.comms_can_read(dat, CHUNK_SIZE)
+    for _ in range(10):
+      for p in (std, ext):
+        lpp.can_push(lpp.rx_q, p)
+    # all SAME records
+    self.assertEqual(lpp.comms_can_read(dat, CHUNK_SIZE), 20 * 3)
+    self.assertEqual(first, 3 + 2 * (2 + 6 + 2))
+    lpp.comms_can_reset()
+
+  def test_can_receive_compressed_resync(self):
+    addrs = [(random.randint(1, (1 << 29) - 1), random.randint(0, 2)) for _ in range(50)]
+    msgs = []
+    for i in range(3 * CAN_COMPRESS_REFRESH // len(addrs)):
+      for a in addrs:
+        msgs.append((a[0], bytes([i & 0xFF, a[1], 1, 2, 3, 4, 5, 6]), a[1]))
+    packets = [libpanda_py.make_CANPacket(m[0], m[2], m[1]) for m in msgs]
+
+    # a transfer is lost after the panda advanced its dictionary
+    lpp.comms_can_set_compression(True)
+    rx_msgs, decompressor = self._compressed_read(packets, drop=lambda i: i == 20)
+    lpp.comms_can_reset()
+
+    self.assertGreater(decompressor.desyncs, 0)
+    self.assertLess(len(rx_msgs), len(msgs))
+    # nothing wrong is returned, and everything after the next refresh is back
+    self.assertTrue(set(rx_msgs) <= set(msgs))
+    tail = msgs[-(len(msgs) - 2 * CAN_COMPRESS_REFRESH):]
+    self.assertEqual(rx_msgs[-len(tail):], tail)
+
 
 if __name__ == "__main__":
   unittest.main()
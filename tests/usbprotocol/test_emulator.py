@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+import platform
+import unittest
+
+from opendbc.car.structs import CarParams
+
+FRAME_SIZE = 6 + 8  # header and 8 data bytes
+
+
+@unittest.skipUnless(platform.system() == "Linux", "the emulator maps the FDCAN message RAM at its address")
+class TestEmulator(unittest.TestCase):
+  @classmethod
+  def setUpClass(cls):
+    from panda.tests.libpanda import libpanda_emu_py
+    cls.emu = libpanda_emu_py
+
+  def setUp(self):
+    self.assertTrue(self.emu.libpanda_emu.emu_init())
+    self.emu.libpanda_emu.set_safety_hooks(CarParams.SafetyModel.silent, 0)
+
+  def test_forwarding(self):
+    r = self.emu.run_traffic(load=(80, 0, 0), forward=(2, -1, -1))
+    self.assertGreater(r["offered"][0], 2900)
+    self.assertEqual(r["rx"][0], r["offered"][0])
+    # the last one may still be on the wire
+    self.assertGreaterEqual(r["sent"][2], r["offered"][0] - 1)
+    self.assertEqual(r["bench"]["fwd"]["frames"], r["offered"][0])
+    for k in ("rx_lost", "rx_overflow", "tx_overflow"):
+      self.assertEqual(max(r[k]) if isinstance(r[k], list) else r[k], 0, k)
+    # received and echoed frames
+    self.assertGreaterEqual(r["host_rx_bytes"], (r["offered"][0] + r["sent"][2]) * FRAME_SIZE)
+
+  def test_host_stalled(self):
+    r = self.emu.run_traffic(load=(100, 0, 0), host_rx_period_us=0, duration_us=2000000)
+    self.assertEqual(r["rx_q_max"], 4095)
+    self.assertEqual(r["rx"][0], r["offered"][0])
+    self.assertGreater(r["rx_overflow"], 0)
+    self.assertEqual(r["rx_lost"][0], 0)
+
+  def test_isr_overload(self):
+    # each handled frame costs more than a frame on the wire, the RX FIFO overflows.
+    # rx_lost counts overflows seen by can_rx, each one is at least a frame
+    r = self.emu.run_traffic(load=(100, 0, 0), isr_frame_ns=400000)
+    self.assertGreater(r["rx_lost"][0], 0)
+    self.assertLessEqual(r["rx"][0] + r["rx_lost"][0], r["offered"][0])
+
+    # three busy buses share the CPU
+    self.emu.libpanda_emu.emu_init()
+    r = self.emu.run_traffic(load=(100, 100, 100), isr_frame_ns=100000)
+    self.assertGreater(min(r["rx_lost"]), 0)
+    r = self.emu.run_traffic(load=(100, 100, 100), isr_frame_ns=50000)
+    self.assertEqual(max(r["rx_lost"]), 0)
+
+  def test_host_tx_flow_control(self):
+    self.emu.libpanda_emu.set_safety_hooks(CarParams.SafetyModel.allOutput, 0)
+    # much faster than the bus, the host is stopped before the queue overflows
+    r = self.emu.run_traffic(load=(0, 50, 0), host_tx_period_us=1000, host_tx_batch=100, host_tx_bus=1)
+    self.assertGreater(r["host_tx_nack"], 0)
+    self.assertEqual(r["tx_overflow"], 0)
+    self.assertGreater(r["tx_q_max"], 300)
+    self.assertGreater(r["sent"][1], 1000)
+    self.assertLessEqual(r["sent"][1], r["host_tx_frames"])
+    self.assertGreater(r["offered"][1], 0)
+
+
+if __name__ == "__main__":
+  unittest.main()
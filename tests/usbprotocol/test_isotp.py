@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+import unittest
+
+from opendbc.car.structs import CarParams
+from panda import DLC_TO_LEN, ISOTP_BUS, Panda, pack_can_buffer, pack_isotp_pdu, unpack_can_buffer
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+
+TX_ADDR = 0x7E0
+FC_ADDR = 0x7E8
+
+
+def submit(dat, addr=TX_ADDR, bus=0, chunk_size=64):
+  for buf in pack_can_buffer(pack_isotp_pdu(addr, dat, bus, FC_ADDR, chunk_size)):
+    lpp.comms_can_write(buf, len(buf))
+
+
+def sent_frames(bus=0):
+  ret = []
+  pkt = libpanda_py.ffi.new('CANPacket_t *')
+  while lpp.can_tx_pop(bus, pkt):
+    ret.append((pkt[0].addr, bytes(pkt[0].data[0:DLC_TO_LEN[pkt[0].data_len_code]])))
+  return ret
+
+
+def results():
+  buf = b""
+  dat = libpanda_py.ffi.new("uint8_t[0x4000]")
+  while (n := lpp.comms_can_read(dat, 0x4000)) > 0:
+    buf += bytes(dat[0:n])
+  msgs, _ = unpack_can_buffer(buf)
+  return [Panda.isotp_result(d) for _, d, bus in msgs if bus == ISOTP_BUS]
+
+
+def flow_control(fs=0, bs=0, stmin=0):
+  lpp.isotp_rx_hook(libpanda_py.make_CANPacket(FC_ADDR, 0, bytes([0x30 | fs, bs, stmin, 0, 0, 0, 0, 0])))
+
+
+def reassemble(frames):
+  first = frames[0][1]
+  length = ((first[0] & 0xF) << 8) | first[1]
+  dat = first[2:]
+  for i, (_, f) in enumerate(frames[1:]):
+    assert f[0] == 0x20 | ((i + 1) & 0xF)
+    dat += f[1:]
+  return dat[:length]
+
+
+class TestIsoTp(unittest.TestCase):
+  def setUp(self):
+    lpp.set_safety_hooks(CarParams.SafetyModel.elm327, 0)
+    lpp.comms_can_reset()
+    lpp.MICROSECOND_TIMER.CNT = 0
+    lpp.can_tx_clear(0)
+    results()
+
+  def test_single_frame(self):
+    submit(b"\x22\xf1\x90")
+    self.assertEqual(sent_frames(), [(TX_ADDR, b"\x03\x22\xf1\x90\x00\x00\x00\x00")])
+    self.assertEqual(results(), [(Panda.ISOTP_STATUS_DONE, 3)])
+
+  def test_multi_frame_block_size(self):
+    for chunk_size in (8, 64):
+      pdu = bytes(range(256)) * 2
+      submit(pdu, chunk_size=chunk_size)
+
+      # first frame, then nothing until flow control
+      frames = sent_frames()
+      self.assertEqual(frames, [(TX_ADDR, bytes([0x12, 0x00]) + pdu[:6])])
+      lpp.isotp_service()
+      self.assertEqual(sent_frames(), [])
+
+      flow_control(bs=4)
+      block = sent_frames()
+      self.assertEqual(len(block), 4)
+      frames += block
+
+      # STmin 0 queues the rest in bursts
+      flow_control(bs=0)
+      while len(results()) == 0:
+        frames += sent_frames()
+        lpp.isotp_service()
+      frames += sent_frames()
+      self.assertEqual(reassemble(frames), pdu)
+      self.assertTrue(all(len(f) == 8 for _, f in frames))
+
+  def test_stmin_one_frame_per_service(self):
+    submit(bytes(20))
+    sent_frames()
+    flow_control(stmin=0xF5)
+    self.assertEqual(len(sent_frames()), 1)
+    lpp.isotp_service()
+    self.assertEqual(len(sent_frames()), 1)
+    lpp.isotp_service()
+    self.assertEqual(results(), [(Panda.ISOTP_STATUS_DONE, 20)])
+
+  def test_safety_blocks_address(self):
+    submit(b"\x10\x03", addr=0x123)
+    self.assertEqual(sent_frames(), [])
+    self.assertEqual(results(), [(Panda.ISOTP_STATUS_REJECTED, 0)])
+
+  def test_flow_control_timeout(self):
+    submit(bytes(100))
+    sent_frames()
+    lpp.MICROSECOND_TIMER.CNT += 500000
+    lpp.isotp_service()
+    self.assertEqual(results(), [])
+    lpp.MICROSECOND_TIMER.CNT += 600000
+    lpp.isotp_service()
+    self.assertEqual(results(), [(Panda.ISOTP_STATUS_TIMEOUT, 6)])
+
+  def test_overflow_and_busy(self):
+    submit(bytes(100))
+    submit(bytes(100))
+    self.assertEqual(results(), [(Panda.ISOTP_STATUS_BUSY, 0)])
+    flow_control(fs=2)
+    self.assertEqual(results(), [(Panda.ISOTP_STATUS_OVERFLOW, 6)])
+
+
+if __name__ == "__main__":
+  unittest.main()
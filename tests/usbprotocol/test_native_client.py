@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+import random
+import unittest
+
+from panda import DLC_TO_LEN, pack_can_buffer, unpack_can_buffer
+from panda.python.native import NativePandaLoop, can_pack, can_unpack
+
+
+def random_frames(n, fd):
+  lens = DLC_TO_LEN if fd else DLC_TO_LEN[:9]
+  return [(random.choice((random.randint(0, 0x7FF), random.randint(0x800, 0x1FFFFFFF))),
+           random.randbytes(random.choice(lens)), random.randint(0, 2)) for _ in range(n)]
+
+
+class TestNativeClient(unittest.TestCase):
+  def test_pack_matches_python(self):
+    for fd in (False, True):
+      msgs = random_frames(200, fd)
+      self.assertEqual(can_pack(msgs, fd), b"".join(pack_can_buffer(msgs, fd=fd)))
+
+  def test_unpack_split_transfers(self):
+    msgs = random_frames(300, True)
+    dat = b"".join(pack_can_buffer(msgs, fd=True))
+
+    # packets continue across transfers of any size
+    got, rest = [], b""
+    for i in range(0, len(dat), 64):
+      out, rest = can_unpack(rest + dat[i:i + 64])
+      got += out
+    self.assertEqual(rest, b"")
+    self.assertEqual(got, msgs)
+    self.assertEqual(can_unpack(dat), unpack_can_buffer(dat))
+
+    bad = bytearray(dat)
+    bad[5] ^= 0xFF
+    with self.assertRaises(AssertionError):
+      can_unpack(bytes(bad))
+
+  def test_empty_loop(self):
+    with NativePandaLoop() as loop:
+      self.assertEqual(loop.run(0), 0)
+      self.assertGreaterEqual(loop.fileno(), 0)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -2,7 +2,7 @@
 import random
 import unittest
 
-from panda import pack_can_buffer, unpack_can_buffer, DLC_TO_LEN
+from panda import Panda, pack_can_buffer, unpack_can_buffer, DLC_TO_LEN, TELEMETRY_BUS
 
 class PandaTestPackUnpack(unittest.TestCase):
   def test_panda_lib_pack_unpack(self):
@@ -22,5 +22,30 @@ class PandaTestPackUnpack(unittest.TestCase):
 
     self.assertEqual(unpacked, to_pack)
 
+  def test_telemetry_unpack(self):
+    health = bytes(i % 8 for i in range(Panda.HEALTH_STRUCT.size))
+    can_health = bytes(i % 8 for i in range(Panda.CAN_HEALTH_STRUCT.size))
+
+    # health split into 8 byte chunks as on bxCAN pandas, CAN health in one CAN FD frame
+    to_pack = [(0x10 << 8 | i, health[i*8:(i+1)*8].ljust(8, b'\x00'), TELEMETRY_BUS) for i in range(-(-len(health) // 8))]
+    to_pack += [(0x123, b'\x01', 0)]
+    to_pack += [(0x1 << 16 | 0x5 << 8, can_health, TELEMETRY_BUS)]
+
+    telemetry = []
+    msgs = []
+    for dat in pack_can_buffer(to_pack):
+      m, _ = unpack_can_buffer(dat, telemetry)
+      msgs.extend(m)
+    self.assertEqual(msgs, [(0x123, b'\x01', 0)])
+    self.assertEqual(len(telemetry), len(to_pack) - 1)
+
+    p = Panda.__new__(Panda)
+    p._telemetry_chunks = {}
+    p.streamed_health = None
+    p.streamed_can_health = [None] * 3
+    p._process_telemetry(telemetry)
+    self.assertEqual(p.streamed_health, p._parse_health(health))
+    self.assertEqual(p.streamed_can_health[0], p._parse_can_health(can_health))
+
 if __name__ == "__main__":
   unittest.main()
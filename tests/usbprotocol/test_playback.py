@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+import unittest
+
+from opendbc.car.structs import CarParams
+from panda import Panda, pack_playback
+from panda.python import PLAYBACK_STATUS_STRUCT
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+ffi = libpanda_py.ffi
+
+PLAYBACK_BURST_FRAMES = 8  # board/playback.h
+PLAYBACK_BURST_US = 100
+CAN_TX_HP_BUFFER_SIZE = 32  # board/drivers/can_common.h
+
+
+def command(cmd, param=0):
+  resp = ffi.new("uint8_t[64]")
+  n = lpp.playback_command(cmd, param, resp)
+  keys = ("state", "loop", "frames", "loaded", "sent", "blocked", "loops", "late", "max_error_us", "mean_error_us")
+  return dict(zip(keys, PLAYBACK_STATUS_STRUCT.unpack(bytes(resp[0:n])), strict=True))
+
+
+def load(frames):
+  command(1)
+  dat = pack_playback(frames)
+  for i in range(0, len(dat), 63):
+    lpp.playback_write(dat[i:i + 63], len(dat[i:i + 63]))
+  return len(dat)
+
+
+def sent(bus=0):
+  ret = []
+  pkt = ffi.new('CANPacket_t *')
+  while lpp.can_tx_pop(bus, pkt):
+    ret.append(pkt[0].addr)
+  return ret
+
+
+def advance(us):
+  lpp.MICROSECOND_TIMER.CNT = (lpp.MICROSECOND_TIMER.CNT + us) & 0xFFFFFFFF
+  lpp.playback_service()
+
+
+class TestPlayback(unittest.TestCase):
+  def setUp(self):
+    lpp.set_safety_hooks(CarParams.SafetyModel.allOutput, 0)
+    for bus in range(3):
+      lpp.can_tx_clear(bus)
+    # also covers the timer wrapping
+    lpp.MICROSECOND_TIMER.CNT = 0xFFFFF000
+
+  def test_schedule(self):
+    n = load([(0, 0x100, b"\x01", 0), (1000, 0x101, b"\x02", 0), (0, 0x102, b"", 1), (5000, 0x103, b"\x03" * 8, 2)])
+    status = command(0)
+    self.assertEqual(status["loaded"], n)
+
+    self.assertEqual(command(2)["state"], Panda.PLAYBACK_RUNNING)
+    self.assertEqual(command(0)["frames"], 4)
+    advance(999)
+    self.assertEqual(sent(), [])
+    advance(1)
+    self.assertEqual(sent(), [0x100])
+    advance(1003)
+    self.assertEqual((sent(0), sent(1)), ([0x101], [0x102]))
+    advance(5000)
+    self.assertEqual(sent(2), [0x103])
+
+    status = command(0)
+    self.assertEqual(status["state"], Panda.PLAYBACK_DONE)
+    self.assertEqual(status["sent"], 4)
+    self.assertEqual(status["max_error_us"], 3)
+    self.assertEqual(status["late"], 0)
+
+  def test_loop_and_late(self):
+    load([(100, 0x200, b"", 0), (100, 0x201, b"", 0)])
+    command(2, 1)
+    advance(1100)
+    advance(100)
+    advance(300)
+    self.assertEqual(sent(), [0x200, 0x201, 0x200, 0x201, 0x200])
+    status = command(3)
+    self.assertEqual(status["state"], Panda.PLAYBACK_IDLE)
+    self.assertEqual(status["loops"], 2)
+    self.assertEqual(status["late"], 2)
+    self.assertEqual(status["max_error_us"], 200)
+
+  def test_burst_and_full_queue(self):
+    n = 100
+    load([(0, 0x300, b"\x00", 0)] * n)
+    command(2)
+    advance(1000)
+    status = command(0)
+    self.assertEqual(status["sent"], PLAYBACK_BURST_FRAMES)
+
+    # the rest follows in bursts, the frames that don't fit are not sent
+    overflow = lpp.tx_buffer_overflow
+    while command(0)["state"] == Panda.PLAYBACK_RUNNING:
+      advance(PLAYBACK_BURST_US)
+    status = command(0)
+    self.assertEqual(status["sent"], CAN_TX_HP_BUFFER_SIZE - 1)
+    self.assertEqual(lpp.tx_buffer_overflow - overflow, n - (CAN_TX_HP_BUFFER_SIZE - 1))
+    self.assertEqual(len(sent()), CAN_TX_HP_BUFFER_SIZE - 1)
+
+  def test_safety_blocks(self):
+    lpp.set_safety_hooks(CarParams.SafetyModel.elm327, 0)
+    load([(0, 0x123, b"\x00" * 8, 0), (0, 0x7E0, b"\x00" * 8, 0)])
+    command(2)
+    advance(1000)
+    self.assertEqual(sent(), [0x7E0])
+    status = command(0)
+    self.assertEqual((status["sent"], status["blocked"]), (1, 1))
+
+  def test_invalid(self):
+    # partial record, bad bus, zero length loop
+    load([(0, 0x100, b"\x01", 0)])
+    lpp.playback_write(b"\x00\x00", 2)
+    self.assertNotEqual(command(2)["state"], Panda.PLAYBACK_RUNNING)
+    load([(0, 0x100, b"\x01", 3)])
+    self.assertNotEqual(command(2)["state"], Panda.PLAYBACK_RUNNING)
+    load([(0, 0x100, b"\x01", 0)])
+    self.assertNotEqual(command(2, 1)["state"], Panda.PLAYBACK_RUNNING)
+    load([(0, 0x100, b"\x01", 0)] * 2000)
+    self.assertEqual(command(0)["loaded"], 0xFFFFFFFF)
+
+
+if __name__ == "__main__":
+  unittest.main()
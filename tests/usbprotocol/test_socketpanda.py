@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+import socket
+import struct
+import unittest
+
+from panda.python import socketpanda
+from panda.python.socketpanda import (CAN_HEADER_FMT, CAN_HEADER_LEN, CAN_MTU, CANFD_MTU, CAN_EFF_FLAG, CMSG_CONTROL_LEN,
+                                      CMSG_HEADER_FMT, SCM_TIMESTAMPING, SO_RXQ_OVFL, MMsgBuffer, SocketPanda)
+
+
+def can_frame(can_id, dat, fd):
+  flags = socketpanda.CANFD_BRS | socketpanda.CANFD_FDF if fd else 0
+  return struct.pack(CAN_HEADER_FMT, can_id, len(dat), flags) + dat.ljust(64 if fd else 8, b'\x00')
+
+
+def cmsg(level, cmsg_type, data):
+  # struct cmsghdr and its data, padded like CMSG_SPACE
+  hdr = struct.pack(CMSG_HEADER_FMT, struct.calcsize(CMSG_HEADER_FMT) + len(data), level, cmsg_type)
+  align = socketpanda.CMSG_ALIGN
+  return (hdr + data).ljust((len(hdr) + len(data) + align - 1) // align * align, b'\x00')
+
+
+@unittest.skipIf(socketpanda._libc is None, "no recvmmsg/sendmmsg")
+class TestMMsgBuffer(unittest.TestCase):
+  # a datagram socket pair keeps the frame boundaries like a CAN_RAW socket
+  def setUp(self):
+    self.a, self.b = socket.socketpair(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+
+  def tearDown(self):
+    self.a.close()
+    self.b.close()
+
+  def test_send_recv(self):
+    frames = [can_frame(0x100 + i, bytes([i] * (8 if i % 2 else 64)), i % 2 == 0) for i in range(10)]
+    tx = MMsgBuffer(16)
+    for i, f in enumerate(frames):
+      tx.frames_view[i * CANFD_MTU:i * CANFD_MTU + len(f)] = f
+    tx.send(self.a.fileno(), [len(f) for f in frames])
+
+    rx = MMsgBuffer(4)
+    got = []
+    while (cnt := rx.recv(self.b.fileno())) > 0:
+      for i in range(cnt):
+        n = rx.msgs[i].msg_len
+        got.append(bytes(rx.frames_view[i * CANFD_MTU:i * CANFD_MTU + n]))
+        self.assertEqual(rx.control_data(i), (None, None))
+    # classic and FD frames keep their own lengths
+    self.assertEqual(got, frames)
+    self.assertEqual(rx.recv(self.b.fileno()), 0)
+
+  def test_control_data(self):
+    buf = MMsgBuffer(2)
+    sw, hw = (12, 345), (0, 0)
+    ctrl = cmsg(socket.SOL_SOCKET, SO_RXQ_OVFL, struct.pack("@I", 7)) + \
+           cmsg(socket.SOL_SOCKET, SCM_TIMESTAMPING, struct.pack("@qqqqqq", *sw, 0, 0, *hw))
+    self.assertLessEqual(len(ctrl), CMSG_CONTROL_LEN)
+    buf.control_view[CMSG_CONTROL_LEN:CMSG_CONTROL_LEN + len(ctrl)] = ctrl
+    buf.msgs[1].msg_hdr.msg_controllen = len(ctrl)
+    self.assertEqual(buf.control_data(1), (12 * 1000000000 + 345, 7))
+
+    # the hardware timestamp wins when there is one, unknown messages are skipped
+    ctrl = cmsg(socket.SOL_SOCKET, 1234, b'\xff' * 3) + \
+           cmsg(socket.SOL_SOCKET, SCM_TIMESTAMPING, struct.pack("@qqqqqq", *sw, 0, 0, 5, 6))
+    buf.control_view[0:len(ctrl)] = ctrl
+    buf.msgs[0].msg_hdr.msg_controllen = len(ctrl)
+    self.assertEqual(buf.control_data(0), (5 * 1000000000 + 6, None))
+
+    # a truncated header ends the parsing
+    buf.msgs[0].msg_hdr.msg_controllen = 4
+    self.assertEqual(buf.control_data(0), (None, None))
+
+
+@unittest.skipIf(socketpanda._libc is None, "no recvmmsg/sendmmsg")
+class TestSocketPanda(unittest.TestCase):
+  def make_panda(self, fd, batch_size=3):
+    # SocketPanda on one end of a socket pair instead of a CAN interface
+    a, b = socket.socketpair(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+    p = SocketPanda.__new__(SocketPanda)
+    p.interface, p.bus, p.fd = "vcan0", 1, fd
+    p.flags = socketpanda.CANFD_BRS | socketpanda.CANFD_FDF if fd else 0
+    p.data_len = socketpanda.CANFD_MAX_DLEN if fd else socketpanda.CAN_MAX_DLEN
+    p.socket = a
+    p.mmsg = MMsgBuffer(batch_size)
+    p.rx_dropped = 0
+    self.addCleanup(b.close)
+    return p, b
+
+  def test_recv_mixed(self):
+    p, peer = self.make_panda(fd=True)
+    msgs = [(0x123, b'\x01\x02', False), (0x18DAF110, bytes(range(48)), True), (0x7FF, b'', False),
+            (0x200, bytes(range(64)), True), (0x1FFFFFFF, b'\xaa' * 8, False)]
+    for addr, dat, fd in msgs:
+      peer.send(can_frame(addr | (CAN_EFF_FLAG if addr >= 0x800 else 0), dat, fd))
+    self.assertEqual(p.can_recv_ts(), [(addr, dat, 1, None) for addr, dat, _ in msgs])
+    self.assertEqual(p.can_recv(), [])
+
+  def test_send_many(self):
+    for fd in (False, True):
+      p, peer = self.make_panda(fd=fd)
+      msgs = [(0x100 + i, bytes([i] * (i % 9)), 0) for i in range(7)] + [(0x18DAF110, b'\x02\x10\x03', 0)]
+      p.can_send_many(msgs)
+      for addr, dat, _ in msgs:
+        frame = peer.recv(CANFD_MTU)
+        self.assertEqual(len(frame), CANFD_MTU if fd else CAN_MTU)
+        can_id, msg_len, flags = struct.unpack_from(CAN_HEADER_FMT, frame)
+        self.assertEqual(p._addr(can_id), addr)
+        self.assertEqual(bool(can_id & CAN_EFF_FLAG), addr >= 0x800)
+        self.assertEqual(frame[CAN_HEADER_LEN:CAN_HEADER_LEN + msg_len], dat)
+        self.assertEqual(flags, p.flags)
+
+
+if __name__ == "__main__":
+  unittest.main()
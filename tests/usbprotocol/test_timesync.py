@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+import random
+import unittest
+
+from panda.python.timesync import SKEW_SCALE, TIMER_WRAP, ClockSync, TimeSyncSample, apply_correction, to_host_ns
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+
+
+class SimPanda:
+  """A panda timer running 40 ppm fast, the firmware correction on top"""
+  def __init__(self, t0_us, skew_ppm=40.0):
+    self.t0_us = t0_us
+    self.rate = 1 + skew_ppm * 1e-6
+    self.start = random.randrange(TIMER_WRAP)
+    self.correction = (0, 0, 0)
+
+  def local(self, host_us):
+    return int(self.start + (host_us - self.t0_us) * self.rate) % TIMER_WRAP
+
+  def exchange(self, host_us, rng):
+    # USB control transfers: a fixed part and jitter on each leg
+    up, down = 150 + rng.expovariate(1 / 80), 150 + rng.expovariate(1 / 80)
+    local = self.local(host_us + up)
+    return TimeSyncSample(int(host_us * 1000), local, apply_correction(local, *self.correction), int((host_us + up + down) * 1000))
+
+
+class TestTimeSync(unittest.TestCase):
+  def test_firmware_correction(self):
+    rng = random.Random(0)
+    for _ in range(200):
+      ref, offset = rng.randrange(TIMER_WRAP), rng.randrange(TIMER_WRAP)
+      skew = rng.randrange(-(1 << 31), 1 << 31)
+      lpp.time_sync_stage(False, ref)
+      lpp.time_sync_stage(True, offset)
+      lpp.time_sync_apply(skew)
+      for local in (ref, (ref + rng.randrange(1 << 31)) % TIMER_WRAP, (ref - rng.randrange(1 << 31)) % TIMER_WRAP):
+        self.assertEqual(lpp.time_sync_correct(local), apply_correction(local, ref, offset, skew))
+
+    # exported trace timestamps are corrected, the fake timer stands still
+    def trace_ts():
+      lpp.trace_clear()
+      lpp.trace_event(1, 0, 0)
+      buf = libpanda_py.ffi.new("uint8_t[16]")
+      self.assertEqual(lpp.trace_read(buf, 16), 16)
+      return int.from_bytes(bytes(buf[0:4]), "little")
+
+    ts = trace_ts()
+    lpp.time_sync_stage(False, 0)
+    lpp.time_sync_stage(True, 0)
+    lpp.time_sync_apply(0)
+    raw = trace_ts()
+    self.assertEqual(ts, apply_correction(raw, ref, offset, skew))
+    self.assertEqual(lpp.time_sync_correct(1234), 1234)
+
+  def test_two_pandas_share_timebase(self):
+    rng = random.Random(1)
+    t0 = 1_000_000_000.0  # host clock, us
+    pandas = [SimPanda(t0, 40.0), SimPanda(t0, -25.0)]
+    syncs = [ClockSync(), ClockSync()]
+
+    host = t0
+    # a burst per panda every 500 ms for 5 minutes, across a timer wrap for one of them
+    pandas[0].start = TIMER_WRAP - 60_000_000
+    for _ in range(600):
+      for p, s in zip(pandas, syncs, strict=True):
+        burst = []
+        for _ in range(8):
+          burst.append(p.exchange(host, rng))
+          host += 600
+        if s.add(burst):
+          p.correction = s.correction(burst[-1].local)
+      host += 500_000
+
+    # a fast timer is slowed down
+    for p, s in zip(pandas, syncs, strict=True):
+      self.assertAlmostEqual(s.skew * 1e6, (1 / p.rate - 1) * 1e6, delta=0.5)
+      _, _, skew = p.correction
+      self.assertAlmostEqual(skew / SKEW_SCALE, 1 / p.rate - 1, delta=5e-7)
+
+    # a second later, both pandas stamp the same instant within the error budget
+    host += 1_000_000
+    stamps = [apply_correction(p.local(host), *p.correction) for p in pandas]
+    for ts in stamps:
+      self.assertLess(abs(to_host_ns(ts, int(host * 1000)) / 1000 - host), 50)
+
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+import unittest
+
+from panda.python.trace import TRACE_BUF_SIZE, TRACE_EVENT_STRUCT, count_dropped, render_timeline, unpack_trace_buffer
+from panda.tests.libpanda import libpanda_py
+
+lpp = libpanda_py.libpanda
+
+
+def read_all():
+  buf = libpanda_py.ffi.new(f"uint8_t[{TRACE_BUF_SIZE * TRACE_EVENT_STRUCT.size}]")
+  n = lpp.trace_read(buf, len(buf))
+  return unpack_trace_buffer(bytes(libpanda_py.ffi.buffer(buf, n)))
+
+
+class TestTrace(unittest.TestCase):
+  def setUp(self):
+    lpp.trace_clear()
+
+  def test_roundtrip(self):
+    for i in range(10):
+      lpp.trace_event(1, i % 3, 0x100 + i)
+
+    events = read_all()
+    self.assertEqual(len(events), 10)
+    self.assertEqual([(e.id, e.arg0, e.arg1) for e in events], [(1, i % 3, 0x100 + i) for i in range(10)])
+    self.assertEqual(count_dropped(events), 0)
+    self.assertEqual(len(render_timeline(events)), 10)
+
+    # ring is drained
+    self.assertEqual(len(read_all()), 0)
+
+  def test_partial_reads(self):
+    for i in range(5):
+      lpp.trace_event(2, 0, i)
+
+    buf = libpanda_py.ffi.new("uint8_t[64]")
+    # only whole events are returned
+    self.assertEqual(lpp.trace_read(buf, TRACE_EVENT_STRUCT.size + 1), TRACE_EVENT_STRUCT.size)
+    self.assertEqual(lpp.trace_read(buf, 64), 4 * TRACE_EVENT_STRUCT.size)
+    self.assertEqual(lpp.trace_read(buf, 64), 0)
+
+  def test_overrun(self):
+    extra = 100
+    for i in range(TRACE_BUF_SIZE + extra):
+      lpp.trace_event(3, 0, i)
+
+    events = read_all()
+    self.assertEqual(len(events), TRACE_BUF_SIZE)
+    # oldest events were overwritten
+    self.assertEqual(events[0].arg1, extra)
+    self.assertEqual(count_dropped(events), 0)
+    self.assertEqual(count_dropped(events, last_seq=(events[0].seq - extra - 1) & 0xFFFF), extra)
+
+
+if __name__ == "__main__":
+  unittest.main()